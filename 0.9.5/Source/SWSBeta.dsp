@@ -95,12 +95,96 @@ SOURCE=.\main.cpp
 # PROP Default_Filter "h;hpp;hxx;hm;inl"
 # Begin Source File
 
+SOURCE=.\accesslog.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\admission.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\arena.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\assetpack.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\buffer.hpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\connection.hpp
 # End Source File
 # Begin Source File
 
+SOURCE=.\coroutine.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\httpdate.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\hpack.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\http2.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\iocp.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\listing.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\metrics.hpp
+# End Source File
+# Begin Source File
+
 SOURCE=.\options.hpp
 # End Source File
+# Begin Source File
+
+SOURCE=.\pacing.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\prewarm.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\proxy.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\ratelimit.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\respcache.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\response.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\shard.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\timers.hpp
+# End Source File
+# Begin Source File
+
+SOURCE=.\tls.hpp
+# End Source File
 # End Group
 # Begin Group "Resource Files"
 
@@ -0,0 +1,728 @@
+#ifndef ACCESSLOGHPP
+#define ACCESSLOGHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			ACCESSLOG.HPP
+			-------------
+			The access log. Request threads never touch a log file: they fill in a LOGRECORD
+			and push it onto a ring buffer, and a writer thread drains the rings every quarter
+			of a second (or sooner, if a ring is getting full), formats the records and writes
+			each log file with one WriteFile() per batch.
+
+			There are LOG_RINGS rings and each thread uses the one its thread ID picks, so
+			threads rarely share a ring. The rings are lock free (each slot has a sequence
+			number saying whether it is free or full), so pushing a record is a copy and a
+			couple of interlocked instructions. If a ring is full the record is dropped and
+			counted rather than making the request wait; the writer notes the drops in the
+			text log.
+
+			Each log file has its own format:
+
+				common		Common Log Format
+							127.0.0.1 - - [10/Oct/2000:13:55:36 +0000] "GET /a.gif HTTP/1.0" 200 2326
+				combined	Common Log Format plus "Referer" "User-Agent"
+				binary		One record after another, each one:
+								WORD	Length of the whole record
+								DWORD	time_t
+								DWORD	IPv4 address (network order)
+								WORD	Status code
+								DWORD	Bytes sent, low then high
+								DWORD
+								BYTE	Length of the request line, then the request line
+								BYTE	Length of the referer, then the referer
+								BYTE	Length of the user agent, then the user agent
+
+			The main log is Options.Logfile, and virtual hosts with a vhLogFile get their own.
+			LogText() messages go to LOG_TEXTFILE.
+
+			Rotation is done by the writer thread too, between batches, so a request never
+			waits for it. When a file passes LogRotateSize KB, or has been open for
+			LogRotateMinutes, it is closed, renamed to "name.YYYYMMDD-HHMMSS" and a new one
+			started. Records that arrive meanwhile just wait in the rings. If LogCompress is
+			on, renamed files are handed to a low priority thread which turns on NTFS
+			compression for them. Sending the service control SERVICE_CONTROL_REOPENLOGS
+
+				sc control "SWS Web Server" 128
+
+			makes the writer close and reopen every file, for when something else has moved
+			them. SERVICE_CONTROL_ROTATELOGS (129) rotates every file that has anything in it
+			straight away, as if it had reached LogRotateSize.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "options.hpp"
+#include "httpdate.hpp"
+#include "buffer.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define LOG_RINGS							16						// Number of ring buffers
+#define LOG_RINGSIZE						512						// Records per ring (a power of 2)
+#define LOG_INTERVAL						250						// Milliseconds between writes
+#define LOG_FLUSHSIZE						65536					// Write a file once this much is waiting
+#define LOG_TEXTFILE						"C:\\SWS\\testlog.txt"	// Where LogText() messages go
+
+#define LOG_COMMON							0						// Log formats
+#define LOG_COMBINED						1
+#define LOG_BINARY							2
+
+#define LOG_ACCESS							0						// Kinds of record
+#define LOG_TEXT							1
+
+#define SERVICE_CONTROL_REOPENLOGS			128						// Service control code to reopen the logs
+#define SERVICE_CONTROL_ROTATELOGS			129						// Service control code to rotate the logs now
+
+//----------------------------------------------------------------------------------------------------
+//			One log record. Fixed size, so pushing one never allocates.
+//----------------------------------------------------------------------------------------------------
+struct LOGRECORD
+{
+	WORD Kind;													// LOG_ACCESS or LOG_TEXT
+	WORD Status;												// Status code sent
+	short File;													// Log file number
+	DWORD Time;													// time() of the request
+	DWORD Address;												// Client address, network order
+	unsigned __int64 Bytes;										// Bytes sent
+	char Request[256];											// Request line, or the message for LOG_TEXT
+	char Referer[128];											// Referer: header
+	char UserAgent[128];										// User-Agent: header
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Lock free ring of records. Any number of threads can Push(); only the writer Pop()s.
+//----------------------------------------------------------------------------------------------------
+struct LOGSLOT
+{
+	volatile LONG Sequence;										// Equals the push position when free, +1 when full
+	LOGRECORD Record;
+};
+
+class LOGRING
+{
+  public:
+	LOGRING();													// Constructor
+	bool Push(const LOGRECORD &Record, bool *GettingFull);		// Adds a record, false if the ring is full
+	bool Pop(LOGRECORD *Record);								// Takes a record, false if the ring is empty
+
+  private:
+	LOGSLOT Slots[LOG_RINGSIZE];
+	volatile LONG Head;											// Next position to push
+	char Padding[60];											// Keep Head and Tail on different cache lines
+	volatile LONG Tail;											// Next position to pop
+};
+
+//----------------------------------------------------------------------------------------------------
+//			LOGRING::LOGRING
+//----------------------------------------------------------------------------------------------------
+LOGRING::LOGRING()
+{
+	for (int X = 0; X < LOG_RINGSIZE; X++)
+		Slots[X].Sequence = X;
+	Head = 0;
+	Tail = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LOGRING::Push()
+//----------------------------------------------------------------------------------------------------
+bool LOGRING::Push(const LOGRECORD &Record, bool *GettingFull)
+{
+	LONG Position = Head;
+	LOGSLOT *Slot;
+	for (;;)
+	{
+		Slot = &Slots[Position & (LOG_RINGSIZE - 1)];
+		LONG Difference = Slot->Sequence - Position;
+		if (Difference == 0)									// Slot is free, try to claim it
+		{
+			if (InterlockedCompareExchange(&Head, Position + 1, Position) == Position)
+				break;
+			Position = Head;
+		}
+		else if (Difference < 0)								// Slot still full from last time round
+			return false;
+		else
+			Position = Head;									// Someone else took it, try again
+	}
+
+	Slot->Record = Record;
+	InterlockedExchange(&Slot->Sequence, Position + 1);			// Mark it full
+	*GettingFull = (Position - Tail == LOG_RINGSIZE / 2);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LOGRING::Pop()
+//----------------------------------------------------------------------------------------------------
+bool LOGRING::Pop(LOGRECORD *Record)
+{
+	LOGSLOT *Slot = &Slots[Tail & (LOG_RINGSIZE - 1)];
+	if (Slot->Sequence != Tail + 1)								// Not full yet
+		return false;
+
+	*Record = Slot->Record;
+	InterlockedExchange(&Slot->Sequence, Tail + LOG_RINGSIZE);	// Free for the next time round
+	Tail++;
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			A log file
+//----------------------------------------------------------------------------------------------------
+struct LOGFILE
+{
+	string Path;												// Where it is
+	int Format;													// LOG_COMMON, LOG_COMBINED or LOG_BINARY
+	HANDLE hFile;												// Open handle, or INVALID_HANDLE_VALUE
+	string Pending;												// Formatted records not yet written
+	unsigned __int64 Size;										// Size of the file so far
+	time_t Opened;												// When the current file was started
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Compresses rotated log files on a low priority thread
+//----------------------------------------------------------------------------------------------------
+class LOGCOMPRESSOR
+{
+  public:
+	LOGCOMPRESSOR();											// Constructor
+	void Add(const string &Path);								// Queues a file to be compressed
+	void Stop();												// Finishes the queue and stops
+
+  private:
+	static DWORD WINAPI CompressThread(LPVOID lpParam);
+	void Compress(const string &Path);							// Turns on NTFS compression for a file
+
+	vector <string> Queue;										// Files waiting to be compressed
+	CRITICAL_SECTION Lock;										// Protects Queue
+	HANDLE hWake;												// Set when something is queued
+	HANDLE hThread;												// Compressing thread, started by the first Add()
+	volatile bool Running;
+};
+
+//----------------------------------------------------------------------------------------------------
+//			LOGCOMPRESSOR::LOGCOMPRESSOR
+//----------------------------------------------------------------------------------------------------
+LOGCOMPRESSOR::LOGCOMPRESSOR()
+{
+	InitializeCriticalSection(&Lock);
+	hWake = NULL;
+	hThread = NULL;
+	Running = false;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LOGCOMPRESSOR::Add()
+//----------------------------------------------------------------------------------------------------
+void LOGCOMPRESSOR::Add(const string &Path)
+{
+	EnterCriticalSection(&Lock);
+	Queue.push_back(Path);
+	LeaveCriticalSection(&Lock);
+
+	if (hThread == NULL)										// Only the log writer calls Add()
+	{
+		hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+		Running = true;
+		DWORD dwThreadId;
+		hThread = CreateThread(NULL, 0, CompressThread, this, CREATE_SUSPENDED, &dwThreadId);
+		if (hThread == NULL)
+		{
+			Running = false;
+			return;
+		}
+		SetThreadPriority(hThread, THREAD_PRIORITY_LOWEST);
+		ResumeThread(hThread);
+	}
+	SetEvent(hWake);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LOGCOMPRESSOR::Stop()
+//----------------------------------------------------------------------------------------------------
+void LOGCOMPRESSOR::Stop()
+{
+	if (hThread == NULL)
+		return;
+
+	Running = false;
+	SetEvent(hWake);
+	WaitForSingleObject(hThread, INFINITE);
+	CloseHandle(hThread);
+	CloseHandle(hWake);
+	hThread = NULL;
+	hWake = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LOGCOMPRESSOR::CompressThread() - used by CreateThread()
+//----------------------------------------------------------------------------------------------------
+DWORD WINAPI LOGCOMPRESSOR::CompressThread(LPVOID lpParam)
+{
+	LOGCOMPRESSOR *Self = (LOGCOMPRESSOR *)lpParam;
+	for (;;)
+	{
+		WaitForSingleObject(Self->hWake, INFINITE);
+
+		vector <string> Work;
+		EnterCriticalSection(&Self->Lock);
+		Work.swap(Self->Queue);
+		LeaveCriticalSection(&Self->Lock);
+
+		for (int X = 0; X < (int)Work.size(); X++)
+			Self->Compress(Work[X]);
+
+		if (!Self->Running)
+			break;
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LOGCOMPRESSOR::Compress()
+//----------------------------------------------------------------------------------------------------
+void LOGCOMPRESSOR::Compress(const string &Path)
+{
+	HANDLE hFile = CreateFile(Path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING,
+							  FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	USHORT Format = COMPRESSION_FORMAT_DEFAULT;
+	DWORD Returned;
+	DeviceIoControl(hFile, FSCTL_SET_COMPRESSION, &Format, sizeof(Format), NULL, 0, &Returned, NULL);
+	CloseHandle(hFile);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LogFormat() - converts a format name from the config file
+//----------------------------------------------------------------------------------------------------
+int LogFormat(const string &Name)
+{
+	if (!strcmpi(Name.c_str(), "combined"))		return LOG_COMBINED;
+	if (!strcmpi(Name.c_str(), "binary"))		return LOG_BINARY;
+	return LOG_COMMON;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			CopyField() - copies a string into a record field, cutting it off if it is too long.
+//			Quotes and control characters would break up a log line, so they are replaced.
+//----------------------------------------------------------------------------------------------------
+void CopyField(char *Field, int Size, const char *Text)
+{
+	int X;
+	for (X = 0; X < Size - 1 && Text[X]; X++)
+	{
+		if (Text[X] == '"')								Field[X] = '\'';
+		else if ((unsigned char)Text[X] < 0x20)			Field[X] = ' ';
+		else											Field[X] = Text[X];
+	}
+	Field[X] = '\0';
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Access log class
+//----------------------------------------------------------------------------------------------------
+class ACCESSLOG
+{
+  public:
+	ACCESSLOG();												// Constructor
+	int AddFile(const string &Path, int Format);				// Adds a log file, returns its number
+	bool Start();												// Opens the files and starts the writer
+	void Stop();												// Writes everything left and stops
+	void Write(LOGRECORD &Record);								// Queues a record. Never blocks
+	void WriteText(const char *Text);							// Queues a message for the text log
+	void Reopen();												// Close and reopen every file soon
+	void RotateNow();											// Rotate every file soon
+
+	volatile LONG Dropped;										// Records dropped because a ring was full
+	volatile LONG Rotations;									// Files rotated so far
+	int MainFile;												// File number of Options.Logfile
+
+  private:
+	static DWORD WINAPI WriterThread(LPVOID lpParam);			// Drains the rings
+	int Drain();												// Formats everything in the rings
+	void Format(LOGRECORD &Record);								// Formats one record onto its file
+	void Flush(LOGFILE *File);									// Writes a file's pending records
+	void Open(LOGFILE *File);									// Opens a log file for appending
+	bool NeedsRotating(LOGFILE *File);							// Is it too big or too old
+	void Rotate(LOGFILE *File);									// Renames the file and starts a new one
+
+	LOGRING Rings[LOG_RINGS];
+	vector <LOGFILE> Files;
+	map <string, int> FileNumbers;								// Path to file number, so hosts can share a file
+	int TextFile;												// File number of the text log
+	LONG DroppedReported;										// Drops already mentioned in the text log
+	HANDLE hWake;												// Set when a ring is getting full
+	HANDLE hThread;												// Writer thread
+	volatile bool Running;
+	volatile LONG ReopenWanted;									// Set by Reopen()
+	volatile LONG RotateWanted;									// Set by RotateNow()
+	LOGCOMPRESSOR Compressor;
+}AccessLog;
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::ACCESSLOG
+//----------------------------------------------------------------------------------------------------
+ACCESSLOG::ACCESSLOG()
+{
+	Dropped = 0;
+	DroppedReported = 0;
+	Rotations = 0;
+	ReopenWanted = 0;
+	RotateWanted = 0;
+	hWake = NULL;
+	hThread = NULL;
+	Running = false;
+	TextFile = AddFile(LOG_TEXTFILE, LOG_COMMON);
+	MainFile = TextFile;										// Until StartAccessLogs() adds the real one
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::AddFile() - only before Start()
+//----------------------------------------------------------------------------------------------------
+int ACCESSLOG::AddFile(const string &Path, int Format)
+{
+	map <string, int>::iterator Found = FileNumbers.find(Path);
+	if (Found != FileNumbers.end())
+		return Found->second;
+
+	LOGFILE File;
+	File.Path = Path;
+	File.Format = Format;
+	File.hFile = INVALID_HANDLE_VALUE;
+	File.Size = 0;
+	File.Opened = 0;
+	Files.push_back(File);
+
+	FileNumbers[Path] = Files.size() - 1;
+	return Files.size() - 1;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Open()
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::Open(LOGFILE *File)
+{
+	File->hFile = CreateFile(File->Path.c_str(), FILE_APPEND_DATA, FILE_SHARE_READ, NULL,
+							 OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	File->Size = 0;
+	File->Opened = Clock.Seconds();
+	if (File->hFile != INVALID_HANDLE_VALUE)
+	{
+		DWORD High;
+		DWORD Low = GetFileSize(File->hFile, &High);
+		if (Low != 0xFFFFFFFF || GetLastError() == NO_ERROR)
+			File->Size = ((unsigned __int64)High << 32) | Low;
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::NeedsRotating()
+//----------------------------------------------------------------------------------------------------
+bool ACCESSLOG::NeedsRotating(LOGFILE *File)
+{
+	if (File->hFile == INVALID_HANDLE_VALUE || File->Size == 0)
+		return false;
+	if (Options.LogRotateSize > 0 && File->Size >= (unsigned __int64)Options.LogRotateSize * 1024)
+		return true;
+	if (Options.LogRotateMinutes > 0 && Clock.Seconds() - File->Opened >= Options.LogRotateMinutes * 60)
+		return true;
+	return false;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Rotate()
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::Rotate(LOGFILE *File)
+{
+	CloseHandle(File->hFile);
+	File->hFile = INVALID_HANDLE_VALUE;
+
+	SYSTEMTIME Now;
+	GetLocalTime(&Now);
+	char Stamp[32];
+	sprintf(Stamp, ".%04d%02d%02d-%02d%02d%02d", Now.wYear, Now.wMonth, Now.wDay,
+			Now.wHour, Now.wMinute, Now.wSecond);
+	string NewPath = File->Path + Stamp;
+
+	if (MoveFile(File->Path.c_str(), NewPath.c_str()))
+	{
+		InterlockedIncrement(&Rotations);
+		if (Options.LogCompress)
+			Compressor.Add(NewPath);
+	}
+	Open(File);													// If the rename failed we carry on with the old file
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Reopen() - safe to call from any thread, including the service control handler
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::Reopen()
+{
+	InterlockedExchange(&ReopenWanted, 1);
+	if (Running)
+		SetEvent(hWake);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::RotateNow() - safe to call from any thread, including the service control handler
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::RotateNow()
+{
+	InterlockedExchange(&RotateWanted, 1);
+	if (Running)
+		SetEvent(hWake);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Start()
+//----------------------------------------------------------------------------------------------------
+bool ACCESSLOG::Start()
+{
+	if (Running)
+		return true;
+
+	for (int X = 0; X < (int)Files.size(); X++)
+		Open(&Files[X]);
+
+	hWake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	Running = true;
+	DWORD dwThreadId;
+	hThread = CreateThread(NULL, 0, WriterThread, this, 0, &dwThreadId);
+	if (hThread == NULL)
+	{
+		Running = false;
+		return false;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Stop()
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::Stop()
+{
+	if (!Running)
+		return;
+
+	Running = false;
+	SetEvent(hWake);
+	WaitForSingleObject(hThread, INFINITE);						// It drains the rings on the way out
+	CloseHandle(hThread);
+	CloseHandle(hWake);
+	Compressor.Stop();
+
+	for (int X = 0; X < (int)Files.size(); X++)
+	{
+		if (Files[X].hFile != INVALID_HANDLE_VALUE)
+			CloseHandle(Files[X].hFile);
+		Files[X].hFile = INVALID_HANDLE_VALUE;
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Write()
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::Write(LOGRECORD &Record)
+{
+	if (Record.File < 0 || Record.File >= (int)Files.size())
+		Record.File = MainFile;
+
+	bool GettingFull = false;
+	LOGRING *Ring = &Rings[(GetCurrentThreadId() >> 2) % LOG_RINGS];	// Thread IDs are multiples of 4
+	if (!Ring->Push(Record, &GettingFull))
+		InterlockedIncrement(&Dropped);
+	else if (GettingFull && Running)
+		SetEvent(hWake);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::WriteText()
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::WriteText(const char *Text)
+{
+	LOGRECORD Record;
+	Record.Kind = LOG_TEXT;
+	Record.File = TextFile;
+	Record.Time = (DWORD)Clock.Seconds();
+	strncpy(Record.Request, Text, sizeof(Record.Request) - 1);	// Messages keep their own newlines
+	Record.Request[sizeof(Record.Request) - 1] = '\0';
+	int Length = strlen(Text);
+	if (Length >= (int)sizeof(Record.Request) && Text[Length - 1] == '\n')
+		Record.Request[sizeof(Record.Request) - 2] = '\n';		// Cut short, but still a line of its own
+	Write(Record);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::WriterThread() - used by CreateThread()
+//----------------------------------------------------------------------------------------------------
+DWORD WINAPI ACCESSLOG::WriterThread(LPVOID lpParam)
+{
+	ACCESSLOG *Self = (ACCESSLOG *)lpParam;
+	while (Self->Running)
+	{
+		WaitForSingleObject(Self->hWake, LOG_INTERVAL);
+		Self->Drain();
+	}
+	Self->Drain();												// Anything queued while we were stopping
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Drain()
+//----------------------------------------------------------------------------------------------------
+int ACCESSLOG::Drain()
+{
+	int Count = 0;
+	LOGRECORD Record;
+
+	for (int R = 0; R < LOG_RINGS; R++)
+	{
+		while (Rings[R].Pop(&Record))
+		{
+			Format(Record);
+			Count++;
+		}
+	}
+
+	LONG NowDropped = Dropped;
+	if (NowDropped != DroppedReported)
+	{
+		char Text[64];
+		sprintf(Text, "Access log: %ld records dropped\n", NowDropped - DroppedReported);
+		Files[TextFile].Pending += Text;
+		DroppedReported = NowDropped;
+	}
+
+	bool ReopenAll = InterlockedExchange(&ReopenWanted, 0) != 0;
+	bool RotateAll = InterlockedExchange(&RotateWanted, 0) != 0;
+	for (int F = 0; F < (int)Files.size(); F++)
+	{
+		Flush(&Files[F]);
+		if (ReopenAll)
+		{
+			if (Files[F].hFile != INVALID_HANDLE_VALUE)
+				CloseHandle(Files[F].hFile);
+			Open(&Files[F]);
+		}
+		else if (NeedsRotating(&Files[F]) ||
+				 (RotateAll && Files[F].hFile != INVALID_HANDLE_VALUE && Files[F].Size))
+			Rotate(&Files[F]);
+	}
+	return Count;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Flush()
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::Flush(LOGFILE *File)
+{
+	if (File->Pending.empty())
+		return;
+
+	if (File->hFile != INVALID_HANDLE_VALUE)
+	{
+		DWORD Written;
+		WriteFile(File->hFile, File->Pending.data(), File->Pending.length(), &Written, NULL);
+		File->Size += Written;
+	}
+	File->Pending.erase();
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ACCESSLOG::Format()
+//----------------------------------------------------------------------------------------------------
+void ACCESSLOG::Format(LOGRECORD &Record)
+{
+	LOGFILE *File = &Files[Record.File];
+
+	if (Record.Kind == LOG_TEXT)
+	{
+		File->Pending += Record.Request;
+	}
+	else if (File->Format == LOG_BINARY)
+	{
+		BYTE Lengths[3];
+		Lengths[0] = (BYTE)strlen(Record.Request);
+		Lengths[1] = (BYTE)strlen(Record.Referer);
+		Lengths[2] = (BYTE)strlen(Record.UserAgent);
+		WORD Length = 2 + 4 + 4 + 2 + 8 + 3 + Lengths[0] + Lengths[1] + Lengths[2];
+
+		File->Pending.append((const char *)&Length, 2);
+		File->Pending.append((const char *)&Record.Time, 4);
+		File->Pending.append((const char *)&Record.Address, 4);
+		File->Pending.append((const char *)&Record.Status, 2);
+		File->Pending.append((const char *)&Record.Bytes, 8);
+		File->Pending.append((const char *)&Lengths[0], 1);
+		File->Pending.append(Record.Request, Lengths[0]);
+		File->Pending.append((const char *)&Lengths[1], 1);
+		File->Pending.append(Record.Referer, Lengths[1]);
+		File->Pending.append((const char *)&Lengths[2], 1);
+		File->Pending.append(Record.UserAgent, Lengths[2]);
+	}
+	else
+	{
+		// 127.0.0.1 - - [10/Oct/2000:13:55:36 +0000] "GET /a.gif HTTP/1.0" 200 2326
+		int Year, Month, Day;
+		long Days = Record.Time / 86400;
+		long Secs = Record.Time % 86400;
+		CivilFromDays(Days, &Year, &Month, &Day);
+
+		BYTE *IP = (BYTE *)&Record.Address;
+		char Line[128];
+		sprintf(Line, "%d.%d.%d.%d - - [%02d/%s/%04d:%02ld:%02ld:%02ld +0000] \"",
+				IP[0], IP[1], IP[2], IP[3], Day, MonthNames[Month], Year,
+				Secs / 3600, (Secs / 60) % 60, Secs % 60);
+		File->Pending += Line;
+		File->Pending += Record.Request;
+
+		char Bytes[21];
+		FormatNumber(Record.Bytes, Bytes);
+		sprintf(Line, "\" %d %s", Record.Status, Record.Bytes ? Bytes : "-");
+		File->Pending += Line;
+
+		if (File->Format == LOG_COMBINED)
+		{
+			File->Pending += " \"";
+			File->Pending += Record.Referer[0] ? Record.Referer : "-";
+			File->Pending += "\" \"";
+			File->Pending += Record.UserAgent[0] ? Record.UserAgent : "-";
+			File->Pending += "\"";
+		}
+		File->Pending += "\r\n";
+	}
+
+	if (File->Pending.length() >= LOG_FLUSHSIZE)
+		Flush(File);
+}
+//----------------------------------------------------------------------------------------------------
+//			StartAccessLogs() - adds the main log and each virtual host's log, then starts the
+//			writer. Hosts without a log file of their own use the main log.
+//----------------------------------------------------------------------------------------------------
+bool StartAccessLogs()
+{
+	AccessLog.MainFile = AccessLog.AddFile(Options.Logfile, LogFormat(Options.LogFormat));
+
+	map <string, VIRTUALHOST>::iterator It;
+	for (It = VHI.Host.begin(); It != VHI.Host.end(); It++)
+	{
+		VIRTUALHOST *Host = &It->second;
+		if (Host->Logfile.empty())
+		{
+			Host->LogNumber = AccessLog.MainFile;
+			continue;
+		}
+		string Format = Host->LogFormat.empty() ? Options.LogFormat : Host->LogFormat;
+		Host->LogNumber = AccessLog.AddFile(Host->Logfile, LogFormat(Format));
+	}
+	return AccessLog.Start();
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,276 @@
+#ifndef ADMISSIONHPP
+#define ADMISSIONHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			ADMISSION.HPP
+			-------------
+			Admission control. At most Options.MaxConnections connections are worked on at
+			once. The rest wait their turn in a queue, each with the time it arrived, and
+			are handed a slot in order as others finish:
+
+				int Admitted = Admission.Arrive(&Waiting);
+				if (Admitted == ADMISSION_ADMITTED)				// A slot is free
+					...
+				else if (Admitted == ADMISSION_SHED)			// Too many waiting already
+					Admission.SendShed(SFD);
+				else
+					...											// Waiting.Wake() gets called later
+
+			Once it is queued, Waiting belongs to Admission until Wake() is called, which
+			can happen on another thread before Arrive() has even returned. So nothing
+			about it is looked at after ADMISSION_QUEUED comes back.
+				...
+				Admission.Leave();								// Finished, the next one can go
+
+			A kept connection waiting for its next request is doing nothing, so it Leave()s
+			while it waits, and when the request starts to arrive it gets back in line like
+			a new connection. A thread that can block until then calls Return(), which is
+			false if it was shed.
+
+			A queue only helps with a short burst. If the server can't keep up, every
+			request waits longer and longer until they are all too slow to be any use. So
+			the queue is managed like CoDel: if nothing has got through in under
+			<QueueTarget> ms for a whole <QueueInterval> ms, the server is overloaded, and
+			until that changes anything that has waited more than twice the target is
+			turned away with a ready-made 503 and a Retry-After, which costs next to
+			nothing. The ones that do get in are answered quickly, so the number of useful
+			answers a second stays the same however much arrives.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <string>
+#include <stdio.h>
+#include "options.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define ADMISSION_QUEUE						1024					// Most that can wait, any more are shed at once
+
+#define ADMISSION_ADMITTED					0						// What Arrive() did
+#define ADMISSION_QUEUED					1
+#define ADMISSION_SHED						2
+
+//----------------------------------------------------------------------------------------------------
+//			A connection waiting for a slot
+//----------------------------------------------------------------------------------------------------
+struct WAITING
+{
+	__int64 Queued;												// QueryPerformanceCounter() when it arrived
+	WAITING *Next;												// Next in the queue
+	bool Shed;													// Turned away, send it the 503
+	void (*Wake)(WAITING *Waiting);								// Called when it gets a slot or is shed
+	void *Owner;												// For Wake()
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Admission class
+//----------------------------------------------------------------------------------------------------
+class ADMISSION
+{
+  public:
+	ADMISSION();												// Constructor
+	void Start();												// Renders the 503. Call once the options are read
+	int Arrive(WAITING *Waiting);								// ADMISSION_ADMITTED, ADMISSION_QUEUED or ADMISSION_SHED
+	void Leave();												// Gives up a slot, to the next one waiting
+	bool Return();												// Arrive()s and waits, false if shed
+	void SendShed(int SFD);										// Sends the 503
+
+	volatile LONG Busy;											// Connections being worked on
+	volatile LONG Waiting;										// Connections in the queue
+	volatile LONG Shed;											// Connections turned away
+
+  private:
+	bool Overloaded(DWORD Delay);								// CoDel. Should something that waited Delay ms go
+	static void Returned(WAITING *Waiting);						// Wake() for Return()
+
+	CRITICAL_SECTION Lock;										// For everything below
+	WAITING *Head;												// Waited longest
+	WAITING *Tail;												// Arrived last
+	__int64 Frequency;											// QueryPerformanceFrequency()
+	__int64 IntervalEnd;										// When this interval is over
+	DWORD MinDelay;												// Shortest wait this interval
+	bool Reset;													// Start a new interval with the next wait
+	bool Overload;												// Was the last interval's shortest wait over target
+	string Response;											// The 503
+}Admission;
+
+//----------------------------------------------------------------------------------------------------
+//			ADMISSION::ADMISSION
+//----------------------------------------------------------------------------------------------------
+ADMISSION::ADMISSION()
+{
+	InitializeCriticalSection(&Lock);
+	QueryPerformanceFrequency((LARGE_INTEGER *)&Frequency);
+	Head = Tail = NULL;
+	Busy = Waiting = Shed = 0;
+	IntervalEnd = 0;
+	MinDelay = 0;
+	Reset = true;
+	Overload = false;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ADMISSION::Start()
+//----------------------------------------------------------------------------------------------------
+void ADMISSION::Start()
+{
+	const char *Body = "<html><head><title>503 Service Unavailable</title></head>\n"
+					   "<body><h1>Service Unavailable</h1>The server is busy. Please try again in a moment.</body></html>\n";
+	char Length[21];
+	sprintf(Length, "%d", strlen(Body));
+
+	Response = "HTTP/1.0 503 Service Unavailable\nServer: ";		// We haven't read the request to know better
+	Response += Options.Servername;
+	Response += "\nRetry-After: 1\nConnection: close\nContent-type: text/html\nContent-length: ";
+	Response += Length;
+	Response += "\n\n";
+	Response += Body;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ADMISSION::Arrive() - takes a slot if one is free. If not, Waiting is queued; or if
+//			the queue is full, it is shed and Waiting.Shed is set.
+//----------------------------------------------------------------------------------------------------
+int ADMISSION::Arrive(WAITING *W)
+{
+	QueryPerformanceCounter((LARGE_INTEGER *)&W->Queued);
+	W->Next = NULL;
+	W->Shed = false;
+
+	EnterCriticalSection(&Lock);
+	if (Options.MaxConnections <= 0 || Busy < Options.MaxConnections)
+	{
+		Busy++;
+		Overloaded(0);											// It didn't wait at all
+		LeaveCriticalSection(&Lock);
+		return ADMISSION_ADMITTED;
+	}
+	if (Waiting >= ADMISSION_QUEUE)
+	{
+		W->Shed = true;
+		Shed++;
+		LeaveCriticalSection(&Lock);
+		return ADMISSION_SHED;
+	}
+	if (Tail)
+		Tail->Next = W;
+	else
+		Head = W;
+	Tail = W;
+	Waiting++;
+	LeaveCriticalSection(&Lock);								// W can be woken, and gone, from here on
+	return ADMISSION_QUEUED;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ADMISSION::Leave() - hands the slot straight to the next one waiting, after shedding
+//			any in front of it that have waited too long
+//----------------------------------------------------------------------------------------------------
+void ADMISSION::Leave()
+{
+	WAITING *Turned = NULL;										// Shed, in the order they waited
+	WAITING *LastTurned = NULL;
+	WAITING *Next = NULL;
+
+	__int64 Now;
+	QueryPerformanceCounter((LARGE_INTEGER *)&Now);
+
+	EnterCriticalSection(&Lock);
+	while (Head)
+	{
+		WAITING *W = Head;
+		Head = W->Next;
+		if (!Head)
+			Tail = NULL;
+		Waiting--;
+		W->Next = NULL;
+
+		DWORD Delay = (DWORD)((Now - W->Queued) * 1000 / Frequency);
+		if (!Overloaded(Delay))
+		{
+			Next = W;
+			break;
+		}
+		W->Shed = true;
+		Shed++;
+		if (LastTurned)
+			LastTurned->Next = W;
+		else
+			Turned = W;
+		LastTurned = W;
+	}
+	if (!Next)
+		Busy--;													// Nobody to give the slot to
+	LeaveCriticalSection(&Lock);
+
+	while (Turned)
+	{
+		WAITING *W = Turned;
+		Turned = W->Next;
+		W->Wake(W);
+	}
+	if (Next)
+		Next->Wake(Next);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ADMISSION::Return() and ADMISSION::Returned()
+//----------------------------------------------------------------------------------------------------
+bool ADMISSION::Return()
+{
+	WAITING W;
+	HANDLE Event = CreateEvent(NULL, TRUE, FALSE, NULL);
+	W.Wake = Returned;
+	W.Owner = Event;
+	if (Arrive(&W) == ADMISSION_QUEUED)
+		WaitForSingleObject(Event, INFINITE);					// W is ours again once it's set
+	CloseHandle(Event);
+	return !W.Shed;
+}
+
+void ADMISSION::Returned(WAITING *W)
+{
+	SetEvent((HANDLE)W->Owner);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ADMISSION::Overloaded() - must be locked. Keeps the shortest wait over each interval,
+//			and once a whole interval's shortest wait is over target, sheds anything that has
+//			waited more than twice the target until an interval isn't.
+//----------------------------------------------------------------------------------------------------
+bool ADMISSION::Overloaded(DWORD Delay)
+{
+	if (Options.QueueTarget <= 0)
+		return false;											// Just queue
+
+	__int64 Now;
+	QueryPerformanceCounter((LARGE_INTEGER *)&Now);
+	if (!Reset && Now > IntervalEnd)
+	{
+		Overload = MinDelay > (DWORD)Options.QueueTarget;
+		Reset = true;
+	}
+	if (Reset)
+	{
+		Reset = false;
+		IntervalEnd = Now + Frequency * Options.QueueInterval / 1000;
+		MinDelay = Delay;
+		return false;
+	}
+	if (Delay < MinDelay)
+		MinDelay = Delay;
+	return Overload && Delay > 2 * (DWORD)Options.QueueTarget;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ADMISSION::SendShed() - the request isn't read, so it's only told once, without waiting
+//----------------------------------------------------------------------------------------------------
+void ADMISSION::SendShed(int SFD)
+{
+	send(SFD, Response.data(), Response.length(), 0);
+	shutdown(SFD, 1);											// SD_SEND, we've nothing else to say
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,135 @@
+#ifndef ARENAHPP
+#define ARENAHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			ARENA.HPP
+			---------
+			ARENA hands out memory for things that only last as long as one request, without
+			going to the heap for each of them. It takes memory from the front of a block it
+			already has, and Reset() gives it all back at once. For example:
+
+				char *Copy = Arena.Copy(Word.c_str(), Word.length());
+				...
+				Arena.Reset();									// Copy is gone now
+
+			There is no way to free one allocation on its own. Each CONNECTION has an arena,
+			and connections are reused, so after the first few requests the first block is
+			usually all a request needs. Anything bigger gets extra blocks from the heap, and
+			Reset() frees those.
+
+			An arena is not thread safe. It belongs to whoever is handling the request.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define ARENA_BLOCK							16384					// Size of the first block
+#define ARENA_ALIGN							8						// Every allocation starts on this
+
+//----------------------------------------------------------------------------------------------------
+//			Arena class
+//----------------------------------------------------------------------------------------------------
+struct ARENABLOCK
+{
+	ARENABLOCK *Next;											// Block allocated before this one
+	DWORD Size;													// Bytes after the header
+};
+
+class ARENA
+{
+  public:
+	ARENA();													// Constructor
+	~ARENA();													// Destructor
+
+	void *Alloc(DWORD Size);									// Memory until the next Reset()
+	char *Copy(const char *Text, int Length);					// Copy of Text, with a '\0' after it
+	void Reset();												// Gives everything back
+
+	DWORD Used;													// Bytes handed out since the last Reset()
+	DWORD ExtraBlocks;											// Blocks taken from the heap since the last Reset()
+
+  private:
+	char *First;												// The block that is kept between requests
+	ARENABLOCK *Extra;											// Blocks from the heap, newest first
+	char *Next;													// Next free byte
+	char *End;													// End of the current block
+};
+
+//----------------------------------------------------------------------------------------------------
+//			ARENA::ARENA()
+//----------------------------------------------------------------------------------------------------
+ARENA::ARENA()
+{
+	First = (char *)malloc(ARENA_BLOCK);
+	Extra = NULL;
+	Next = First;
+	End = First ? First + ARENA_BLOCK : First;
+	Used = 0;
+	ExtraBlocks = 0;
+}
+
+ARENA::~ARENA()
+{
+	Reset();
+	free(First);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ARENA::Alloc() - returns Size bytes, or NULL if there is no memory left at all
+//----------------------------------------------------------------------------------------------------
+void *ARENA::Alloc(DWORD Size)
+{
+	Size = (Size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+	if ((DWORD)(End - Next) < Size)
+	{
+		// Start another block, at least as big as the first one
+		DWORD BlockSize = Size > ARENA_BLOCK ? Size : ARENA_BLOCK;
+		ARENABLOCK *Block = (ARENABLOCK *)malloc(sizeof(ARENABLOCK) + BlockSize);
+		if (!Block)
+			return NULL;
+		Block->Next = Extra;
+		Block->Size = BlockSize;
+		Extra = Block;
+		ExtraBlocks++;
+		Next = (char *)(Block + 1);
+		End = Next + BlockSize;
+	}
+
+	void *Memory = Next;
+	Next += Size;
+	Used += Size;
+	return Memory;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ARENA::Copy()
+//----------------------------------------------------------------------------------------------------
+char *ARENA::Copy(const char *Text, int Length)
+{
+	char *Out = (char *)Alloc(Length + 1);
+	if (!Out)
+		return NULL;
+	memcpy(Out, Text, Length);
+	Out[Length] = '\0';
+	return Out;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ARENA::Reset() - frees the extra blocks and starts again at the front of the first
+//----------------------------------------------------------------------------------------------------
+void ARENA::Reset()
+{
+	while (Extra)
+	{
+		ARENABLOCK *Block = Extra;
+		Extra = Block->Next;
+		free(Block);
+	}
+	Next = First;
+	End = First ? First + ARENA_BLOCK : First;
+	Used = 0;
+	ExtraBlocks = 0;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
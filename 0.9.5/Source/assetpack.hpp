@@ -0,0 +1,271 @@
+#ifndef ASSETPACKHPP
+#define ASSETPACKHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			ASSETPACK.HPP
+			-------------
+			An asset pack is a whole virtual host Root folder packed into one read-only file
+			by SWSPack (see packer.cpp). The server maps the file into memory when it starts,
+			and serves any request it can find in the pack straight out of that memory, with
+			no open/read/close per request.
+
+			The file looks like this. All offsets are from the start of the file.
+
+				PACKHEADER
+				DWORD Buckets[BucketCount]				Entry number + 1, or 0 if empty
+				PACKENTRY Entries[EntryCount]
+				Strings									Paths, MIME types, ETags, dates (NUL terminated)
+				Data									File contents, each aligned to PACK_ALIGN
+
+			Paths are looked up in an open addressed hash table (linear probing). Paths are
+			stored in web style ("/images/logo.gif") and compared without case, like the
+			windows file system. Folders that have an index file get their own entries,
+			pointing at the index file's data, so "/" and "/docs/" are one lookup too.
+
+			If the packer finds "file.ext.gz" next to "file.ext" it stores it as the gzip
+			version of file.ext, which is sent to clients that accept gzip.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include "options.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define PACK_MAGIC							0x50535753				// "SWSP"
+#define PACK_VERSION						1
+#define PACK_ALIGN							16						// Alignment of each file's data
+
+struct PACKHEADER
+{
+	DWORD Magic;												// PACK_MAGIC
+	DWORD Version;												// PACK_VERSION
+	DWORD EntryCount;											// Number of entries
+	DWORD BucketCount;											// Number of hash buckets (a power of 2)
+	DWORD BucketOffset;											// Where the buckets start
+	DWORD EntryOffset;											// Where the entries start
+	DWORD FileSize;												// Size of the whole pack, to catch truncated files
+	DWORD Created;												// time() the pack was built
+};
+
+struct PACKENTRY
+{
+	DWORD Hash;													// PackHash() of the path
+	DWORD Path;													// String offset of the path ("/images/logo.gif")
+	DWORD MIMEType;												// String offset of the MIME type
+	DWORD ETag;													// String offset of the ETag (with quotes)
+	DWORD LastModified;											// String offset of the Last-Modified date
+	DWORD Modified;												// Last modified time as a time_t
+	DWORD Data;													// Offset of the file contents
+	DWORD Length;												// Length of the file contents
+	DWORD GzipData;												// Offset of the gzip version, or 0 if there is none
+	DWORD GzipLength;											// Length of the gzip version
+};
+
+//----------------------------------------------------------------------------------------------------
+//			PackHash() - FNV-1a hash of a path, ignoring case and treating \ as /
+//----------------------------------------------------------------------------------------------------
+DWORD PackHash(const char *Path)
+{
+	DWORD Hash = 2166136261;
+	for (const char *P = Path; *P; P++)
+	{
+		char C = *P;
+		if (C == '\\')					C = '/';
+		else if (C >= 'A' && C <= 'Z')	C += 'a' - 'A';
+		Hash ^= (unsigned char)C;
+		Hash *= 16777619;
+	}
+	return Hash;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PackPathsEqual() - compares two paths the same way PackHash() hashes them
+//----------------------------------------------------------------------------------------------------
+bool PackPathsEqual(const char *A, const char *B)
+{
+	for (; *A && *B; A++, B++)
+	{
+		char CA = *A, CB = *B;
+		if (CA == '\\')						CA = '/';
+		else if (CA >= 'A' && CA <= 'Z')	CA += 'a' - 'A';
+		if (CB == '\\')						CB = '/';
+		else if (CB >= 'A' && CB <= 'Z')	CB += 'a' - 'A';
+		if (CA != CB)
+			return false;
+	}
+	return *A == *B;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Asset pack class
+//----------------------------------------------------------------------------------------------------
+class ASSETPACK
+{
+  public:
+	ASSETPACK();												// Constructor
+	~ASSETPACK();												// Destructor, unmaps the file
+	bool Open(const char *FileName);							// Maps the pack into memory and checks it
+	void Close();												// Unmaps the pack
+	const PACKENTRY *Find(const char *Path);					// Finds a path, or NULL if it is not in the pack
+	const char *String(DWORD Offset);							// Gets a string from the string table
+	const char *Data(DWORD Offset);								// Gets a pointer to file data
+
+  private:
+	HANDLE hFile;												// The pack file
+	HANDLE hMapping;											// File mapping object
+	const char *Base;											// Where the pack is mapped
+	const PACKHEADER *Header;									// The header (same as Base)
+	const DWORD *Buckets;										// The hash table
+	const PACKENTRY *Entries;									// The entries
+};
+
+//----------------------------------------------------------------------------------------------------
+//			ASSETPACK::ASSETPACK
+//----------------------------------------------------------------------------------------------------
+ASSETPACK::ASSETPACK()
+{
+	hFile = INVALID_HANDLE_VALUE;
+	hMapping = NULL;
+	Base = NULL;
+	Header = NULL;
+	Buckets = NULL;
+	Entries = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ASSETPACK::~ASSETPACK
+//----------------------------------------------------------------------------------------------------
+ASSETPACK::~ASSETPACK()
+{
+	Close();
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ASSETPACK::Open()
+//----------------------------------------------------------------------------------------------------
+bool ASSETPACK::Open(const char *FileName)
+{
+	Close();
+
+	hFile = CreateFile(FileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+					   FILE_ATTRIBUTE_NORMAL, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	DWORD Size = GetFileSize(hFile, NULL);
+	if (Size < sizeof(PACKHEADER))
+	{
+		Close();
+		return false;
+	}
+
+	hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (hMapping == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	Base = (const char *)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+	if (Base == NULL)
+	{
+		Close();
+		return false;
+	}
+
+	// Check the header makes sense before we trust any offsets in it
+	Header = (const PACKHEADER *)Base;
+	if (Header->Magic != PACK_MAGIC || Header->Version != PACK_VERSION || Header->FileSize != Size
+		|| Header->BucketCount == 0 || (Header->BucketCount & (Header->BucketCount - 1)) != 0
+		|| Header->BucketOffset + Header->BucketCount * sizeof(DWORD) > Size
+		|| Header->EntryOffset + Header->EntryCount * sizeof(PACKENTRY) > Size)
+	{
+		Close();
+		return false;
+	}
+
+	Buckets = (const DWORD *)(Base + Header->BucketOffset);
+	Entries = (const PACKENTRY *)(Base + Header->EntryOffset);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ASSETPACK::Close()
+//----------------------------------------------------------------------------------------------------
+void ASSETPACK::Close()
+{
+	if (Base)							UnmapViewOfFile(Base);
+	if (hMapping)						CloseHandle(hMapping);
+	if (hFile != INVALID_HANDLE_VALUE)	CloseHandle(hFile);
+
+	hFile = INVALID_HANDLE_VALUE;
+	hMapping = NULL;
+	Base = NULL;
+	Header = NULL;
+	Buckets = NULL;
+	Entries = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ASSETPACK::Find()
+//----------------------------------------------------------------------------------------------------
+const PACKENTRY *ASSETPACK::Find(const char *Path)
+{
+	if (!Base)
+		return NULL;
+
+	DWORD Hash = PackHash(Path);
+	DWORD Mask = Header->BucketCount - 1;
+
+	for (DWORD Bucket = Hash & Mask; Buckets[Bucket] != 0; Bucket = (Bucket + 1) & Mask)
+	{
+		const PACKENTRY *Entry = &Entries[Buckets[Bucket] - 1];
+		if (Entry->Hash == Hash && PackPathsEqual(String(Entry->Path), Path))
+			return Entry;
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ASSETPACK::String() and ASSETPACK::Data()
+//----------------------------------------------------------------------------------------------------
+const char *ASSETPACK::String(DWORD Offset)
+{
+	return Base + Offset;
+}
+
+const char *ASSETPACK::Data(DWORD Offset)
+{
+	return Base + Offset;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LoadAssetPacks() - opens the pack for every virtual host that has one. A host whose
+//			pack will not open is served from its Root folder as normal.
+//----------------------------------------------------------------------------------------------------
+int LoadAssetPacks()
+{
+	int Loaded = 0;
+	map <string, VIRTUALHOST>::iterator It;
+	for (It = VHI.Host.begin(); It != VHI.Host.end(); It++)
+	{
+		VIRTUALHOST *Host = &It->second;
+		if (Host->PackFile.empty())
+			continue;
+
+		ASSETPACK *Pack = new ASSETPACK;
+		if (Pack->Open(Host->PackFile.c_str()))
+		{
+			Host->Pack = Pack;
+			Loaded++;
+		}
+		else delete Pack;
+	}
+	return Loaded;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,1245 @@
+//---------------------------------------------------------------------------------------------
+/*
+			BENCH.CPP
+			---------
+			SWSBench - load generator for measuring the server. It runs a fixed set of
+			scenarios over loopback, so a change can be measured the same way every time.
+
+				SWSBench setup <Webroot>				Makes the files the scenarios ask for
+				SWSBench list							Lists the scenarios
+				SWSBench run <scenario> [options]		Runs a scenario
+				SWSBench -cgi <script>					CGI stub, used by the cgi scenario
+				SWSBench replay-setup <log> <Webroot>	Makes the files a logged day asked for
+				SWSBench replay <log> [options]			Replays an access log
+
+			Options for run:
+
+				-a <address>		Server address (127.0.0.1)
+				-p <port>			Server port (80)
+				-H <host>			Host: header to send (the address)
+				-c <connections>	Connections, each with its own thread (8)
+				-r <rate>			Requests per second over all connections. Without
+									-r every connection sends its next request as soon
+									as it has the last answer (closed loop). With -r,
+									requests are sent on a fixed schedule whether or not
+									the server has kept up (open loop).
+				-d <seconds>		How long to run (10)
+				-w <seconds>		Warm up time at the start that is not counted (2)
+				-o <file>			Write the results there rather than to the screen
+				-t <full|resume>	Use HTTPS. With full, every connection does the whole
+									handshake. With resume, they resume the session the
+									last one made, as a returning browser would.
+				-R <seconds>		How often the rotate scenario rotates the logs (1)
+				-n <service>		The server's service name, for rotate ("SWS Web Server")
+				-S <url>			The server status page, for rotate (/server-status)
+
+			The results are JSON. "latency" is measured from when each request should have
+			been sent, so a server that stalls is charged for every request that had to
+			wait behind the stall (coordinated omission). "service" is measured from when
+			each request was actually sent. In closed loop the two are the same.
+
+			To compare the server's engines, run the same scenarios (small, large and
+			index are the static mix) with <Engine>threads</Engine> and then with
+			<Engine>iocp</Engine> in the configuration file.
+
+			For HTTPS, run against <SecurePort> with -p. The close scenario with -t full, and
+			then -t resume, measures handshakes a second ("connects" and "throughput"), and
+			the large scenario measures bulk transfer ("bytes_per_second"). Compare them with
+			the same runs over plain HTTP. The server's certificate isn't checked, and -H is
+			the name asked for with SNI.
+
+			The rotate scenario runs the small files twice, for -d seconds each. The second
+			time the server is sent SERVICE_CONTROL_ROTATELOGS every -R seconds, so its logs
+			are renamed and started again all through the run. The results are the first run,
+			then "rotating" with the second, and "p99_change_us", how much later the second
+			run's p99 was. Run it on the server's machine as an administrator, since it
+			controls the service, and with the server's <LogRotateSize> and
+			<LogRotateMinutes> at 0 so the first run doesn't rotate.
+
+			For the cgi scenario the server needs SWSBench as the interpreter for .bcgi
+			files, ie, <CGI><Extension>bcgi</Extension><Interpreter>C:\SWS\SWSBench.exe -cgi
+			</Interpreter></CGI> in the configuration file.
+
+			Replay takes a log in Common Log Format (or combined), as the server writes with
+			<LogFormat>common</LogFormat>. replay-setup makes Webroot\replay with a file of the
+			logged size for every path that was answered with 200 or 304, so the replay gets
+			the same mix of sizes and the same 404s. The replay sends each GET and HEAD at its
+			logged time from the start of the log. Requests logged in the same second are
+			spread over that second. Options for replay are -a, -p, -H, -c, -o and -t as for run, and:
+
+				-s <speed>			1 for the logged timing, 2 for twice as fast, and so on.
+									0 sends as fast as the connections allow (1)
+				-x <prefix>			Where the files are on the server (/replay)
+				-S <url>			The server status page, read before and after the
+									replay for the cache hit ratios (/server-status)
+
+			Query strings are kept, but POST bodies and conditional headers are not in the
+			log, so POSTs are skipped and 304s come back as 200s. "mismatched" counts the
+			answers whose status differs from the log.
+*/
+//---------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "options.hpp"
+#include "httpdate.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+#pragma comment(lib, "wsock32.lib")
+#pragma warning(disable:4786)
+
+#define BENCH_SMALLFILES					100						// Files in bench\small
+#define BENCH_SMALLSIZE						1024					// Size of each of them
+#define BENCH_LARGESIZE						(4 * 1024 * 1024)		// Size of bench\large.bin
+#define BENCH_INDEXFILES					2000					// Files in bench\index
+#define BENCH_MAXCONNECTIONS				256
+#define BENCH_BUFFER						65536
+
+//---------------------------------------------------------------------------------------------
+//			Scenarios
+//---------------------------------------------------------------------------------------------
+struct SCENARIO
+{
+	const char *Name;
+	const char *Description;
+};
+
+static const SCENARIO Scenarios[] =
+{
+	{ "small",			"1KB static files, 100 of them in turn" },
+	{ "large",			"One 4MB binary file" },
+	{ "index",			"Folder index of 2000 files" },
+	{ "404",			"Files that do not exist" },
+	{ "conditional",	"If-Modified-Since on the small files, so every answer is a 304" },
+	{ "keepalive",		"Small files with Connection: keep-alive" },
+	{ "close",			"Small files with Connection: close" },
+	{ "cgi",			"A CGI script run by SWSBench -cgi" },
+	{ "rotate",			"Small files, then small files again with the logs rotated every -R seconds" },
+	{ NULL,				NULL }
+};
+
+//---------------------------------------------------------------------------------------------
+//			Settings from the command line
+//---------------------------------------------------------------------------------------------
+struct BENCHOPTIONS
+{
+	string Address;												// Server address
+	int Port;													// Server port
+	string Host;												// Host: header
+	string Scenario;											// Scenario to run
+	int Connections;											// Number of connections
+	double Rate;												// Requests per second, 0 for closed loop
+	double Duration;											// Seconds to run
+	double Warmup;												// Seconds not counted at the start
+	string Output;												// Results file, empty for the screen
+	string Log;													// Log to replay
+	double Speed;												// Replay speed, 0 for as fast as possible
+	string Prefix;												// Where the replay files are on the server
+	string StatusURL;											// Server status page
+	string Tls;													// full or resume for HTTPS, empty for HTTP
+	double RotateEvery;											// Seconds between rotations for the rotate scenario
+	string Service;												// The server's service name
+}Bench;
+
+//---------------------------------------------------------------------------------------------
+//			Timing, in QueryPerformanceCounter() ticks
+//---------------------------------------------------------------------------------------------
+__int64 Frequency;												// Ticks per second
+__int64 StartTicks;												// When the run starts
+__int64 WarmupTicks;											// When counting starts
+__int64 StopTicks;												// When the run stops
+struct sockaddr_in ServerAddress;
+CredHandle SharedCredentials;									// For -t resume, so sessions are resumed
+char FutureDate[HTTPDATE_LENGTH + 1];							// If-Modified-Since for the conditional scenario
+SC_HANDLE hService;												// The server, for the rotate scenario
+
+__int64 TicksNow()
+{
+	LARGE_INTEGER Now;
+	QueryPerformanceCounter(&Now);
+	return Now.QuadPart;
+}
+
+DWORD TicksToMicro(__int64 Ticks)
+{
+	if (Ticks <= 0)
+		return 0;
+	__int64 Micro = Ticks / Frequency * 1000000 + Ticks % Frequency * 1000000 / Frequency;
+	return Micro > 0xFFFFFFFF ? 0xFFFFFFFF : (DWORD)Micro;
+}
+
+//---------------------------------------------------------------------------------------------
+//			A connection's TLS, for -t
+//---------------------------------------------------------------------------------------------
+struct LINK
+{
+	TLSSESSION Session;
+	CredHandle Credentials;										// Its own for -t full, so nothing is resumed
+	bool Own;													// Are they to be freed
+};
+
+//---------------------------------------------------------------------------------------------
+//			Each connection's results
+//---------------------------------------------------------------------------------------------
+struct WORKER
+{
+	int Number;													// Which connection this is
+	LINK Link;													// Its TLS, if it's HTTPS
+	HISTOGRAM Latency;											// From when each request should have gone
+	HISTOGRAM Service;											// From when each request did go
+	unsigned __int64 Requests;									// Requests answered
+	unsigned __int64 Errors;									// Requests that failed
+	unsigned __int64 Bytes;										// Bytes received
+	unsigned __int64 Connects;									// Connections made
+	map <int, unsigned __int64> Statuses;						// Answers by status code
+	unsigned __int64 Mismatched;								// Replayed answers not matching the log
+};
+
+//---------------------------------------------------------------------------------------------
+//			All the connections' results added up
+//---------------------------------------------------------------------------------------------
+struct TOTALS
+{
+	HISTOGRAM Latency;
+	HISTOGRAM Service;
+	unsigned __int64 Requests;
+	unsigned __int64 Errors;
+	unsigned __int64 Bytes;
+	unsigned __int64 Connects;
+	unsigned __int64 Mismatched;
+	map <int, unsigned __int64> Statuses;
+};
+
+//---------------------------------------------------------------------------------------------
+//			MakeRequest() - the Nth request of the scenario
+//---------------------------------------------------------------------------------------------
+string MakeRequest(DWORD N, bool *KeepAlive)
+{
+	char Path[64];
+	const string &S = Bench.Scenario;
+	*KeepAlive = false;
+
+	if (S == "large")				strcpy(Path, "/bench/large.bin");
+	else if (S == "index")			strcpy(Path, "/bench/index/");
+	else if (S == "404")			sprintf(Path, "/bench/missing/%lu.html", N);
+	else if (S == "cgi")			sprintf(Path, "/bench/stub.bcgi?n=%lu", N);
+	else							sprintf(Path, "/bench/small/%lu.html", N % BENCH_SMALLFILES);
+
+	string Request = "GET ";
+	Request += Path;
+	Request += " HTTP/1.1\r\nHost: ";
+	Request += Bench.Host;
+	Request += "\r\nUser-Agent: SWSBench\r\nAccept: */*\r\n";
+	if (S == "conditional")
+	{
+		Request += "If-Modified-Since: ";
+		Request += FutureDate;
+		Request += "\r\n";
+	}
+	if (S == "keepalive")
+	{
+		Request += "Connection: keep-alive\r\n";
+		*KeepAlive = true;
+	}
+	else Request += "Connection: close\r\n";
+	Request += "\r\n";
+	return Request;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connect() - opens a connection to the server, or returns -1. With -t it does the
+//			handshake as well.
+//			Write(), Read() and Disconnect() - send(), recv() and closesocket(), through TLS
+//			with -t
+//---------------------------------------------------------------------------------------------
+int Connect(LINK *Link)
+{
+	int SFD = socket(AF_INET, SOCK_STREAM, 0);
+	if (SFD == -1)
+		return -1;
+	if (connect(SFD, (struct sockaddr *)&ServerAddress, sizeof(ServerAddress)) != 0)
+	{
+		closesocket(SFD);
+		return -1;
+	}
+	int NoDelay = 1;
+	setsockopt(SFD, IPPROTO_TCP, TCP_NODELAY, (const char *)&NoDelay, sizeof(NoDelay));
+	if (Bench.Tls.empty())
+		return SFD;
+
+	Link->Own = (Bench.Tls == "full");
+	if (Link->Own && !TLSCHANNEL::ClientCredentials(&Link->Credentials))
+	{
+		closesocket(SFD);
+		return -1;
+	}
+	if (!Tls.Connect(&Link->Session, SFD, Bench.Host.c_str(), Link->Own ? &Link->Credentials : &SharedCredentials))
+	{
+		if (Link->Own)
+			FreeCredentialsHandle(&Link->Credentials);
+		closesocket(SFD);
+		return -1;
+	}
+	return SFD;
+}
+
+int Write(LINK *Link, int SFD, const char *Data, int Length)
+{
+	if (Bench.Tls.empty())
+		return send(SFD, Data, Length, 0);
+	return Tls.Send(&Link->Session, Data, Length);
+}
+
+int Read(LINK *Link, int SFD, char *Data, int Length)
+{
+	if (Bench.Tls.empty())
+		return recv(SFD, Data, Length, 0);
+	return Tls.Recv(&Link->Session, Data, Length);
+}
+
+void Disconnect(LINK *Link, int SFD)
+{
+	if (!Bench.Tls.empty())
+	{
+		Tls.End(&Link->Session);
+		if (Link->Own)
+			FreeCredentialsHandle(&Link->Credentials);
+	}
+	closesocket(SFD);
+}
+
+//---------------------------------------------------------------------------------------------
+//			FindHeader() - finds a header in a response and returns its value, or NULL
+//---------------------------------------------------------------------------------------------
+const char *FindHeader(const char *Headers, const char *Name)
+{
+	int Length = strlen(Name);
+	for (const char *Line = Headers; Line && *Line; )
+	{
+		if (!strnicmp(Line, Name, Length) && Line[Length] == ':')
+		{
+			const char *Value = Line + Length + 1;
+			while (*Value == ' ')
+				Value++;
+			return Value;
+		}
+		Line = strchr(Line, '\n');
+		if (Line) Line++;
+	}
+	return NULL;
+}
+
+//---------------------------------------------------------------------------------------------
+//			DoRequest() - sends a request and reads the whole answer. *SFD is the open
+//			connection, or -1. It is left open if the server will take another request on it.
+//---------------------------------------------------------------------------------------------
+bool DoRequest(WORKER *W, int *SFD, const string &Request, bool KeepAlive, int *Status)
+{
+	char Buffer[BENCH_BUFFER];
+	*Status = 0;
+
+	for (int Try = 0; Try < 2; Try++)
+	{
+		bool Reused = (*SFD != -1);
+		if (*SFD == -1)
+		{
+			*SFD = Connect(&W->Link);
+			if (*SFD == -1)
+				return false;
+			W->Connects++;
+		}
+
+		int Sent = Write(&W->Link, *SFD, Request.data(), Request.length());
+		if (Sent != (int)Request.length())
+		{
+			Disconnect(&W->Link, *SFD);
+			*SFD = -1;
+			if (Reused) continue;								// The server closed an idle connection
+			return false;
+		}
+
+		// Read up to the end of the headers. The server ends lines with \n or \r\n.
+		string Head;
+		int HeadEnd = -1;
+		int EndLength = 0;
+		int Received = 0;
+		while (HeadEnd < 0)
+		{
+			Received = Read(&W->Link, *SFD, Buffer, sizeof(Buffer));
+			if (Received <= 0)
+				break;
+			Head.append(Buffer, Received);
+			W->Bytes += Received;
+			int CRLF = Head.find("\r\n\r\n");
+			int LF = Head.find("\n\n");
+			if (CRLF >= 0 && (LF < 0 || CRLF < LF))	{ HeadEnd = CRLF; EndLength = 4; }
+			else if (LF >= 0)						{ HeadEnd = LF; EndLength = 2; }
+		}
+		if (HeadEnd < 0)
+		{
+			Disconnect(&W->Link, *SFD);
+			*SFD = -1;
+			if (Reused && Head.empty()) continue;				// Closed before answering, try a new connection
+			if (Head.length() > 9)
+				*Status = atoi(Head.c_str() + 9);				// A close delimited answer with no body
+			return *Status != 0;
+		}
+
+		*Status = atoi(Head.c_str() + 9);						// "HTTP/1.1 200 OK"
+		string Headers = Head.substr(0, HeadEnd + 1);
+		unsigned __int64 BodyHave = Head.length() - HeadEnd - EndLength;
+
+		const char *Length = FindHeader(Headers.c_str(), "Content-Length");
+		const char *Connection = FindHeader(Headers.c_str(), "Connection");
+		bool ServerCloses = (Connection && !strnicmp(Connection, "close", 5));
+		bool Chunked = false;
+		const char *Encoding = FindHeader(Headers.c_str(), "Transfer-Encoding");
+		if (Encoding && !strnicmp(Encoding, "chunked", 7))
+			Chunked = true;
+
+		if (KeepAlive && Length && !ServerCloses && !Chunked)
+		{
+			unsigned __int64 BodyLength = _atoi64(Length);
+			while (BodyHave < BodyLength)
+			{
+				Received = Read(&W->Link, *SFD, Buffer, sizeof(Buffer));
+				if (Received <= 0)
+				{
+					Disconnect(&W->Link, *SFD);
+					*SFD = -1;
+					return false;
+				}
+				BodyHave += Received;
+				W->Bytes += Received;
+			}
+			return true;										// Connection stays open for the next one
+		}
+
+		if (KeepAlive && Chunked && !ServerCloses)
+		{
+			// Read chunks until the zero length one and the blank line after it
+			string Body = Head.substr(HeadEnd + EndLength);
+			for (;;)
+			{
+				int End = Body.find("\r\n0\r\n\r\n");
+				if (End >= 0 || Body.substr(0, 5) == "0\r\n\r\n")
+					return true;
+				Received = Read(&W->Link, *SFD, Buffer, sizeof(Buffer));
+				if (Received <= 0)
+				{
+					Disconnect(&W->Link, *SFD);
+					*SFD = -1;
+					return false;
+				}
+				Body.append(Buffer, Received);
+				W->Bytes += Received;
+				if (Body.length() > 16)
+					Body.erase(0, Body.length() - 16);			// Only the end matters
+			}
+		}
+
+		// Otherwise the answer ends when the server closes the connection
+		while ((Received = Read(&W->Link, *SFD, Buffer, sizeof(Buffer))) > 0)
+			W->Bytes += Received;
+		Disconnect(&W->Link, *SFD);
+		*SFD = -1;
+		return true;
+	}
+	return false;
+}
+
+//---------------------------------------------------------------------------------------------
+//			WorkerThread() - one connection's worth of load. Used by CreateThread()
+//---------------------------------------------------------------------------------------------
+DWORD WINAPI WorkerThread(LPVOID lpParam)
+{
+	WORKER *W = (WORKER *)lpParam;
+	int SFD = -1;
+
+	// In open loop each connection sends every Interval ticks, staggered so the
+	// connections don't all send at once
+	double Interval = (Bench.Rate > 0) ? (double)Frequency * Bench.Connections / Bench.Rate : 0;
+	__int64 First = StartTicks + (__int64)(Interval * W->Number / Bench.Connections);
+
+	for (DWORD K = 0; ; K++)
+	{
+		__int64 Due;
+		__int64 Now = TicksNow();
+		if (Interval > 0)
+		{
+			Due = First + (__int64)(Interval * K);
+			while (Now < Due)									// Wait for our turn
+			{
+				DWORD Wait = (DWORD)((Due - Now) * 1000 / Frequency);
+				Sleep(Wait > 1 ? Wait - 1 : 0);
+				Now = TicksNow();
+			}
+		}
+		else Due = Now;
+		if (Due >= StopTicks)
+			break;
+
+		bool KeepAlive;
+		string Request = MakeRequest(K * Bench.Connections + W->Number, &KeepAlive);
+		int Status;
+		__int64 Sent = TicksNow();
+		bool OK = DoRequest(W, &SFD, Request, KeepAlive, &Status);
+		__int64 Done = TicksNow();
+
+		if (Due < WarmupTicks)
+		{
+			W->Bytes = W->Connects = 0;							// Only count what happens after the warm up
+			continue;
+		}
+		if (!OK)
+		{
+			W->Errors++;
+			if (!Interval) Sleep(1);							// Don't spin if the server is down
+			continue;
+		}
+		W->Requests++;
+		W->Statuses[Status]++;
+		W->Latency.Add(TicksToMicro(Done - Due));
+		W->Service.Add(TicksToMicro(Done - Sent));
+	}
+	if (SFD != -1)
+		Disconnect(&W->Link, SFD);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+//			WriteHistogram() - one histogram as a JSON object, in microseconds
+//---------------------------------------------------------------------------------------------
+void WriteHistogram(FILE *Out, const HISTOGRAM &H)
+{
+	fprintf(Out, "{\"mean\":%lu,\"p50\":%lu,\"p90\":%lu,\"p99\":%lu,\"p999\":%lu,\"p9999\":%lu,\"max\":%lu}",
+			(unsigned long)(H.Count ? H.Sum / H.Count : 0),
+			H.Quantile(0.5), H.Quantile(0.9), H.Quantile(0.99), H.Quantile(0.999), H.Quantile(0.9999), H.Max);
+}
+
+//---------------------------------------------------------------------------------------------
+//			Setup() - makes the files the scenarios use, under Webroot\bench
+//---------------------------------------------------------------------------------------------
+bool MakeFile(const string &Path, DWORD Size, char Fill)
+{
+	ofstream Out(Path.c_str(), ios::binary);
+	if (!Out)
+		return false;
+	char Block[4096];
+	memset(Block, Fill, sizeof(Block));
+	while (Size > 0)
+	{
+		DWORD Part = Size < sizeof(Block) ? Size : sizeof(Block);
+		Out.write(Block, Part);
+		Size -= Part;
+	}
+	return true;
+}
+
+int Setup(const string &Webroot)
+{
+	string Root = Webroot + "\\bench";
+	CreateDirectory(Root.c_str(), NULL);
+	CreateDirectory((Root + "\\small").c_str(), NULL);
+	CreateDirectory((Root + "\\index").c_str(), NULL);
+
+	char Name[64];
+	int X;
+	for (X = 0; X < BENCH_SMALLFILES; X++)
+	{
+		sprintf(Name, "\\small\\%d.html", X);
+		if (!MakeFile(Root + Name, BENCH_SMALLSIZE, 'a' + X % 26))
+		{
+			cout << "Could not write " << Root << Name << endl;
+			return 1;
+		}
+	}
+	for (X = 0; X < BENCH_INDEXFILES; X++)
+	{
+		sprintf(Name, "\\index\\file%04d.txt", X);
+		MakeFile(Root + Name, X, 'x');
+	}
+	MakeFile(Root + "\\large.bin", BENCH_LARGESIZE, 'L');
+	MakeFile(Root + "\\stub.bcgi", 16, '#');
+
+	cout << "Made the benchmark files in " << Root << endl;
+	cout << "For the cgi scenario, make SWSBench -cgi the interpreter for .bcgi files." << endl;
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+//			ResolveServer() - fills in ServerAddress from the options
+//---------------------------------------------------------------------------------------------
+bool ResolveServer()
+{
+	ServerAddress.sin_family = AF_INET;
+	ServerAddress.sin_port = htons(Bench.Port);
+	ServerAddress.sin_addr.s_addr = inet_addr(Bench.Address.c_str());
+	if (ServerAddress.sin_addr.s_addr == INADDR_NONE)
+	{
+		struct hostent *Host = gethostbyname(Bench.Address.c_str());
+		if (!Host)
+		{
+			cout << "Unknown address " << Bench.Address << endl;
+			return false;
+		}
+		memcpy(&ServerAddress.sin_addr, Host->h_addr, sizeof(ServerAddress.sin_addr));
+	}
+	memset(&(ServerAddress.sin_zero), '\0', 8);
+	if (Bench.Host.empty())
+		Bench.Host = Bench.Address;
+
+	LARGE_INTEGER Freq;
+	QueryPerformanceFrequency(&Freq);
+	Frequency = Freq.QuadPart;
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			RunWorkers() - runs Bench.Connections threads of Function to the end, and adds
+//			up their results
+//---------------------------------------------------------------------------------------------
+void RunWorkers(LPTHREAD_START_ROUTINE Function, TOTALS *Totals)
+{
+	int X;
+	vector <WORKER *> Workers;
+	vector <HANDLE> Threads;
+	for (X = 0; X < Bench.Connections; X++)
+	{
+		WORKER *W = new WORKER;
+		memset(&W->Latency, 0, sizeof(HISTOGRAM));
+		memset(&W->Service, 0, sizeof(HISTOGRAM));
+		W->Number = X;
+		W->Requests = W->Errors = W->Bytes = W->Connects = W->Mismatched = 0;
+		Workers.push_back(W);
+
+		DWORD dwThreadId;
+		HANDLE hThread = CreateThread(NULL, 0, Function, W, 0, &dwThreadId);
+		if (hThread)
+			Threads.push_back(hThread);
+	}
+	for (X = 0; X < (int)Threads.size(); X++)
+	{
+		WaitForSingleObject(Threads[X], INFINITE);
+		CloseHandle(Threads[X]);
+	}
+
+	memset(&Totals->Latency, 0, sizeof(HISTOGRAM));
+	memset(&Totals->Service, 0, sizeof(HISTOGRAM));
+	Totals->Requests = Totals->Errors = Totals->Bytes = Totals->Connects = Totals->Mismatched = 0;
+	for (X = 0; X < (int)Workers.size(); X++)
+	{
+		WORKER *W = Workers[X];
+		Totals->Latency.Merge(W->Latency);
+		Totals->Service.Merge(W->Service);
+		Totals->Requests += W->Requests;
+		Totals->Errors += W->Errors;
+		Totals->Bytes += W->Bytes;
+		Totals->Connects += W->Connects;
+		Totals->Mismatched += W->Mismatched;
+		map <int, unsigned __int64>::iterator It;
+		for (It = W->Statuses.begin(); It != W->Statuses.end(); It++)
+			Totals->Statuses[It->first] += It->second;
+		delete W;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+//			OpenResults() - the results file, or the screen
+//			WriteTotals() - the results every run has, as JSON fields
+//---------------------------------------------------------------------------------------------
+FILE *OpenResults()
+{
+	if (Bench.Output.empty())
+		return stdout;
+	FILE *Out = fopen(Bench.Output.c_str(), "w");
+	if (!Out)
+		cout << "Could not write " << Bench.Output << endl;
+	return Out;
+}
+
+void WriteTotals(FILE *Out, TOTALS &Totals, double Seconds)
+{
+	fprintf(Out, "\"requests\":%lu,\"errors\":%lu,\"connects\":%lu,\"throughput\":%.1f,\"bytes_per_second\":%.0f,\n",
+			(unsigned long)Totals.Requests, (unsigned long)Totals.Errors, (unsigned long)Totals.Connects,
+			(double)(__int64)Totals.Requests / Seconds, (double)(__int64)Totals.Bytes / Seconds);
+	fprintf(Out, "\"status\":{");
+	map <int, unsigned __int64>::iterator It;
+	for (It = Totals.Statuses.begin(); It != Totals.Statuses.end(); It++)
+		fprintf(Out, "%s\"%d\":%lu", It == Totals.Statuses.begin() ? "" : ",", It->first, (unsigned long)It->second);
+	fprintf(Out, "},\n\"latency_us\":");
+	WriteHistogram(Out, Totals.Latency);
+	fprintf(Out, ",\n\"service_us\":");
+	WriteHistogram(Out, Totals.Service);
+}
+
+//---------------------------------------------------------------------------------------------
+//			ReadStatus() - the server status page as JSON, empty if there isn't one
+//			ReadRotations() - the server's log rotations so far, -1 if it can't be read
+//---------------------------------------------------------------------------------------------
+string ReadStatus()
+{
+	LINK Link;
+	int SFD = Connect(&Link);
+	if (SFD == -1)
+		return "";
+	string Request = "GET " + Bench.StatusURL + "?format=json HTTP/1.0\r\nHost: " + Bench.Host + "\r\n\r\n";
+	Write(&Link, SFD, Request.data(), Request.length());
+	string Page;
+	char Buffer[4096];
+	int Received;
+	while ((Received = Read(&Link, SFD, Buffer, sizeof(Buffer))) > 0)
+		Page.append(Buffer, Received);
+	Disconnect(&Link, SFD);
+	return Page;
+}
+
+long ReadRotations()
+{
+	string Page = ReadStatus();
+	int Found = Page.find("\"rotations\":");
+	if (Found < 0)
+		return -1;
+	return atol(Page.c_str() + Found + 12);
+}
+
+//---------------------------------------------------------------------------------------------
+//			RotatorThread() - rotates the server's logs every Bench.RotateEvery seconds while
+//			the counted part of the run goes on. Returns how many it asked for. Used by
+//			CreateThread()
+//---------------------------------------------------------------------------------------------
+DWORD WINAPI RotatorThread(LPVOID lpParam)
+{
+	DWORD Asked = 0;
+	__int64 Every = (__int64)(Bench.RotateEvery * Frequency);
+	for (__int64 Next = WarmupTicks; Next < StopTicks; Next += Every)
+	{
+		__int64 Now = TicksNow();
+		if (Now < Next)
+			Sleep((DWORD)((Next - Now) * 1000 / Frequency));
+		SERVICE_STATUS Status;
+		if (ControlService(hService, SERVICE_CONTROL_ROTATELOGS, &Status))
+			Asked++;
+	}
+	return Asked;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Schedule() - sets the start, warm up and stop times for a run from now
+//---------------------------------------------------------------------------------------------
+void Schedule()
+{
+	StartTicks = TicksNow() + Frequency / 10;					// Give the threads time to start
+	WarmupTicks = StartTicks + (__int64)(Bench.Warmup * Frequency);
+	StopTicks = StartTicks + (__int64)(Bench.Duration * Frequency);
+}
+
+//---------------------------------------------------------------------------------------------
+//			Run() - runs a scenario and writes the results
+//---------------------------------------------------------------------------------------------
+int Run()
+{
+	bool Known = false;
+	for (int X = 0; Scenarios[X].Name; X++)
+	{
+		if (Bench.Scenario == Scenarios[X].Name)
+			Known = true;
+	}
+	if (!Known)
+	{
+		cout << "Unknown scenario " << Bench.Scenario << ". Try SWSBench list" << endl;
+		return 1;
+	}
+	if (Bench.Connections < 1 || Bench.Connections > BENCH_MAXCONNECTIONS || Bench.Duration <= Bench.Warmup)
+	{
+		cout << "Need 1 to " << BENCH_MAXCONNECTIONS << " connections, and a duration longer than the warm up" << endl;
+		return 1;
+	}
+	if (!ResolveServer())
+		return 1;
+	FormatHTTPDate(time(NULL) + 365 * 86400, FutureDate);		// Nothing is newer than a year from now
+
+	bool Rotating = (Bench.Scenario == "rotate");
+	if (Rotating)
+	{
+		SC_HANDLE hManager = OpenSCManager(NULL, NULL, SC_MANAGER_CONNECT);
+		hService = hManager ? OpenService(hManager, Bench.Service.c_str(), SERVICE_USER_DEFINED_CONTROL) : NULL;
+		if (hManager)
+			CloseServiceHandle(hManager);
+		if (!hService || Bench.RotateEvery <= 0)
+		{
+			cout << "Could not control the service \"" << Bench.Service << "\" to rotate its logs."
+				 << " Run as an administrator on the server's machine, with -R above 0" << endl;
+			return 1;
+		}
+	}
+
+	Schedule();
+	TOTALS Totals;
+	RunWorkers(WorkerThread, &Totals);
+	double Seconds = Bench.Duration - Bench.Warmup;
+
+	// The same again with the logs rotating
+	TOTALS Rotated;
+	DWORD Asked = 0;
+	long RotationsBefore = 0, RotationsAfter = 0;
+	if (Rotating)
+	{
+		RotationsBefore = ReadRotations();
+		Schedule();
+		DWORD dwThreadId;
+		HANDLE hRotator = CreateThread(NULL, 0, RotatorThread, NULL, 0, &dwThreadId);
+		RunWorkers(WorkerThread, &Rotated);
+		if (hRotator)
+		{
+			WaitForSingleObject(hRotator, INFINITE);
+			GetExitCodeThread(hRotator, &Asked);
+			CloseHandle(hRotator);
+		}
+		RotationsAfter = ReadRotations();
+		CloseServiceHandle(hService);
+	}
+
+	FILE *Out = OpenResults();
+	if (!Out)
+		return 1;
+	fprintf(Out, "{\"scenario\":\"%s\",\"mode\":\"%s\",\"connections\":%d,\"rate\":%.1f,\"seconds\":%.1f,\n",
+			Bench.Scenario.c_str(), Bench.Rate > 0 ? "open" : "closed", Bench.Connections, Bench.Rate, Seconds);
+	if (!Bench.Tls.empty())
+		fprintf(Out, "\"tls\":\"%s\",\"handshakes\":%ld,\"resumed\":%ld,\"handshake_failures\":%ld,\n",
+				Bench.Tls.c_str(), Tls.Handshakes, Tls.Resumptions, Tls.Failed);
+	WriteTotals(Out, Totals, Seconds);
+	if (Rotating)
+	{
+		fprintf(Out, ",\n\"rotating\":{\"rotations_asked\":%lu,\"rotations\":%ld,\n", Asked,
+				RotationsBefore >= 0 && RotationsAfter >= 0 ? RotationsAfter - RotationsBefore : -1);
+		WriteTotals(Out, Rotated, Seconds);
+		fprintf(Out, "},\n\"p99_change_us\":%ld",
+				(long)Rotated.Latency.Quantile(0.99) - (long)Totals.Latency.Quantile(0.99));
+	}
+	fprintf(Out, "}\n");
+
+	if (Out != stdout)
+		fclose(Out);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Replay. Each line of the log becomes a REPLAYENTRY.
+//---------------------------------------------------------------------------------------------
+struct REPLAYENTRY
+{
+	time_t Time;												// When it was logged
+	double Offset;												// Seconds from the start of the log
+	string Method;
+	string Path;												// As logged, with any query string
+	int Status;													// What the server answered
+	unsigned __int64 Bytes;										// How much it sent
+};
+
+bool EarlierEntry(const REPLAYENTRY &A, const REPLAYENTRY &B)
+{
+	return A.Time < B.Time;
+}
+
+vector <REPLAYENTRY> Replay;									// The log, in time order
+volatile LONG ReplayNext = 0;									// Next entry to send
+
+//---------------------------------------------------------------------------------------------
+//			ParseLogLine() - reads one Common Log Format line, ie,
+//			127.0.0.1 - - [10/Oct/2000:13:55:36 -0700] "GET /a.gif HTTP/1.0" 200 2326
+//---------------------------------------------------------------------------------------------
+bool ParseLogLine(const char *Line, REPLAYENTRY *Entry)
+{
+	const char *Date = strchr(Line, '[');
+	if (!Date)
+		return false;
+
+	int Day, Year, Hour, Minute, Second, Zone;
+	char Month[4], Sign;
+	if (sscanf(Date + 1, "%d/%3s/%d:%d:%d:%d %c%d", &Day, Month, &Year, &Hour, &Minute, &Second, &Sign, &Zone) != 8)
+		return false;
+	int M = CalcMonth(Month);
+	if (M < 0)
+		return false;
+	long ZoneSeconds = (Zone / 100) * 3600 + (Zone % 100) * 60;
+	Entry->Time = (time_t)(DaysFromCivil(Year, M, Day) * 86400 + Hour * 3600 + Minute * 60 + Second);
+	Entry->Time += (Sign == '-') ? ZoneSeconds : -ZoneSeconds;	// Back to UTC
+
+	const char *Request = strchr(Date, '"');
+	if (!Request)
+		return false;
+	const char *RequestEnd = strchr(Request + 1, '"');
+	if (!RequestEnd)
+		return false;
+	string Text(Request + 1, RequestEnd - Request - 1);
+	int Space = Text.find(' ');
+	if (Space < 0)
+		return false;
+	Entry->Method = Text.substr(0, Space);
+	int PathEnd = Text.find(' ', Space + 1);
+	Entry->Path = Text.substr(Space + 1, PathEnd < 0 ? string::npos : PathEnd - Space - 1);
+	if (Entry->Path.empty() || Entry->Path[0] != '/')
+		return false;
+
+	char Bytes[32];
+	if (sscanf(RequestEnd + 1, "%d %31s", &Entry->Status, Bytes) != 2)
+		return false;
+	Entry->Bytes = (Bytes[0] == '-') ? 0 : _atoi64(Bytes);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			LoadLog() - reads the log into Replay and works out when to send each entry
+//---------------------------------------------------------------------------------------------
+bool LoadLog(const string &FileName)
+{
+	ifstream In(FileName.c_str());
+	if (!In)
+	{
+		cout << "Could not read " << FileName << endl;
+		return false;
+	}
+
+	string Line;
+	unsigned long Bad = 0;
+	while (getline(In, Line))
+	{
+		REPLAYENTRY Entry;
+		if (ParseLogLine(Line.c_str(), &Entry))
+			Replay.push_back(Entry);
+		else if (Line.length() > 1)
+			Bad++;
+	}
+	if (Bad)
+		cout << "Skipped " << Bad << " lines that were not Common Log Format" << endl;
+	if (Replay.empty())
+	{
+		cout << "Nothing to replay in " << FileName << endl;
+		return false;
+	}
+
+	// The writer thread can log slightly out of order
+	stable_sort(Replay.begin(), Replay.end(), EarlierEntry);
+
+	// Spread the requests logged in each second evenly over it
+	int First = 0;
+	for (int X = 1; X <= (int)Replay.size(); X++)
+	{
+		if (X < (int)Replay.size() && Replay[X].Time == Replay[First].Time)
+			continue;
+		int InSecond = X - First;
+		for (int Y = First; Y < X; Y++)
+			Replay[Y].Offset = (double)(Replay[Y].Time - Replay[0].Time) + (double)(Y - First) / InSecond;
+		First = X;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			ReplaySetup() - makes a file of the logged size for each path that was there
+//---------------------------------------------------------------------------------------------
+int ReplaySetup(const string &LogFile, const string &Webroot)
+{
+	if (!LoadLog(LogFile))
+		return 1;
+
+	// The biggest answer for each path. Paths that were never found are left out.
+	map <string, unsigned __int64> Sizes;
+	int X;
+	for (X = 0; X < (int)Replay.size(); X++)
+	{
+		REPLAYENTRY &E = Replay[X];
+		if (E.Status != 200 && E.Status != 304)
+			continue;
+		string Path = E.Path.substr(0, E.Path.find('?'));
+		if (strstr(Path.c_str(), "..") || strchr(Path.c_str(), ':') || strchr(Path.c_str(), '\\'))
+			continue;											// Keep everything under Webroot\replay
+		unsigned __int64 &Size = Sizes[Path];
+		if (E.Status == 200 && E.Bytes > Size)
+			Size = E.Bytes;
+	}
+
+	string Root = Webroot + "\\replay";
+	CreateDirectory(Root.c_str(), NULL);
+	unsigned long Files = 0;
+	unsigned __int64 Total = 0;
+	map <string, unsigned __int64>::iterator It;
+	for (It = Sizes.begin(); It != Sizes.end(); It++)
+	{
+		// Make the folders on the way, then the file
+		string Path = Root;
+		const string &Name = It->first;
+		int Start = 1;
+		int Slash;
+		while ((Slash = Name.find('/', Start)) >= 0)
+		{
+			Path += '\\';
+			Path += Name.substr(Start, Slash - Start);
+			CreateDirectory(Path.c_str(), NULL);
+			Start = Slash + 1;
+		}
+		if (Start >= (int)Name.length())
+			continue;											// A folder, the server indexes it
+		Path += '\\';
+		Path += Name.substr(Start);
+		DWORD Size = It->second > 0xFFFFFFFF ? 0xFFFFFFFF : (DWORD)It->second;
+		if (!MakeFile(Path, Size, 'r'))
+		{
+			cout << "Could not write " << Path << endl;
+			return 1;
+		}
+		Files++;
+		Total += Size;
+	}
+
+	cout << "Made " << Files << " files, " << (unsigned long)(Total / 1024) << "KB, in " << Root << endl;
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+//			ReplayThread() - sends the log entries at their time. Used by CreateThread()
+//---------------------------------------------------------------------------------------------
+DWORD WINAPI ReplayThread(LPVOID lpParam)
+{
+	WORKER *W = (WORKER *)lpParam;
+
+	for (;;)
+	{
+		LONG Next = InterlockedIncrement((LONG *)&ReplayNext) - 1;
+		if (Next >= (LONG)Replay.size())
+			break;
+		REPLAYENTRY &E = Replay[Next];
+
+		__int64 Now = TicksNow();
+		__int64 Due = Now;
+		if (Bench.Speed > 0)
+		{
+			Due = StartTicks + (__int64)(E.Offset / Bench.Speed * Frequency);
+			while (Now < Due)
+			{
+				DWORD Wait = (DWORD)((Due - Now) * 1000 / Frequency);
+				Sleep(Wait > 1 ? Wait - 1 : 0);
+				Now = TicksNow();
+			}
+		}
+
+		string Request = E.Method;
+		Request += ' ';
+		Request += Bench.Prefix;
+		Request += E.Path;
+		Request += " HTTP/1.1\r\nHost: ";
+		Request += Bench.Host;
+		Request += "\r\nUser-Agent: SWSBench replay\r\nAccept: */*\r\nConnection: close\r\n\r\n";
+
+		int SFD = -1;
+		int Status;
+		__int64 Sent = TicksNow();
+		bool OK = DoRequest(W, &SFD, Request, false, &Status);
+		__int64 Done = TicksNow();
+		if (!OK)
+		{
+			W->Errors++;
+			continue;
+		}
+		W->Requests++;
+		W->Statuses[Status]++;
+		if (Status != E.Status)
+			W->Mismatched++;
+		W->Latency.Add(TicksToMicro(Done - Due));
+		W->Service.Add(TicksToMicro(Done - Sent));
+	}
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+//			ReadCaches() - reads the cache counters from the server status page. Returns false
+//			if there isn't one.
+//---------------------------------------------------------------------------------------------
+bool ReadCaches(map <string, unsigned __int64> *Hits, map <string, unsigned __int64> *Misses)
+{
+	string Page = ReadStatus();
+
+	// "cache":{"pack":{"hits":1,"misses":2},"listing":{"hits":3,"misses":4}}
+	int Cache = Page.find("\"cache\":{");
+	if (Cache < 0)
+		return false;
+	const char *P = Page.c_str() + Cache + 9;
+	for (;;)
+	{
+		char Name[64];
+		unsigned long H, M;
+		int Used = 0;
+		if (sscanf(P, "\"%63[^\"]\":{\"hits\":%lu,\"misses\":%lu}%n", Name, &H, &M, &Used) != 3 || !Used)
+			break;
+		(*Hits)[Name] = H;
+		(*Misses)[Name] = M;
+		P += Used;
+		if (*P != ',')
+			break;
+		P++;
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			ReplayLog() - replays the log and writes the results
+//---------------------------------------------------------------------------------------------
+int ReplayLog()
+{
+	if (Bench.Connections < 1 || Bench.Connections > BENCH_MAXCONNECTIONS || Bench.Speed < 0)
+	{
+		cout << "Need 1 to " << BENCH_MAXCONNECTIONS << " connections, and a speed of 0 or more" << endl;
+		return 1;
+	}
+	if (!ResolveServer() || !LoadLog(Bench.Log))
+		return 1;
+
+	// Only GET and HEAD can be sent again as they were
+	unsigned long Skipped = 0;
+	vector <REPLAYENTRY> Sendable;
+	int X;
+	for (X = 0; X < (int)Replay.size(); X++)
+	{
+		if (!strcmpi(Replay[X].Method.c_str(), "GET") || !strcmpi(Replay[X].Method.c_str(), "HEAD"))
+			Sendable.push_back(Replay[X]);
+		else Skipped++;
+	}
+	Replay.swap(Sendable);
+	if (Replay.empty())
+	{
+		cout << "No GET or HEAD requests in " << Bench.Log << endl;
+		return 1;
+	}
+
+	map <string, unsigned __int64> HitsBefore, MissesBefore, HitsAfter, MissesAfter;
+	bool HaveCaches = ReadCaches(&HitsBefore, &MissesBefore);
+
+	StartTicks = TicksNow() + Frequency / 10;					// Give the threads time to start
+	TOTALS Totals;
+	RunWorkers(ReplayThread, &Totals);
+	double Seconds = (double)(TicksNow() - StartTicks) / Frequency;
+
+	if (HaveCaches)
+		HaveCaches = ReadCaches(&HitsAfter, &MissesAfter);
+
+	FILE *Out = OpenResults();
+	if (!Out)
+		return 1;
+	fprintf(Out, "{\"replay\":\"%s\",\"entries\":%lu,\"skipped\":%lu,\"logged_seconds\":%.0f,\"speed\":%.2f,\"connections\":%d,\"seconds\":%.1f,\n",
+			Bench.Log.c_str(), (unsigned long)Replay.size(), Skipped, Replay.back().Offset, Bench.Speed, Bench.Connections, Seconds);
+	WriteTotals(Out, Totals, Seconds);
+	fprintf(Out, ",\n\"mismatched\":%lu", (unsigned long)Totals.Mismatched);
+	if (HaveCaches)
+	{
+		fprintf(Out, ",\n\"cache\":{");
+		map <string, unsigned __int64>::iterator It;
+		for (It = HitsAfter.begin(); It != HitsAfter.end(); It++)
+		{
+			unsigned __int64 Hits = It->second - HitsBefore[It->first];
+			unsigned __int64 Misses = MissesAfter[It->first] - MissesBefore[It->first];
+			fprintf(Out, "%s\"%s\":{\"hits\":%lu,\"misses\":%lu,\"hit_ratio\":%.3f}", It == HitsAfter.begin() ? "" : ",",
+					It->first.c_str(), (unsigned long)Hits, (unsigned long)Misses,
+					Hits + Misses ? (double)(__int64)Hits / (double)(__int64)(Hits + Misses) : 0.0);
+		}
+		fprintf(Out, "}");
+	}
+	fprintf(Out, "}\n");
+
+	if (Out != stdout)
+		fclose(Out);
+	return 0;
+}
+//---------------------------------------------------------------------------------------------
+//			Main
+//---------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	if (argc >= 2 && !strcmp(argv[1], "-cgi"))					// Being the CGI interpreter
+	{
+		printf("Content-type: text/html\n\n<html><body>SWSBench CGI stub</body></html>\n");
+		return 0;
+	}
+
+	if (argc >= 2 && !strcmp(argv[1], "list"))
+	{
+		for (int X = 0; Scenarios[X].Name; X++)
+			printf("%-12s %s\n", Scenarios[X].Name, Scenarios[X].Description);
+		return 0;
+	}
+
+	if (argc >= 3 && !strcmp(argv[1], "setup"))
+		return Setup(argv[2]);
+
+	if (argc >= 4 && !strcmp(argv[1], "replay-setup"))
+		return ReplaySetup(argv[2], argv[3]);
+
+	bool Replaying = (argc >= 3 && !strcmp(argv[1], "replay"));
+	if (argc < 3 || (strcmp(argv[1], "run") && !Replaying))
+	{
+		cout << "Usage: SWSBench setup <Webroot>" << endl;
+		cout << "       SWSBench list" << endl;
+		cout << "       SWSBench run <scenario> [-a address] [-p port] [-H host] [-c connections]" << endl;
+		cout << "                               [-r rate] [-d seconds] [-w seconds] [-o file] [-t full|resume]" << endl;
+		cout << "                               [-R seconds] [-n service] [-S status url]" << endl;
+		cout << "       SWSBench replay-setup <log> <Webroot>" << endl;
+		cout << "       SWSBench replay <log> [-a address] [-p port] [-H host] [-c connections]" << endl;
+		cout << "                             [-s speed] [-x prefix] [-S status url] [-o file] [-t full|resume]" << endl;
+		return 1;
+	}
+
+	if (Replaying) Bench.Log = argv[2];
+	else Bench.Scenario = argv[2];
+	Bench.Address = "127.0.0.1";
+	Bench.Port = 80;
+	Bench.Connections = 8;
+	Bench.Rate = 0;
+	Bench.Duration = 10;
+	Bench.Warmup = 2;
+	Bench.Speed = 1;
+	Bench.Prefix = "/replay";
+	Bench.StatusURL = "/server-status";
+	Bench.RotateEvery = 1;
+	Bench.Service = "SWS Web Server";
+	for (int A = 3; A + 1 < argc; A += 2)
+	{
+		if (!strcmp(argv[A], "-a"))			Bench.Address = argv[A + 1];
+		else if (!strcmp(argv[A], "-p"))	Bench.Port = atoi(argv[A + 1]);
+		else if (!strcmp(argv[A], "-H"))	Bench.Host = argv[A + 1];
+		else if (!strcmp(argv[A], "-c"))	Bench.Connections = atoi(argv[A + 1]);
+		else if (!strcmp(argv[A], "-r"))	Bench.Rate = atof(argv[A + 1]);
+		else if (!strcmp(argv[A], "-d"))	Bench.Duration = atof(argv[A + 1]);
+		else if (!strcmp(argv[A], "-w"))	Bench.Warmup = atof(argv[A + 1]);
+		else if (!strcmp(argv[A], "-o"))	Bench.Output = argv[A + 1];
+		else if (!strcmp(argv[A], "-s"))	Bench.Speed = atof(argv[A + 1]);
+		else if (!strcmp(argv[A], "-x"))	Bench.Prefix = argv[A + 1];
+		else if (!strcmp(argv[A], "-S"))	Bench.StatusURL = argv[A + 1];
+		else if (!strcmp(argv[A], "-t"))	Bench.Tls = argv[A + 1];
+		else if (!strcmp(argv[A], "-R"))	Bench.RotateEvery = atof(argv[A + 1]);
+		else if (!strcmp(argv[A], "-n"))	Bench.Service = argv[A + 1];
+	}
+	if (!Bench.Tls.empty() && Bench.Tls != "full" && Bench.Tls != "resume")
+	{
+		cout << "-t is full or resume" << endl;
+		return 1;
+	}
+	if (Bench.Tls == "resume" && !TLSCHANNEL::ClientCredentials(&SharedCredentials))
+	{
+		cout << "Could not get TLS credentials" << endl;
+		return 1;
+	}
+
+	WSADATA wsaData;
+	WSAStartup(MAKEWORD(1,1), &wsaData);
+	int Result = Replaying ? ReplayLog() : Run();
+	WSACleanup();
+	return Result;
+}
@@ -0,0 +1,466 @@
+#ifndef BUFFERHPP
+#define BUFFERHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			BUFFER.HPP
+			----------
+			SENDBUFFER collects output for a socket and sends it in large blocks, rather than
+			doing one send() for every little piece of a page. For example:
+
+				SENDBUFFER Out(SFD);
+				Out.Write("<td>");
+				Out.WriteHTML(FileName);						// Escapes < > & "
+				Out.WriteNumber(FileSize);
+				Out.Flush();									// Sends whatever is left
+
+			Nothing is sent until the buffer fills up or Flush() is called, so remember to
+			Flush() at the end. Output for an HTTPS connection goes through its TLS session
+			instead, with Out.Through(Tls.Write, Session). RESPONSEWRITER (response.hpp)
+			is a SENDBUFFER that frames what it sends as an HTTP response.
+
+			IOBuffers is a pool of page aligned buffers in a few fixed sizes, for anything
+			that reads or sends in bulk. Use it rather than a char array on the stack:
+
+				IOBUFFER *Block = IOBuffers.Get(IOBUFFER_BULK);	// 64KB, or NULL
+				...
+				IOBuffers.Put(Block);
+
+			A buffer belongs to whoever got it until it is Put() back, which can be on
+			another thread, so one can be lent to an overlapped read or write and given back
+			when it finishes. The pool is sharded like the statistics (see shard.hpp), and
+			each shard keeps only a few spare buffers of each size. The rest go back to the
+			system, so the memory it holds stays bounded.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <string.h>
+#include <string>
+#include "shard.hpp"
+
+using namespace std;
+
+typedef int (*SENDFUNCTION)(void *Context, const char *Data, int Length);	// Sends it all, or returns how much it did
+
+#define SENDBUFFER_SIZE						65536					// Default size of a send buffer
+
+#define IOBUFFER_CLASSES					4						// Sizes of pooled buffer
+#define IOBUFFER_REQUEST					16384					// Enough for a request's headers
+#define IOBUFFER_BULK						65536					// For reading and sending files
+
+static const DWORD IOBufferSizes[IOBUFFER_CLASSES] = { 4096, 16384, 65536, 262144 };
+static const int IOBufferKeep[IOBUFFER_CLASSES] = { 8, 8, 4, 1 };	// Spares each shard keeps
+
+//----------------------------------------------------------------------------------------------------
+//			FormatNumber() - writes Number into Out (at least 21 chars) and returns its length.
+//			Much cheaper than IntToString(), which goes through an ostringstream.
+//----------------------------------------------------------------------------------------------------
+int FormatNumber(unsigned __int64 Number, char *Out)
+{
+	char Digits[21];
+	int Length = 0;
+	do
+	{
+		Digits[Length++] = '0' + (char)(Number % 10);
+		Number /= 10;
+	} while (Number);
+
+	for (int X = 0; X < Length; X++)							// They come out backwards
+		Out[X] = Digits[Length - 1 - X];
+	Out[Length] = '\0';
+	return Length;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			DecodeURL() - undoes what SENDBUFFER::WriteURL() does, in place, up to the first '\0'.
+//			False for a %00, or a % without two hex digits after it.
+//----------------------------------------------------------------------------------------------------
+int HexValue(char C)
+{
+	if (C >= '0' && C <= '9')	return C - '0';
+	if (C >= 'a' && C <= 'f')	return C - 'a' + 10;
+	if (C >= 'A' && C <= 'F')	return C - 'A' + 10;
+	return -1;
+}
+
+bool DecodeURL(string &Text)
+{
+	int To = 0;
+	int From = 0;
+	int Length = Text.length();
+	while (From < Length && Text[From] != '\0')
+	{
+		if (Text[From] != '%')
+		{
+			Text[To++] = Text[From++];
+			continue;
+		}
+		int High = From + 2 < Length ? HexValue(Text[From + 1]) : -1;
+		int Low = High >= 0 ? HexValue(Text[From + 2]) : -1;
+		if (Low < 0 || (!High && !Low))
+			return false;
+		Text[To++] = (char)(High * 16 + Low);
+		From += 3;
+	}
+	Text.erase(To, From - To);									// Anything after a '\0' stays
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Buffer pool
+//----------------------------------------------------------------------------------------------------
+struct IOBUFFER
+{
+	char *Data;													// The buffer, from VirtualAlloc() so it is page aligned
+	DWORD Size;													// Size of Data
+	DWORD Used;													// Bytes of Data in use, for whoever has it
+	int Class;													// Which of IOBufferSizes it is
+	IOBUFFER *Next;												// Next spare in the shard
+};
+
+struct BUFFERSHARD
+{
+	volatile LONG Lock;											// Spin lock, 1 while someone is using the shard
+	IOBUFFER *Spare[IOBUFFER_CLASSES];							// Spare buffers of each size
+	int Spares[IOBUFFER_CLASSES];								// How many
+	char Padding[64];											// Keeps the next shard off this one's cache line
+};
+
+class BUFFERPOOL
+{
+  public:
+	BUFFERPOOL();												// Constructor
+	~BUFFERPOOL();												// Destructor
+
+	IOBUFFER *Get(DWORD Size);									// A buffer of at least Size (or the biggest), or NULL
+	void Put(IOBUFFER *Buffer);									// Gives a buffer back
+
+	volatile LONG Allocated;									// Bytes taken from the system
+	volatile LONG Lent;											// Buffers that have not been given back
+
+  private:
+	void Free(IOBUFFER *Buffer);								// Gives a buffer back to the system
+
+	BUFFERSHARD Shards[SHARD_COUNT];
+}IOBuffers;
+
+BUFFERPOOL::BUFFERPOOL()
+{
+	memset(Shards, 0, sizeof(Shards));
+	Allocated = Lent = 0;
+}
+
+BUFFERPOOL::~BUFFERPOOL()
+{
+	for (int S = 0; S < SHARD_COUNT; S++)
+	{
+		for (int C = 0; C < IOBUFFER_CLASSES; C++)
+		{
+			while (Shards[S].Spare[C])
+			{
+				IOBUFFER *Buffer = Shards[S].Spare[C];
+				Shards[S].Spare[C] = Buffer->Next;
+				Free(Buffer);
+			}
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			BUFFERPOOL::Get() - a spare from this thread's shard, or a new one
+//----------------------------------------------------------------------------------------------------
+IOBUFFER *BUFFERPOOL::Get(DWORD Size)
+{
+	int Class = 0;
+	while (Class < IOBUFFER_CLASSES - 1 && IOBufferSizes[Class] < Size)
+		Class++;
+
+	BUFFERSHARD *Shard = &Shards[ShardNumber()];
+	LockShard(&Shard->Lock);
+	IOBUFFER *Buffer = Shard->Spare[Class];
+	if (Buffer)
+	{
+		Shard->Spare[Class] = Buffer->Next;
+		Shard->Spares[Class]--;
+	}
+	UnlockShard(&Shard->Lock);
+
+	if (!Buffer)
+	{
+		Buffer = new IOBUFFER;
+		Buffer->Data = (char *)VirtualAlloc(NULL, IOBufferSizes[Class], MEM_COMMIT, PAGE_READWRITE);
+		if (!Buffer->Data)
+		{
+			delete Buffer;
+			return NULL;
+		}
+		Buffer->Size = IOBufferSizes[Class];
+		Buffer->Class = Class;
+		InterlockedExchangeAdd((LONG *)&Allocated, Buffer->Size);
+	}
+	Buffer->Used = 0;
+	Buffer->Next = NULL;
+	InterlockedIncrement(&Lent);
+	return Buffer;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			BUFFERPOOL::Put() - keeps the buffer as a spare, unless the shard has enough
+//----------------------------------------------------------------------------------------------------
+void BUFFERPOOL::Put(IOBUFFER *Buffer)
+{
+	if (!Buffer)
+		return;
+	InterlockedDecrement(&Lent);
+
+	BUFFERSHARD *Shard = &Shards[ShardNumber()];
+	LockShard(&Shard->Lock);
+	if (Shard->Spares[Buffer->Class] < IOBufferKeep[Buffer->Class])
+	{
+		Buffer->Next = Shard->Spare[Buffer->Class];
+		Shard->Spare[Buffer->Class] = Buffer;
+		Shard->Spares[Buffer->Class]++;
+		Buffer = NULL;
+	}
+	UnlockShard(&Shard->Lock);
+
+	if (Buffer)
+		Free(Buffer);
+}
+
+void BUFFERPOOL::Free(IOBUFFER *Buffer)
+{
+	InterlockedExchangeAdd((LONG *)&Allocated, -(LONG)Buffer->Size);
+	VirtualFree(Buffer->Data, 0, MEM_RELEASE);
+	delete Buffer;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Send buffer class
+//----------------------------------------------------------------------------------------------------
+class SENDBUFFER
+{
+  public:
+	SENDBUFFER(int SFD_SET, int Size = SENDBUFFER_SIZE, int Room = 0);	// Constructor. Room is kept free either side of the buffer
+	virtual ~SENDBUFFER();										// Destructor. Does NOT flush
+
+	bool Write(const char *Data, int Length);					// Adds some data
+	bool Write(const char *Text);								// Adds a string
+	bool Write(const string &Text);								// Adds a string
+	bool WriteNumber(unsigned __int64 Number);					// Adds a number as text
+	bool WriteHTML(const char *Text);							// Adds text, escaped for HTML
+	bool WriteURL(const char *Text);							// Adds text, escaped for a URL path
+	bool WriteJSON(const char *Text);							// Adds text, escaped for a JSON string
+	bool Flush();												// Sends everything in the buffer
+	void Through(SENDFUNCTION Function, void *Context);			// Sends with Function rather than send()
+
+	unsigned __int64 BytesSent;									// Total bytes sent so far
+	bool Failed;												// Did a send() fail
+
+  protected:
+	virtual int Send(const char *Data, int Length);				// One send(), or all of it through Sender
+
+	char *Buffer;												// Block->Data, after Room
+	int Room;													// Bytes free before and after Buffer
+	int Used;													// Bytes in the buffer
+
+  private:
+	bool Put(char C);											// Adds one character
+
+	int SFD;													// Socket to send to
+	SENDFUNCTION Sender;										// Or what to send with, if not NULL
+	void *SenderContext;
+	IOBUFFER *Block;											// The buffer, from IOBuffers
+	int Capacity;												// Size of the buffer
+};
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::SENDBUFFER
+//----------------------------------------------------------------------------------------------------
+SENDBUFFER::SENDBUFFER(int SFD_SET, int Size, int Room_SET)
+{
+	SFD = SFD_SET;
+	Room = Room_SET;
+	Block = IOBuffers.Get(Size);								// Room comes out of Size, so it stays in its class
+	Buffer = Block ? Block->Data + Room : NULL;
+	Capacity = Block ? Block->Size - 2 * Room : 0;				// With no buffer, everything is sent as it comes
+	Used = 0;
+	BytesSent = 0;
+	Failed = false;
+	Sender = NULL;
+	SenderContext = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::~SENDBUFFER
+//----------------------------------------------------------------------------------------------------
+SENDBUFFER::~SENDBUFFER()
+{
+	IOBuffers.Put(Block);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::Flush()
+//----------------------------------------------------------------------------------------------------
+bool SENDBUFFER::Flush()
+{
+	int Sent = 0;
+	while (Sent < Used && !Failed)
+	{
+		int Y = Send(Buffer + Sent, Used - Sent);
+		if (Y <= 0)
+			Failed = true;										// Client has gone, stop sending
+		else
+			Sent += Y;
+	}
+	BytesSent += Sent;
+	Used = 0;
+	return !Failed;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::Through() and SENDBUFFER::Send()
+//----------------------------------------------------------------------------------------------------
+void SENDBUFFER::Through(SENDFUNCTION Function, void *Context)
+{
+	Sender = Function;
+	SenderContext = Context;
+}
+
+int SENDBUFFER::Send(const char *Data, int Length)
+{
+	if (Sender)
+		return Sender(SenderContext, Data, Length);
+	return send(SFD, Data, Length, 0);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::Write()
+//----------------------------------------------------------------------------------------------------
+bool SENDBUFFER::Write(const char *Data, int Length)
+{
+	if (Used + Length > Capacity)
+	{
+		if (!Flush())
+			return false;
+		if (Length > Capacity)									// Too big to buffer, send it as it is
+		{
+			int Sent = 0;
+			while (Sent < Length)
+			{
+				int Y = Send(Data + Sent, Length - Sent);
+				if (Y <= 0)
+				{
+					Failed = true;
+					break;
+				}
+				Sent += Y;
+			}
+			BytesSent += Sent;
+			return !Failed;
+		}
+	}
+	memcpy(Buffer + Used, Data, Length);
+	Used += Length;
+	return true;
+}
+
+bool SENDBUFFER::Write(const char *Text)
+{
+	return Write(Text, strlen(Text));
+}
+
+bool SENDBUFFER::Write(const string &Text)
+{
+	return Write(Text.c_str(), Text.length());
+}
+
+bool SENDBUFFER::Put(char C)
+{
+	if (!Capacity)												// No buffer to put it in
+		return Write(&C, 1);
+	if (Used == Capacity && !Flush())
+		return false;
+	Buffer[Used++] = C;
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::WriteNumber()
+//----------------------------------------------------------------------------------------------------
+bool SENDBUFFER::WriteNumber(unsigned __int64 Number)
+{
+	char Text[21];
+	int Length = FormatNumber(Number, Text);
+	return Write(Text, Length);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::WriteHTML()
+//----------------------------------------------------------------------------------------------------
+bool SENDBUFFER::WriteHTML(const char *Text)
+{
+	for (; *Text; Text++)
+	{
+		switch (*Text)
+		{
+		case '<':	Write("&lt;", 4);	break;
+		case '>':	Write("&gt;", 4);	break;
+		case '&':	Write("&amp;", 5);	break;
+		case '"':	Write("&quot;", 6);	break;
+		default:	Put(*Text);			break;
+		}
+	}
+	return !Failed;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::WriteURL()
+//----------------------------------------------------------------------------------------------------
+bool SENDBUFFER::WriteURL(const char *Text)
+{
+	static const char Hex[] = "0123456789ABCDEF";
+	for (; *Text; Text++)
+	{
+		unsigned char C = *Text;
+		if ((C >= 'a' && C <= 'z') || (C >= 'A' && C <= 'Z') || (C >= '0' && C <= '9')
+			|| strchr("-_.~/!$'()*,;:@", C))
+		{
+			Put(C);
+		}
+		else
+		{
+			Put('%');
+			Put(Hex[C >> 4]);
+			Put(Hex[C & 15]);
+		}
+	}
+	return !Failed;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			SENDBUFFER::WriteJSON()
+//----------------------------------------------------------------------------------------------------
+bool SENDBUFFER::WriteJSON(const char *Text)
+{
+	static const char Hex[] = "0123456789abcdef";
+	for (; *Text; Text++)
+	{
+		unsigned char C = *Text;
+		if (C == '"' || C == '\\')
+		{
+			Put('\\');
+			Put(C);
+		}
+		else if (C < 0x20)
+		{
+			Write("\\u00", 4);
+			Put(Hex[C >> 4]);
+			Put(Hex[C & 15]);
+		}
+		else Put(C);
+	}
+	return !Failed;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -31,6 +31,31 @@
 
 			Would list the windows directory. The same theory would work for all directories,
 			thus giving full access to a system. 
+
+			Update:
+			Connections are no longer new'd and deleted for every request. ConnectionPool
+			keeps used ones, with their strings already grown and their arena allocated,
+			and Reset() makes them as good as new:
+
+				CONNECTION * NewRequest = ConnectionPool.Get(SFD, CLA);
+				...
+				ConnectionPool.Put(NewRequest);
+
+			Update:
+			Responses say where they end (see response.hpp), so the client can send
+			another request on the same connection. Next() gets it ready for one:
+
+				do
+				{
+					NewRequest->ReadRequest();
+					...
+				} while (NewRequest->Next());
+
+			Update:
+			Binary files are opened for sequential reading, so Windows reads ahead of
+			us. Files of <ReadAhead> KB (1024) or more also have their next piece read
+			overlapped while the last one is being sent, so a cold disk and the client
+			aren't waiting on each other in turn. 0 turns that off.
 */
 //---------------------------------------------------------------------------------------------
 #include <windows.h>
@@ -43,6 +68,21 @@
 #include <stdio.h>
 #include <ctime>
 #include "options.hpp"											// Contains definitions of the VHI (Virtual Host Index)
+#include "httpdate.hpp"											// The server clock and HTTP date parser
+#include "assetpack.hpp"										// Memory mapped asset packs
+#include "buffer.hpp"											// Buffered socket output
+#include "response.hpp"											// Framing responses
+#include "listing.hpp"											// Cached folder listings
+#include "accesslog.hpp"										// The access log
+#include "metrics.hpp"											// Server statistics and the status page
+#include "arena.hpp"											// Memory for the length of a request
+#include "timers.hpp"											// Connection deadlines
+#include "ratelimit.hpp"										// Limits for each client
+#include "pacing.hpp"											// Bandwidth caps
+#include "proxy.hpp"											// Reverse proxy routes and upstream connections
+#include "respcache.hpp"										// Cached CGI and proxied replies
+#include "tls.hpp"												// HTTPS
+#include "http2.hpp"											// HTTP/2 streams
 
 using namespace std;
 #pragma comment(lib, "wsock32.lib")								// Link with winsock32
@@ -55,7 +95,91 @@ using namespace std;
 
 
 #define FILE_INVALID						4294967295
-int CGICounter = 0;												// Counter for every CGI script processed
+volatile LONG CGIPipes = 0;										// Counter for the pipes StartCGI() names
+
+#define POOL_PERSHARD						8						// Connections each pool shard keeps
+
+#define REQUEST_HEADERS						0						// What RequestState() says is still coming
+#define REQUEST_BODY						1
+#define REQUEST_COMPLETE					2
+
+//---------------------------------------------------------------------------------------------
+//			RequestState() - how much of a request has arrived. Once the headers are all
+//			there, the body is complete when it is as long as their Content-Length. Whole is
+//			set to the request's length once it's complete, anything after it is the next.
+//---------------------------------------------------------------------------------------------
+int RequestState(const char *Request, int Length, int *Whole = NULL)
+{
+	const char *End = strstr(Request, "\r\n\r\n");
+	int Blank = 4;
+	const char *Bare = strstr(Request, "\n\n");
+	if (Bare && (!End || Bare < End))
+	{
+		End = Bare;
+		Blank = 2;
+	}
+	if (!End)
+		return REQUEST_HEADERS;
+
+	long Expected = 0;
+	const char *Line = Request;
+	while (Line && Line < End)
+	{
+		if (!strnicmp(Line, "Content-Length:", 15))
+		{
+			Expected = atol(Line + 15);
+			break;
+		}
+		Line = strchr(Line, '\n');
+		if (Line)
+			Line++;
+	}
+	if (Request + Length - (End + Blank) < Expected)
+		return REQUEST_BODY;
+	if (Whole)
+		*Whole = End + Blank - Request + Expected;
+	return REQUEST_COMPLETE;
+}
+
+//---------------------------------------------------------------------------------------------
+//			WORDREADER - splits the request into words, like an istringstream does, but
+//			reading the request where it is rather than copying it
+//---------------------------------------------------------------------------------------------
+struct WORDREADER
+{
+	WORDREADER(const char *Text, int Length) : Next(Text), End(Text + Length), Failed(false) {}
+
+	WORDREADER &operator>>(string &Word)
+	{
+		while (Next < End && (*Next == ' ' || *Next == '\t' || *Next == '\r' || *Next == '\n'))
+			Next++;
+		const char *Start = Next;
+		while (Next < End && *Next != ' ' && *Next != '\t' && *Next != '\r' && *Next != '\n')
+			Next++;
+		if (Next == Start)
+		{
+			Failed = true;										// Nothing left
+			Word.erase();
+		}
+		else Word.assign(Start, Next - Start);					// Reuses Word's memory if it can
+		return *this;
+	}
+	operator void *() const { return Failed ? NULL : (void *)this; }
+
+	const char *Next;
+	const char *End;
+	bool Failed;
+};
+
+//---------------------------------------------------------------------------------------------
+//			ACCEPTTYPE - one of the MIME types the client accepts. They are kept in the
+//			connection's arena.
+//---------------------------------------------------------------------------------------------
+struct ACCEPTTYPE
+{
+	const char *Type;
+	ACCEPTTYPE *Next;
+};
 
 //---------------------------------------------------------------------------------------------
 //			Connection class
@@ -64,20 +188,59 @@ class CONNECTION
 {
   public:
 	CONNECTION(int SFD_SET, struct sockaddr_in);				// Constructor
+	void Reset(int SFD_SET, struct sockaddr_in);				// Makes a used connection ready for another request
+	bool Accepts(const char *Type);								// Does the client accept that MIME type
 	bool LogConnection();										// Logs connection to the appropriate log
-	bool ReadRequest();											// Reads the request and sets values
+	void CountRequest();										// Adds the request to the server statistics and stage times
+	bool StartTLS();											// The TLS handshake, for a connection to the secure port
+	bool ReadRequest(bool *Admitted = NULL);					// Reads the request and sets values
+	bool RequestReceived(const char *Request);					// Sets values from a request that has been read
+	int Split(char *Request, int Length);						// Keeps what came after the request for the next one
+	bool ParseRequest(const char *Request);						// Breaks up the request text (ReadRequest() calls it)
 	bool HandleRequest();										// Handles the request
+	bool Preface(const char *Data, int Length);					// Is what was read HTTP/2's preface, kept for ServeHTTP2() if so
+	bool ServeHTTP2();											// If ReadRequest() found HTTP/2's preface, serves the connection
+	void StartStream(H2STREAM *HTTP2Stream);					// Takes its request from an HTTP/2 stream instead
+	bool Gone();												// Did the client close a kept connection rather than send another request
+	bool Next();												// Gets ready for the next request, false if the connection has to close
 
   private:
 	// Methods
+	bool LocateFile();											// Works out what the request is for
 	bool SetFileType();											// Sets if the file is a script or binary
 	bool IndexFolder();											// Indexes the folder by listing all the files
 	bool SendText();											// Sends the requested file if it is text
 	bool SendCGI();												// Sends the requested file if it is a script
+	bool StartCGI();											// Starts the script with its output in CGIOutput
+	string CGIEnvironment();									// The script's environment block
+	__int64 SendCGIHeaders(const char *Script, int Length);		// Our headers for the output StartCGI() leaves, with the script's
+	__int64 ScriptHeaders(const char *Data, int Length, string &Kept, string &Reason);
+																// Sorts out the headers a script wrote
+	void EndCGI();												// Closes what StartCGI() opened
 	bool SendBinary();											// Sends the requested file if it is binary
+	static bool ReadAt(HANDLE File, char *Into, DWORD Length, unsigned __int64 Offset, OVERLAPPED *Reading);
+																// Starts an overlapped read for SendBinary()
 	bool SendError();											// Outputs the appropriate error code
-	bool LogText(string);										// Logs some text. Used only for testing
-	string CalculateSize();										// Outputs the file size
+	bool SendNotModified();										// The 304, headers only
+	bool SendPacked();											// Sends the requested file from the asset pack
+	bool SendStatus();											// Sends the server status page
+	bool SendProxied();											// Passes the request on to an upstream and sends its reply
+	bool CacheLookup();											// Answers it from the response cache, true if that's all
+	void Capture(const char *Data, int Length);					// Keeps what's sent for CacheFill
+	void EndCache(int How);										// Hands what was captured to the response cache
+	void EndTLS();												// Closes the TLS session, if there is one
+	bool LogText(string);										// Logs some text to the text log
+	bool ReadText(const char *FileName, string &Text);			// Adds a text file to Text
+	int Send(const char *Data, int Length);						// Sends data to the client and counts it
+	static int Deliver(void *Connection, const char *Data, int Length);	// Send(), as a SENDFUNCTION
+	void StartResponse(RESPONSEWRITER &Out, const char *Reason, const char *ContentType);	// The usual headers
+	const char *Persistence();									// The Connection: header to send, if any
+	void BuildHeaders(const char *ContentType, const char *Length);	// Puts the usual response headers in Headers
+	void Mark(int Stage);										// Ends a stage, the time since the last Mark() goes to it
+	void Arm(int Kind);											// Starts the deadline for a TIMEOUT_ phase
+	static void DeadlinePassed(TIMER *Timer);					// Deadline.Expired, closes the socket
+	void CalculateSize(char *Out);								// Writes the file size into Out (21 chars)
+	void ReadDate(WORDREADER &IS, string &Word, string &Out);	// Reads the rest of a date that starts with Word
 	bool ModifiedSince(string Date);							// Was the file modifed since...
 	bool UnModifiedSince(string Date);							// Is the file Unmodified since...
 
@@ -87,6 +250,7 @@ class CONNECTION
 	VIRTUALHOST *ThisHost;										// This virtual host host
 
 	string FullRequest;											// The entire input from the client
+	string RequestLine;											// First line of the request, for the log
 	string RequestType;											// Type of request (POST, GET etc)
 	string FileRequested;										// String folling GET
 	  string QueryString;										// Anything after the '?' in the file
@@ -97,30 +261,82 @@ class CONNECTION
 	string PostData;											// Data supplied AFTER the double newline, for post requests
 
 	string Headers;												// Headers to be sent with the file
-	map <string, bool> Accepts;									// MIME types the client accepts
+	ACCEPTTYPE *AcceptTypes;									// MIME types the client accepts
 	string UserAgent;											// Browser used by the user
 	string HostRequested;										// Host: from browser
 	string From;												// From: value (email address normally)
+	string Referer;												// Referer: page the link was on
 	string Connection;											// Connection: type (keep alive normally)
+	string IfNoneMatch;											// If-None-Match: ETag
+	bool AcceptGzip;											// Accept-Encoding: included gzip
 
-	string Date;												// Date/time of this request
+	char Date[HTTPDATE_LENGTH + 1];								// Date/time of this request
 	string ModifiedSinceStr;										// IfModifiedSince string
 	string UnModifiedSinceStr;										// IfUnModifiedSince string
 	bool UseModDate;											// Do we use an If-Modified-Since
 	bool UseUnModDate;											// Do we use the If-Unmodified-Since
 
 	int Status;													// Status code for request (404, 200 etc)
+	unsigned __int64 BytesSent;									// Bytes sent to the client, for the log
 	bool UseVH;													// Does the connection use a virtual host or a real one
 	bool IsFolder;												// Is the file requested a folder or a file
 	bool IsBinary;												// Is the file binary?
 	bool IsScript;												// Is the file a script
 	bool IsAbsolute;											// Did the client use an absolute address
+	const PACKENTRY *PackEntry;									// Entry in the virtual host's asset pack, or NULL
+	bool IsStatusPage;											// Was Options.StatusURL asked for
+	PROXY *Proxy;												// Route to an upstream server, or NULL
+	CACHEENTRY *CacheFill;										// Response cache entry the reply goes to, or NULL
+	string CacheKey;											// Its key
+	string Captured;											// What has been sent for it so far
+	bool Quiet;													// The client has a stale copy, only the cache gets it
+	bool Authorized;											// The request had Authorization:, so its reply may be the user's alone
+	TLSSESSION Session;											// HTTPS, once StartTLS() has done the handshake
+	TLSSESSION *Secure;											// &Session for HTTPS, or NULL
+	H2STREAM *Stream;											// The HTTP/2 stream the request came on, or NULL
+	bool Multiplexed;											// ReadRequest() found HTTP/2's preface
+	bool KeepAlive;												// Can the connection carry another request after this one
+	int Served;													// Requests answered on the connection before this one
+	string Pending;												// What arrived after the request, the start of the next
+	bool ClientGone;											// The client closed a kept connection
+
+	ARENA Arena;												// Memory that lasts until Reset()
+	string ParseWord;											// ParseRequest()'s word, kept so its memory is too
+
+	bool Transmit;												// The engine sends binary files and CGI output itself
+	HANDLE TransmitHandle;										// The file HandleRequest() left for the engine to send
+	PACE Pace;													// Bandwidth caps for binary files
+	HANDLE CGIOutput;											// The pipe StartCGI() left for the engine to read
+	HANDLE CGIProcess;											// The script writing to it
+	TIMER Deadline;												// Goes off if the client takes too long
+
+	friend class MICROBENCH;									// micro.cpp times the private parts
+	friend class IOCPENGINE;									// iocp.hpp sends files and CGI output
+	friend class CONNECTIONPOOL;								// Cancels the deadline, any cache fill and TLS
+
+	__int64 Arrived;											// Latency.Now() when we started reading the request
+	__int64 LastMark;											// Latency.Now() at the last Mark()
+	__int64 StageTicks[LATENCY_STAGES];							// Time spent in each stage
+	DWORD StagesUsed;											// A bit for each stage that happened
 };
 
 //---------------------------------------------------------------------------------------------
 //			Connection::CONNECTION
 //---------------------------------------------------------------------------------------------
 CONNECTION::CONNECTION(int SFD_SET, struct sockaddr_in CA)
+{
+	memset(&Deadline, 0, sizeof(Deadline));
+	Deadline.Expired = DeadlinePassed;
+	Deadline.Owner = this;
+	Reset(SFD_SET, CA);
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Reset
+//			Sets everything up for a new request. Strings are erased rather than replaced, so
+//			they keep the memory they grew into on earlier requests.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::Reset(int SFD_SET, struct sockaddr_in CA)
 {
 	//-----------------------------------------------------------------------------------------
 	//			Change settings
@@ -133,6 +349,101 @@ CONNECTION::CONNECTION(int SFD_SET, struct sockaddr_in CA)
 	IsScript = false;											// Or a CGI script
 	IsAbsolute = false;											// And the URL is not an absolute URL
 	Status = 200;												// But the file is always served fine
+	UseModDate = false;											// No If-Modified-Since until we read one
+	UseUnModDate = false;										// Same for If-Unmodified-Since
+	AcceptGzip = false;											// Nor can we assume they take gzip
+	Authorized = false;											// Or that they've said who they are
+	ThisHost = NULL;											// No virtual host yet
+	PackEntry = NULL;											// Not found in an asset pack yet
+	BytesSent = 0;												// Nothing sent yet
+	IsStatusPage = false;										// Nor is it the status page
+	Proxy = NULL;												// Nor is it for another server
+	CacheFill = NULL;											// Nothing to cache yet
+	Secure = NULL;												// Plain HTTP unless StartTLS() says
+	Stream = NULL;												// Or it comes on an HTTP/2 stream
+	Multiplexed = false;
+	KeepAlive = false;											// Closed after the response, unless the request says
+	Served = 0;
+	ClientGone = false;
+	Quiet = false;
+	Arrived = LastMark = Latency.Now();							// Start the stage timer
+	memset(StageTicks, 0, sizeof(StageTicks));
+	StagesUsed = 0;
+
+	//-----------------------------------------------------------------------------------------
+	//			Forget the last request
+	//-----------------------------------------------------------------------------------------
+	FullRequest.erase();
+	RequestLine.erase();
+	RequestType.erase();
+	FileRequested.erase();
+	QueryString.erase();
+	Extension.erase();
+	RealFile.erase();
+	RealFileDate.erase();
+	HTTPVersion.erase();
+	PostData.erase();
+	Headers.erase();
+	UserAgent.erase();
+	HostRequested.erase();
+	From.erase();
+	Referer.erase();
+	Connection.erase();
+	IfNoneMatch.erase();
+	CacheKey.erase();
+	Captured.erase();
+	ModifiedSinceStr.erase();
+	UnModifiedSinceStr.erase();
+	Pending.erase();
+	Date[0] = '\0';
+	AcceptTypes = NULL;											// They were in the arena
+	Arena.Reset();
+	Transmit = false;											// Send files ourselves unless the engine says
+	TransmitHandle = INVALID_HANDLE_VALUE;
+	CGIOutput = INVALID_HANDLE_VALUE;
+	CGIProcess = NULL;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Next
+//			Reset() for the next request on the same connection, if the response left it open.
+//			The TLS session, the engine's say and anything pipelined are kept.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::Next()
+{
+	if (!KeepAlive || Stream)
+		return false;
+	EndCache(CACHE_ABANDON);									// If it stopped before it got all of it
+
+	TLSSESSION *WasSecure = Secure;
+	bool WasTransmit = Transmit;
+	int WasServed = Served + 1;
+	string Left;
+	Left.swap(Pending);
+	Reset(SFD, ClientAddress);
+	Secure = WasSecure;
+	Transmit = WasTransmit;
+	Served = WasServed;
+	Pending.swap(Left);
+	return true;
+}
+
+bool CONNECTION::Gone()
+{
+	return ClientGone;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Accepts
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::Accepts(const char *Type)
+{
+	for (ACCEPTTYPE *A = AcceptTypes; A; A = A->Next)
+	{
+		if (!strcmpi(A->Type, Type))
+			return true;
+	}
+	return false;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -169,20 +480,196 @@ bool CONNECTION::SetFileType()
 	return 0;
 }
 
+//---------------------------------------------------------------------------------------------
+//			Connection::StartTLS() and Connection::EndTLS()
+//			The handshake has as long as the request's headers would.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::StartTLS()
+{
+	Arm(TIMEOUT_HEADER);
+	if (!Tls.Accept(&Session, SFD))
+		return false;
+	Secure = &Session;
+	return true;
+}
+
+void CONNECTION::EndTLS()
+{
+	if (!Secure)
+		return;
+	Tls.End(Secure);											// close_notify, before the socket is closed
+	Secure = NULL;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Preface(), Connection::ServeHTTP2() and Connection::StartStream()
+//			An HTTP/2 connection is read by its own thread in Http2.Serve(), and each stream's
+//			request is given to a connection of its own (see ProcessStream() in main.cpp).
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::Preface(const char *Data, int Length)
+{
+	if (Options.Http2 <= 0 || !HTTP2::Preface(Data, Length))
+		return false;
+	FullRequest.assign(Data, Length);							// Serve() carries on from here
+	Multiplexed = true;
+	return true;
+}
+
+bool CONNECTION::ServeHTTP2()
+{
+	if (!Multiplexed)
+		return false;
+	Admission.Leave();											// Each stream takes a slot of its own
+	Http2.Serve(SFD, Secure, ClientAddress, &Deadline, FullRequest);
+	EndTLS();
+	return true;
+}
+
+void CONNECTION::StartStream(H2STREAM *HTTP2Stream)
+{
+	Stream = HTTP2Stream;
+	Arrived = LastMark = Latency.Now();
+}
+
 //---------------------------------------------------------------------------------------------
 //			Connection::ReadRequest
+//			If Admitted is given, a kept connection gives its Admission slot up while it waits
+//			for the next request, and gets back in line for one when it starts to arrive.
+//			*Admitted says whether it holds one. If it's shed the client is told, and Gone().
 //---------------------------------------------------------------------------------------------
-bool CONNECTION::ReadRequest()
+bool CONNECTION::ReadRequest(bool *Admitted)
 {
 	//-----------------------------------------------------------------------------------------
 	//			Set request variables
 	//-----------------------------------------------------------------------------------------
 	// First, read in the whole request
-	char Buffer[10000];
-	recv(SFD, Buffer, 10000, 0);
-	
-	string Word;												// Temporary place to store each word
-	FullRequest = Buffer;
+	Arrived = LastMark = Latency.Now();
+	IOBUFFER *In = IOBuffers.Get(IOBUFFER_REQUEST);
+	if (!In)
+	{
+		Status = 500;											// Out of memory
+		return false;
+	}
+	// Read until it's all there. The client gets Options.Timeout to start, and then each
+	//  part has its own deadline, rather than each recv(), so it can't be sent a byte at a time.
+	//  A kept connection starts with whatever came after the last request.
+	int Received = Pending.length();
+	memcpy(In->Data, Pending.data(), Received);
+	In->Data[Received] = '\0';
+	Pending.erase();
+	int State = Received ? RequestState(In->Data, Received) : REQUEST_HEADERS;
+	Arm(Received ? TIMEOUT_HEADER : Served ? TIMEOUT_KEEPALIVE : TIMEOUT_IDLE);
+	bool Idle = Admitted && *Admitted && Served && !Received;
+	if (Idle)
+	{
+		*Admitted = false;										// Nothing to do until the client says something,
+		Admission.Leave();										//  so someone else can have the slot meanwhile
+	}
+	while (State != REQUEST_COMPLETE && Received < In->Size - 1)
+	{
+		int Got = Secure ? Tls.Recv(Secure, In->Data + Received, In->Size - 1 - Received)
+						 : recv(SFD, In->Data + Received, In->Size - 1 - Received, 0);
+		if (Got <= 0)
+			break;												// Gone, or the deadline closed it
+		if (Idle)
+		{
+			Idle = false;
+			Timers.Cancel(&Deadline);							// Its wait in line isn't the client's
+			if (!Admission.Return())
+			{
+				if (!Secure)
+					Admission.SendShed(SFD);					// The 503 is plain text
+				ClientGone = true;
+				IOBuffers.Put(In);
+				return false;
+			}
+			*Admitted = true;
+		}
+		if (!Received)
+		{
+			Arm(TIMEOUT_HEADER);
+			if (Served)
+				Arrived = LastMark = Latency.Now();				// Waiting for it isn't part of it
+		}
+		Received += Got;
+		In->Data[Received] = '\0';								// recv() does not terminate it for us
+
+		int Was = State;
+		State = RequestState(In->Data, Received);
+		if (State == REQUEST_BODY && Was != REQUEST_BODY)
+			Arm(TIMEOUT_BODY);
+	}
+	In->Data[Received] = '\0';
+	if (!Received && Served)
+	{
+		ClientGone = true;										// It's done with the connection
+		IOBuffers.Put(In);
+		return false;
+	}
+	if (Preface(In->Data, Received))
+	{
+		IOBuffers.Put(In);
+		return false;
+	}
+	Split(In->Data, Received);
+	bool Result = RequestReceived(In->Data);
+	IOBuffers.Put(In);											// ParseRequest() copied what it needs
+	return Result;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Split
+//			Keeps anything after the request that has arrived for the next one, and ends the
+//			request where it ends. Returns its length.
+//---------------------------------------------------------------------------------------------
+int CONNECTION::Split(char *Request, int Length)
+{
+	int Whole;
+	if (RequestState(Request, Length, &Whole) != REQUEST_COMPLETE || Whole >= Length)
+		return Length;
+	Pending.assign(Request + Whole, Length - Whole);			// Pipelined
+	Request[Whole] = '\0';
+	return Whole;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::RequestReceived
+//			Everything ReadRequest() does once the request has arrived. The iocp engine reads
+//			the request itself and then calls this.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::RequestReceived(const char *Request)
+{
+	if (Served)
+		Metrics.KeptAlive();
+	Mark(STAGE_READ);
+	bool Parsed = ParseRequest(Request);
+	Mark(STAGE_PARSE);
+	if (!Parsed)
+		return false;
+	if (!RateLimits.Request(ClientAddress.sin_addr, ThisHost))
+	{
+		Status = 429;											// Too soon, don't go near the disk
+		return false;
+	}
+	Proxy = Proxies.Find(HostRequested.c_str(), FileRequested.c_str());
+	if (Proxy)
+	{
+		Status = 200;											// Nothing on the disk to look for
+		return true;
+	}
+	return LocateFile();
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::ParseRequest
+//			Breaks the request up into the method, file, headers and so on. Only looks at the
+//			text, apart from finding the virtual host.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::ParseRequest(const char *Request)
+{
+	string &Word = ParseWord;									// Temporary place to store each word
+	FullRequest = Request;
+	RequestLine.assign(FullRequest, 0, FullRequest.find_first_of("\r\n"));
 
 	//-----------------------------------------------------------------------------------------------------
 	// Break off any POST data following a double newline
@@ -200,7 +687,7 @@ bool CONNECTION::ReadRequest()
 
 	//-----------------------------------------------------------------------------------------------------
 	// Split it into words
-	istringstream IS(FullRequest);								// Create an istringstream class
+	WORDREADER IS(FullRequest.data(), FullRequest.length());	// Reads straight out of FullRequest
 
 	//-----------------------------------------------------------------------------------------------------
 	IS >> Word;													// The first word will be the request type
@@ -225,110 +712,46 @@ bool CONNECTION::ReadRequest()
 	
 	//-----------------------------------------------------------------------------------------------------
 	// Map keys to values
-	while (Word.length())
+	while (IS && Word.length())									// Stop at the end, whatever the library leaves in Word
 	{
 		// Loop through, mapping keys to values
 		if (!strcmpi(Word.c_str(), "From:"))			IS >> From;
 		else if(!strcmpi(Word.c_str(), "User-Agent:"))
 		{
 			IS >> Word;
-			while ( !strstr(Word.c_str(), ":") )				// While theres no colons in the word, the word should be added to UserAgent
+			while ( IS && !strstr(Word.c_str(), ":") )		// While theres no colons in the word, the word should be added to UserAgent
 			{
 				UserAgent += Word;
 				UserAgent += ' ';
 				IS >> Word;
 			}
 		}
+		else if(!strcmpi(Word.c_str(), "Authorization:"))	Authorized = true;
+		else if(!strcmpi(Word.c_str(), "Accept-Encoding:"))
+		{
+			IS >> Word;
+			while ( IS && !strstr(Word.c_str(), ":") )			// Every word up to the next header is an encoding
+			{
+				if (!strnicmp(Word.c_str(), "gzip", 4))
+					AcceptGzip = true;
+				IS >> Word;
+			}
+		}
 		if(!strcmpi(Word.c_str(), "Host:"))		IS >> HostRequested;
 		else if(!strcmpi(Word.c_str(), "Connection:"))	IS >> Connection;
+		else if(!strcmpi(Word.c_str(), "If-None-Match:"))	IS >> IfNoneMatch;
+		else if(!strcmpi(Word.c_str(), "Referer:"))		IS >> Referer;
 		else if(!strcmpi(Word.c_str(), "If-Modified-Since:"))	// If modified
 		{
 			IS >> Word;
 			UseModDate = true;
-			if (Word[3] == ',')
-			{
-				// Its the first type
-				ModifiedSinceStr = Word + ' ';					// We have the day and 5 more words
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-			}
-			else if (Word.length() > 3)
-			{
-				// Its the second type
-				ModifiedSinceStr = Word + ' ';					// We have the day and 3 more words
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-			}
-			else if (Word[3] != ',')
-			{
-				// Its the third date type
-				ModifiedSinceStr = Word + ' ';					// We have the day and 4 more words
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				ModifiedSinceStr += Word + ' ';
-			}
+			ReadDate(IS, Word, ModifiedSinceStr);
 		}
-
 		else if(!strcmpi(Word.c_str(), "If-Unmodified-Since:"))	// If Unmodifed	
 		{
 			IS >> Word;
 			UseUnModDate = true;
-			if (Word[3] == ',')
-			{
-				// Its the first type
-				UnModifiedSinceStr = Word + ' ';				// We have the day and 5 more words
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-			}
-			else if (Word.length() > 3)
-			{
-				// Its the second type
-				UnModifiedSinceStr = Word + ' ';				// We have the day and 3 more words
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-			}
-			else if (Word[3] != ',')
-			{
-				// Its the third date type
-				UnModifiedSinceStr = Word + ' ';				// We have the day and 4 more words
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-				IS >> Word;
-				UnModifiedSinceStr += Word + ' ';
-			}
+			ReadDate(IS, Word, UnModifiedSinceStr);
 		}
 		// Now, check if its a MIME type. If it DOES NOT have ':' and DOES have '/', then its probably mime
 		else if (!strstr(Word.c_str(), ":") && strstr(Word.c_str(), "/"))
@@ -339,7 +762,13 @@ bool CONNECTION::ReadRequest()
 				int Y = Word.length() - 1;
 				Word[Y] = '\0';
 			}
-			Accepts[Word] = true;
+			ACCEPTTYPE *Accepted = (ACCEPTTYPE *)Arena.Alloc(sizeof(ACCEPTTYPE));
+			if (Accepted)
+			{
+				Accepted->Type = Arena.Copy(Word.c_str(), strlen(Word.c_str()));	// strlen() stops at the comma we cut
+				Accepted->Next = AcceptTypes;
+				AcceptTypes = Accepted;
+			}
 		}
 		IS >> Word;
 	}
@@ -370,8 +799,11 @@ bool CONNECTION::ReadRequest()
 	
 	//-----------------------------------------------------------------------------------------------------
 	// Figue out the virtual host
-	ThisHost = &VHI.Host[HostRequested];						
-	if(ThisHost->Root.length() < 1)								// If there is an entry for the host in the VHI 
+	// Use find() rather than [], which would add an entry to the VHI from every thread
+	map <string, VIRTUALHOST>::iterator VH = VHI.Host.find(HostRequested);
+	if (VH != VHI.Host.end())
+		ThisHost = &VH->second;
+	if(ThisHost == NULL || ThisHost->Root.length() < 1)			// If there is an entry for the host in the VHI 
 		UseVH = false;											//  then it is a virtual host
 	else UseVH = true;
 
@@ -387,6 +819,58 @@ bool CONNECTION::ReadRequest()
 		}
 		FileRequested[Y - 1] = '\0';							// Chop it off at the '?'
 	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Undo the %-escapes, after the query string is cut off so a %3F stays in the path. Folder
+	//  listings write their links with WriteURL(), so a name with a space or anything past ASCII
+	//  only comes back to us escaped. A %00, or a % without two hex digits, is no file name.
+	if (!DecodeURL(FileRequested))
+	{
+		Status = 400;
+		return false;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// Can the client send another request on this connection afterwards. HTTP/1.1 can unless
+	//  it says close, HTTP/1.0 only if it asks.
+	if (!strcmpi(HTTPVersion.c_str(), "HTTP/1.1"))
+		KeepAlive = strnicmp(Connection.c_str(), "close", 5) != 0;
+	else if (!strcmpi(HTTPVersion.c_str(), "HTTP/1.0"))
+		KeepAlive = !strnicmp(Connection.c_str(), "keep-alive", 10);
+	if (Stream || Served + 1 >= Options.KeepAlive)
+		KeepAlive = false;										// A stream isn't ours to keep, or it has done enough
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::LocateFile
+//			Finds what the request is for: the status page, a file in an asset pack, or a file
+//			or folder on the disk.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::LocateFile()
+{
+	//-----------------------------------------------------------------------------------------------------
+	// The server status page is answered by the server itself, whichever host it is asked of
+	if (Options.StatusURL.length() && !strcmpi(FileRequested.c_str(), Options.StatusURL.c_str()))
+	{
+		IsStatusPage = true;
+		Status = 200;
+		return true;
+	}
+
+	//-----------------------------------------------------------------------------------------------------
+	// If the virtual host has an asset pack, look there before going to the disk
+	if (UseVH && ThisHost->Pack)
+	{
+		PackEntry = ThisHost->Pack->Find(FileRequested.c_str());
+		Metrics.Cache(METRIC_CACHE_PACK, PackEntry != NULL);
+		if (PackEntry)
+		{
+			Mark(STAGE_LOOKUP);
+			Status = 200;
+			return true;
+		}
+	}
 		
 	//-----------------------------------------------------------------------------------------------------
 	// Change slashes from *nix to windows
@@ -397,8 +881,8 @@ bool CONNECTION::ReadRequest()
 	
 	//-----------------------------------------------------------------------------------------------------
 	// Assign full path based on virtualhosts
-	if (UseVH) RealFile = ThisHost->Root + FileRequested;
-	else RealFile = Options.WebRoot + FileRequested;
+	RealFile = UseVH ? ThisHost->Root : Options.WebRoot;
+	RealFile += FileRequested.c_str();							// c_str() stops where the query string was cut off
 		
 	// Check for a "../", if found send a 404. Because this will allow them to go one folder back, and 
 	//  then get files from there, effectivley giving full access to the system
@@ -429,7 +913,9 @@ bool CONNECTION::ReadRequest()
 	}
 
 	//-----------------------------------------------------------------------------------------------------	
+	Mark(STAGE_LOOKUP);
 	SetFileType();												// Set whether the file is binary or a script
+	Mark(STAGE_FILETYPE);
 	Status = 200;												// It passed all the tests, therefore its ok
 	return true;
 }
@@ -440,19 +926,31 @@ bool CONNECTION::ReadRequest()
 bool CONNECTION::HandleRequest()
 {
 	// Get the time:
-	time_t now;
-	struct tm *tm_now;
-	char buff[BUFSIZ];
+	Clock.Now(Date);											// Copy of the date the clock thread formatted
+	Arm(TIMEOUT_SEND);											// Send() moves it on each time it gets somewhere
+	Mark(STAGE_LOOKUP);											// Anything ReadRequest() did after its last Mark()
 
-	now = time ( NULL );
-	tm_now = gmtime(&now);
-	strftime ( buff, sizeof buff, "%a, %d %b %Y %H:%M:%S GMT", tm_now );
-	Date = buff;
+	if (Status == 429)											// Rate limited, it gets the ready-made answer
+	{
+		KeepAlive = false;										// Which says close
+		if (Stream)
+			BytesSent += RateLimits.SendLimited(SFD, HTTP2::Write, Stream);
+		else
+			BytesSent += RateLimits.SendLimited(SFD, Secure ? TLSCHANNEL::Write : NULL, Secure);
+		return false;
+	}
 
 	//----------------------------------------------------------
 	// Do the request
 	if (Status == 200)
 	{
+		if (IsStatusPage)										// The server status page
+			return SendStatus();
+		if (Proxy)												// For an upstream server
+			return SendProxied();
+		if (PackEntry)											// The file is in an asset pack
+			return SendPacked();
+
 		if (UseModDate == true)									// If we got a last modified header:
 		{
 			if (!ModifiedSince(ModifiedSinceStr))				// If the file has not been modifed
@@ -467,6 +965,13 @@ bool CONNECTION::HandleRequest()
 				Status = 402;									// Send them a 402 not modifed
 			}
 		}
+		if (Status == 304)
+			return SendNotModified();							// They have it already, nothing else goes
+		if (Status != 200)
+		{
+			SendError();										// Instead of the file, not as well
+			return false;
+		}
 		// Output the file
 		if (IsFolder)											// Request was a folder
 		{
@@ -490,6 +995,7 @@ bool CONNECTION::HandleRequest()
 				RealFile += Options.IndexFiles[X];				// Make the file were looking for the appropriate index file
 				IsFolder = false;									
 			}													// Not a folder anymore, break out and send as a file
+			Mark(STAGE_LOOKUP);
 			// If we are allowed to index:
 			if (Options.AllowIndex == true && IsFolder)			// Ensure its still a folder
 			{
@@ -506,87 +1012,58 @@ bool CONNECTION::HandleRequest()
 			if (IsBinary == true && IsScript == false)
 			{
 				// The file is a binary file
-				Headers = HTTPVersion;							// Send HTTP version
-				Headers += " ";											
-				Headers += IntToString(Status);					// Send status code
-				Headers += " ";			
-				Headers += "OK\n";								// Send OK msg
-				Headers += "Server: ";
-				Headers += Options.Servername;
-				Headers += "\nConnection: ";					// Connection type
-				Headers += "close\n";
-				Headers += "Date: ";
-				Headers += Date;
-				Headers += "\nContent-type: ";					// Content type
-				if (Options.MIMETypes[Extension].length() > 0)	// If we know the mime type
-				{
-					Headers += Options.MIMETypes[Extension];	// Send it
-				}
-				else											// Or if we don't know it
+				string &Type = Options.MIMETypes[Extension];
+				char Size[21];
+				CalculateSize(Size);
+				BuildHeaders(Type.length() ? Type.c_str() : "image/jpeg", Size);
+				bool WantsFile = !strcmpi(RequestType.c_str(), "GET") || !strcmpi(RequestType.c_str(), "POST");
+
+				// The iocp engine sends the headers and the file in one TransmitFile()
+				if (WantsFile && Transmit && Status == 200)
 				{
-					Headers += "image/jpeg";					// Send image/jpg
+					TransmitHandle = CreateFile(RealFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+												FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+					if (TransmitHandle != INVALID_HANDLE_VALUE)
+						return true;
 				}
-				Headers += "\nContent-length: ";
-				Headers += CalculateSize();
-				Headers += "\n\n";								// Double newlines
 
-				send (SFD, Headers.c_str(), Headers.length(), 0);// Send headers
+				Send(Headers.c_str(), Headers.length());// Send headers
 
 				// Then, if its a GET of POST request, send the file requested
-				if ( !strcmpi(RequestType.c_str(), "GET") || !strcmpi(RequestType.c_str(), "POST") )
+				if (WantsFile)
 					SendBinary();
 			}
 			else if (IsScript == true && IsBinary == false)
 			{
-				// The file is a CGI script
-				Headers = HTTPVersion;							// Send HTTP version
-				Headers += " ";											
-				Headers += IntToString(Status);					// Send status code
-				Headers += " ";			
-				Headers += "OK\n";								// Send OK msg
-				Headers += "Server: ";
-				Headers += Options.Servername;
-				Headers += "Date: ";
-				Headers += Date;
-				Headers += "\nConnection: close ";				// Connection type
-				// Note: We do not send the content type OR the double newlines, the
-				//  CGI interpreter must do that itself.	
-
-				send (SFD, Headers.c_str(), Headers.length(), 0);		// Send headers
+				if (Status == 200 && CacheLookup())				// Its output is cached
+					return true;
 
-				// Then, if its a GET of POST request, send the file requested
+				// The file is a CGI script. If its a GET of POST request, run it
 				if ( !strcmpi(RequestType.c_str(), "GET") || !strcmpi(RequestType.c_str(), "POST") )
-					SendCGI();
-			}
-			else
-			{
-				// The file is plain text
-				Headers = HTTPVersion;							// Send HTTP version
-				Headers += " ";											
-				Headers += IntToString(Status);					// Send status code
-				Headers += " ";			
-				Headers += "OK\n";								// Send OK msg
-				Headers += "Server: ";
-				Headers += Options.Servername;
-				Headers += "\nConnection: ";					// Connection type
-				Headers += "close\n";
-				Headers += "Date: ";
-				Headers += Date;
-				Headers += "\nContent-type: ";					// Content type
-				if (Options.MIMETypes[Extension].length() > 0)	// If we know the mime type
 				{
-					Headers += Options.MIMETypes[Extension];	// Send it
+					Timers.Cancel(&Deadline);					// The script can take as long as it likes
+					if (Transmit && !CacheFill && StartCGI())	// A fill can't wait on the port it's holding up
+					{
+						Mark(STAGE_SEND);						// The iocp engine sends the output as it comes
+						return true;
+					}
+					SendCGI();									// Sends our headers with the script's
+					EndCache(CACHE_COMPLETE);
+					Mark(STAGE_CGI);
+					return true;								// Whatever Status: it gave, that was the reply
 				}
-				else											// Or if we don't know it
+				else
 				{
-					Headers += "text/plain";					// Send text/plain
+					RESPONSEWRITER Out(SFD);					// Just our headers
+					StartResponse(Out, "OK", NULL);
+					Out.End();
+					KeepAlive = Out.KeepAlive;
 				}
-				Headers += "\n\n";								// Double newlines
-				send (SFD, Headers.c_str(), Headers.length(), 0);// Send headers
-	
-				// Then, if its a GET of POST request, send the file requested
-				if ( !strcmpi(RequestType.c_str(), "GET") || !strcmpi(RequestType.c_str(), "POST"))
-					SendText();
+			}
+			else
+			{
+				// The file is plain text
+				SendText();
 			}
 		}
 	}
@@ -599,143 +1076,449 @@ bool CONNECTION::HandleRequest()
 	return true;												// No errors. Return true
 }
 
+//---------------------------------------------------------------------------------------------
+//			Connection::BuildHeaders
+//			Puts the headers for a file in Headers. Length can be NULL if we don't know it.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::BuildHeaders(const char *ContentType, const char *Length)
+{
+	char Number[21];
+	Headers = HTTPVersion;										// HTTP version
+	Headers += ' ';
+	Headers.append(Number, FormatNumber(Status, Number));		// Status code
+	Headers += " OK\r\nServer: ";
+	Headers += Options.Servername;
+	Headers += Length ? Persistence() : "\r\nConnection: close";	// It can only be kept open if it has a length
+	Headers += "\r\nDate: ";
+	Headers += Date;
+	Headers += "\r\nContent-type: ";
+	Headers += ContentType;
+	if (Length)
+	{
+		Headers += "\r\nContent-length: ";
+		Headers += Length;
+	}
+	else
+		KeepAlive = false;
+	Headers += "\r\n\r\n";										// Double newlines
+}
+
 //---------------------------------------------------------------------------------------------
 //			Connection::SendText
 //---------------------------------------------------------------------------------------------
 bool CONNECTION::SendText()
 {
-	char Buffer[10000];											// Buffer to store data
-	string Text;												// String to store everything
-	ifstream hFile (RealFile.c_str());		
-	while (!hFile.eof())										// Go until the end
+	string &Type = Options.MIMETypes[Extension];
+	RESPONSEWRITER Out(SFD);
+	StartResponse(Out, "OK", Type.length() ? Type.c_str() : "text/plain");
+
+	// If its a GET of POST request, send the file requested
+	if ( !strcmpi(RequestType.c_str(), "GET") || !strcmpi(RequestType.c_str(), "POST"))
 	{
-		hFile.getline(Buffer, 10000);							// Read a full line
-		Text += Buffer;											// Put it in the string
-		Text += "\n";											// Remember to add the \n
+		string Text;											// String to store everything
+		ReadText(RealFile.c_str(), Text);
+		Out.Write(Text);										// Framed once we know how long it is
 	}
-	hFile.close();												// Close
-																// Send the data
-	int Y = send (SFD, Text.c_str(), Text.length(), 0);
-	if (Y != 0)					
-		return true;											// It sent fine
-	else
-		return false;											// Errors sending
+	Out.End();
+	KeepAlive = Out.KeepAlive;
+	return !Out.Failed;
 }
 
 //---------------------------------------------------------------------------------------------
 //			Connection::SendBinary
+//			Sends the file a piece at a time. With a second buffer the next piece is read while
+//			one is sent, otherwise each is read straight into where it's sent from.
 //---------------------------------------------------------------------------------------------
 bool CONNECTION::SendBinary()
 {
 	// WOOHOO! Do not lose this function, it took me ages to learn how to send binary files,
 	//  and now it finally works.
-	char Buffer[10000];
+	IOBUFFER *Block = IOBuffers.Get(IOBUFFER_BULK);
+	if (!Block)
+		return false;
+	Pacing.Start(&Pace, UseVH ? ThisHost : NULL);
+	DWORD Piece = Pacing.Piece(&Pace, Block->Size);				// All of Block unless it's paced
 																// Open the file as binary
-	ifstream hFile (RealFile.c_str(), ios::binary);
-	int X = 0;
-	while (!hFile.eof())                                        // Keep reading it in
-    {
-        hFile.read(Buffer, 10000);
-        int Y = send(SFD, Buffer, hFile.gcount(), 0);			// Send data as we read it
-    }
-    hFile.close();                                              // Close  
-    return true;
-}
-
-//---------------------------------------------------------------------------------------------
-//			Connection::SendCGI
-//---------------------------------------------------------------------------------------------
-bool CONNECTION::SendCGI()
-{
-	if (CGICounter > 1000)										// Check the counter hasn't gotten too high
+	char *Into = Block->Data;
+	if (Secure)
 	{
-		CGICounter = 0;
+		DWORD Room;
+		Into = Tls.Payload(Secure, &Room);						// Read it straight into the next record
+		if (Room < Piece)
+			Piece = Room;
+	}
+																// Open the file for reading in order
+	HANDLE hFile = CreateFile(RealFile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+							  FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_OVERLAPPED, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		IOBuffers.Put(Block);
+		KeepAlive = false;										// Its length was sent, and it won't come
+		return false;
 	}
 
-	string OutFile = "C:\\SWS\\CGI\\Out\\out";					// File to output to
-	OutFile += IntToString(CGICounter);
-	OutFile += ".txt";
+	// A big file gets a second buffer, for the piece after the one being sent
+	DWORD High = 0;
+	DWORD Size = GetFileSize(hFile, &High);
+	IOBUFFER *Ahead = NULL;
+	if (Options.ReadAhead > 0 && (High || Size / 1024 >= (DWORD)Options.ReadAhead))
+		Ahead = IOBuffers.Get(IOBUFFER_BULK);
+	char *Data = Ahead ? Block->Data : Into;					// With one, pieces are copied into the record
+	char *Spare = Ahead ? Ahead->Data : NULL;
+
+	OVERLAPPED Reading;
+	unsigned __int64 Offset = 0;
+	bool Busy = ReadAt(hFile, Data, Piece, Offset, &Reading);
+	while (Busy)												// Keep reading it in
+	{
+		DWORD Got = 0;
+		Busy = false;
+		if (!GetOverlappedResult(hFile, &Reading, &Got, TRUE) || !Got)
+			break;												// The end of it
+		Offset += Got;
+		char *Ready = Data;
+		if (Spare)
+		{
+			Data = Spare;										// Start on the next piece while this one goes
+			Spare = Ready;
+			Busy = ReadAt(hFile, Data, Piece, Offset, &Reading);
+			if (Secure)
+			{
+				memcpy(Into, Ready, Got);
+				Ready = Into;
+			}
+		}
+
+		DWORD Wait = Pacing.Delay(&Pace, Got);
+		if (Wait)
+		{
+			Timers.Cancel(&Deadline);							// Our wait, not the client's. Send() re-arms it
+			Sleep(Wait);
+		}
+		if (Send(Ready, Got) != (int)Got)						// Send data as we read it
+			break;
+		if (!Spare)
+			Busy = ReadAt(hFile, Data, Piece, Offset, &Reading);
+	}
+	if (Busy)
+	{
+		DWORD Got;
+		CancelIo(hFile);										// The client went with a read still going
+		GetOverlappedResult(hFile, &Reading, &Got, TRUE);
+	}
+	CloseHandle(hFile);
+	IOBuffers.Put(Ahead);
+	IOBuffers.Put(Block);
+	if (Offset < (((unsigned __int64)High << 32) | Size))
+		KeepAlive = false;										// It stopped short of the length it was sent with
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::ReadAt() - false if the read couldn't start, which includes the end of
+//			the file
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::ReadAt(HANDLE File, char *Into, DWORD Length, unsigned __int64 Offset, OVERLAPPED *Reading)
+{
+	memset(Reading, 0, sizeof(OVERLAPPED));
+	Reading->Offset = (DWORD)Offset;
+	Reading->OffsetHigh = (DWORD)(Offset >> 32);
+	DWORD Got;
+	return ReadFile(File, Into, Length, &Got, Reading) || GetLastError() == ERROR_IO_PENDING;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::SendCGI
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::SendCGI()
+{
+	// Its output comes down the pipe StartCGI() makes, with no shell or file in between.
+	//  All of it is read before anything is sent, so the page can be framed.
+	string Text;												// String to store everything
+	if (StartCGI())
+	{
+		IOBUFFER *Block = IOBuffers.Get(IOBUFFER_BULK);
+		while (Block)
+		{
+			OVERLAPPED Reading;									// The pipe was opened for the iocp engine
+			memset(&Reading, 0, sizeof(Reading));
+			DWORD Got = 0;
+			if (!ReadFile(CGIOutput, Block->Data, Block->Size, &Got, &Reading) && GetLastError() != ERROR_IO_PENDING)
+				break;											// The script has finished
+			if (!GetOverlappedResult(CGIOutput, &Reading, &Got, TRUE) || !Got)
+				break;
+			Text.append(Block->Data, Got);
+		}
+		IOBuffers.Put(Block);
+		EndCGI();
+	}
+
+	// The script writes its own headers, and a blank line before the page. They go after
+	//  ours, less any that would frame the page, which is framed so the connection can be
+	//  kept open.
+	int Body = 0;
+	int Blank = Text.find("\n\n");
+	int Other = Text.find("\n\r\n");
+	if (Other >= 0 && (Blank < 0 || Other < Blank))
+		Blank = Other;
+	string Kept, Reason = "OK";
+	__int64 Declared = -1;
+	if (Blank >= 0)
+	{
+		Declared = ScriptHeaders(Text.data(), Blank + 1, Kept, Reason);
+		Body = Blank + (Text[Blank + 1] == '\r' ? 3 : 2);
+	}
+	RESPONSEWRITER Out(SFD);
+	StartResponse(Out, Reason.c_str(), NULL);
+	Out.Headers(Kept.data(), Kept.length());
+	if (Declared >= 0)
+		Out.ContentLength(Declared);
+	Out.Write(Text.data() + Body, Text.length() - Body);
+	Out.End();
+	KeepAlive = Out.KeepAlive;
+	return !Out.Failed;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::SendCGIHeaders
+//			Our headers, with the script's, for a script the iocp engine sends the output of as
+//			it comes. Script is what it wrote up to its blank line. If it gave a length the page
+//			goes as it is, otherwise an HTTP/1.1 client gets it in chunks, which the engine
+//			frames, so the connection can still be kept open. Anyone else is told it closes.
+//			Returns the length it gave, or -1.
+//---------------------------------------------------------------------------------------------
+__int64 CONNECTION::SendCGIHeaders(const char *Script, int Length)
+{
+	string Kept, Reason;
+	__int64 Declared = ScriptHeaders(Script, Length, Kept, Reason);
+	if (Declared < 0 && strcmpi(HTTPVersion.c_str(), "HTTP/1.1"))
+		KeepAlive = false;
+	Headers = HTTPVersion;										// Send HTTP version
+	Headers += " ";
+	Headers += IntToString(Status);								// Send status code
+	Headers += " ";
+	Headers += Reason;
+	Headers += "\r\nServer: ";
+	Headers += Options.Servername;
+	Headers += "\r\nDate: ";
+	Headers += Date;
+	Headers += "\r\n";
+	Headers += Kept;
+	if (Declared >= 0)
+	{
+		char Number[21];
+		Headers += "Content-Length: ";
+		Headers.append(Number, FormatNumber(Declared, Number));
+		Headers += Persistence();
+		Headers += "\r\n";
+	}
+	else
+		Headers += KeepAlive ? "Transfer-Encoding: chunked\r\n" : "Connection: close\r\n";
+	Headers += "\r\n";
+	if (Send(Headers.c_str(), Headers.length()) != (int)Headers.length())
+		KeepAlive = false;
+	return Declared;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::ScriptHeaders
+//			Sorts out the headers a script wrote, up to the blank line after them. Status: sets
+//			our status and Reason, and Content-Length is handed back, or -1 if it gave none or
+//			gave two that differ. Those, and the ones about framing or only this connection,
+//			are ours to send. The rest go in Kept, each ended with \r\n.
+//---------------------------------------------------------------------------------------------
+static const char *CGIDropped[] = { "Status", "Content-Length", "Transfer-Encoding", "Connection", "Keep-Alive",
+									"Proxy-Connection", "TE", "Trailer", "Upgrade", "Server", "Date", NULL };
+
+__int64 CONNECTION::ScriptHeaders(const char *Data, int Length, string &Kept, string &Reason)
+{
+	__int64 Declared = -1;
+	bool Conflict = false;
+	Reason = "OK";
+	const char *End = Data + Length;
+	const char *Line = Data;
+	while (Line < End)
+	{
+		const char *Next = (const char *)memchr(Line, '\n', End - Line);
+		if (!Next)
+			Next = End;
+		int Text = Next - Line;
+		if (Text && Line[Text - 1] == '\r')
+			Text--;
+		if (!Text)
+			break;												// The blank line
+
+		const char *Colon = (const char *)memchr(Line, ':', Text);
+		int Name = Colon ? Colon - Line : 0;
+		const char *Value = Colon ? Colon + 1 : Line + Text;
+		const char *Stop = Line + Text;
+		while (Value < Stop && (*Value == ' ' || *Value == '\t'))
+			Value++;
+		if (Name == 6 && !strnicmp(Line, "Status", 6))
+		{
+			int Code = atoi(Value);
+			if (Code >= 100 && Code <= 999)
+			{
+				Status = Code;
+				while (Value < Stop && *Value >= '0' && *Value <= '9')
+					Value++;
+				while (Value < Stop && *Value == ' ')
+					Value++;
+				Reason.assign(Value, Stop - Value);
+				if (Reason.empty())
+					Reason = Options.Reason(Status);
+			}
+		}
+		else if (Name == 14 && !strnicmp(Line, "Content-Length", 14))
+		{
+			__int64 Said = 0;
+			const char *Digit = Value;
+			while (Digit < Stop && *Digit >= '0' && *Digit <= '9' && Digit - Value < 18)
+				Said = Said * 10 + *Digit++ - '0';
+			if (Digit == Value || Digit < Stop || (Declared >= 0 && Said != Declared))
+				Conflict = true;
+			Declared = Said;
+		}
+
+		bool Ours = !Colon;										// Not a header at all
+		for (int X = 0; CGIDropped[X] && !Ours; X++)
+			Ours = (int)strlen(CGIDropped[X]) == Name && !strnicmp(Line, CGIDropped[X], Name);
+		if (!Ours)
+		{
+			Kept.append(Line, Text);
+			Kept += "\r\n";
+		}
+		Line = Next + 1;
+	}
+	return Conflict ? -1 : Declared;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::StartCGI
+//			Starts the script with its output going into a pipe, and returns without waiting
+//			for it. The iocp engine reads CGIOutput overlapped and sends it on as it comes, so
+//			no thread waits for the script. SendCGI() reads it itself. The interpreter is run
+//			directly, so nothing in the query string reaches a shell.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::StartCGI()
+{
+	// A named pipe, because anonymous ones can't be read overlapped
+	char PipeName[64];
+	sprintf(PipeName, "\\\\.\\pipe\\SWS-CGI-%lu-%ld", GetCurrentProcessId(), InterlockedIncrement(&CGIPipes));
+	HANDLE Read = CreateNamedPipe(PipeName, PIPE_ACCESS_INBOUND | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_WAIT,
+								  1, 0, IOBUFFER_BULK, 0, NULL);
+	if (Read == INVALID_HANDLE_VALUE)
+		return false;
+	SECURITY_ATTRIBUTES Inherit;
+	Inherit.nLength = sizeof(Inherit);
+	Inherit.lpSecurityDescriptor = NULL;
+	Inherit.bInheritHandle = TRUE;								// The script gets this end
+	HANDLE Write = CreateFile(PipeName, GENERIC_WRITE, 0, &Inherit, OPEN_EXISTING, 0, NULL);
+	if (Write == INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(Read);
+		return false;
+	}
+
+	string Environment = CGIEnvironment();
 
 	string Command = Options.CGI[Extension];					// Create the command
-	Command += " ";
+	Command += " \"";
 	Command += RealFile;										// File to interpret
 	Command += "?";
-	Command += QueryString;
-	Command += " > ";
-	Command += OutFile;											// Pipe to output file				
-
+	for (int Q = 0; Q < (int)QueryString.length(); Q++)
+	{
+		if (QueryString[Q] != '"')								// It stays one argument
+			Command += QueryString[Q];
+	}
+	Command += "\"";
 	LogText(Command);
 
-	// Set environment variables
-	
-	string SERVER_SOFTWARE = "SERVER_SOFTWARE=";
-		SERVER_SOFTWARE += Options.Servername;
-	string SERVER_INTERFACE = "SERVER_INTERFACE=CGI/1.1";
-	string REDIRECT_STATUS = "REDIRECT_STATUS=200";
+	STARTUPINFO Startup;
+	memset(&Startup, 0, sizeof(Startup));
+	Startup.cb = sizeof(Startup);
+	Startup.dwFlags = STARTF_USESTDHANDLES;
+	Startup.hStdOutput = Write;
+	Startup.hStdError = Write;
+	PROCESS_INFORMATION Process;
+	Metrics.CGISpawn();
+	BOOL Started = CreateProcess(NULL, Arena.Copy(Command.c_str(), Command.length()), NULL, NULL, TRUE,
+								 CREATE_NO_WINDOW, (void *)Environment.data(), NULL, &Startup, &Process);
+	CloseHandle(Write);											// The script has its own copy now
+	if (!Started)
+	{
+		CloseHandle(Read);
+		return false;
+	}
+	CloseHandle(Process.hThread);
+	CGIProcess = Process.hProcess;
+	CGIOutput = Read;
+	return true;
+}
 
-	putenv(SERVER_SOFTWARE.c_str());
-	putenv(SERVER_INTERFACE.c_str());
-	putenv(REDIRECT_STATUS.c_str());
+//---------------------------------------------------------------------------------------------
+//			Connection::CGIEnvironment
+//			The block CreateProcess() takes, built for the script alone rather than with
+//			putenv(), which would change it for every thread. The server's variables come
+//			first, then the server's own environment (PATH, SystemRoot and so on) without any
+//			variables of the same name.
+//---------------------------------------------------------------------------------------------
+static const char *CGIVariables[] = { "SERVER_SOFTWARE", "SERVER_INTERFACE", "REDIRECT_STATUS", "SERVER_PROTOCOL",
+									  "SERVER_PORT", "REQUEST_METHOD", "PATH_INFO", "PATH_TRANSLATED",
+									  "QUERY_STRING", "REMOTE_ADDR", NULL };
 
-	
+string CONNECTION::CGIEnvironment()
+{
 	string FileRequestedWebStyle = FileRequested;				// Set the request back to web style
-
 	for (int Z = 0; FileRequestedWebStyle[Z] != '\0'; Z++)		// Replace \ with / 
 	{
 		if (FileRequestedWebStyle[Z] == '\\') FileRequestedWebStyle[Z] = '/';
 	}
 
-
-	string SERVER_PROTOCOL = "SERVER_PROTOCOL=";				// Create all the env. variables
-		SERVER_PROTOCOL += HTTPVersion;
-	string SERVER_PORT = "SERVER_PORT=";
-		SERVER_PORT += IntToString(Options.Port);
-	string REQUEST_METHOD = "REQUEST_METHOD=";
-		REQUEST_METHOD += RequestType;
-	string PATH_INFO = "PATH_INFO=";
-		PATH_INFO += FileRequestedWebStyle;
-	string PATH_TRANSLATED = "PATH_TRANSLATED=";
-		PATH_TRANSLATED += RealFile;
-	// SCRIPT_NAME 
-	string QUERY_STRING = "QUERY_STRING=\"?";
-		QUERY_STRING += QueryString;
-		QUERY_STRING += "\"";
-	string REMOTE_ADDR = "REMOTE_ADDR=";
-		REMOTE_ADDR += inet_ntoa(ClientAddress.sin_addr);
-
-	putenv(SERVER_PROTOCOL.c_str());							// Set all the env. variables
-	putenv(SERVER_PORT.c_str());
-	putenv(REQUEST_METHOD.c_str());
-	putenv(PATH_INFO.c_str());
-	putenv(PATH_TRANSLATED.c_str());
-	putenv(QUERY_STRING.c_str());
-	putenv(REMOTE_ADDR.c_str());
-	LogText(QUERY_STRING);
-
-	system(Command.c_str());									// Do the command
-
-
-	char Buffer[10000];											// Buffer to store data
-	string Text;												// String to store everything
-	ifstream hFile (OutFile.c_str());		
-	while (!hFile.eof())										// Go until the end
+	string Environment;
+	Environment += "SERVER_SOFTWARE=";	Environment += Options.Servername;			Environment += '\0';
+	Environment += "SERVER_INTERFACE=CGI/1.1";										Environment += '\0';
+	Environment += "REDIRECT_STATUS=200";											Environment += '\0';
+	Environment += "SERVER_PROTOCOL=";	Environment += HTTPVersion;					Environment += '\0';
+	Environment += "SERVER_PORT=";		Environment += IntToString(Options.Port);	Environment += '\0';
+	Environment += "REQUEST_METHOD=";	Environment += RequestType;					Environment += '\0';
+	Environment += "PATH_INFO=";		Environment += FileRequestedWebStyle;		Environment += '\0';
+	Environment += "PATH_TRANSLATED=";	Environment += RealFile;					Environment += '\0';
+	Environment += "QUERY_STRING=\"?";	Environment += QueryString;					Environment += "\"";
+																					Environment += '\0';
+	Environment += "REMOTE_ADDR=";		Environment += inet_ntoa(ClientAddress.sin_addr);	Environment += '\0';
+
+	char *Parent = GetEnvironmentStrings();
+	for (const char *Variable = Parent; Parent && *Variable; Variable += strlen(Variable) + 1)
 	{
-		hFile.getline(Buffer, 10000);							// Read a full line
-		Text += Buffer;											// Put it in the string
-		Text += "\n";											// Remember to add the \n
+		bool Ours = false;
+		for (int V = 0; CGIVariables[V] && !Ours; V++)
+		{
+			int Length = strlen(CGIVariables[V]);
+			Ours = !strnicmp(Variable, CGIVariables[V], Length) && Variable[Length] == '=';
+		}
+		if (!Ours)
+			Environment.append(Variable, strlen(Variable) + 1);
 	}
-	hFile.close();	
-
-	CGICounter++;												// Increase the counter
-
-	DeleteFile(OutFile.c_str());								// Delete the file (clean up after ourselves)
+	if (Parent)
+		FreeEnvironmentStrings(Parent);
+	Environment += '\0';										// Ends the block
+	return Environment;
+}
 
-	int Y = send (SFD, Text.c_str(), Text.length(), 0);
-	if (Y != 0)					
-		return true;											// It sent fine
-	else
-		return false;											// Errors sending
-	return 0;
+//---------------------------------------------------------------------------------------------
+//			Connection::EndCGI
+//			Closing the pipe first means a script still writing to a client that has gone
+//			gets an error rather than waiting forever.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::EndCGI()
+{
+	if (CGIOutput != INVALID_HANDLE_VALUE)
+		CloseHandle(CGIOutput);
+	if (CGIProcess)
+		CloseHandle(CGIProcess);
+	CGIOutput = INVALID_HANDLE_VALUE;
+	CGIProcess = NULL;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -749,135 +1532,481 @@ bool CONNECTION::IndexFolder()
 		Status = 404;
 		return false;
 	}
-	else
-	{	
-		// Open and list folder contents
-		HANDLE hFind;
-		WIN32_FIND_DATA FindData;
-		int ErrorCode;
-		BOOL Continue = true;
 
-		string FileIndex = RealFile + "\\*.*";					// List all files
-		hFind = FindFirstFile(FileIndex.c_str(), &FindData);
+	// Get the listing from the cache, which reads the folder if it has to
+	LISTING *Listing = Listings.Get(RealFile);
+	if (Listing == NULL)
+	{
+		Status = 404;
+		return false;
+	}
+
+	for (int Z = 0; FileRequested[Z] != '\0'; Z++)				// Replace \ with / 
+	{
+		if (FileRequested[Z] == '\\') FileRequested[Z] = '/';
+	}
+	string Folder = FileRequested.c_str();						// c_str() stops where the query string was cut off
+	if (Folder.empty() || Folder[Folder.length() - 1] != '/')
+		Folder += '/';
 
-		string Text;
-		for (int Z = 0; FileRequested[Z] != '\0'; Z++)			// Replace \ with / 
+	//-----------------------------------------------------------------------------------------
+	// Options from the query string, ie, ?sort=size&order=desc&page=2&format=json
+	string SortName = QueryValue(QueryString, "sort");
+	int Sort = LISTING_SORT_NAME;
+	if (SortName == "size")			Sort = LISTING_SORT_SIZE;
+	else if (SortName == "date")	Sort = LISTING_SORT_DATE;
+	else							SortName = "name";
+	bool Descending = (QueryValue(QueryString, "order") == "desc");
+	bool JSON = (QueryValue(QueryString, "format") == "json");
+
+	int Total = Listing->Entries.size();
+	int PerPage = (Options.IndexPageSize > 0) ? Options.IndexPageSize : Total;
+	if (PerPage < 1) PerPage = 1;
+	int Pages = (Total + PerPage - 1) / PerPage;
+	if (Pages < 1) Pages = 1;
+	int Page = atoi(QueryValue(QueryString, "page").c_str());
+	if (Page < 1) Page = 1;
+	if (Page > Pages) Page = Pages;
+	int First = (Page - 1) * PerPage;
+	int Last = First + PerPage;
+	if (Last > Total) Last = Total;
+
+	const vector <int> &Order = Listing->Order(Sort);
+
+	//-----------------------------------------------------------------------------------------
+	// Everything goes through one buffer, so a big folder is a few large send()s
+	RESPONSEWRITER Out(SFD);
+	StartResponse(Out, "OK", JSON ? "application/json" : "text/html");
+
+	if (!strcmpi(RequestType.c_str(), "HEAD"))					// HEAD only wants the headers
+	{
+		Out.End();
+		KeepAlive = Out.KeepAlive;
+		Listings.Release(Listing);
+		return true;
+	}
+
+	if (JSON)
+	{
+		Out.Write("{\"path\":\"");
+		Out.WriteJSON(Folder.c_str());
+		Out.Write("\",\"sort\":\"");
+		Out.Write(SortName);
+		Out.Write(Descending ? "\",\"order\":\"desc\"" : "\",\"order\":\"asc\"");
+		Out.Write(",\"page\":");		Out.WriteNumber(Page);
+		Out.Write(",\"pages\":");		Out.WriteNumber(Pages);
+		Out.Write(",\"total\":");		Out.WriteNumber(Total);
+		Out.Write(",\"entries\":[");
+		for (int X = First; X < Last; X++)
 		{
-			if (FileRequested[Z] == '\\') FileRequested[Z] = '/';
+			const LISTINGENTRY &Entry = Listing->Entries[Order[Listing->Position(X, Descending)]];
+			char Modified[HTTPDATE_LENGTH + 1];
+			FormatHTTPDate(Entry.Modified, Modified);
+
+			if (X > First) Out.Write(",");
+			Out.Write("\n{\"name\":\"");
+			Out.WriteJSON(Entry.Name.c_str());
+			Out.Write(Entry.IsFolder ? "\",\"type\":\"folder\",\"size\":" : "\",\"type\":\"file\",\"size\":");
+			Out.WriteNumber(Entry.Size);
+			Out.Write(",\"modified\":\"");
+			Out.Write(Modified);
+			Out.Write("\"}");
 		}
+		Out.Write("\n]}\n");
+		Out.End();
+		KeepAlive = Out.KeepAlive;
+		Listings.Release(Listing);
+		return true;
+	}
+
+	// Most of this is all HTML bieng generated
+	Out.Write("<html>\n<head>\n<title>Index of ");
+	Out.WriteHTML(Folder.c_str());
+	Out.Write("</title>\n</head>\n\n<body>\n<!-- Title -->\n<p align=\"center\">\n  <font face=\"Verdana\" size=\"6\">\n    Index of ");
+	Out.WriteHTML(Folder.c_str());
+	Out.Write("\n  </font>\n</p>\n\n<hr>\n\n<center>\n"
+			  "<table border=\"0\" width=\"75%\" height=\"6\" cellspacing=\"0\" cellpadding=\"4\">\n  <tr>\n");
+
+	// Column titles sort by that column. Clicking the current one again reverses it.
+	const char *Titles[3] = { "Name", "Size", "Modified" };
+	const char *SortNames[3] = { "name", "size", "date" };
+	const char *Widths[3] = { "40%", "23%", "37%" };
+	for (int T = 0; T < 3; T++)
+	{
+		Out.Write("    <td width=\"");
+		Out.Write(Widths[T]);
+		Out.Write("\" height=\"1\" bgcolor=\"#0080C0\"><p align=\"center\"><strong><small><font face=\"Verdana\"><a style=\"color:#FFFFFF\" href=\"?sort=");
+		Out.Write(SortNames[T]);
+		Out.Write((T == Sort && !Descending) ? "&order=desc\">" : "\">");
+		Out.Write(Titles[T]);
+		Out.Write("</a></font></small></strong></td>\n");
+	}
+	Out.Write("  </tr>\n");
+
+	for (int X = First; X < Last; X++)
+	{
+		const LISTINGENTRY &Entry = Listing->Entries[Order[Listing->Position(X, Descending)]];
+		char Modified[HTTPDATE_LENGTH + 1];
+		FormatHTTPDate(Entry.Modified, Modified);
+
+		Out.Write("  <tr>\n    <td width=\"40%\" height=\"0\" bgcolor=\"#E2E2E2\"><p align=\"left\"><small><font face=\"Verdana\"><a href=\"");
+		Out.WriteURL(Folder.c_str());
+		Out.WriteURL(Entry.Name.c_str());
+		if (Entry.IsFolder) Out.Write("/");
+		Out.Write("\">");
+		Out.WriteHTML(Entry.Name.c_str());
+		Out.Write("</a></font></small></td>\n    <td width='23%' height='0' bgcolor='#C0C0C0'><p align='center'><small><font face='Verdana'>");
+		if (!Entry.IsFolder)
+			Out.WriteNumber(Entry.Size);
+		Out.Write("</font></small></td>\n    <td width='37%' height='0' bgcolor='#E2E2E2'><p align='center'><small><font face='Verdana'>");
+		Out.Write(Modified);
+		Out.Write("</font></small></td>\n  </tr>\n");
+	}
+	Out.Write("</table>\n</center>\n");
 
-		//-----------------------------
-		if(hFind == INVALID_HANDLE_VALUE)
+	// Links to the other pages
+	if (Pages > 1)
+	{
+		Out.Write("\n<p align='center'><small><font face='Verdana'>");
+		for (int P = 1; P <= Pages; P++)
 		{
-			Status = 404;
-			return false;
+			if (P == Page)
+			{
+				Out.Write("<b>");
+				Out.WriteNumber(P);
+				Out.Write("</b> ");
+				continue;
+			}
+			Out.Write("<a href=\"?sort=");
+			Out.Write(SortName);
+			if (Descending) Out.Write("&order=desc");
+			Out.Write("&page=");
+			Out.WriteNumber(P);
+			Out.Write("\">");
+			Out.WriteNumber(P);
+			Out.Write("</a> ");
 		}
-		else
-		{	
-			Headers = HTTPVersion;								// Send HTTP version
-			Headers += " 200 OK\n";								
-			Headers += "Server: SWS Stovell Web Server 2.0\n";	// Server name
-			Headers += "Connection: close";
-			Headers += "\nContent-type: text/html";				// Content type
-			Headers += "\n\n";									// Double newlines
-			send (SFD, Headers.c_str(), Headers.length(), 0);	// Send headers
-
-			// Most of this is all HTML bieng generated													
-			Text = "<html>\n<head>\
-\n<title>Index of ";
-			Text += FileRequested;								// Insert the file requested					
-			Text += "</title>\
-\n</head>\
-\
-\n<body>\
-\n<!-- Title -->\
-\n<p align=\"center\">\
-\n  <font face=\"Verdana\" size=\"6\">\
-\n    Index of ";
-			Text += FileRequested;								// Insert the file requested
-			Text += "\n  </font>\
-\n</p>\
-\n\
-\n<hr>\
-\n\
-\n<center>\
-\n<table border=\"0\" width=\"75%\" height=\"6\" cellspacing=\"0\" cellpadding=\"4\">\
-\n  <tr>\
-\n    <td width=\"40%\" height=\"1\" bgcolor=\"#0080C0\"><p align=\"center\"><strong><small><font\
-\n    face=\"Verdana\" color=\"#FFFFFF\">Name</font></small></strong></td>\
-\n    <td width=\"23%\" height=\"1\" bgcolor=\"#0080C0\"><p align=\"center\"><font face=\"Verdana\"\
-\n    color=\"#FFFFFF\"><strong><small>Size</small></strong></font></td>\
-\n    \
-\n  </tr>";
-																// Now, print the first entry
-			Text += "  <tr>\
-\n    <td width=\"40%\" height=\"0\" bgcolor=\"#E2E2E2\"><p align=\"left\"><small><font face=\"Verdana\">";
-			Text += "<a href=\"";
-			Text += FileRequested;								// Current folder
-			Text += "/";
-			Text += FindData.cFileName;							// Name of file
-			Text += "\">";
-			Text += FindData.cFileName;							// Name of file
-			Text += "</a></font></small></td>\n";
-			Text += "\n    <td width='23%' height='0' bgcolor='#C0C0C0'>\
-\n    <p align='center'><small><font face='Verdana'>";
-			if (IntToString(FindData.nFileSizeHigh)[0] != '0')
-				Text += IntToString(FindData.nFileSizeHigh);
-			if (IntToString(FindData.nFileSizeLow)[0] != '0')
-				Text += IntToString(FindData.nFileSizeLow);
-			Text += "\n</font></small></td>\
-\n    </font></small></td>";
-			send(SFD, Text.c_str(), Text.length(), 0);
+		Out.Write("</font></small></p>\n");
+	}
+
+	Out.Write("\n<hr>\n\n<p align='center'><small><small><font face='Verdana'>Index produced automatically by <a\n"
+			  "href='http://swebs.sourceforge.net'>SWS Web Server</a></font></small></small></p>\n</body>\n</html>");
+	Out.End();
+	KeepAlive = Out.KeepAlive;
+
+	Listings.Release(Listing);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::SendPacked()
+//			Sends a file out of the virtual host's asset pack. The headers are mostly stored in
+//			the pack already, and small files go out in the same send() as the headers.
+//---------------------------------------------------------------------------------------------
+#define PACK_COALESCE						16384					// Files this size or less are sent with the headers
+
+bool CONNECTION::SendPacked()
+{
+	ASSETPACK *Pack = ThisHost->Pack;
+	const char *ETag = Pack->String(PackEntry->ETag);
+
+	// Check if the client already has it
+	bool NotModified = false;
+	if (IfNoneMatch.length())
+	{
+		NotModified = (IfNoneMatch == ETag || IfNoneMatch == "*");
+	}
+	else if (UseModDate)
+	{
+		time_t Since;
+		if (ParseHTTPDate(ModifiedSinceStr.c_str(), &Since) && (time_t)PackEntry->Modified <= Since)
+			NotModified = true;
+	}
+
+	if (NotModified)
+		Status = 304;											// For the log
+
+	bool Gzip = AcceptGzip && PackEntry->GzipLength > 0;		// Send the gzip version if we can
+	const char *Body = Pack->Data(Gzip ? PackEntry->GzipData : PackEntry->Data);
+	DWORD Length = Gzip ? PackEntry->GzipLength : PackEntry->Length;
+
+	Headers = HTTPVersion;
+	Headers += NotModified ? " 304 Not Modified\r\n" : " 200 OK\r\n";
+	Headers += "Server: ";
+	Headers += Options.Servername;
+	Headers += Persistence();									// Always framed, so it can be kept open
+	Headers += "\r\nDate: ";
+	Headers += Date;
+	Headers += "\r\nETag: ";
+	Headers += ETag;
+	Headers += "\r\nLast-Modified: ";
+	Headers += Pack->String(PackEntry->LastModified);
+	if (PackEntry->GzipLength > 0)
+		Headers += "\r\nVary: Accept-Encoding";
+	if (!NotModified)
+	{
+		Headers += "\r\nContent-type: ";
+		Headers += Pack->String(PackEntry->MIMEType);
+		Headers += "\r\nContent-length: ";
+		Headers += IntToString(Length);
+		if (Gzip)
+			Headers += "\r\nContent-Encoding: gzip";
+	}
+	Headers += "\r\n\r\n";
+
+	// HEAD requests and 304s get headers only
+	if (NotModified || !strcmpi(RequestType.c_str(), "HEAD"))
+	{
+		Send(Headers.c_str(), Headers.length());
+		return true;
+	}
+
+	if (Length <= PACK_COALESCE)
+	{
+		Headers.append(Body, Length);							// One send() for the whole response
+		Send(Headers.c_str(), Headers.length());
+		return true;
+	}
+
+	Send(Headers.c_str(), Headers.length());					// Headers, then the file straight from the mapping
+	return Send(Body, Length) == (int)Length;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::SendProxied()
+//			Sends the request to one of the route's upstreams and streams the reply back as it
+//			arrives. Headers holds the request until the reply's headers replace it.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::SendProxied()
+{
+	if (CacheLookup())
+		return true;
+	Timers.Cancel(&Deadline);									// The upstream has its own timeouts. Send() re-arms it
+	IOBUFFER *Block = IOBuffers.Get(IOBUFFER_BULK);
+	if (!Block)
+	{
+		EndCache(CACHE_ABANDON);
+		Status = 500;											// Out of memory
+		SendError();
+		return false;
+	}
+
+	Proxies.BuildRequest(Headers, RequestLine.c_str(), FullRequest.c_str(), PostData, ClientAddress.sin_addr);
+	bool Head = !strcmpi(RequestType.c_str(), "HEAD");
+	bool Retry = Head || !strcmpi(RequestType.c_str(), "GET");	// Safe to send twice
+	bool Strip = strcmpi(HTTPVersion.c_str(), "HTTP/1.1") != 0;	// Only HTTP/1.1 clients take chunks
+
+	//-----------------------------------------------------------------------------------------------------
+	// Send it, and wait for the reply's headers
+	UPSTREAM *Upstream = NULL;
+	SOCKET Socket = INVALID_SOCKET;
+	PROXYREPLY Reply;
+	int Got = 0;
+	int HeadLength = 0;
+	bool TimedOut = false;
+	for (int Attempt = 0; Attempt < PROXY_ATTEMPTS; Attempt++)
+	{
+		Upstream = Proxies.Pick(Proxy, Upstream);				// Another one than last time, if there is one
+		if (!Upstream)
+			break;
+		bool Reused;
+		Socket = Proxies.Get(Upstream, &Reused);
+		if (Socket == INVALID_SOCKET)
+		{
+			Proxies.Done(Upstream, Socket, false);				// Refused, nothing was sent
+			continue;
 		}
 
-		if (Continue)
+		int Sent = 0;
+		while (Sent < (int)Headers.length())
 		{
-			while (FindNextFile(hFind, &FindData))
+			int Y = send(Socket, Headers.data() + Sent, Headers.length() - Sent, 0);
+			if (Y <= 0)
+				break;
+			Sent += Y;
+		}
+		Got = 0;
+		HeadLength = 0;
+		while (Sent == (int)Headers.length() && !HeadLength && Got < (int)Block->Size - 1)
+		{
+			int Y = recv(Socket, Block->Data + Got, Block->Size - 1 - Got, 0);
+			if (Y <= 0)
 			{
-				Text = "  <tr>\
-\n    <td width=\"40%\" height=\"0\" bgcolor=\"#E2E2E2\"><p align=\"left\"><small><font face=\"Verdana\">";
-			Text += "<a href=\"";
-			if (strcmpi(FileRequested.c_str(), "/"))
-				Text += FileRequested;								// Current folder
-			Text += "/";
-			Text += FindData.cFileName;							// Name of file
-			Text += "\">";
-			Text += FindData.cFileName;							// Name of file
-			Text += "</a></font></small></td>\n";
-			Text += "\n    <td width='23%' height='0' bgcolor='#C0C0C0'>\
-\n    <p align='center'><small><font face='Verdana'>";
-			
-			if (IntToString(FindData.nFileSizeHigh)[0] != '0')
-				Text += IntToString(FindData.nFileSizeHigh);
-			if (IntToString(FindData.nFileSizeLow)[0] != '0')
-				Text += IntToString(FindData.nFileSizeLow);
-			Text += "\n</font></small></td>\
-\n    </font></small></td>";
-				send(SFD, Text.c_str(), Text.length(), 0);
+				TimedOut = Y < 0 && WSAGetLastError() == WSAETIMEDOUT;
+				break;
 			}
+			Got += Y;
+			Block->Data[Got] = '\0';
+			HeadLength = Proxies.ReadReply(Block->Data, Got, Head, Strip, KeepAlive, &Reply, Headers);	// Only changes Headers once it's all here
+		}
+		if (HeadLength > 0)
+			break;
 
-			ErrorCode = GetLastError();
+		Proxies.Done(Upstream, Socket, false);
+		Socket = INVALID_SOCKET;
+		if (!Reused || Got || !Retry || TimedOut)
+			break;												// It may have been acted on, so don't send it again
+	}
+
+	if (HeadLength <= 0)
+	{
+		IOBuffers.Put(Block);
+		InterlockedIncrement(&Proxies.Errors);
+		EndCache(CACHE_ABANDON);								// The next request can try
+		Status = TimedOut ? 504 : 502;
+		SendError();
+		return false;
+	}
+	InterlockedIncrement(&Proxies.Forwarded);
+	Status = Reply.Status;										// For the log
 
-			if (ErrorCode == ERROR_NO_MORE_FILES)
+	//-----------------------------------------------------------------------------------------------------
+	// Pass the reply on a buffer at a time, until its length says it's over, or its last
+	//  chunk, or the upstream closes
+	bool Reuse = !Reply.Close;									// Can the upstream connection be pooled
+	bool Whole = false;											// Did all of it arrive
+	if (Send(Headers.data(), Headers.length()) == (int)Headers.length())
+	{
+		CHUNKED Chunks;
+		Chunks.Start();
+		__int64 Remaining = Reply.Length;
+		char *Data = Block->Data + HeadLength;
+		int Left = Got - HeadLength;
+		for (;;)
+		{
+			if (Left > 0)
 			{
-				Text = "</tr>\
-\n</table>\
-\n</div>\
-\n\
-\n<hr>\
-\n\
-\n<p align='center'><small><small><font face='Verdana'>Index produced automatically by <a\
-\nhref='http://swebs.sourceforge.net'>SWS Web Server</a></font></small></small></p>\
-\n</body>\
-\n</html>";
-				send(SFD, Text.c_str(), Text.length(), 0);
+				int Used = Left;
+				int Out = Left;
+				if (Reply.Chunked)
+					Out = Chunks.Feed(Data, Left, Strip, &Used);
+				else if (Remaining >= 0 && Remaining < Left)
+					Out = Used = (int)Remaining;
+				if (Remaining > 0)
+					Remaining -= Used;
+				if (Used < Left)
+					Reuse = false;								// More than the reply, don't trust what follows
+				if (Out > 0 && Send(Data, Out) != Out)
+				{
+					Reuse = false;								// The client has gone, the rest isn't read
+					break;
+				}
+			}
+			if (Reply.Chunked ? Chunks.State == CHUNK_DONE || Chunks.State == CHUNK_ERROR : Remaining == 0)
+			{
+				Whole = Chunks.State != CHUNK_ERROR;
+				break;
 			}
 
-        FindClose(hFind);
-       
+			Data = Block->Data;
+			Left = recv(Socket, Data, Block->Size, 0);
+			if (Left <= 0)
+			{
+				if (Reply.Chunked || Remaining > 0)
+					Reuse = false;								// It stopped short
+				else
+					Whole = Left == 0;							// Its length was the connection's
+				break;
+			}
 		}
+		if (Chunks.State == CHUNK_ERROR)
+			Reuse = false;
+	}
+	else
+		Reuse = false;
+
+	Proxies.Done(Upstream, Socket, Reuse);
+	KeepAlive = KeepAlive && Reply.Framed && Whole;				// Or the client can't tell it's over
+	IOBuffers.Put(Block);
+	EndCache(Whole ? CACHE_COMPLETE : CACHE_ABANDON);
 	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::CacheLookup()
+//			For GETs of scripts and upstreams. A hit is sent here and that's the request done.
+//			Otherwise, if CacheFill is set, everything sent from now on is captured to fill it,
+//			and if Quiet is set too the client has been sent a stale copy already, so it isn't
+//			sent anything else.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::CacheLookup()
+{
+	if (strcmpi(RequestType.c_str(), "GET"))
+		return false;
+
+	CacheKey = HostRequested;									// The request line has the HTTP version,
+	CacheKey += ' ';											//  which decides how a reply is framed
+	CacheKey += RequestLine;
+	CACHEDREPLY *Reply;
+	ResponseCache.Begin(CacheKey, &Reply, &CacheFill);			// Can wait for another request to fill it
+	Metrics.Cache(METRIC_CACHE_RESPONSE, Reply != NULL);
+	if (!Reply)
+		return false;
+
+	Status = Reply->Status;										// For the log
+	Send(Reply->Data, Reply->Length);
+	if (ResponseCloses(Reply->Data, Reply->Length))
+		KeepAlive = false;										// It was made for a connection that closed
+	ResponseCache.Release(Reply);
+	if (!CacheFill)
+		return true;
+	if (Stream)
+		Http2.End(Stream);										// So the client isn't kept waiting
+	else														//  while we make it again
+	{
+		EndTLS();
+		shutdown(SFD, 1);										// SD_SEND
 	}
+	Quiet = true;
+	KeepAlive = false;
+	return false;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Capture() and Connection::EndCache()
+//---------------------------------------------------------------------------------------------
+void CONNECTION::Capture(const char *Data, int Length)
+{
+	if (!CacheFill)
+		return;
+	if (Captured.length() + Length > ResponseCache.Largest())
+		EndCache(CACHE_UNCACHEABLE);							// Too big to keep
+	else
+		Captured.append(Data, Length);
+}
+
+void CONNECTION::EndCache(int How)
+{
+	if (!CacheFill)
+		return;
+	ResponseCache.Finish(CacheFill, Captured, How, Authorized);
+	CacheFill = NULL;
+	if (Captured.capacity() > IOBUFFER_BULK)
+		string().swap(Captured);								// Don't keep a big reply's memory in the pool
+	else
+		Captured.erase();
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::SendStatus()
+//			Sends the server statistics, in the Prometheus text format or as JSON (?format=json)
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::SendStatus()
+{
+	bool JSON = (QueryValue(QueryString, "format") == "json");
+
+	RESPONSEWRITER Out(SFD);
+	StartResponse(Out, "OK", JSON ? "application/json" : "text/plain; version=0.0.4");
+	Out.Header("Cache-Control", "no-cache");
+
+	if (strcmpi(RequestType.c_str(), "HEAD"))
+	{
+		if (JSON)	Metrics.WriteJSON(Out);
+		else		Metrics.WritePrometheus(Out);
+	}
+	Out.End();
+	KeepAlive = Out.KeepAlive;
+	return !Out.Failed;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -891,74 +2020,250 @@ bool CONNECTION::SendError()
 	RealFile += IntToString(Status);							// Error code
 	RealFile += ".html";										// Extension
 
-	char Buffer[10000];											// Buffer to store data
-
+	if (BytesSent)												// Something already went out for this one, the
+		KeepAlive = false;										//  client can't tell where the error starts
+	RESPONSEWRITER Out(SFD);
 	string ErrorPage;
-
-	ifstream hFile (RealFile.c_str());	
-	if (hFile)													// The file exists
+	int Code = Status;
+	if (ReadText(RealFile.c_str(), ErrorPage))					// Since we have an HTML file to send them, just send a 200
 	{
-		ErrorPage = "HTTP/1.1 ";								// Since we have an HTML file to send them, just send a 200
-		ErrorPage += "200";
-		ErrorPage += ' ';
-		ErrorPage += "OK";
-		ErrorPage += "\nContent-type: text/html\n\n";
-		while (!hFile.eof())									// Go until the end
-		{
-			hFile.getline(Buffer, 10000);						// Read a full line
-			ErrorPage += Buffer;								// Put it in the string
-			ErrorPage += "\n";									// Remember to add the \n
-		}
-		hFile.close();											// Close
+		Status = 200;
+		StartResponse(Out, "OK", "text/html");
+		Status = Code;											// Logged as the error it was
 	}
-	
 	else														// There was no custom error page for this code
-	{					
-		ErrorPage = "HTTP/1.1 ";								
-		ErrorPage += IntToString(Status);						// Send the appropriate status code
-		ErrorPage += ' ';
-		ErrorPage += Options.ErrorCode[Status];
-		ErrorPage += "\nContent-type: text/html\n\n";
-
-		ErrorPage += "<html><body><center><b>";					// Send a basic and boring looking error page
+	{
+		StartResponse(Out, Options.Reason(Status), "text/html");
+
+		ErrorPage = "<html><body><center><b>";					// Send a basic and boring looking error page
 		ErrorPage += IntToString(Status);
 		ErrorPage += " ";
-		ErrorPage += Options.ErrorCode[Status];
+		ErrorPage += Options.Reason(Status);
 		ErrorPage += "</b></body></html>";
 	}
-	int Y = send (SFD, ErrorPage.c_str(), ErrorPage.length(), 0);
+	Out.Write(ErrorPage);
+	Out.End();
+	KeepAlive = Out.KeepAlive;
+	return !Out.Failed;
+}
 
-	if (Y != 0)					
-		return true;											// It sent fine
-	else
-		return false;											// Errors sending
-	
-	return false;
+//---------------------------------------------------------------------------------------------
+//			Connection::SendNotModified
+//			No body, so nothing to frame and no Content-Length, and the connection can be kept.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::SendNotModified()
+{
+	RESPONSEWRITER Out(SFD);
+	StartResponse(Out, Options.Reason(304), NULL);
+	Out.End();
+	KeepAlive = Out.KeepAlive;
+	return !Out.Failed;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::ReadText()
+//			Adds a text file to Text a line at a time, ending each line with \n. Returns false,
+//			with Text as it was, if the file can't be read.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::ReadText(const char *FileName, string &Text)
+{
+	ifstream hFile (FileName);
+	if (!hFile)
+		return false;
+	IOBUFFER *Line = IOBuffers.Get(IOBUFFER_BULK);
+	if (!Line)
+		return false;
+
+	while (!hFile.eof())										// Go until the end
+	{
+		hFile.getline(Line->Data, Line->Size);					// Read a full line
+		Text += Line->Data;										// Put it in the string
+		if (hFile.fail() && !hFile.eof() && !hFile.bad())	// The line didn't fit, get the rest of it
+		{
+			hFile.clear();
+			continue;
+		}
+		Text += "\n";											// Remember to add the \n
+	}
+	hFile.close();												// Close
+	IOBuffers.Put(Line);
+	return true;
 }
 
 //---------------------------------------------------------------------------------------------
 //			Connection::LogText()
-//			Logs the string passed as an argument. This is just a temporary log, 
-//			used for testing. A propper logging function must be written to replace this.
+//			Logs the string passed as an argument to the text log (LOG_TEXTFILE).
 //---------------------------------------------------------------------------------------------
 bool CONNECTION::LogText(string Text)
 {
-	FILE* log;
-	log = fopen("C:\\SWS\\testlog.txt", "a+");
-	if (log == NULL)
-      return false;
-	fprintf(log, "%s", Text.c_str());
-	fclose(log);
+	AccessLog.WriteText(Text.c_str());
 	return true;
 }
 
+//---------------------------------------------------------------------------------------------
+//			Connection::LogConnection()
+//			Queues a record of this request for the access log. The log is written by another
+//			thread, so this never waits on the disk.
+//---------------------------------------------------------------------------------------------
+bool CONNECTION::LogConnection()
+{
+	LOGRECORD Record;
+	Record.Kind = LOG_ACCESS;
+	Record.Status = Status;
+	Record.File = (ThisHost && ThisHost->LogNumber >= 0) ? ThisHost->LogNumber : AccessLog.MainFile;
+	Record.Time = (DWORD)Clock.Seconds();
+	Record.Address = ClientAddress.sin_addr.s_addr;
+	Record.Bytes = BytesSent;
+	CopyField(Record.Request, sizeof(Record.Request), RequestLine.c_str());
+	CopyField(Record.Referer, sizeof(Record.Referer), Referer.c_str());
+	CopyField(Record.UserAgent, sizeof(Record.UserAgent), UserAgent.c_str());
+
+	AccessLog.Write(Record);
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::CountRequest()
+//			Adds this request to the server statistics once it has been answered.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::CountRequest()
+{
+	Mark(STAGE_SEND);											// Whatever is left is sending the response
+	StageTicks[STAGE_TOTAL] = LastMark - Arrived;
+	StagesUsed |= 1 << STAGE_TOTAL;
+
+	Metrics.Request(RequestType, Status, BytesSent);
+	Latency.Record(StageTicks, StagesUsed);
+
+	// Slow requests go in the text log with where the time went
+	DWORD Total = Latency.Microseconds(StageTicks[STAGE_TOTAL]);
+	if (Options.SlowRequestMs > 0 && Total >= (DWORD)Options.SlowRequestMs * 1000)
+	{
+		char Text[512];
+		int Length = sprintf(Text, "Slow request: %lu.%03lu ms %d \"%.200s\"", Total / 1000, Total % 1000,
+							 Status, RequestLine.c_str());
+		for (int S = 0; S < STAGE_TOTAL; S++)
+		{
+			DWORD Micro = Latency.Microseconds(StageTicks[S]);
+			if (StagesUsed & (1 << S))
+				Length += sprintf(Text + Length, " %s %lu.%03lu", StageNames[S], Micro / 1000, Micro % 1000);
+		}
+		strcpy(Text + Length, "\n");
+		AccessLog.WriteText(Text);
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Mark()
+//			Ends a stage of the request. Stages can happen more than once (the lookup is done in
+//			a few places) and their times add up.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::Mark(int Stage)
+{
+	__int64 Now = Latency.Now();
+	StageTicks[Stage] += Now - LastMark;
+	StagesUsed |= 1 << Stage;
+	LastMark = Now;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Send()
+//			Everything sent to the client goes through here, so it can be counted.
+//---------------------------------------------------------------------------------------------
+int CONNECTION::Send(const char *Data, int Length)
+{
+	Capture(Data, Length);
+	if (Quiet)
+		return Length;											// The client has what it's getting
+	int Sent = 0;
+	if (Stream && Http2.Output(Stream, Data, Length) == Length)
+		Sent = Length;											// The stream keeps its own deadlines
+	while (!Stream && Sent < Length)
+	{
+		Arm(TIMEOUT_SEND);
+		int Y = Secure ? Tls.Send(Secure, Data + Sent, Length - Sent) : send(SFD, Data + Sent, Length - Sent, 0);
+		if (Y <= 0)
+			break;												// Client has gone, or stopped taking it
+		Sent += Y;
+	}
+	BytesSent += Sent;
+	if (Sent < Length)
+		KeepAlive = false;										// The response is cut short
+	return Sent;
+}
+
+int CONNECTION::Deliver(void *Connection, const char *Data, int Length)
+{
+	return ((CONNECTION *)Connection)->Send(Data, Length);
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::StartResponse() and Connection::Persistence()
+//			StartResponse() sends Out through Send(), so it goes wherever the rest of the
+//			response would, is captured for the response cache and counted.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::StartResponse(RESPONSEWRITER &Out, const char *Reason, const char *ContentType)
+{
+	Out.Through(Deliver, this);
+	Out.Start(HTTPVersion.length() ? HTTPVersion : string("HTTP/1.1"), Status, Reason, KeepAlive,
+			  !strcmpi(RequestType.c_str(), "HEAD"));
+	Out.Header("Server", Options.Servername);
+	Out.Header("Date", Date);
+	if (ContentType)
+		Out.Header("Content-type", ContentType);
+}
+
+const char *CONNECTION::Persistence()
+{
+	if (!KeepAlive)
+		return "\r\nConnection: close";
+	if (!strcmpi(HTTPVersion.c_str(), "HTTP/1.0"))
+		return "\r\nConnection: keep-alive";
+	return "";													// HTTP/1.1 stays open unless it's told
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::Arm()
+//			Gives the client until Options' timeout for Kind to do whatever comes next, or the
+//			socket is shut down under it. Replaces any deadline already set.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::Arm(int Kind)
+{
+	if (Stream)
+		return;													// Our socket is the whole HTTP/2 connection's
+	int Seconds = Options.Timeout;
+	if (Kind == TIMEOUT_HEADER && Options.HeaderTimeout > 0)	Seconds = Options.HeaderTimeout;
+	if (Kind == TIMEOUT_BODY && Options.BodyTimeout > 0)		Seconds = Options.BodyTimeout;
+	if (Kind == TIMEOUT_SEND && Options.SendTimeout > 0)		Seconds = Options.SendTimeout;
+	if (Kind == TIMEOUT_KEEPALIVE && Options.KeepAliveTimeout > 0)	Seconds = Options.KeepAliveTimeout;
+	if (Seconds <= 0)
+	{
+		Timers.Cancel(&Deadline);								// No deadline at all
+		return;
+	}
+	Deadline.Kind = Kind;
+	Timers.Arm(&Deadline, Seconds * 1000);
+}
+
+//---------------------------------------------------------------------------------------------
+//			Connection::DeadlinePassed()
+//			Runs on the timer thread. Shutting the socket down makes whatever the connection is
+//			waiting in (recv(), send(), an overlapped read) fail, and it finishes as if the
+//			client had gone. The socket is only closed by its own thread.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::DeadlinePassed(TIMER *Timer)
+{
+	CONNECTION *C = (CONNECTION *)Timer->Owner;
+	shutdown(C->SFD, 2);										// SD_BOTH, which winsock.h doesn't have
+	Metrics.TimedOut(Timer->Kind);
+}
+
 //---------------------------------------------------------------------------------------------
 //			Connection::CalculateSize()
-//			Calculates and returns the size of the file requested.
+//			Writes the size of the file requested into Out.
 //---------------------------------------------------------------------------------------------
-string CONNECTION::CalculateSize()
+void CONNECTION::CalculateSize(char *Out)
 {
-	string ReturnValue;
 	unsigned long Size = 0;
 
 	HANDLE hFile = CreateFile(
@@ -973,12 +2278,33 @@ string CONNECTION::CalculateSize()
 	if (hFile != INVALID_HANDLE_VALUE)							// If the file was opened
 	{
 		Size = GetFileSize(hFile, NULL);						// Get the size
+		CloseHandle(hFile);
 	}
 	
-	ReturnValue = IntToString(Size);							// Convert it to a printable string
-	return ReturnValue;
+	FormatNumber(Size, Out);									// Convert it to a printable string
 }
 
+//---------------------------------------------------------------------------------------------
+//			Connection::ReadDate()
+//			Reads a date header into Out. Word is the first word of it, and the number of words
+//			left depends on which of the three date formats it is.
+//---------------------------------------------------------------------------------------------
+void CONNECTION::ReadDate(WORDREADER &IS, string &Word, string &Out)
+{
+	int Words;
+	if (Word.length() > 3 && Word[3] == ',')	Words = 6;		// Sun, 06 Nov 1994 08:49:37 GMT
+	else if (Word.length() > 3)					Words = 4;		// Sunday, 06-Nov-94 08:49:37 GMT
+	else										Words = 5;		// Sun Nov  6 08:49:37 1994
+
+	Out = Word;
+	Out += ' ';
+	for (int W = 1; W < Words; W++)
+	{
+		IS >> Word;
+		Out += Word;
+		Out += ' ';
+	}
+}
 
 //---------------------------------------------------------------------------------------------
 //			Connection::ModifiedSince()
@@ -986,127 +2312,17 @@ string CONNECTION::CalculateSize()
 //---------------------------------------------------------------------------------------------
 bool CONNECTION::ModifiedSince(string Date)
 {
-	//----------------------------------------------------------
-	string Temp;
-	time_t now;
-	struct tm *tm_now = new tm;
-	struct tm *tm_date = new tm;
+	time_t Since;
+	if (!ParseHTTPDate(Date.c_str(), &Since))					// If we can't read the date, send the file
+		return true;
 
 	// Get the time the file was last modified:
-	SYSTEMTIME myTime;											// Windows time structure
-	HANDLE hFind;
-    WIN32_FIND_DATA FindData;
-
-	now = time ( NULL );										// Get the current time
-	tm_date = localtime ( &now );
-	
-	hFind = FindFirstFile(RealFile.c_str(), &FindData);			// Open the file
-	FileTimeToSystemTime(&FindData.ftLastWriteTime, &myTime);	// Get its time
-	
-	tm_now->tm_hour = myTime.wHour + 1;							// Copy the time settings
-	tm_now->tm_min = myTime.wMinute;
-	tm_now->tm_mday = myTime.wDay;
-	tm_now->tm_mon = myTime.wMonth - 1;
-	tm_now->tm_sec = myTime.wSecond;
-	tm_now->tm_year = myTime.wYear;
-	tm_now->tm_year -= 1900;
-
-	//----------------------------------------------------------
-	int Day;
-	string Month;
-	int Year;
-	int Hour;
-	int Minute;
-	int Second;
-	
-	int Type = 0;
-
-	istringstream DateString1(Date);
-	DateString1 >> Temp;
-
-	if (Temp[3] == ',')
-	{
-		Type = 1;
-		//------------------------------------------------------
-		for (int X = 0; X < Date.length(); X++)
-		{
-			if ( Date[X] == ':' )
-				Date[X] = ' ';
-		}
-
-		istringstream DateString(Date);
-		DateString >> Temp;
-		//------------------------------------------------------
-		DateString >> Day;
-		DateString >> Month;
-		DateString >> Year;
-		DateString >> Hour;
-		DateString >> Minute;
-		DateString >> Second;
-	}
-	else if (Temp.length() > 3)
-	{
-		Type = 2;
-		//------------------------------------------------------
-		for (int X = 0; X < Date.length(); X++)
-		{
-			if ( Date[X] == ':' )
-				Date[X] = ' ';
-		}
-		for (int Z = 0; Z < Date.length(); Z++)
-		{
-			if ( Date[Z] == '-' )
-				Date[Z] = ' ';
-		}
-		istringstream DateString(Date);
-		DateString >> Temp;
-		//------------------------------------------------------
-		DateString >> Day;
-		DateString >> Month;
-		DateString >> Year;
-		Year += 2000;
-		if (Year > 2050)
-			return true;
-		DateString >> Hour;
-		DateString >> Minute;
-		DateString >> Second;
-	}
-	else if (Temp[3] != ',')
-	{
-		Type = 3;
-		//------------------------------------------------------
-		for (int X = 0; X < Date.length(); X++)
-		{
-			if ( Date[X] == ':' )
-				Date[X] = ' ';
-		}
-
-		istringstream DateString(Date);
-		DateString >> Temp;
-		//------------------------------------------------------
-		
-		DateString >> Month;
-		DateString >> Day;
-		DateString >> Hour;
-		DateString >> Minute;
-		DateString >> Second;
-		DateString >> Year;
-	}
+	WIN32_FILE_ATTRIBUTE_DATA FileData;
+	if (!GetFileAttributesEx(RealFile.c_str(), GetFileExInfoStandard, &FileData))
+		return true;
 
-	//----------------------------------------------------------
-	tm_date->tm_hour = Hour;
-	tm_date->tm_mday = Day;
-	tm_date->tm_min = Minute;
-	tm_date->tm_mon = CalcMonth(Month);
-	tm_date->tm_sec = Second;
-	tm_date->tm_year = Year - 1900;
-	
-	//----------------------------------------------------------
-	
-	int Y = difftime(mktime(tm_date), mktime(tm_now));
-	delete tm_now;
-	delete tm_date;
-	if (Y < 0)
+	time_t Modified = FileTimeToUnix(&FileData.ftLastWriteTime);
+	if (Modified > Since)
 	{
 		return true;
 	}
@@ -1131,4 +2347,95 @@ bool CONNECTION::UnModifiedSince(string Date)
 	}
 }
 //---------------------------------------------------------------------------------------------
+//			Connection pool
+//			Keeps connections that have finished, so the next request gets one that has already
+//			grown its strings and its arena. Like the metrics, it is split into shards so threads
+//			rarely wait for each other, and each thread uses the shard its thread ID picks.
+//---------------------------------------------------------------------------------------------
+struct POOLSHARD
+{
+	volatile LONG Lock;											// Spin lock, 1 while someone is using the shard
+	int Count;													// Connections in Free
+	CONNECTION *Free[POOL_PERSHARD];							// Connections waiting to be used again
+	char Padding[64];											// Keeps the next shard off this one's cache line
+};
+
+class CONNECTIONPOOL
+{
+  public:
+	CONNECTIONPOOL();											// Constructor
+	~CONNECTIONPOOL();											// Destructor
+
+	CONNECTION *Get(int SFD, struct sockaddr_in CA);			// A connection ready for a request
+	void Put(CONNECTION *Connection);							// Gives a connection back when it is done
+
+	volatile LONG Created;										// Connections made with new
+	volatile LONG Reused;										// Connections that came out of the pool
+
+  private:
+	POOLSHARD Shards[SHARD_COUNT];
+}ConnectionPool;
+
+CONNECTIONPOOL::CONNECTIONPOOL()
+{
+	memset(Shards, 0, sizeof(Shards));
+	Created = Reused = 0;
+}
+
+CONNECTIONPOOL::~CONNECTIONPOOL()
+{
+	for (int S = 0; S < SHARD_COUNT; S++)
+	{
+		for (int X = 0; X < Shards[S].Count; X++)
+			delete Shards[S].Free[X];
+		Shards[S].Count = 0;
+	}
+}
+
+//---------------------------------------------------------------------------------------------
+//			CONNECTIONPOOL::Get() - takes a connection from this thread's shard, or makes one
+//---------------------------------------------------------------------------------------------
+CONNECTION *CONNECTIONPOOL::Get(int SFD, struct sockaddr_in CA)
+{
+	POOLSHARD *Shard = &Shards[ShardNumber()];
+	CONNECTION *Connection = NULL;
+
+	LockShard(&Shard->Lock);
+	if (Shard->Count > 0)
+		Connection = Shard->Free[--Shard->Count];
+	UnlockShard(&Shard->Lock);
+
+	if (Connection)
+	{
+		InterlockedIncrement(&Reused);
+		Connection->Reset(SFD, CA);
+		return Connection;
+	}
+	InterlockedIncrement(&Created);
+	return new CONNECTION(SFD, CA);
+}
+
+//---------------------------------------------------------------------------------------------
+//			CONNECTIONPOOL::Put() - keeps the connection, or deletes it if the shard is full
+//---------------------------------------------------------------------------------------------
+void CONNECTIONPOOL::Put(CONNECTION *Connection)
+{
+	if (!Connection)
+		return;
+	Timers.Cancel(&Connection->Deadline);						// Before its socket is closed and reused
+	Connection->EndCache(CACHE_ABANDON);						// If it stopped before it got all of it
+	Connection->EndTLS();
+	POOLSHARD *Shard = &Shards[ShardNumber()];
+
+	LockShard(&Shard->Lock);
+	if (Shard->Count < POOL_PERSHARD)
+	{
+		Shard->Free[Shard->Count++] = Connection;
+		Connection = NULL;
+	}
+	UnlockShard(&Shard->Lock);
+
+	delete Connection;											// NULL if the shard kept it
+}
+//---------------------------------------------------------------------------------------------
 #endif
@@ -0,0 +1,59 @@
+#ifndef COROUTINEHPP
+#define COROUTINEHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			COROUTINE.HPP
+			-------------
+			Stackless coroutines, so something that waits on overlapped I/O can be written as
+			one function from top to bottom, rather than as a callback for every step. The
+			function returns whenever it starts an operation, and the completion thread calls
+			it again when the operation finishes. It carries on from where it left off:
+
+				void Run(JOB *Job)
+				{
+					COROUTINE *Co = &Job->Co;
+					CO_BEGIN(Co);
+					...
+					CO_AWAIT(Co, 1, StartRead(Job));			// Returns, carries on here when it's read
+					if (!Co->Result)
+						...										// The read failed, or never started
+					...
+					CO_END(Co);
+				}
+
+			Whoever calls it again sets Co->Result and Co->Bytes from the completion first.
+
+			Underneath it is a switch statement with a case for each CO_AWAIT, so:
+
+				- Locals don't keep their values across a CO_AWAIT. Anything needed after
+				  one goes in the struct.
+				- Each CO_AWAIT in a function has its own number, 1 or more. (Not __LINE__,
+				  which isn't a constant when compiling for Edit and Continue.)
+				- No switch statements of your own between CO_BEGIN and CO_END.
+				- No declarations with initialisers before a CO_AWAIT in the same { }, as
+				  the jump to it would skip them. After it is fine.
+				- Once a coroutine has reached CO_END it must not be called again.
+
+			The whole state of a waiting coroutine is its struct, a few hundred bytes, where
+			a blocked thread needs a stack.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+
+struct COROUTINE
+{
+	int Point;													// Which CO_AWAIT to carry on from, 0 for the start
+	bool Result;												// Did the operation it waited for work
+	DWORD Bytes;												// Bytes the operation moved
+};
+
+#define CO_BEGIN(Co)						switch ((Co)->Point) { case 0:
+
+// Point is set before Start, because the operation can finish, and the coroutine be called
+//  again on another thread, before Start has even returned.
+#define CO_AWAIT(Co, N, Start)				do { (Co)->Point = (N); if (Start) return; \
+												 (Co)->Result = false; (Co)->Bytes = 0; case (N):; } while (0)
+
+#define CO_END(Co)							}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,532 @@
+#ifndef HPACKHPP
+#define HPACKHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			HPACK.HPP
+			---------
+			HTTP/2's header compression (RFC 7541), for http2.hpp. Each end of a connection
+			keeps a table of headers it has seen, and a header already in the table, or in
+			the fixed table of the 61 most common ones, is sent as its index.
+
+			HPACKDECODER reads the client's header blocks. Each connection has its own, as
+			the table is the connection's, and only the thread reading the connection uses
+			it. Strings can be Huffman coded, which browsers nearly always do, so they are
+			decoded by walking a tree built from the RFC's code table when the server
+			starts.
+
+			HPACKENCODER writes the replies'. It indexes headers that come up again and
+			again (Server:, Content-type:, Cache-Control:) so they cost a byte or two after
+			the first reply, and sends ones that change every time (Date:, Content-length:,
+			ETag:) as literals that aren't kept, so they don't push the rest out. Replies
+			aren't Huffman coded, which saves the time for a few bytes.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define HPACK_STATIC						61						// Entries in the static table
+#define HPACK_TABLE							4096					// SETTINGS_HEADER_TABLE_SIZE's default, the most we use
+#define HPACK_OVERHEAD						32						// Added to each entry's size by the RFC
+#define HPACK_NODES							256						// Huffman tree nodes, one less than there are symbols
+
+//----------------------------------------------------------------------------------------------------
+//			The static table (RFC 7541 Appendix A) and the Huffman code (Appendix B)
+//----------------------------------------------------------------------------------------------------
+static const char *HpackStatic[HPACK_STATIC][2] =
+{
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" }
+};
+
+static const DWORD HuffmanCodes[256] =
+{
+	0x00001ff8, 0x007fffd8, 0x0fffffe2, 0x0fffffe3, 0x0fffffe4, 0x0fffffe5, 0x0fffffe6, 0x0fffffe7,
+	0x0fffffe8, 0x00ffffea, 0x3ffffffc, 0x0fffffe9, 0x0fffffea, 0x3ffffffd, 0x0fffffeb, 0x0fffffec,
+	0x0fffffed, 0x0fffffee, 0x0fffffef, 0x0ffffff0, 0x0ffffff1, 0x0ffffff2, 0x3ffffffe, 0x0ffffff3,
+	0x0ffffff4, 0x0ffffff5, 0x0ffffff6, 0x0ffffff7, 0x0ffffff8, 0x0ffffff9, 0x0ffffffa, 0x0ffffffb,
+	0x00000014, 0x000003f8, 0x000003f9, 0x00000ffa, 0x00001ff9, 0x00000015, 0x000000f8, 0x000007fa,
+	0x000003fa, 0x000003fb, 0x000000f9, 0x000007fb, 0x000000fa, 0x00000016, 0x00000017, 0x00000018,
+	0x00000000, 0x00000001, 0x00000002, 0x00000019, 0x0000001a, 0x0000001b, 0x0000001c, 0x0000001d,
+	0x0000001e, 0x0000001f, 0x0000005c, 0x000000fb, 0x00007ffc, 0x00000020, 0x00000ffb, 0x000003fc,
+	0x00001ffa, 0x00000021, 0x0000005d, 0x0000005e, 0x0000005f, 0x00000060, 0x00000061, 0x00000062,
+	0x00000063, 0x00000064, 0x00000065, 0x00000066, 0x00000067, 0x00000068, 0x00000069, 0x0000006a,
+	0x0000006b, 0x0000006c, 0x0000006d, 0x0000006e, 0x0000006f, 0x00000070, 0x00000071, 0x00000072,
+	0x000000fc, 0x00000073, 0x000000fd, 0x00001ffb, 0x0007fff0, 0x00001ffc, 0x00003ffc, 0x00000022,
+	0x00007ffd, 0x00000003, 0x00000023, 0x00000004, 0x00000024, 0x00000005, 0x00000025, 0x00000026,
+	0x00000027, 0x00000006, 0x00000074, 0x00000075, 0x00000028, 0x00000029, 0x0000002a, 0x00000007,
+	0x0000002b, 0x00000076, 0x0000002c, 0x00000008, 0x00000009, 0x0000002d, 0x00000077, 0x00000078,
+	0x00000079, 0x0000007a, 0x0000007b, 0x00007ffe, 0x000007fc, 0x00003ffd, 0x00001ffd, 0x0ffffffc,
+	0x000fffe6, 0x003fffd2, 0x000fffe7, 0x000fffe8, 0x003fffd3, 0x003fffd4, 0x003fffd5, 0x007fffd9,
+	0x003fffd6, 0x007fffda, 0x007fffdb, 0x007fffdc, 0x007fffdd, 0x007fffde, 0x00ffffeb, 0x007fffdf,
+	0x00ffffec, 0x00ffffed, 0x003fffd7, 0x007fffe0, 0x00ffffee, 0x007fffe1, 0x007fffe2, 0x007fffe3,
+	0x007fffe4, 0x001fffdc, 0x003fffd8, 0x007fffe5, 0x003fffd9, 0x007fffe6, 0x007fffe7, 0x00ffffef,
+	0x003fffda, 0x001fffdd, 0x000fffe9, 0x003fffdb, 0x003fffdc, 0x007fffe8, 0x007fffe9, 0x001fffde,
+	0x007fffea, 0x003fffdd, 0x003fffde, 0x00fffff0, 0x001fffdf, 0x003fffdf, 0x007fffeb, 0x007fffec,
+	0x001fffe0, 0x001fffe1, 0x003fffe0, 0x001fffe2, 0x007fffed, 0x003fffe1, 0x007fffee, 0x007fffef,
+	0x000fffea, 0x003fffe2, 0x003fffe3, 0x003fffe4, 0x007ffff0, 0x003fffe5, 0x003fffe6, 0x007ffff1,
+	0x03ffffe0, 0x03ffffe1, 0x000fffeb, 0x0007fff1, 0x003fffe7, 0x007ffff2, 0x003fffe8, 0x01ffffec,
+	0x03ffffe2, 0x03ffffe3, 0x03ffffe4, 0x07ffffde, 0x07ffffdf, 0x03ffffe5, 0x00fffff1, 0x01ffffed,
+	0x0007fff2, 0x001fffe3, 0x03ffffe6, 0x07ffffe0, 0x07ffffe1, 0x03ffffe7, 0x07ffffe2, 0x00fffff2,
+	0x001fffe4, 0x001fffe5, 0x03ffffe8, 0x03ffffe9, 0x0ffffffd, 0x07ffffe3, 0x07ffffe4, 0x07ffffe5,
+	0x000fffec, 0x00fffff3, 0x000fffed, 0x001fffe6, 0x003fffe9, 0x001fffe7, 0x001fffe8, 0x007ffff3,
+	0x003fffea, 0x003fffeb, 0x01ffffee, 0x01ffffef, 0x00fffff4, 0x00fffff5, 0x03ffffea, 0x007ffff4,
+	0x03ffffeb, 0x07ffffe6, 0x03ffffec, 0x03ffffed, 0x07ffffe7, 0x07ffffe8, 0x07ffffe9, 0x07ffffea,
+	0x07ffffeb, 0x0ffffffe, 0x07ffffec, 0x07ffffed, 0x07ffffee, 0x07ffffef, 0x07fffff0, 0x03ffffee
+};
+
+static const BYTE HuffmanLengths[256] =
+{
+	13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+	28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+	6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+	5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+	13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+	7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+	15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+	6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+	20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+	24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+	22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+	21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+	26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+	19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+	20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+	26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26
+};
+
+//----------------------------------------------------------------------------------------------------
+//			A header
+//----------------------------------------------------------------------------------------------------
+struct HPACKFIELD
+{
+	string Name;
+	string Value;
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Huffman class - decodes Huffman coded strings
+//----------------------------------------------------------------------------------------------------
+class HUFFMAN
+{
+  public:
+	HUFFMAN();													// Constructor, builds the tree
+	bool Decode(const BYTE *Data, DWORD Length, string &Out);	// Adds the decoded string to Out, false if it's wrong
+
+  private:
+	short Tree[HPACK_NODES][2];									// Children for a 0 and a 1. A symbol is -(symbol + 1)
+}Huffman;
+
+HUFFMAN::HUFFMAN()
+{
+	memset(Tree, 0, sizeof(Tree));
+	int Nodes = 1;												// Node 0 is the root
+	for (int Symbol = 0; Symbol < 256; Symbol++)
+	{
+		int Node = 0;
+		for (int Bit = HuffmanLengths[Symbol] - 1; Bit >= 0; Bit--)
+		{
+			int Side = (HuffmanCodes[Symbol] >> Bit) & 1;
+			if (!Bit)
+				Tree[Node][Side] = (short)-(Symbol + 1);
+			else
+			{
+				if (!Tree[Node][Side])
+					Tree[Node][Side] = (short)Nodes++;
+				Node = Tree[Node][Side];
+			}
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HUFFMAN::Decode() - a bit at a time. What's left at the end must be the start of
+//			EOS, which is all 1s, and shorter than a byte.
+//----------------------------------------------------------------------------------------------------
+bool HUFFMAN::Decode(const BYTE *Data, DWORD Length, string &Out)
+{
+	int Node = 0;
+	int Bits = 0;												// Since the last symbol
+	bool Ones = true;											// Were they all 1s
+	for (DWORD X = 0; X < Length; X++)
+	{
+		for (int Bit = 7; Bit >= 0; Bit--)
+		{
+			int Side = (Data[X] >> Bit) & 1;
+			int Next = Tree[Node][Side];
+			if (!Next)
+				return false;									// EOS, which can't be in a string
+			Bits++;
+			Ones = Ones && Side;
+			if (Next < 0)
+			{
+				Out += (char)(-Next - 1);
+				Node = Bits = 0;
+				Ones = true;
+			}
+			else Node = Next;
+		}
+	}
+	return Bits < 8 && Ones;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Integers and strings, as the RFC codes them. An integer starts in the low Prefix
+//			bits of a byte whose other bits say what it is.
+//----------------------------------------------------------------------------------------------------
+bool ReadHpackInteger(const BYTE *&At, const BYTE *End, int Prefix, DWORD &Value)
+{
+	if (At >= End)
+		return false;
+	DWORD Most = (1 << Prefix) - 1;
+	Value = *At++ & Most;
+	if (Value < Most)
+		return true;
+	for (int Shift = 0; At < End && Shift <= 21; Shift += 7)	// 28 bits is plenty
+	{
+		BYTE Byte = *At++;
+		Value += (DWORD)(Byte & 0x7f) << Shift;
+		if (!(Byte & 0x80))
+			return true;
+	}
+	return false;
+}
+
+bool ReadHpackString(const BYTE *&At, const BYTE *End, string &Out)
+{
+	if (At >= End)
+		return false;
+	bool Coded = (*At & 0x80) != 0;
+	DWORD Length;
+	if (!ReadHpackInteger(At, End, 7, Length) || Length > (DWORD)(End - At))
+		return false;
+	Out.erase();
+	if (Coded)
+	{
+		if (!Huffman.Decode(At, Length, Out))
+			return false;
+	}
+	else Out.assign((const char *)At, Length);
+	At += Length;
+	return true;
+}
+
+void WriteHpackInteger(string &Out, BYTE First, int Prefix, DWORD Value)
+{
+	DWORD Most = (1 << Prefix) - 1;
+	if (Value < Most)
+	{
+		Out += (char)(First | Value);
+		return;
+	}
+	Out += (char)(First | Most);
+	for (Value -= Most; Value >= 128; Value >>= 7)
+		Out += (char)(0x80 | (Value & 0x7f));
+	Out += (char)Value;
+}
+
+void WriteHpackString(string &Out, const string &Text)
+{
+	WriteHpackInteger(Out, 0, 7, Text.length());				// Not Huffman coded
+	Out += Text;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			A dynamic table, newest first. Indexes carry on from the static table's.
+//----------------------------------------------------------------------------------------------------
+class HPACKTABLE
+{
+  public:
+	HPACKTABLE();												// Constructor
+	bool Get(DWORD Index, string &Name, string &Value);			// Looks up an index, false if there isn't one
+	DWORD Find(const string &Name, const string &Value, bool *Whole);	// Best index for a header, 0 for none
+	void Add(const string &Name, const string &Value);			// Adds a header, evicting the oldest to make room
+	void Resize(DWORD Size);									// Sets the limit, evicting if it's smaller
+
+	DWORD Limit;												// Most it can hold, as the RFC counts it
+
+  private:
+	void Evict(DWORD Room);										// Evicts until Room more would fit
+
+	deque <HPACKFIELD> Fields;
+	DWORD Size;													// As the RFC counts it
+};
+
+HPACKTABLE::HPACKTABLE()
+{
+	Limit = HPACK_TABLE;
+	Size = 0;
+}
+
+bool HPACKTABLE::Get(DWORD Index, string &Name, string &Value)
+{
+	if (Index >= 1 && Index <= HPACK_STATIC)
+	{
+		Name = HpackStatic[Index - 1][0];
+		Value = HpackStatic[Index - 1][1];
+		return true;
+	}
+	Index -= HPACK_STATIC + 1;
+	if (Index >= Fields.size())
+		return false;											// Including 0, which wrapped
+	Name = Fields[Index].Name;
+	Value = Fields[Index].Value;
+	return true;
+}
+
+DWORD HPACKTABLE::Find(const string &Name, const string &Value, bool *Whole)
+{
+	DWORD Named = 0;
+	*Whole = false;
+	DWORD X;
+	for (X = 0; X < HPACK_STATIC; X++)
+	{
+		if (Name != HpackStatic[X][0])
+			continue;
+		if (Value == HpackStatic[X][1])
+		{
+			*Whole = true;
+			return X + 1;
+		}
+		if (!Named)
+			Named = X + 1;
+	}
+	for (X = 0; X < Fields.size(); X++)
+	{
+		if (Fields[X].Name != Name)
+			continue;
+		if (Fields[X].Value == Value)
+		{
+			*Whole = true;
+			return X + HPACK_STATIC + 1;
+		}
+		if (!Named)
+			Named = X + HPACK_STATIC + 1;
+	}
+	return Named;
+}
+
+void HPACKTABLE::Add(const string &Name, const string &Value)
+{
+	DWORD Entry = Name.length() + Value.length() + HPACK_OVERHEAD;
+	if (Entry > Limit)
+	{
+		Evict(Limit + 1);										// Too big for the table, which empties it
+		return;
+	}
+	Evict(Entry);
+	Fields.push_front(HPACKFIELD());
+	Fields.front().Name = Name;
+	Fields.front().Value = Value;
+	Size += Entry;
+}
+
+void HPACKTABLE::Resize(DWORD Size)
+{
+	Limit = Size;
+	Evict(0);
+}
+
+void HPACKTABLE::Evict(DWORD Room)
+{
+	while (!Fields.empty() && Size + Room > Limit)
+	{
+		Size -= Fields.back().Name.length() + Fields.back().Value.length() + HPACK_OVERHEAD;
+		Fields.pop_back();
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Decoder class
+//----------------------------------------------------------------------------------------------------
+class HPACKDECODER
+{
+  public:
+	bool Decode(const BYTE *Block, int Length, vector <HPACKFIELD> &Fields, DWORD Largest);	// False for a
+																//  COMPRESSION_ERROR, or a list bigger than Largest
+  private:
+	HPACKTABLE Table;
+};
+
+//----------------------------------------------------------------------------------------------------
+//			HPACKDECODER::Decode() - the headers in a whole header block, in order
+//----------------------------------------------------------------------------------------------------
+bool HPACKDECODER::Decode(const BYTE *Block, int Length, vector <HPACKFIELD> &Fields, DWORD Largest)
+{
+	const BYTE *At = Block;
+	const BYTE *End = Block + Length;
+	DWORD Total = 0;
+	Fields.clear();
+	while (At < End)
+	{
+		DWORD Index;
+		BYTE Kind = *At;
+		if ((Kind & 0xe0) == 0x20)								// Dynamic table size update, only before any header
+		{
+			if (!Fields.empty() || !ReadHpackInteger(At, End, 5, Index) || Index > HPACK_TABLE)
+				return false;
+			Table.Resize(Index);
+			continue;
+		}
+
+		Fields.push_back(HPACKFIELD());
+		HPACKFIELD &Field = Fields.back();
+		if (Kind & 0x80)										// Indexed
+		{
+			if (!ReadHpackInteger(At, End, 7, Index) || !Table.Get(Index, Field.Name, Field.Value))
+				return false;
+		}
+		else													// Literal, with its name indexed or not
+		{
+			bool Indexing = (Kind & 0xc0) == 0x40;				// Otherwise without indexing, or never indexed
+			string Unused;
+			if (!ReadHpackInteger(At, End, Indexing ? 6 : 4, Index))
+				return false;
+			if (Index ? !Table.Get(Index, Field.Name, Unused) : !ReadHpackString(At, End, Field.Name))
+				return false;
+			if (!ReadHpackString(At, End, Field.Value))
+				return false;
+			if (Indexing)
+				Table.Add(Field.Name, Field.Value);
+		}
+		Total += Field.Name.length() + Field.Value.length() + HPACK_OVERHEAD;
+		if (Total > Largest)
+			return false;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Encoder class
+//----------------------------------------------------------------------------------------------------
+class HPACKENCODER
+{
+  public:
+	HPACKENCODER();												// Constructor
+	void Limit(DWORD Size);										// The client's SETTINGS_HEADER_TABLE_SIZE
+	void Start(string &Block);									// Starts a header block
+	void Field(string &Block, const string &Name, const string &Value);	// Adds a header. Name is in lower case
+
+  private:
+	HPACKTABLE Table;
+	bool Resized;												// The next block has to say so
+};
+
+HPACKENCODER::HPACKENCODER()
+{
+	Resized = false;
+}
+
+void HPACKENCODER::Limit(DWORD Size)
+{
+	if (Size > HPACK_TABLE)
+		Size = HPACK_TABLE;										// More would only cost us memory
+	if (Size == Table.Limit)
+		return;
+	Table.Resize(Size);
+	Resized = true;
+}
+
+void HPACKENCODER::Start(string &Block)
+{
+	Block.erase();
+	if (!Resized)
+		return;
+	WriteHpackInteger(Block, 0x20, 5, Table.Limit);
+	Resized = false;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HPACKENCODER::Field()
+//----------------------------------------------------------------------------------------------------
+void HPACKENCODER::Field(string &Block, const string &Name, const string &Value)
+{
+	bool Whole;
+	DWORD Index = Table.Find(Name, Value, &Whole);
+	if (Whole)
+	{
+		WriteHpackInteger(Block, 0x80, 7, Index);				// Indexed
+		return;
+	}
+
+	// Headers that are different on every reply would only push the others out
+	bool Changes = Name == "date" || Name == "content-length" || Name == "etag" || Name == "last-modified" ||
+				   Name == "expires" || Name == "age";
+	if (Name == "set-cookie")
+		WriteHpackInteger(Block, 0x10, 4, Index);				// Never indexed, by anyone along the way
+	else if (Changes)
+		WriteHpackInteger(Block, 0x00, 4, Index);				// Without indexing
+	else
+		WriteHpackInteger(Block, 0x40, 6, Index);				// With incremental indexing
+	if (!Index)
+		WriteHpackString(Block, Name);
+	WriteHpackString(Block, Value);
+	if (!Changes && Name != "set-cookie")
+		Table.Add(Name, Value);
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,1220 @@
+#ifndef HTTP2HPP
+#define HTTP2HPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			HTTP2.HPP
+			---------
+			HTTP/2 (RFC 7540), so a browser can fetch a whole page's files over one
+			connection rather than opening six or more.
+
+				<Http2>					0 for none, 1 for clients that start a plain
+										connection with it (h2c with prior knowledge),
+										2 to offer it over HTTPS with ALPN as well (2)
+				<Http2Streams>			Streams each connection can have open at once (32)
+
+			A connection is told apart by its preface, which CONNECTION::ReadRequest()
+			would otherwise take for a request, and then its thread reads frames in
+			Serve(). Each stream is a request, run on a thread of its own by the same
+			CONNECTION code as any other (see ProcessStream() in main.cpp). Each stream
+			takes an Admission slot before its thread starts, as a connection does, so
+			<MaxConnections> bounds the streams running as well; one that is shed is
+			refused with REFUSED_STREAM. The connection gives up its own slot while it is
+			served, as all it does is read frames (see CONNECTION::ServeHTTP2()). It is given
+			the request as HTTP/1 text made from the stream's headers, and what it sends
+			comes to Output() instead of going to the socket. Output() turns the status
+			line and headers into a HEADERS frame and the rest into DATA frames, so files,
+			folder indexes, CGI, the status page and proxied replies all work as they are.
+
+			Frames are written whole, under the connection's lock. A stream can only send
+			DATA while its own flow control window and the connection's both have room,
+			and when several are waiting the one that has sent least for its weight goes
+			next (stride scheduling), so a stream of weight 256 gets sixteen times the
+			share of one of weight 16. Only weights are used, not dependencies, which is
+			as far as RFC 9113 still asks. What the client sends is given back to its
+			window as soon as it's read, as a request's body is kept whole anyway.
+
+			ALPN is new in Windows 8.1's SChannel, so on older systems set <Http2> to 1.
+			Under the iocp engine an HTTP/2 connection is given a thread of its own, as
+			HTTPS connections are.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+#include "options.hpp"
+#include "buffer.hpp"
+#include "timers.hpp"
+#include "metrics.hpp"
+#include "tls.hpp"
+#include "hpack.hpp"
+#include "admission.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define H2_PREFACE							"PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define H2_PREFACE_LENGTH					24
+#define H2_PREFACE_LINE						16						// "PRI * HTTP/2.0\r\n", enough to tell
+#define H2_HEADER							9						// Frame header
+#define H2_FRAME							16384					// Largest frame either way, the RFC's default
+#define H2_WINDOW							65535					// Flow control windows start at this
+#define H2_LARGEST_WINDOW					0x7fffffff
+#define H2_WEIGHT							16						// A stream's weight unless it says
+#define H2_LIST								IOBUFFER_REQUEST		// Largest request, headers and body, as for HTTP/1
+
+#define H2_DATA								0x0						// Frame types
+#define H2_HEADERS							0x1
+#define H2_PRIORITY							0x2
+#define H2_RST_STREAM						0x3
+#define H2_SETTINGS							0x4
+#define H2_PUSH_PROMISE						0x5
+#define H2_PING								0x6
+#define H2_GOAWAY							0x7
+#define H2_WINDOW_UPDATE					0x8
+#define H2_CONTINUATION						0x9
+
+#define H2_END_STREAM						0x01					// Flags
+#define H2_ACK								0x01
+#define H2_END_HEADERS						0x04
+#define H2_PADDED							0x08
+#define H2_PRIORITIZED						0x20
+
+#define H2_NO_ERROR							0x0						// Error codes
+#define H2_PROTOCOL_ERROR					0x1
+#define H2_INTERNAL_ERROR					0x2
+#define H2_FLOW_CONTROL_ERROR				0x3
+#define H2_STREAM_CLOSED					0x5
+#define H2_FRAME_SIZE_ERROR					0x6
+#define H2_REFUSED_STREAM					0x7
+#define H2_CANCEL							0x8
+#define H2_COMPRESSION_ERROR				0x9
+#define H2_ENHANCE_YOUR_CALM				0xb
+
+#define H2_SETTINGS_TABLE					0x1						// Settings
+#define H2_SETTINGS_STREAMS					0x3
+#define H2_SETTINGS_WINDOW					0x4
+#define H2_SETTINGS_FRAME					0x5
+#define H2_SETTINGS_LIST					0x6
+
+//----------------------------------------------------------------------------------------------------
+//			A stream, and the connection it is on
+//----------------------------------------------------------------------------------------------------
+struct H2LINK;
+
+struct H2STREAM
+{
+	H2LINK *Link;
+	DWORD Id;
+	string Request;												// As HTTP/1, complete once it's Running
+	string Body;												// What has come in DATA frames so far
+	bool Sized;													// Did the client say its Content-Length
+	bool Running;												// Has its thread, or is waiting for Admission to give it one
+	WAITING Slot;												// Its place with Admission
+	volatile bool Reset;										// By either end, or the connection is going
+	bool HeadersSent;
+	bool Ended;													// END_STREAM sent
+	string Head;												// The reply's status line and headers, until they're all here
+	bool Waiting;												// For its turn to send DATA
+	HANDLE Wake;												// Set when it might be its turn
+	LONG Window;												// The client's flow control window for it
+	int Weight;													// 1 to 256
+	__int64 Pass;												// What it has sent, over its weight
+};
+
+struct H2LINK
+{
+	SOCKET Socket;
+	TLSSESSION *Secure;											// Or NULL
+	struct sockaddr_in Client;
+	TIMER *Deadline;											// The connection's, for while it's idle
+
+	CRITICAL_SECTION Lock;										// Everything below, and writing to the socket
+	map <DWORD, H2STREAM *> Streams;							// Open ones
+	DWORD LastStream;											// Highest stream the client has started
+	int Running;												// Streams with a thread, or waiting for one
+	int Refunds;												// Admission slots to give back once the lock is let go
+	HANDLE Idle;												// Set while Running is 0
+	bool Closing;												// No new streams
+	bool Broken;												// A write failed, nothing else will get through
+	LONG Window;												// The client's window for the whole connection
+	LONG InitialWindow;											// What streams' windows start at
+	__int64 Pass;												// The last Pass that sent
+	HPACKENCODER Encoder;
+	IOBUFFER *Out;												// The frame being written
+
+	IOBUFFER *In;												// Only the reading thread uses these
+	HPACKDECODER Decoder;
+	string Block;												// A header block, until its CONTINUATIONs are in
+	DWORD Continuing;											// Stream it's for, 0 if there isn't one
+	BYTE BlockFlags;											// Its HEADERS frame's
+	int BlockWeight;											// Its priority's, 0 if it didn't have one
+	vector <HPACKFIELD> Fields;
+};
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP/2 class
+//----------------------------------------------------------------------------------------------------
+class HTTP2
+{
+  public:
+	HTTP2();													// Constructor
+	void Start(LPTHREAD_START_ROUTINE Runner);					// Runner(H2STREAM *) answers a stream, then Finish()es it
+	static bool Preface(const char *Data, int Length);			// Does a connection start with HTTP/2's preface
+	void Serve(SOCKET Socket, TLSSESSION *Secure, struct sockaddr_in Client, TIMER *Deadline, const string &Early);
+																// Reads the connection until it ends. Early is what
+																//  has been read already, starting with the preface
+	int Output(H2STREAM *Stream, const char *Data, int Length);	// A stream's reply, returns how much was sent
+	static int Write(void *Stream, const char *Data, int Length);	// Output() as a SENDFUNCTION
+	void End(H2STREAM *Stream);									// Ends a stream's reply, anything sent after is dropped
+	void Finish(H2STREAM *Stream);								// The stream's thread is done with it
+
+  private:
+	bool Fill(H2LINK *Link, DWORD Wanted);						// Reads until In has Wanted bytes
+	bool Frame(H2LINK *Link);									// Reads and handles a frame, false to stop
+	bool HeaderBlock(H2LINK *Link);								// A stream's headers have all arrived
+	bool Data(H2LINK *Link, BYTE Flags, DWORD Id, const BYTE *Payload, DWORD Length);
+	bool Settings(H2LINK *Link, BYTE Flags, const BYTE *Payload, DWORD Length);
+	bool WindowUpdate(H2LINK *Link, DWORD Id, const BYTE *Payload, DWORD Length);
+	bool BuildRequest(H2STREAM *Stream, const vector <HPACKFIELD> &Fields);	// The request as HTTP/1 text
+	void Dispatch(H2LINK *Link, H2STREAM *Stream);				// Starts a stream's thread once Admission lets it
+	static void Admitted(WAITING *Waiting);						// Stream->Slot.Wake, starts the thread or refuses the stream
+	bool Launch(H2STREAM *Stream);								// Starts its thread
+	void Refuse(H2LINK *Link, H2STREAM *Stream);				// Resets and forgets a stream that has no thread
+	void Abandon(H2LINK *Link, H2STREAM *Stream);				// Tells its thread to stop, or forgets it if there isn't one
+	void Drop(H2LINK *Link, H2STREAM *Stream);					// Forgets a stream without a thread
+	H2STREAM *Find(H2LINK *Link, DWORD Id);						// An open stream, or NULL
+	bool Reply(H2STREAM *Stream, DWORD Length);					// Sends the first Length of Head as HEADERS
+	bool SendData(H2STREAM *Stream, const char *Data, DWORD Length);
+	bool Ready(H2LINK *Link, H2STREAM *Stream);					// Can it send DATA now
+	void Turn(H2LINK *Link);									// Wakes whichever stream goes next
+	void Idle(H2LINK *Link);									// Arms or cancels the connection's deadline
+	bool WriteFrame(H2LINK *Link, BYTE Type, BYTE Flags, DWORD Id, const char *Payload, DWORD Length);
+	void ResetStream(H2LINK *Link, DWORD Id, DWORD Error);		// Sends RST_STREAM
+	bool GoAway(H2LINK *Link, DWORD Error);						// Sends GOAWAY, returns false
+
+	LPTHREAD_START_ROUTINE Runner;
+}Http2;
+
+//----------------------------------------------------------------------------------------------------
+//			Big endian fields
+//----------------------------------------------------------------------------------------------------
+DWORD H2Number(const BYTE *At)
+{
+	return (DWORD)At[0] << 24 | (DWORD)At[1] << 16 | (DWORD)At[2] << 8 | At[3];
+}
+
+void H2PutNumber(char *At, DWORD Number)
+{
+	At[0] = (char)(Number >> 24);
+	At[1] = (char)(Number >> 16);
+	At[2] = (char)(Number >> 8);
+	At[3] = (char)Number;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::HTTP2 and HTTP2::Start()
+//----------------------------------------------------------------------------------------------------
+HTTP2::HTTP2()
+{
+	Runner = NULL;
+}
+
+void HTTP2::Start(LPTHREAD_START_ROUTINE Run)
+{
+	Runner = Run;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Preface()
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Preface(const char *Data, int Length)
+{
+	return Length >= H2_PREFACE_LINE && !memcmp(Data, H2_PREFACE, H2_PREFACE_LINE);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Serve()
+//----------------------------------------------------------------------------------------------------
+void HTTP2::Serve(SOCKET Socket, TLSSESSION *Secure, struct sockaddr_in Client, TIMER *Deadline, const string &Early)
+{
+	H2LINK *Link = new H2LINK;
+	Link->Socket = Socket;
+	Link->Secure = Secure;
+	Link->Client = Client;
+	Link->Deadline = Deadline;
+	InitializeCriticalSection(&Link->Lock);
+	Link->LastStream = 0;
+	Link->Running = 0;
+	Link->Refunds = 0;
+	Link->Idle = CreateEvent(NULL, TRUE, TRUE, NULL);
+	Link->Closing = false;
+	Link->Broken = false;
+	Link->Window = Link->InitialWindow = H2_WINDOW;
+	Link->Pass = 0;
+	Link->Out = IOBuffers.Get(H2_HEADER + H2_FRAME);
+	Link->In = IOBuffers.Get(H2_HEADER + H2_FRAME);
+	Link->Continuing = 0;
+	Metrics.Http2(METRIC_HTTP2_CONNECTION);
+
+	if (Link->Idle && Link->In && Link->Out && Early.length() < Link->In->Size)
+	{
+		memcpy(Link->In->Data, Early.data(), Early.length());
+		Link->In->Used = Early.length();
+		if (Fill(Link, H2_PREFACE_LENGTH) && !memcmp(Link->In->Data, H2_PREFACE, H2_PREFACE_LENGTH))
+		{
+			Link->In->Used -= H2_PREFACE_LENGTH;
+			memmove(Link->In->Data, Link->In->Data + H2_PREFACE_LENGTH, Link->In->Used);
+
+			// Our settings. Everything else is as the RFC starts it.
+			char Ours[12];
+			H2PutNumber(Ours, H2_SETTINGS_STREAMS << 16);
+			H2PutNumber(Ours + 2, Options.Http2Streams);
+			H2PutNumber(Ours + 6, H2_SETTINGS_LIST << 16);
+			H2PutNumber(Ours + 8, H2_LIST);
+			EnterCriticalSection(&Link->Lock);
+			bool Sent = WriteFrame(Link, H2_SETTINGS, 0, 0, Ours, sizeof(Ours));
+			Idle(Link);
+			LeaveCriticalSection(&Link->Lock);
+
+			while (Sent)
+			{
+				Sent = Frame(Link);
+				for (; Link->Refunds; Link->Refunds--)
+					Admission.Leave();							// Might start a stream that needs its own lock
+			}
+		}
+	}
+
+	// Streams still going are reset, and we wait for their threads to see it
+	EnterCriticalSection(&Link->Lock);
+	Link->Closing = true;
+	map <DWORD, H2STREAM *>::iterator S = Link->Streams.begin();
+	while (S != Link->Streams.end())
+	{
+		H2STREAM *Stream = S->second;
+		S++;
+		if (!Stream->Running)
+		{
+			Drop(Link, Stream);
+			continue;
+		}
+		Stream->Reset = true;
+		SetEvent(Stream->Wake);
+	}
+	LeaveCriticalSection(&Link->Lock);
+	if (Link->Idle)
+	{
+		WaitForSingleObject(Link->Idle, INFINITE);
+		CloseHandle(Link->Idle);
+	}
+	EnterCriticalSection(&Link->Lock);							// Until the last Finish() has let go
+	LeaveCriticalSection(&Link->Lock);
+	DeleteCriticalSection(&Link->Lock);
+	IOBuffers.Put(Link->In);
+	IOBuffers.Put(Link->Out);
+	delete Link;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Fill()
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Fill(H2LINK *Link, DWORD Wanted)
+{
+	IOBUFFER *In = Link->In;
+	while (In->Used < Wanted)
+	{
+		int Got = Link->Secure ? Tls.Recv(Link->Secure, In->Data + In->Used, In->Size - In->Used)
+							   : recv(Link->Socket, In->Data + In->Used, In->Size - In->Used, 0);
+		if (Got <= 0)
+			return false;										// Gone, or the deadline closed it
+		In->Used += Got;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Frame()
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Frame(H2LINK *Link)
+{
+	if (!Fill(Link, H2_HEADER))
+		return false;
+	const BYTE *Header = (const BYTE *)Link->In->Data;
+	DWORD Length = (DWORD)Header[0] << 16 | (DWORD)Header[1] << 8 | Header[2];
+	BYTE Type = Header[3];
+	BYTE Flags = Header[4];
+	DWORD Id = H2Number(Header + 5) & 0x7fffffff;
+	if (Length > H2_FRAME)
+		return GoAway(Link, H2_FRAME_SIZE_ERROR);
+	DWORD Whole = H2_HEADER + Length;
+	if (!Fill(Link, Whole))
+		return false;
+	const BYTE *Payload = Header + H2_HEADER;
+
+	bool Result = true;
+	if (Link->Continuing && (Type != H2_CONTINUATION || Id != Link->Continuing))
+		Result = GoAway(Link, H2_PROTOCOL_ERROR);				// A header block can't be interrupted
+	else switch (Type)
+	{
+		case H2_HEADERS:
+		{
+			DWORD Pad = 0;
+			if (!Id || !(Id & 1))
+			{
+				Result = GoAway(Link, H2_PROTOCOL_ERROR);		// Clients' streams are odd
+				break;
+			}
+			if (Flags & H2_PADDED)
+			{
+				if (!Length)
+				{
+					Result = GoAway(Link, H2_PROTOCOL_ERROR);
+					break;
+				}
+				Pad = Payload[0];
+				Payload++;
+				Length--;
+			}
+			Link->BlockWeight = 0;
+			if (Flags & H2_PRIORITIZED)
+			{
+				if (Length < 5)
+				{
+					Result = GoAway(Link, H2_PROTOCOL_ERROR);
+					break;
+				}
+				Link->BlockWeight = Payload[4] + 1;				// The dependency isn't used
+				Payload += 5;
+				Length -= 5;
+			}
+			if (Pad > Length)
+			{
+				Result = GoAway(Link, H2_PROTOCOL_ERROR);
+				break;
+			}
+			Link->Block.assign((const char *)Payload, Length - Pad);
+			Link->Continuing = Id;
+			Link->BlockFlags = Flags;
+			if (Flags & H2_END_HEADERS)
+				Result = HeaderBlock(Link);
+			break;
+		}
+		case H2_CONTINUATION:
+			if (!Link->Continuing)
+			{
+				Result = GoAway(Link, H2_PROTOCOL_ERROR);
+				break;
+			}
+			Link->Block.append((const char *)Payload, Length);
+			if (Link->Block.length() > 2 * H2_LIST)
+				Result = GoAway(Link, H2_ENHANCE_YOUR_CALM);
+			else if (Flags & H2_END_HEADERS)
+				Result = HeaderBlock(Link);
+			break;
+		case H2_DATA:
+			Result = Data(Link, Flags, Id, Payload, Length);
+			break;
+		case H2_SETTINGS:
+			Result = Id ? GoAway(Link, H2_PROTOCOL_ERROR) : Settings(Link, Flags, Payload, Length);
+			break;
+		case H2_WINDOW_UPDATE:
+			Result = WindowUpdate(Link, Id, Payload, Length);
+			break;
+		case H2_PING:
+			if (Id || Length != 8)
+				Result = GoAway(Link, Id ? H2_PROTOCOL_ERROR : H2_FRAME_SIZE_ERROR);
+			else if (!(Flags & H2_ACK))
+			{
+				EnterCriticalSection(&Link->Lock);
+				WriteFrame(Link, H2_PING, H2_ACK, 0, (const char *)Payload, Length);
+				LeaveCriticalSection(&Link->Lock);
+			}
+			break;
+		case H2_RST_STREAM:
+			if (!Id || Length != 4)
+				Result = GoAway(Link, Id ? H2_FRAME_SIZE_ERROR : H2_PROTOCOL_ERROR);
+			else
+			{
+				EnterCriticalSection(&Link->Lock);
+				H2STREAM *Stream = Find(Link, Id);
+				if (Stream)
+				{
+					Abandon(Link, Stream);
+					Metrics.Http2(METRIC_HTTP2_RESET);
+					Turn(Link);
+				}
+				LeaveCriticalSection(&Link->Lock);
+			}
+			break;
+		case H2_PRIORITY:
+			if (Id && Length == 5)
+			{
+				EnterCriticalSection(&Link->Lock);
+				H2STREAM *Stream = Find(Link, Id);
+				if (Stream)
+					Stream->Weight = Payload[4] + 1;
+				LeaveCriticalSection(&Link->Lock);
+			}
+			break;
+		case H2_GOAWAY:
+			Link->Closing = true;								// It won't start any more
+			break;
+		case H2_PUSH_PROMISE:
+			Result = GoAway(Link, H2_PROTOCOL_ERROR);			// Only servers push
+			break;
+		default:
+			break;												// Unknown frames are ignored
+	}
+
+	// Done with it, move up whatever came after
+	IOBUFFER *In = Link->In;
+	In->Used -= Whole;
+	memmove(In->Data, In->Data + Whole, In->Used);
+
+	EnterCriticalSection(&Link->Lock);
+	if (Link->Closing && !Link->Running)
+		Result = false;											// It said goodbye, and it has all its replies
+	Idle(Link);
+	LeaveCriticalSection(&Link->Lock);
+	return Result;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::HeaderBlock() - a stream's headers, or its trailers, are all here
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::HeaderBlock(H2LINK *Link)
+{
+	DWORD Id = Link->Continuing;
+	bool Ended = (Link->BlockFlags & H2_END_STREAM) != 0;
+	Link->Continuing = 0;
+	bool Decoded = Link->Decoder.Decode((const BYTE *)Link->Block.data(), Link->Block.length(), Link->Fields, H2_LIST);
+	Link->Block.erase();
+	if (!Decoded)
+		return GoAway(Link, H2_COMPRESSION_ERROR);				// Its table and ours don't agree any more
+
+	EnterCriticalSection(&Link->Lock);
+	if (Id <= Link->LastStream)
+	{
+		H2STREAM *Stream = Find(Link, Id);
+		if (!Stream)
+		{
+			LeaveCriticalSection(&Link->Lock);
+			return GoAway(Link, H2_STREAM_CLOSED);
+		}
+		if (Stream->Running || !Ended)
+		{
+			ResetStream(Link, Id, Stream->Running ? H2_STREAM_CLOSED : H2_PROTOCOL_ERROR);
+			Abandon(Link, Stream);
+		}
+		else
+			Dispatch(Link, Stream);								// Trailers, which the request doesn't need
+		LeaveCriticalSection(&Link->Lock);
+		return true;
+	}
+
+	Link->LastStream = Id;
+	if (Link->Closing || (int)Link->Streams.size() >= Options.Http2Streams)
+	{
+		ResetStream(Link, Id, H2_REFUSED_STREAM);				// It can try again, there or elsewhere
+		LeaveCriticalSection(&Link->Lock);
+		return true;
+	}
+	H2STREAM *Stream = new H2STREAM;
+	Stream->Link = Link;
+	Stream->Id = Id;
+	Stream->Sized = false;
+	Stream->Running = false;
+	Stream->Reset = false;
+	Stream->HeadersSent = false;
+	Stream->Ended = false;
+	Stream->Waiting = false;
+	Stream->Wake = CreateEvent(NULL, FALSE, FALSE, NULL);
+	Stream->Window = Link->InitialWindow;
+	Stream->Weight = Link->BlockWeight ? Link->BlockWeight : H2_WEIGHT;
+	Stream->Pass = Link->Pass;
+	if (!Stream->Wake || !BuildRequest(Stream, Link->Fields))
+	{
+		ResetStream(Link, Id, Stream->Wake ? H2_PROTOCOL_ERROR : H2_REFUSED_STREAM);
+		if (Stream->Wake)
+			CloseHandle(Stream->Wake);
+		delete Stream;
+		LeaveCriticalSection(&Link->Lock);
+		return true;
+	}
+	Link->Streams[Id] = Stream;
+	Metrics.Http2(METRIC_HTTP2_STREAM);
+	if (Ended)
+		Dispatch(Link, Stream);
+	LeaveCriticalSection(&Link->Lock);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::BuildRequest()
+//			Writes the request as HTTP/1 would have it, for ParseRequest(), with HTTP/2.0 as its
+//			version. Names are left in lower case, as ParseRequest() doesn't mind. False if the
+//			request is malformed.
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::BuildRequest(H2STREAM *Stream, const vector <HPACKFIELD> &Fields)
+{
+	string Method, Path, Authority, Headers, Cookies;
+	bool Regular = false;										// Pseudo-headers have to come first
+	for (int F = 0; F < (int)Fields.size(); F++)
+	{
+		const string &Name = Fields[F].Name;
+		const string &Value = Fields[F].Value;
+		if (Name.empty() || Name.find_first_of("\r\n", 0) != string::npos || Name.find('\0') != string::npos ||
+			Value.find_first_of("\r\n", 0) != string::npos || Value.find('\0') != string::npos)
+			return false;										// Or it could smuggle in headers of its own
+		if (Name[0] == ':')
+		{
+			if (Regular)
+				return false;
+			if (Name == ":method")				Method = Value;
+			else if (Name == ":path")			Path = Value;
+			else if (Name == ":authority")		Authority = Value;
+			else if (Name != ":scheme")			return false;
+			continue;
+		}
+		Regular = true;
+		if (Name == "connection" || Name == "keep-alive" || Name == "proxy-connection" ||
+			Name == "transfer-encoding" || Name == "upgrade")
+			return false;										// Only HTTP/1 has these
+		if (Name == "te")
+			continue;
+		if (Name == "cookie")									// Which HTTP/2 can split up
+		{
+			if (!Cookies.empty())
+				Cookies += "; ";
+			Cookies += Value;
+			continue;
+		}
+		if (Name == "host")
+		{
+			if (Authority.empty())
+				Authority = Value;
+			continue;
+		}
+		if (Name == "content-length")
+			Stream->Sized = true;
+		Headers += Name;
+		Headers += ": ";
+		Headers += Value;
+		Headers += "\r\n";
+	}
+	if (Method.empty() || Path.empty() || Path.find(' ') != string::npos)
+		return false;
+
+	string &Request = Stream->Request;
+	Request = Method;
+	Request += ' ';
+	Request += Path;
+	Request += " HTTP/2.0\r\n";
+	if (!Authority.empty())
+	{
+		Request += "Host: ";
+		Request += Authority;
+		Request += "\r\n";
+	}
+	Request += Headers;
+	if (!Cookies.empty())
+	{
+		Request += "Cookie: ";
+		Request += Cookies;
+		Request += "\r\n";
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Dispatch() - the request is all here, give it a thread once there's a slot.
+//			Lock held. The stream is Running from here, so Serve() waits for it even while it's
+//			queued.
+//----------------------------------------------------------------------------------------------------
+void HTTP2::Dispatch(H2LINK *Link, H2STREAM *Stream)
+{
+	if (!Stream->Sized && !Stream->Body.empty())
+	{
+		char Number[24];
+		Number[FormatNumber(Stream->Body.length(), Number)] = '\0';
+		Stream->Request += "Content-Length: ";
+		Stream->Request += Number;
+		Stream->Request += "\r\n";
+	}
+	Stream->Request += "\r\n";
+	Stream->Request += Stream->Body;
+	Stream->Body.erase();
+
+	Stream->Running = true;										// Before the thread can get the lock to Finish()
+	Link->Running++;
+	ResetEvent(Link->Idle);
+	Stream->Slot.Wake = Admitted;
+	Stream->Slot.Owner = Stream;
+	int Admit = Admission.Arrive(&Stream->Slot);
+	if (Admit == ADMISSION_QUEUED)
+		return;													// Admitted() starts it, Stream may be gone already
+	if (Admit == ADMISSION_ADMITTED && Launch(Stream))
+		return;
+	if (Admit == ADMISSION_ADMITTED)
+		Link->Refunds++;										// Not with the lock held, see Serve()
+	Refuse(Link, Stream);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Launch() - starts the stream's thread, which Leave()s Admission when it's done
+//			HTTP2::Refuse() - ends a stream that didn't get a thread. Lock held.
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Launch(H2STREAM *Stream)
+{
+	DWORD ThreadId;
+	HANDLE Thread = Runner ? CreateThread(NULL, 0, Runner, Stream, 0, &ThreadId) : NULL;
+	if (!Thread)
+		return false;
+	CloseHandle(Thread);
+	return true;
+}
+
+void HTTP2::Refuse(H2LINK *Link, H2STREAM *Stream)
+{
+	if (!Stream->Reset)
+		ResetStream(Link, Stream->Id, H2_REFUSED_STREAM);		// The client can ask again
+	Stream->Reset = true;
+	Finish(Stream);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Admitted() - called once a queued stream has a slot, or has been shed, from
+//			whichever thread gave up the slot. No lock is held.
+//----------------------------------------------------------------------------------------------------
+void HTTP2::Admitted(WAITING *Waiting)
+{
+	H2STREAM *Stream = (H2STREAM *)Waiting->Owner;
+	bool Shed = Waiting->Shed;
+	if (!Shed && Http2.Launch(Stream))
+		return;
+
+	H2LINK *Link = Stream->Link;
+	EnterCriticalSection(&Link->Lock);
+	Http2.Refuse(Link, Stream);
+	LeaveCriticalSection(&Link->Lock);							// Serve() may free Link as soon as this is done
+	if (!Shed)
+		Admission.Leave();										// No thread, give the slot to someone else
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Abandon(), HTTP2::Drop() and HTTP2::Find(). Lock held.
+//----------------------------------------------------------------------------------------------------
+void HTTP2::Abandon(H2LINK *Link, H2STREAM *Stream)
+{
+	if (!Stream->Running)
+	{
+		Drop(Link, Stream);
+		return;
+	}
+	Stream->Reset = true;										// Output() fails from now on
+	SetEvent(Stream->Wake);
+}
+
+void HTTP2::Drop(H2LINK *Link, H2STREAM *Stream)
+{
+	Link->Streams.erase(Stream->Id);
+	CloseHandle(Stream->Wake);
+	delete Stream;
+}
+
+H2STREAM *HTTP2::Find(H2LINK *Link, DWORD Id)
+{
+	map <DWORD, H2STREAM *>::iterator Found = Link->Streams.find(Id);
+	return Found == Link->Streams.end() ? NULL : Found->second;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Data() - some of a request's body
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Data(H2LINK *Link, BYTE Flags, DWORD Id, const BYTE *Payload, DWORD Length)
+{
+	DWORD Counted = Length;										// Padding counts against the window too
+	DWORD Pad = 0;
+	if (!Id)
+		return GoAway(Link, H2_PROTOCOL_ERROR);
+	if (Flags & H2_PADDED)
+	{
+		if (!Length || Payload[0] >= Length)
+			return GoAway(Link, H2_PROTOCOL_ERROR);
+		Pad = Payload[0];
+		Payload++;
+		Length--;
+	}
+	Length -= Pad;
+
+	EnterCriticalSection(&Link->Lock);
+	H2STREAM *Stream = Find(Link, Id);
+	bool Open = Stream && !Stream->Running;
+	if (Counted)
+	{
+		char Increment[4];
+		H2PutNumber(Increment, Counted);
+		WriteFrame(Link, H2_WINDOW_UPDATE, 0, 0, Increment, 4);
+		if (Open && !(Flags & H2_END_STREAM))
+			WriteFrame(Link, H2_WINDOW_UPDATE, 0, Id, Increment, 4);
+	}
+	if (!Stream)
+	{
+		LeaveCriticalSection(&Link->Lock);
+		if (Id > Link->LastStream)
+			return GoAway(Link, H2_PROTOCOL_ERROR);				// Never opened
+		return true;											// One we've reset, it may not know yet
+	}
+	if (!Open)
+	{
+		ResetStream(Link, Id, H2_STREAM_CLOSED);				// It already said it had finished
+		Abandon(Link, Stream);
+	}
+	else if (Stream->Body.length() + Length > H2_LIST)
+	{
+		ResetStream(Link, Id, H2_ENHANCE_YOUR_CALM);			// More than HTTP/1 would take
+		Abandon(Link, Stream);
+	}
+	else
+	{
+		Stream->Body.append((const char *)Payload, Length);
+		if (Flags & H2_END_STREAM)
+			Dispatch(Link, Stream);
+	}
+	LeaveCriticalSection(&Link->Lock);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Settings()
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Settings(H2LINK *Link, BYTE Flags, const BYTE *Payload, DWORD Length)
+{
+	if (Flags & H2_ACK)
+		return Length ? GoAway(Link, H2_FRAME_SIZE_ERROR) : true;
+	if (Length % 6)
+		return GoAway(Link, H2_FRAME_SIZE_ERROR);
+
+	EnterCriticalSection(&Link->Lock);
+	DWORD Error = H2_NO_ERROR;
+	for (DWORD At = 0; At < Length; At += 6)
+	{
+		DWORD Setting = Payload[At] << 8 | Payload[At + 1];
+		DWORD Value = H2Number(Payload + At + 2);
+		if (Setting == H2_SETTINGS_TABLE)
+			Link->Encoder.Limit(Value);							// Before the next header block we send
+		else if (Setting == H2_SETTINGS_WINDOW)
+		{
+			if (Value > H2_LARGEST_WINDOW)
+			{
+				Error = H2_FLOW_CONTROL_ERROR;
+				break;
+			}
+			LONG Change = (LONG)Value - Link->InitialWindow;	// Open streams' windows move by as much
+			map <DWORD, H2STREAM *>::iterator S;
+			for (S = Link->Streams.begin(); S != Link->Streams.end() && Error == H2_NO_ERROR; S++)
+			{
+				if (Change > 0 && S->second->Window > H2_LARGEST_WINDOW - Change)
+					Error = H2_FLOW_CONTROL_ERROR;				// RFC 9113 6.9.2, no window can go past 2^31-1
+			}
+			if (Error != H2_NO_ERROR)
+				break;
+			for (S = Link->Streams.begin(); S != Link->Streams.end(); S++)
+				S->second->Window += Change;
+			Link->InitialWindow = Value;
+		}
+		else if (Setting == H2_SETTINGS_FRAME && (Value < H2_FRAME || Value > 0xffffff))
+		{
+			Error = H2_PROTOCOL_ERROR;							// We only ever send the smallest anyway
+			break;
+		}
+	}
+	if (Error == H2_NO_ERROR)
+	{
+		WriteFrame(Link, H2_SETTINGS, H2_ACK, 0, NULL, 0);
+		Turn(Link);
+	}
+	LeaveCriticalSection(&Link->Lock);
+	return Error == H2_NO_ERROR ? true : GoAway(Link, Error);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::WindowUpdate()
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::WindowUpdate(H2LINK *Link, DWORD Id, const BYTE *Payload, DWORD Length)
+{
+	if (Length != 4)
+		return GoAway(Link, H2_FRAME_SIZE_ERROR);
+	LONG Increment = (LONG)(H2Number(Payload) & 0x7fffffff);
+
+	EnterCriticalSection(&Link->Lock);
+	DWORD Error = H2_NO_ERROR;
+	if (!Id)
+	{
+		if (!Increment)
+			Error = H2_PROTOCOL_ERROR;
+		else if (Link->Window > H2_LARGEST_WINDOW - Increment)
+			Error = H2_FLOW_CONTROL_ERROR;
+		else
+			Link->Window += Increment;
+	}
+	else
+	{
+		H2STREAM *Stream = Find(Link, Id);
+		if (Stream && (!Increment || Stream->Window > H2_LARGEST_WINDOW - Increment))
+		{
+			ResetStream(Link, Id, Increment ? H2_FLOW_CONTROL_ERROR : H2_PROTOCOL_ERROR);
+			Abandon(Link, Stream);
+		}
+		else if (Stream)
+			Stream->Window += Increment;
+	}
+	Turn(Link);
+	LeaveCriticalSection(&Link->Lock);
+	return Error == H2_NO_ERROR ? true : GoAway(Link, Error);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Output() and HTTP2::Write()
+//			The status line and headers are kept until the blank line after them arrives, then
+//			sent as HEADERS. Everything after is DATA.
+//----------------------------------------------------------------------------------------------------
+int HTTP2::Output(H2STREAM *Stream, const char *Data, int Length)
+{
+	if (Stream->Reset || Stream->Ended)
+		return SOCKET_ERROR;									// Nobody wants it
+	if (Stream->HeadersSent)
+		return SendData(Stream, Data, Length) ? Length : SOCKET_ERROR;
+
+	string &Head = Stream->Head;
+	int Had = Head.length();
+	Head.append(Data, Length);
+	int Blank = Head.find("\n\n", Had > 2 ? Had - 2 : 0);
+	int Other = Head.find("\n\r\n", Had > 3 ? Had - 3 : 0);
+	int Size;
+	if (Blank != (int)string::npos && (Other == (int)string::npos || Blank < Other))
+		Size = Blank + 2;
+	else if (Other != (int)string::npos)
+		Size = Other + 3;
+	else
+		return Head.length() > H2_LIST ? SOCKET_ERROR : Length;	// Wait for the rest
+
+	H2LINK *Link = Stream->Link;
+	EnterCriticalSection(&Link->Lock);
+	bool Sent = Reply(Stream, Size);
+	LeaveCriticalSection(&Link->Lock);
+	string Rest(Head, Size, string::npos);
+	Head.erase();
+	if (!Sent || (Rest.length() && !SendData(Stream, Rest.data(), Rest.length())))
+		return SOCKET_ERROR;
+	return Length;
+}
+
+int HTTP2::Write(void *Stream, const char *Data, int Length)
+{
+	return Http2.Output((H2STREAM *)Stream, Data, Length);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Reply()
+//			Turns the first Size bytes of Head into a HEADERS frame, and CONTINUATIONs if it needs
+//			them. Head starts with a status line, or is a CGI script's headers with perhaps a
+//			Status: among them. Lock held.
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Reply(H2STREAM *Stream, DWORD Size)
+{
+	H2LINK *Link = Stream->Link;
+	const string &Head = Stream->Head;
+	int Status = 200;
+	string Block, Name, Value;
+	vector <HPACKFIELD> Fields;
+
+	DWORD At = 0;
+	while (At < Size)
+	{
+		DWORD End = Head.find('\n', At);						// npos is past Size, too
+		if (End > Size)
+			End = Size;
+		DWORD Line = End;
+		if (Line > At && Head[Line - 1] == '\r')
+			Line--;
+		if (!At && !strncmp(Head.c_str(), "HTTP/", 5))
+		{
+			DWORD Space = Head.find(' ', 0);
+			if (Space < Line)
+				Status = atoi(Head.c_str() + Space + 1);
+		}
+		else
+		{
+			DWORD Colon = Head.find(':', At);
+			if (Colon < Line)
+			{
+				Name.assign(Head, At, Colon - At);
+				while (Name.length() && Name[Name.length() - 1] == ' ')
+					Name.erase(Name.length() - 1);
+				for (int C = 0; C < (int)Name.length(); C++)
+					Name[C] = (char)tolower((BYTE)Name[C]);		// HTTP/2 wants them in lower case
+				DWORD Start = Colon + 1;
+				while (Start < Line && (Head[Start] == ' ' || Head[Start] == '\t'))
+					Start++;
+				Value.assign(Head, Start, Line - Start);
+				while (Value.length() && Value[Value.length() - 1] == ' ')
+					Value.erase(Value.length() - 1);
+
+				if (Name == "status")
+					Status = atoi(Value.c_str());				// From a CGI script
+				else if (Name.length() && Name != "connection" && Name != "keep-alive" && Name != "proxy-connection" &&
+						 Name != "transfer-encoding" && Name != "upgrade")
+				{
+					Fields.push_back(HPACKFIELD());
+					Fields.back().Name = Name;
+					Fields.back().Value = Value;
+				}
+			}
+		}
+		At = End + 1;
+	}
+	if (Status < 100 || Status > 999)
+		Status = 500;
+
+	char Number[24];
+	Number[FormatNumber(Status, Number)] = '\0';
+	Link->Encoder.Start(Block);
+	Link->Encoder.Field(Block, ":status", Number);
+	for (int F = 0; F < (int)Fields.size(); F++)
+		Link->Encoder.Field(Block, Fields[F].Name, Fields[F].Value);
+
+	// Nothing else can go between these frames, and we have the lock
+	DWORD Sent = 0;
+	do
+	{
+		DWORD Part = Block.length() - Sent;
+		if (Part > H2_FRAME)
+			Part = H2_FRAME;
+		BYTE Flags = Sent + Part == Block.length() ? H2_END_HEADERS : 0;
+		if (!WriteFrame(Link, Sent ? H2_CONTINUATION : H2_HEADERS, Flags, Stream->Id, Block.data() + Sent, Part))
+			return false;
+		Sent += Part;
+	}
+	while (Sent < Block.length());
+	Stream->HeadersSent = true;
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::SendData()
+//			Sends as DATA frames, when it's this stream's turn and there's room in both windows.
+//			Gives up on the stream if the client goes Options' send timeout without letting
+//			anything on the connection through.
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::SendData(H2STREAM *Stream, const char *Data, DWORD Length)
+{
+	H2LINK *Link = Stream->Link;
+	int Seconds = Options.SendTimeout > 0 ? Options.SendTimeout : Options.Timeout;
+	DWORD Sent = 0;
+
+	EnterCriticalSection(&Link->Lock);
+	if (Stream->Pass < Link->Pass)
+		Stream->Pass = Link->Pass;								// No credit for the time it wasn't sending
+	while (Sent < Length && !Stream->Reset && !Link->Broken)
+	{
+		if (!Ready(Link, Stream))
+		{
+			__int64 Was = Link->Pass;
+			Stream->Waiting = true;
+			LeaveCriticalSection(&Link->Lock);
+			DWORD Waited = WaitForSingleObject(Stream->Wake, Seconds > 0 ? Seconds * 1000 : INFINITE);
+			EnterCriticalSection(&Link->Lock);
+			Stream->Waiting = false;
+			if (Waited == WAIT_TIMEOUT && Link->Pass == Was && !Stream->Reset)
+			{
+				ResetStream(Link, Stream->Id, H2_CANCEL);
+				Stream->Reset = true;
+				Metrics.TimedOut(TIMEOUT_SEND);
+			}
+			continue;
+		}
+
+		DWORD Part = Length - Sent;
+		if (Part > H2_FRAME)					Part = H2_FRAME;
+		if (Part > (DWORD)Stream->Window)		Part = Stream->Window;
+		if (Part > (DWORD)Link->Window)			Part = Link->Window;
+		if (!WriteFrame(Link, H2_DATA, 0, Stream->Id, Data + Sent, Part))
+			break;
+		Sent += Part;
+		Stream->Window -= Part;
+		Link->Window -= Part;
+		Stream->Pass += (__int64)Part * 256 / Stream->Weight;
+		Link->Pass = Stream->Pass;
+		Turn(Link);
+	}
+	LeaveCriticalSection(&Link->Lock);
+	return Sent == Length;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Ready() and HTTP2::Turn(). Lock held.
+//			A stream can send when both windows have room, and no other stream that could send
+//			is waiting with a smaller Pass.
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::Ready(H2LINK *Link, H2STREAM *Stream)
+{
+	if (Stream->Window <= 0 || Link->Window <= 0)
+		return false;
+	map <DWORD, H2STREAM *>::iterator S;
+	for (S = Link->Streams.begin(); S != Link->Streams.end(); S++)
+	{
+		H2STREAM *Other = S->second;
+		if (Other != Stream && Other->Waiting && !Other->Reset && Other->Window > 0 && Other->Pass < Stream->Pass)
+			return false;
+	}
+	return true;
+}
+
+void HTTP2::Turn(H2LINK *Link)
+{
+	H2STREAM *Next = NULL;
+	map <DWORD, H2STREAM *>::iterator S;
+	for (S = Link->Streams.begin(); S != Link->Streams.end(); S++)
+	{
+		H2STREAM *Stream = S->second;
+		if (!Stream->Waiting)
+			continue;
+		if (Stream->Reset)
+			SetEvent(Stream->Wake);								// So it can see
+		else if (Stream->Window > 0 && (!Next || Stream->Pass < Next->Pass))
+			Next = Stream;
+	}
+	if (Next && Link->Window > 0)
+		SetEvent(Next->Wake);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::End() and HTTP2::Finish()
+//----------------------------------------------------------------------------------------------------
+void HTTP2::End(H2STREAM *Stream)
+{
+	H2LINK *Link = Stream->Link;
+	EnterCriticalSection(&Link->Lock);
+	if (!Stream->Ended && !Stream->Reset)
+	{
+		if (!Stream->HeadersSent && Stream->Head.empty())
+		{
+			ResetStream(Link, Stream->Id, H2_INTERNAL_ERROR);	// It never replied
+			Stream->Reset = true;
+		}
+		else if ((Stream->HeadersSent || Reply(Stream, Stream->Head.length())) &&
+				 WriteFrame(Link, H2_DATA, H2_END_STREAM, Stream->Id, NULL, 0))
+			Stream->Ended = true;
+	}
+	LeaveCriticalSection(&Link->Lock);
+}
+
+void HTTP2::Finish(H2STREAM *Stream)
+{
+	H2LINK *Link = Stream->Link;
+	End(Stream);
+	EnterCriticalSection(&Link->Lock);
+	Link->Streams.erase(Stream->Id);
+	Link->Running--;
+	CloseHandle(Stream->Wake);
+	delete Stream;
+	Turn(Link);
+	if (!Link->Running)
+	{
+		SetEvent(Link->Idle);
+		if (Link->Closing)
+			shutdown(Link->Socket, 2);							// Wakes Serve() up, its client has gone away
+		else
+			Idle(Link);
+	}
+	LeaveCriticalSection(&Link->Lock);							// Serve() may free Link as soon as this is done
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::Idle() - the connection's deadline runs only while no stream is. Lock held.
+//----------------------------------------------------------------------------------------------------
+void HTTP2::Idle(H2LINK *Link)
+{
+	if (!Link->Deadline)
+		return;
+	if (Link->Running || Options.Timeout <= 0)
+		Timers.Cancel(Link->Deadline);
+	else
+	{
+		Link->Deadline->Kind = TIMEOUT_IDLE;
+		Timers.Arm(Link->Deadline, Options.Timeout * 1000);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::WriteFrame()
+//			Sends a whole frame, with the send timeout on the connection's deadline while it does.
+//			Once a write has failed nothing more is sent, and Serve() is woken up. Lock held.
+//----------------------------------------------------------------------------------------------------
+bool HTTP2::WriteFrame(H2LINK *Link, BYTE Type, BYTE Flags, DWORD Id, const char *Payload, DWORD Length)
+{
+	if (Link->Broken)
+		return false;
+	char *Frame = Link->Out->Data;
+	Frame[0] = (char)(Length >> 16);
+	Frame[1] = (char)(Length >> 8);
+	Frame[2] = (char)Length;
+	Frame[3] = (char)Type;
+	Frame[4] = (char)Flags;
+	H2PutNumber(Frame + 5, Id);
+	if (Length)
+		memcpy(Frame + H2_HEADER, Payload, Length);
+
+	int Seconds = Options.SendTimeout > 0 ? Options.SendTimeout : Options.Timeout;
+	if (Link->Deadline && Seconds > 0)
+	{
+		Link->Deadline->Kind = TIMEOUT_SEND;
+		Timers.Arm(Link->Deadline, Seconds * 1000);
+	}
+	int Total = H2_HEADER + Length;
+	int Sent = 0;
+	while (Sent < Total)
+	{
+		int Y = Link->Secure ? Tls.Send(Link->Secure, Frame + Sent, Total - Sent)
+							 : send(Link->Socket, Frame + Sent, Total - Sent, 0);
+		if (Y <= 0)
+		{
+			Link->Broken = true;
+			shutdown(Link->Socket, 2);
+			return false;
+		}
+		Sent += Y;
+	}
+	Idle(Link);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP2::ResetStream() and HTTP2::GoAway()
+//----------------------------------------------------------------------------------------------------
+void HTTP2::ResetStream(H2LINK *Link, DWORD Id, DWORD Error)
+{
+	char Payload[4];
+	H2PutNumber(Payload, Error);
+	WriteFrame(Link, H2_RST_STREAM, 0, Id, Payload, 4);
+	Metrics.Http2(METRIC_HTTP2_RESET);
+}
+
+bool HTTP2::GoAway(H2LINK *Link, DWORD Error)
+{
+	char Payload[8];
+	EnterCriticalSection(&Link->Lock);
+	H2PutNumber(Payload, Link->LastStream);
+	H2PutNumber(Payload + 4, Error);
+	WriteFrame(Link, H2_GOAWAY, 0, 0, Payload, 8);
+	Link->Closing = true;
+	LeaveCriticalSection(&Link->Lock);
+	return false;
+}
+
+#endif
@@ -0,0 +1,342 @@
+#ifndef HTTPDATEHPP
+#define HTTPDATEHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			HTTPDATE.HPP
+			------------
+			This file contains the server clock and the HTTP date parser.
+
+			The clock formats the current time as an IMF-fixdate, for example:
+
+				Sun, 06 Nov 1994 08:49:37 GMT
+
+			once a second, on its own thread. It writes into whichever of its two slots
+			is not being read, then publishes it by bumping a generation counter. Request
+			threads just copy the published slot, so building the Date: header costs no
+			system calls, no locale work and no gmtime() (which uses a shared static buffer
+			and is not thread safe).
+
+			ParseHTTPDate() reads all three date formats a client may send in
+			If-Modified-Since and friends:
+
+				Sun, 06 Nov 1994 08:49:37 GMT		(IMF-fixdate)
+				Sunday, 06-Nov-94 08:49:37 GMT		(RFC 850)
+				Sun Nov  6 08:49:37 1994			(asctime)
+
+			It does not allocate, and looks months up in a table instead of with strcmpi.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+#include <time.h>
+
+#define HTTPDATE_LENGTH						29						// strlen("Sun, 06 Nov 1994 08:49:37 GMT")
+
+const char DayNames[7][4] = { "Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat" };
+const char MonthNames[12][4] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
+								 "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// Month names packed into an int, lower case, so a month can be found with 12 integer compares
+#define PACKMONTH(a, b, c)					(((a) << 16) | ((b) << 8) | (c))
+const int MonthKeys[12] = {
+	PACKMONTH('j','a','n'), PACKMONTH('f','e','b'), PACKMONTH('m','a','r'), PACKMONTH('a','p','r'),
+	PACKMONTH('m','a','y'), PACKMONTH('j','u','n'), PACKMONTH('j','u','l'), PACKMONTH('a','u','g'),
+	PACKMONTH('s','e','p'), PACKMONTH('o','c','t'), PACKMONTH('n','o','v'), PACKMONTH('d','e','c') };
+
+//----------------------------------------------------------------------------------------------------
+//			CalcMonth() - returns the month number (0 - 11) of a three letter month name, ie, "Feb"
+//			returns 1. Returns -1 if it is not a month.
+//----------------------------------------------------------------------------------------------------
+int CalcMonth(const char *Month)
+{
+	if (!Month[0] || !Month[1] || !Month[2])
+		return -1;
+
+	int Key = PACKMONTH(Month[0] | 0x20, Month[1] | 0x20, Month[2] | 0x20);	// | 0x20 lower cases letters
+	for (int X = 0; X < 12; X++)
+	{
+		if (MonthKeys[X] == Key)
+			return X;
+	}
+	return -1;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			DaysFromCivil() - number of days between 1970-01-01 and the given date. Month is 0 - 11.
+//			CivilFromDays() is the reverse. Both work in UTC, unlike mktime() which uses local time.
+//----------------------------------------------------------------------------------------------------
+long DaysFromCivil(int Year, int Month, int Day)
+{
+	Month += 1;
+	Year -= Month <= 2;
+	long Era = (Year >= 0 ? Year : Year - 399) / 400;
+	long YearOfEra = Year - Era * 400;											// [0, 399]
+	long DayOfYear = (153 * (Month + (Month > 2 ? -3 : 9)) + 2) / 5 + Day - 1;	// [0, 365]
+	long DayOfEra = YearOfEra * 365 + YearOfEra / 4 - YearOfEra / 100 + DayOfYear;
+	return Era * 146097 + DayOfEra - 719468;
+}
+
+void CivilFromDays(long Days, int *Year, int *Month, int *Day)
+{
+	Days += 719468;
+	long Era = (Days >= 0 ? Days : Days - 146096) / 146097;
+	long DayOfEra = Days - Era * 146097;
+	long YearOfEra = (DayOfEra - DayOfEra / 1460 + DayOfEra / 36524 - DayOfEra / 146096) / 365;
+	long DayOfYear = DayOfEra - (365 * YearOfEra + YearOfEra / 4 - YearOfEra / 100);
+	long MonthPart = (5 * DayOfYear + 2) / 153;
+
+	*Day = DayOfYear - (153 * MonthPart + 2) / 5 + 1;
+	*Month = MonthPart < 10 ? MonthPart + 2 : MonthPart - 10;					// 0 - 11
+	*Year = YearOfEra + Era * 400 + (*Month <= 1);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			FormatHTTPDate() - writes Time as an IMF-fixdate into Out, which must hold
+//			HTTPDATE_LENGTH + 1 chars.
+//----------------------------------------------------------------------------------------------------
+void FormatHTTPDate(time_t Time, char *Out)
+{
+	long Days = (long)(Time / 86400);
+	long Secs = (long)(Time % 86400);
+	int Year, Month, Day;
+	CivilFromDays(Days, &Year, &Month, &Day);
+
+	const char *DayName = DayNames[(Days + 4) % 7];								// 1970-01-01 was a Thursday
+	const char *MonthName = MonthNames[Month];
+	int Hour = Secs / 3600;
+	int Minute = (Secs / 60) % 60;
+	int Second = Secs % 60;
+
+	Out[0] = DayName[0]; Out[1] = DayName[1]; Out[2] = DayName[2];
+	Out[3] = ','; Out[4] = ' ';
+	Out[5] = '0' + Day / 10; Out[6] = '0' + Day % 10;
+	Out[7] = ' ';
+	Out[8] = MonthName[0]; Out[9] = MonthName[1]; Out[10] = MonthName[2];
+	Out[11] = ' ';
+	Out[12] = '0' + (Year / 1000) % 10; Out[13] = '0' + (Year / 100) % 10;
+	Out[14] = '0' + (Year / 10) % 10; Out[15] = '0' + Year % 10;
+	Out[16] = ' ';
+	Out[17] = '0' + Hour / 10; Out[18] = '0' + Hour % 10; Out[19] = ':';
+	Out[20] = '0' + Minute / 10; Out[21] = '0' + Minute % 10; Out[22] = ':';
+	Out[23] = '0' + Second / 10; Out[24] = '0' + Second % 10;
+	Out[25] = ' '; Out[26] = 'G'; Out[27] = 'M'; Out[28] = 'T';
+	Out[29] = '\0';
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ParseHTTPDate() helpers. Each one reads from *P and moves it along.
+//----------------------------------------------------------------------------------------------------
+static void SkipSpaces(const char **P)
+{
+	while (**P == ' ' || **P == '\t')
+		(*P)++;
+}
+
+static bool ReadNumber(const char **P, int MaxDigits, int *Out)
+{
+	int Value = 0;
+	int Digits = 0;
+	while (**P >= '0' && **P <= '9' && Digits < MaxDigits)
+	{
+		Value = Value * 10 + (**P - '0');
+		(*P)++;
+		Digits++;
+	}
+	*Out = Value;
+	return Digits > 0;
+}
+
+static bool ReadTime(const char **P, int *Hour, int *Minute, int *Second)	// HH:MM:SS
+{
+	if (!ReadNumber(P, 2, Hour) || **P != ':')		return false;
+	(*P)++;
+	if (!ReadNumber(P, 2, Minute) || **P != ':')	return false;
+	(*P)++;
+	if (!ReadNumber(P, 2, Second))					return false;
+	return (*Hour < 24 && *Minute < 60 && *Second < 61);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ParseHTTPDate() - converts any of the three HTTP date formats into a time_t (UTC).
+//			Returns false if the text is not a date.
+//----------------------------------------------------------------------------------------------------
+bool ParseHTTPDate(const char *Text, time_t *Out)
+{
+	const char *P = Text;
+	int Day, Month, Year, Hour, Minute, Second;
+
+	SkipSpaces(&P);
+	while ((*P | 0x20) >= 'a' && (*P | 0x20) <= 'z')							// Skip the day name
+		P++;
+
+	if (*P == ',')
+	{
+		// IMF-fixdate ("Sun, 06 Nov 1994") or RFC 850 ("Sunday, 06-Nov-94")
+		P++;
+		SkipSpaces(&P);
+		if (!ReadNumber(&P, 2, &Day))						return false;
+		if (*P != ' ' && *P != '-')						return false;	// Or the end, which mustn't be passed
+		bool RFC850 = (*P == '-');
+		P++;
+		if ((Month = CalcMonth(P)) < 0)						return false;
+		P += 3;
+		if (*P != (RFC850 ? '-' : ' '))						return false;
+		P++;
+		if (!ReadNumber(&P, 4, &Year))						return false;
+		if (RFC850 && Year < 100)
+			Year += (Year < 70) ? 2000 : 1900;				// Two digit years: 70 - 99 are 19xx
+		SkipSpaces(&P);
+		if (!ReadTime(&P, &Hour, &Minute, &Second))			return false;
+	}
+	else
+	{
+		// asctime ("Sun Nov  6 08:49:37 1994")
+		SkipSpaces(&P);
+		if ((Month = CalcMonth(P)) < 0)						return false;
+		P += 3;
+		SkipSpaces(&P);
+		if (!ReadNumber(&P, 2, &Day))						return false;
+		SkipSpaces(&P);
+		if (!ReadTime(&P, &Hour, &Minute, &Second))			return false;
+		SkipSpaces(&P);
+		if (!ReadNumber(&P, 4, &Year))						return false;
+	}
+
+	if (Day < 1 || Day > 31 || Year < 1970)
+		return false;
+
+	*Out = (time_t)DaysFromCivil(Year, Month, Day) * 86400 + Hour * 3600 + Minute * 60 + Second;
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			FileTimeToUnix() - converts a windows FILETIME (100ns ticks since 1601) into a time_t
+//----------------------------------------------------------------------------------------------------
+time_t FileTimeToUnix(const FILETIME *FT)
+{
+	unsigned __int64 Ticks = ((unsigned __int64)FT->dwHighDateTime << 32) | FT->dwLowDateTime;
+	return (time_t)((Ticks - 116444736000000000) / 10000000);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTP Clock class
+//----------------------------------------------------------------------------------------------------
+class HTTPCLOCK
+{
+  public:
+	HTTPCLOCK();												// Constructor
+	bool Start();												// Starts the clock thread
+	void Stop();												// Stops the clock thread
+	void Now(char *Out);										// Copies the current date into Out (HTTPDATE_LENGTH + 1)
+	time_t Seconds();											// Current time in seconds, as of the last tick
+
+  private:
+	void Tick();												// Formats the current time into the spare slot
+	static DWORD WINAPI ClockThread(LPVOID lpParam);			// Calls Tick() once a second
+
+	char Slot[2][HTTPDATE_LENGTH + 1];							// The two date strings. Slot[Generation & 1] is live
+	volatile LONG Generation;									// Bumped every time a new slot is published
+	volatile LONG CurrentTime;									// time() as of the last tick
+	volatile bool Running;										// Is the clock thread running
+	HANDLE hThread;												// The clock thread
+}Clock;
+
+//----------------------------------------------------------------------------------------------------
+//			HTTPCLOCK::HTTPCLOCK
+//----------------------------------------------------------------------------------------------------
+HTTPCLOCK::HTTPCLOCK()
+{
+	Generation = 0;
+	CurrentTime = 0;
+	Running = false;
+	hThread = NULL;
+	Tick();														// Make sure there is always a valid date
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTPCLOCK::Tick() - only ever called by one thread at a time
+//----------------------------------------------------------------------------------------------------
+void HTTPCLOCK::Tick()
+{
+	time_t Now = time(NULL);
+	if ((LONG)Now == CurrentTime)
+		return;													// Still the same second, nothing to do
+
+	FormatHTTPDate(Now, Slot[(Generation + 1) & 1]);			// Write the slot nobody is reading
+	InterlockedExchange(&CurrentTime, (LONG)Now);
+	InterlockedIncrement(&Generation);							// Publish it
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTPCLOCK::Now() - copy the live slot. If the clock ticked while we were copying
+//			we might have half of each slot, so go around again.
+//----------------------------------------------------------------------------------------------------
+void HTTPCLOCK::Now(char *Out)
+{
+	LONG Before, After;
+	do
+	{
+		Before = Generation;
+		memcpy(Out, Slot[Before & 1], HTTPDATE_LENGTH + 1);
+		After = Generation;
+	} while (Before != After);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTPCLOCK::Seconds()
+//----------------------------------------------------------------------------------------------------
+time_t HTTPCLOCK::Seconds()
+{
+	return (time_t)CurrentTime;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTPCLOCK::Start()
+//----------------------------------------------------------------------------------------------------
+bool HTTPCLOCK::Start()
+{
+	if (Running)
+		return true;
+
+	Running = true;
+	DWORD dwThreadId;
+	hThread = CreateThread(NULL, 0, ClockThread, this, 0, &dwThreadId);
+	if (hThread == NULL)
+	{
+		Running = false;
+		return false;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTPCLOCK::Stop()
+//----------------------------------------------------------------------------------------------------
+void HTTPCLOCK::Stop()
+{
+	if (!Running)
+		return;
+
+	Running = false;
+	WaitForSingleObject(hThread, 2000);
+	CloseHandle(hThread);
+	hThread = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HTTPCLOCK::ClockThread() - used by CreateThread()
+//----------------------------------------------------------------------------------------------------
+DWORD WINAPI HTTPCLOCK::ClockThread(LPVOID lpParam)
+{
+	HTTPCLOCK *Self = (HTTPCLOCK *)lpParam;
+	SYSTEMTIME Now;
+	while (Self->Running)
+	{
+		Self->Tick();
+		GetSystemTime(&Now);
+		Sleep(1001 - Now.wMilliseconds);						// Wake up just after the start of the next second
+	}
+	return 0;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,737 @@
+#ifndef IOCPHPP
+#define IOCPHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			IOCP.HPP
+			--------
+			The iocp engine, used when the configuration file has <Engine>iocp</Engine>.
+			Instead of a thread for every connection, a few threads (<IOThreads>, two per
+			processor by default) wait on an I/O completion port. Each connection is a
+			coroutine (see coroutine.hpp), IOCPENGINE::Run(), which reads from top to
+			bottom like the thread engine's code but gives its thread back whenever it
+			waits:
+
+				accept		AcceptEx()s are kept waiting on the listening socket, so
+							connections are accepted without a thread sitting in accept()
+				admit		Past Options.MaxConnections, connections wait in Admission's
+							queue, as a coroutine that isn't on any thread
+				read		The request is read with overlapped ReadFile()s into a
+							pooled buffer until it is all there
+				transmit	Binary files go out with overlapped TransmitFile()s, headers
+							and all, straight from the file cache without passing through
+							our buffers
+				pace		If a bandwidth cap holds the next piece back (see pacing.hpp),
+							a timer on the wheel puts it back on the port when it's due
+				cgi			Scripts write into a pipe, which is read overlapped and sent
+							on with overlapped WriteFile()s as the output comes. Its
+							headers go with ours once it has written them all. If the
+							connection is kept open and it gave no Content-Length, the
+							body is chunked on the way, in the buffer it was read into
+				again		A connection that is kept open (see response.hpp) goes back
+							to reading, starting with anything pipelined after the last
+							request. With nothing pipelined it gives its Admission slot
+							up while it waits, and queues for one again once the next
+							request starts to arrive
+
+			The completion port is the scheduler. It lets only as many of its threads run
+			at once as there are processors, and whichever thread takes a completion off
+			it carries on that connection's coroutine, so a connection is never tied to a
+			thread.
+
+			Everything else about a request (finding the file, text files, folder indexes,
+			the status page, errors) is done by the same CONNECTION code the thread engine
+			uses, on the completion thread. Those can block, but the completion port knows
+			when one of its threads is blocked and lets another one run, so the rest of the
+			connections keep going.
+
+			If the engine can't start (no AcceptEx(), say), the server falls back to a
+			thread for each connection.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <mswsock.h>
+#include <vector>
+#include "options.hpp"
+#include "buffer.hpp"
+#include "metrics.hpp"
+#include "connection.hpp"
+#include "admission.hpp"
+#include "coroutine.hpp"
+
+using namespace std;
+#pragma comment(lib, "mswsock.lib")
+#pragma warning(disable:4786)
+
+#define IOCP_ACCEPTS						16						// AcceptEx()s kept waiting on the listening socket
+#define IOCP_ADDRESS						(sizeof(struct sockaddr_in) + 16)	// Room AcceptEx() wants for each address
+#define IOCP_TRANSMIT						262144					// File sent by each TransmitFile(), each has a send deadline
+#define IOCP_ROOM							16						// Room for a chunk's size before CGI output, and its end after
+
+//----------------------------------------------------------------------------------------------------
+//			One connection's coroutine
+//----------------------------------------------------------------------------------------------------
+struct IOCONTEXT
+{
+	IOCONTEXT();												// Everything empty, and Co at the start
+
+	OVERLAPPED Overlapped;										// Must be first, the port hands us a pointer to it
+	COROUTINE Co;												// Where Run() is up to
+	SOCKET Socket;												// The client's socket
+	CONNECTION *Connection;										// From ConnectionPool, once accepted
+	IOBUFFER *Buffer;											// The request as it arrives, then CGI output
+	WAITING Waiting;											// For Admission
+	bool Admitted;												// Has it got a slot
+	bool Counted;												// Is it one of its client's connections
+	DWORD Sent;													// How much of Buffer, or of the headers and file, has been sent
+	DWORD Size;													// Size of the headers and file
+	DWORD Piece;												// Most of the file each TransmitFile() sends
+	DWORD From;													// Where in Buffer the CGI output to write starts
+	int Scan;													// How far into a blank line the script's headers are, -1 past it
+	string Script;												// The script's headers, until its blank line
+	__int64 Left;												// Body the script said it would write still to come, or -1
+	TIMER Resume;												// Carries on after a pause for pacing
+	char Addresses[2 * IOCP_ADDRESS];							// AcceptEx() puts both addresses here
+};
+
+//----------------------------------------------------------------------------------------------------
+//			IOCONTEXT::IOCONTEXT - field by field, since Script can't be memset()
+//----------------------------------------------------------------------------------------------------
+IOCONTEXT::IOCONTEXT()
+{
+	memset(&Overlapped, 0, sizeof(Overlapped));
+	memset(&Co, 0, sizeof(Co));
+	Socket = INVALID_SOCKET;
+	Connection = NULL;
+	Buffer = NULL;
+	memset(&Waiting, 0, sizeof(Waiting));
+	Admitted = false;
+	Counted = false;
+	Sent = Size = Piece = From = 0;
+	Scan = 0;
+	Left = -1;
+	memset(&Resume, 0, sizeof(Resume));
+	memset(Addresses, 0, sizeof(Addresses));
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Engine class
+//----------------------------------------------------------------------------------------------------
+class IOCPENGINE
+{
+  public:
+	IOCPENGINE();												// Constructor
+	bool Start(SOCKET Listening);								// Starts the threads, false if the engine can't run
+	void Stop();												// Stops the threads. Close the listening socket first
+
+	volatile LONG Running;										// Connections open now
+
+  private:
+	void Launch();												// Starts another connection's coroutine
+	void Run(IOCONTEXT *Context);								// The coroutine, carries on from where it waited
+	bool Accepted(IOCONTEXT *Context);							// Gets a new connection ready
+	bool PostAccept(IOCONTEXT *Context);						// Starts an AcceptEx()
+	bool Admit(IOCONTEXT *Context);								// Waits for a slot, true if it has to
+	static void Woken(WAITING *Waiting);						// Waiting.Wake, resumes the coroutine
+	bool Pause(IOCONTEXT *Context, DWORD Milliseconds);			// Waits on the timer wheel, true if it has to
+	static void Resumed(TIMER *Timer);							// Resume.Expired, resumes the coroutine
+	bool PostRead(IOCONTEXT *Context, HANDLE From, char *Data, DWORD Length);
+	bool PostWrite(IOCONTEXT *Context, const char *Data, DWORD Length);
+	bool PostTransmit(IOCONTEXT *Context);						// Sends the headers and file with TransmitFile()
+	void Frame(IOCONTEXT *Context);								// Chunks CGI output that was just read, if it has to
+	void Finish(IOCONTEXT *Context, bool Answered);				// Counts, logs and closes the connection
+
+	static DWORD WINAPI CompletionThread(LPVOID lpParam);
+	static DWORD WINAPI Multiplex(LPVOID lpParam);				// Serves an HTTP/2 connection, then finishes it
+
+	HANDLE Port;												// The completion port
+	SOCKET Listen;												// The listening socket
+	vector <HANDLE> Threads;									// Completion threads
+	volatile LONG Stopping;										// 1 once Stop() has been called
+	volatile LONG Accepting;									// AcceptEx()s waiting
+}Engine;
+
+IOCPENGINE::IOCPENGINE()
+{
+	Port = NULL;
+	Listen = INVALID_SOCKET;
+	Running = 0;
+	Stopping = 0;
+	Accepting = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Start()
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::Start(SOCKET Listening)
+{
+	Listen = Listening;
+	Stopping = 0;
+	Port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);	// 0 runs a thread per processor at once
+	if (!Port)
+		return false;
+	if (!CreateIoCompletionPort((HANDLE)Listen, Port, 0, 0))
+	{
+		CloseHandle(Port);
+		Port = NULL;
+		return false;
+	}
+
+	int Count = Options.IOThreads;
+	if (Count <= 0)
+	{
+		SYSTEM_INFO Info;
+		GetSystemInfo(&Info);
+		Count = 2 * Info.dwNumberOfProcessors;					// Spares for when one blocks
+	}
+	for (int X = 0; X < Count; X++)
+	{
+		DWORD dwThreadId;
+		HANDLE hThread = CreateThread(NULL, 0, CompletionThread, this, 0, &dwThreadId);
+		if (hThread)
+			Threads.push_back(hThread);
+	}
+
+	for (int A = 0; A < IOCP_ACCEPTS; A++)
+		Launch();
+	if (Threads.empty() || !Accepting)
+	{
+		Stop();
+		return false;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Stop() - waits up to Options.Timeout for the open connections, then
+//			stops the threads
+//----------------------------------------------------------------------------------------------------
+void IOCPENGINE::Stop()
+{
+	InterlockedExchange(&Stopping, 1);
+	for (int Wait = 0; Running > 0 && Wait < Options.Timeout * 10; Wait++)
+		Sleep(100);
+
+	int X;
+	for (X = 0; X < (int)Threads.size(); X++)
+		PostQueuedCompletionStatus(Port, 0, 0, NULL);			// A NULL OVERLAPPED tells a thread to stop
+	for (X = 0; X < (int)Threads.size(); X++)
+	{
+		WaitForSingleObject(Threads[X], INFINITE);
+		CloseHandle(Threads[X]);
+	}
+	Threads.erase(Threads.begin(), Threads.end());
+	if (Port)
+		CloseHandle(Port);
+	Port = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::CompletionThread() - carries on the coroutine of whatever has
+//			finished. Used by CreateThread()
+//----------------------------------------------------------------------------------------------------
+DWORD WINAPI IOCPENGINE::CompletionThread(LPVOID lpParam)
+{
+	IOCPENGINE *E = (IOCPENGINE *)lpParam;
+
+	for (;;)
+	{
+		DWORD Bytes = 0;
+		DWORD Key = 0;
+		OVERLAPPED *Overlapped = NULL;
+		BOOL OK = GetQueuedCompletionStatus(E->Port, &Bytes, &Key, &Overlapped, INFINITE);
+		if (!Overlapped)
+			break;												// Stop() or the port has gone
+
+		IOCONTEXT *Context = (IOCONTEXT *)Overlapped;
+		Context->Co.Result = OK != FALSE;
+		Context->Co.Bytes = OK ? Bytes : 0;
+		E->Run(Context);										// Context may be gone after this
+	}
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Launch()
+//----------------------------------------------------------------------------------------------------
+void IOCPENGINE::Launch()
+{
+	if (Stopping)
+		return;
+	IOCONTEXT *Context = new IOCONTEXT;							// Co.Point 0, the start
+	Run(Context);												// Runs as far as the AcceptEx()
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Run() - one connection, from accepting it to closing it. Returns
+//			each time it waits, and the completion thread calls it again when the wait is
+//			over. Nothing it needs after a CO_AWAIT can be a local.
+//----------------------------------------------------------------------------------------------------
+void IOCPENGINE::Run(IOCONTEXT *Context)
+{
+	COROUTINE *Co = &Context->Co;
+	CONNECTION *C = Context->Connection;						// NULL until it's accepted
+	CO_BEGIN(Co);
+
+	// Wait for a client
+	CO_AWAIT(Co, 1, PostAccept(Context));
+	if (Context->Socket != INVALID_SOCKET)						// It did start
+	{
+		InterlockedDecrement(&Accepting);
+		Launch();												// Keep the listening socket busy
+	}
+	if (!Co->Result || !Accepted(Context))
+	{
+		if (Context->Socket != INVALID_SOCKET)
+			closesocket(Context->Socket);						// Usually the listening socket closing
+		delete Context;
+		return;
+	}
+	C = Context->Connection;
+	if (!RateLimits.Connect(C->ClientAddress.sin_addr))
+	{
+		RateLimits.SendLimited(Context->Socket);				// It has enough open already
+		Finish(Context, false);
+		return;
+	}
+	Context->Counted = true;
+
+	// Wait for a slot if Admission says so. Queued, we just wait on the port for Woken().
+	CO_AWAIT(Co, 2, Admit(Context));
+	if (Context->Waiting.Shed)
+	{
+		Admission.SendShed(Context->Socket);					// Too busy, try again later
+		Finish(Context, false);
+		return;
+	}
+	Context->Admitted = true;
+
+	// One request after another, for as long as the connection is kept open
+	for (;;)
+	{
+		// Read until it has all arrived, with the same deadlines as CONNECTION::ReadRequest().
+		//  A kept connection starts with whatever came after the last request.
+		Context->Buffer->Used = C->Pending.length();
+		memcpy(Context->Buffer->Data, C->Pending.data(), Context->Buffer->Used);
+		Context->Buffer->Data[Context->Buffer->Used] = '\0';
+		C->Pending.erase();
+		Context->Sent = Context->Buffer->Used ? RequestState(Context->Buffer->Data, Context->Buffer->Used)
+											  : REQUEST_HEADERS;	// Sent isn't used yet, it keeps the state
+		C->Arm(Context->Buffer->Used ? TIMEOUT_HEADER : C->Served ? TIMEOUT_KEEPALIVE : TIMEOUT_IDLE);
+		if (!Context->Buffer->Used && C->Served)
+		{
+			Context->Admitted = false;							// Nothing to do until the client says something,
+			Admission.Leave();									//  so someone else can have the slot meanwhile
+		}
+		while (Context->Sent != REQUEST_COMPLETE && Context->Buffer->Used < Context->Buffer->Size - 1)
+		{
+			CO_AWAIT(Co, 3, PostRead(Context, (HANDLE)Context->Socket, Context->Buffer->Data + Context->Buffer->Used,
+									 Context->Buffer->Size - 1 - Context->Buffer->Used));
+			if (!Co->Bytes)
+				break;											// The client has gone, stopped sending, or timed out
+			if (!Context->Admitted)
+			{
+				// It's back, and waits for a slot like a new connection would
+				Context->Buffer->Used = Co->Bytes;				// Co->Bytes doesn't last the wait
+				Timers.Cancel(&C->Deadline);
+				CO_AWAIT(Co, 9, Admit(Context));
+				if (Context->Waiting.Shed)
+				{
+					Admission.SendShed(Context->Socket);
+					Finish(Context, false);
+					return;
+				}
+				Context->Admitted = true;
+				Co->Bytes = Context->Buffer->Used;
+				Context->Buffer->Used = 0;
+			}
+			if (!Context->Buffer->Used)
+			{
+				C->Arm(TIMEOUT_HEADER);
+				if (C->Served)
+					C->Arrived = C->LastMark = Latency.Now();	// Waiting for it isn't part of it
+			}
+			Context->Buffer->Used += Co->Bytes;
+			Context->Buffer->Data[Context->Buffer->Used] = '\0';
+			int State = RequestState(Context->Buffer->Data, Context->Buffer->Used);
+			if (State == REQUEST_BODY && Context->Sent != REQUEST_BODY)
+				C->Arm(TIMEOUT_BODY);
+			Context->Sent = State;
+		}
+		if (!Context->Buffer->Used)
+		{
+			Finish(Context, false);								// Connected and went without asking for anything,
+			return;												//  or went after the last one
+		}
+
+		// HTTP/2 reads frames with blocking calls until the client goes, so, as HTTPS does,
+		//  it gets a thread of its own, and the connection leaves the port
+		if (C->Preface(Context->Buffer->Data, Context->Buffer->Used))
+		{
+			DWORD dwThreadId;
+			HANDLE hThread = CreateThread(NULL, 0, Multiplex, Context, 0, &dwThreadId);
+			if (hThread)
+				CloseHandle(hThread);
+			else
+				Finish(Context, false);
+			return;
+		}
+
+		// Answer it, with the same code as the thread engine. It leaves binary files and
+		//  CGI output for us to send.
+		C->Split(Context->Buffer->Data, Context->Buffer->Used);
+		C->RequestReceived(Context->Buffer->Data);
+		IOBuffers.Put(Context->Buffer);
+		Context->Buffer = NULL;
+		C->HandleRequest();
+
+		if (C->TransmitHandle != INVALID_HANDLE_VALUE)
+		{
+			// A piece at a time, so a client that stops reading misses a deadline, and so
+			//  pacing can hold pieces back
+			Context->Size = C->Headers.length() + GetFileSize(C->TransmitHandle, NULL);
+			Pacing.Start(&C->Pace, C->UseVH ? C->ThisHost : NULL);
+			Context->Piece = Pacing.Piece(&C->Pace, IOCP_TRANSMIT);
+			for (Context->Sent = 0; Context->Sent < Context->Size; Context->Sent += Co->Bytes)
+			{
+				CO_AWAIT(Co, 4, Pause(Context, Pacing.Delay(&C->Pace, min(Context->Piece, Context->Size - Context->Sent))));
+				C->Arm(TIMEOUT_SEND);
+				CO_AWAIT(Co, 5, PostTransmit(Context));
+				if (!Co->Bytes)
+					break;
+				C->BytesSent += Co->Bytes;
+			}
+			if (C->TransmitHandle != INVALID_HANDLE_VALUE)
+			{
+				CloseHandle(C->TransmitHandle);
+				C->TransmitHandle = INVALID_HANDLE_VALUE;
+				if (Context->Sent < Context->Size)
+					C->KeepAlive = false;						// The client went before it had it all
+			}
+			else if (!Context->Sent)
+			{
+				C->Send(C->Headers.c_str(), C->Headers.length());	// TransmitFile() wouldn't, send it the usual way
+				C->SendBinary();
+			}
+			else
+				C->KeepAlive = false;							// It stopped partway
+		}
+
+		if (C->CGIOutput != INVALID_HANDLE_VALUE)
+		{
+			// Send the script's output on as it comes, until it finishes or the client goes
+			CreateIoCompletionPort(C->CGIOutput, Port, 0, 0);
+			Context->Buffer = IOBuffers.Get(IOBUFFER_BULK);
+			Context->Scan = 1;									// The script starts at the start of a line
+			Context->Script.erase();
+			Context->Left = -1;
+			if (!Context->Buffer)
+				C->KeepAlive = false;
+			while (Context->Buffer)
+			{
+				Timers.Cancel(&C->Deadline);					// The script can take as long as it likes
+				CO_AWAIT(Co, 6, PostRead(Context, C->CGIOutput, Context->Buffer->Data + IOCP_ROOM,
+										 Context->Buffer->Size - 2 * IOCP_ROOM));
+				if (!Co->Bytes)
+					break;										// The script has finished
+				Context->Buffer->Used = Co->Bytes;
+				Frame(Context);
+				for (Context->Sent = Context->From; Context->Sent < Context->Size; Context->Sent += Co->Bytes)
+				{
+					C->Arm(TIMEOUT_SEND);
+					CO_AWAIT(Co, 7, PostWrite(Context, Context->Buffer->Data + Context->Sent,
+											  Context->Size - Context->Sent));
+					if (!Co->Bytes)
+						break;
+					C->BytesSent += Co->Bytes;
+				}
+				if (Context->Sent < Context->Size)
+				{
+					C->KeepAlive = false;						// The client has gone
+					break;
+				}
+			}
+			if (Context->Scan >= 0)
+			{
+				C->KeepAlive = false;							// The script never ended its headers
+				C->SendCGIHeaders(Context->Script.data(), Context->Script.length());
+			}
+			if (Context->Left > 0)
+				C->KeepAlive = false;							// It wrote less than it said it would
+			if (C->KeepAlive && Context->Left < 0)
+			{
+				// The last chunk
+				memcpy(Context->Buffer->Data, "0\r\n\r\n", 5);
+				for (Context->Sent = 0; Context->Sent < 5; Context->Sent += Co->Bytes)
+				{
+					C->Arm(TIMEOUT_SEND);
+					CO_AWAIT(Co, 8, PostWrite(Context, Context->Buffer->Data + Context->Sent, 5 - Context->Sent));
+					if (!Co->Bytes)
+						break;
+					C->BytesSent += Co->Bytes;
+				}
+				if (Context->Sent < 5)
+					C->KeepAlive = false;
+			}
+			IOBuffers.Put(Context->Buffer);
+			Context->Buffer = NULL;
+			C->EndCGI();
+			C->Mark(STAGE_CGI);
+		}
+
+		if (Stopping || !C->KeepAlive)
+			break;
+		C->CountRequest();										// Count it, before logging adds to the time
+		C->LogConnection();
+		C->Next();
+		Context->Buffer = IOBuffers.Get(IOBUFFER_REQUEST);
+		if (!Context->Buffer)
+		{
+			Finish(Context, false);
+			return;
+		}
+	}
+
+	Finish(Context, true);
+	CO_END(Co);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Accepted() - gets the new connection ready to read the request
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::Accepted(IOCONTEXT *Context)
+{
+	setsockopt(Context->Socket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT, (char *)&Listen, sizeof(Listen));
+	CreateIoCompletionPort((HANDLE)Context->Socket, Port, 0, 0);
+
+	struct sockaddr *Local, *Remote;
+	int LocalLength, RemoteLength;
+	GetAcceptExSockaddrs(Context->Addresses, 0, IOCP_ADDRESS, IOCP_ADDRESS, &Local, &LocalLength, &Remote, &RemoteLength);
+	struct sockaddr_in Client;
+	memset(&Client, 0, sizeof(Client));
+	if (RemoteLength >= (int)sizeof(Client))
+		memcpy(&Client, Remote, sizeof(Client));
+
+	InterlockedIncrement(&Running);
+	Metrics.ConnectionOpened();
+	Context->Connection = ConnectionPool.Get((int)Context->Socket, Client);
+	Context->Buffer = IOBuffers.Get(IOBUFFER_REQUEST);
+	if (!Context->Connection || !Context->Buffer)
+	{
+		ConnectionPool.Put(Context->Connection);
+		IOBuffers.Put(Context->Buffer);
+		Metrics.ConnectionClosed();
+		InterlockedDecrement(&Running);
+		return false;
+	}
+	Context->Connection->Transmit = true;						// We send binary files and CGI output
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::PostAccept()
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::PostAccept(IOCONTEXT *Context)
+{
+	if (Stopping)
+		return false;
+	Context->Socket = socket(AF_INET, SOCK_STREAM, 0);			// Winsock sockets can be used overlapped
+	if (Context->Socket == INVALID_SOCKET)
+		return false;
+
+	DWORD Received;
+	if (!AcceptEx(Listen, Context->Socket, Context->Addresses, 0, IOCP_ADDRESS, IOCP_ADDRESS,
+				  &Received, &Context->Overlapped) && WSAGetLastError() != ERROR_IO_PENDING)
+	{
+		closesocket(Context->Socket);
+		Context->Socket = INVALID_SOCKET;
+		return false;
+	}
+	InterlockedIncrement(&Accepting);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Admit() and IOCPENGINE::Woken()
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::Admit(IOCONTEXT *Context)
+{
+	Context->Waiting.Wake = Woken;
+	Context->Waiting.Owner = Context;
+	return Admission.Arrive(&Context->Waiting) == ADMISSION_QUEUED;	// Then Woken() may have run already
+}
+
+void IOCPENGINE::Woken(WAITING *Waiting)
+{
+	IOCONTEXT *Context = (IOCONTEXT *)Waiting->Owner;
+	memset(&Context->Overlapped, 0, sizeof(OVERLAPPED));
+	PostQueuedCompletionStatus(Engine.Port, 0, 0, &Context->Overlapped);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Pause() and IOCPENGINE::Resumed()
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::Pause(IOCONTEXT *Context, DWORD Milliseconds)
+{
+	if (!Milliseconds)
+		return false;
+	Timers.Cancel(&Context->Connection->Deadline);				// Our wait, not the client's
+	Context->Resume.Expired = Resumed;
+	Context->Resume.Owner = Context;
+	Timers.Arm(&Context->Resume, Milliseconds);
+	return true;
+}
+
+void IOCPENGINE::Resumed(TIMER *Timer)
+{
+	IOCONTEXT *Context = (IOCONTEXT *)Timer->Owner;
+	memset(&Context->Overlapped, 0, sizeof(OVERLAPPED));
+	PostQueuedCompletionStatus(Engine.Port, 0, 0, &Context->Overlapped);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::PostRead() - an overlapped read from the socket or a CGI pipe
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::PostRead(IOCONTEXT *Context, HANDLE From, char *Data, DWORD Length)
+{
+	memset(&Context->Overlapped, 0, sizeof(OVERLAPPED));
+	DWORD Read;
+	if (!ReadFile(From, Data, Length, &Read, &Context->Overlapped) && GetLastError() != ERROR_IO_PENDING)
+		return false;
+	return true;												// It finishes on the port, even if it finished already
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::PostWrite() - an overlapped write to the socket
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::PostWrite(IOCONTEXT *Context, const char *Data, DWORD Length)
+{
+	memset(&Context->Overlapped, 0, sizeof(OVERLAPPED));
+	DWORD Written;
+	if (!WriteFile((HANDLE)Context->Socket, Data, Length, &Written, &Context->Overlapped)
+		&& GetLastError() != ERROR_IO_PENDING)
+		return false;
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::PostTransmit() - sends the next piece of the file after the first
+//			Context->Sent bytes, with the headers in front of the first. Closes the file and
+//			returns false if TransmitFile() wouldn't start.
+//----------------------------------------------------------------------------------------------------
+bool IOCPENGINE::PostTransmit(IOCONTEXT *Context)
+{
+	CONNECTION *C = Context->Connection;
+	DWORD HeadLength = C->Headers.length();
+	memset(&Context->Overlapped, 0, sizeof(OVERLAPPED));
+	Context->Overlapped.Offset = Context->Sent ? Context->Sent - HeadLength : 0;
+	DWORD Piece = Context->Size - HeadLength - Context->Overlapped.Offset;
+	if (Piece > Context->Piece)
+		Piece = Context->Piece;
+
+	TRANSMIT_FILE_BUFFERS Head;
+	Head.Head = (void *)C->Headers.data();
+	Head.HeadLength = Context->Sent ? 0 : HeadLength;
+	Head.Tail = NULL;
+	Head.TailLength = 0;
+	if (!TransmitFile(Context->Socket, C->TransmitHandle, Piece, 0, &Context->Overlapped, &Head, 0)
+		&& WSAGetLastError() != ERROR_IO_PENDING)
+	{
+		CloseHandle(C->TransmitHandle);
+		C->TransmitHandle = INVALID_HANDLE_VALUE;
+		return false;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Frame() - puts CGI output that was just read into Buffer, after IOCP_ROOM, in
+//			a chunk if the connection is being kept open and the script gave no length. The
+//			script's headers are kept until its blank line, then sent with ours. Sets From and
+//			Size to the part of Buffer to write.
+//----------------------------------------------------------------------------------------------------
+void IOCPENGINE::Frame(IOCONTEXT *Context)
+{
+	char *Data = Context->Buffer->Data + IOCP_ROOM;
+	DWORD Length = Context->Buffer->Used;
+	DWORD Head = 0;
+	if (Context->Scan >= 0)
+	{
+		while (Context->Scan >= 0 && Head < Length)
+		{
+			char C = Data[Head++];
+			if (C == '\n')
+				Context->Scan = Context->Scan ? -1 : 1;			// A line of its own ends the headers
+			else if (C == '\r' && Context->Scan == 1)
+				Context->Scan = 2;
+			else
+				Context->Scan = 0;
+		}
+		Context->Script.append(Data, Head);
+		if (Context->Scan < 0)
+		{
+			Context->Left = Context->Connection->SendCGIHeaders(Context->Script.data(), Context->Script.length());
+			Context->Script.erase();
+		}
+	}
+
+	Data += Head;
+	Length -= Head;
+	if (Context->Left >= 0 && Length > Context->Left)
+		Length = (DWORD)Context->Left;							// Past what it said, the client wouldn't know it
+	if (Context->Left >= 0)
+		Context->Left -= Length;
+	Context->From = IOCP_ROOM + Head;
+	Context->Size = IOCP_ROOM + Head + Length;
+	if (!Length || !Context->Connection->KeepAlive || Context->Left >= 0)
+		return;
+
+	char Size[IOCP_ROOM];
+	int Line = sprintf(Size, "%lx\r\n", Length);
+	memcpy(Data - Line, Size, Line);							// Over headers that have gone already
+	memcpy(Data + Length, "\r\n", 2);
+	Context->From -= Line;
+	Context->Size += 2;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Multiplex()
+//----------------------------------------------------------------------------------------------------
+DWORD WINAPI IOCPENGINE::Multiplex(LPVOID lpParam)
+{
+	IOCONTEXT *Context = (IOCONTEXT *)lpParam;
+	Context->Admitted = false;									// ServeHTTP2() gives the slot up for its streams
+	Context->Connection->ServeHTTP2();
+	Engine.Finish(Context, false);								// Its streams were counted and logged already
+	ThreadSlots.Release();
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			IOCPENGINE::Finish()
+//----------------------------------------------------------------------------------------------------
+void IOCPENGINE::Finish(IOCONTEXT *Context, bool Answered)
+{
+	CONNECTION *C = Context->Connection;
+	if (C && Answered)
+	{
+		C->CountRequest();										// Count it, before logging adds to the time
+		C->LogConnection();
+	}
+	if (C && Context->Counted)
+		RateLimits.Disconnect(C->ClientAddress.sin_addr);
+	if (C)
+		C->EndCGI();
+	ConnectionPool.Put(C);										// Cancels the deadline, so before closesocket()
+	closesocket(Context->Socket);
+	IOBuffers.Put(Context->Buffer);
+	bool Admitted = Context->Admitted;
+	delete Context;
+
+	Metrics.ConnectionClosed();
+	InterlockedDecrement(&Running);
+	if (Admitted)
+		Admission.Leave();										// Let the next one in
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,330 @@
+#ifndef LISTINGHPP
+#define LISTINGHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			LISTING.HPP
+			-----------
+			Cache of folder listings, used by CONNECTION::IndexFolder().
+
+			Reading a folder with FindFirstFile()/FindNextFile() is slow for big folders, so
+			each folder is read once and the entries kept, sorted by name, until the folder's
+			last write time changes (which windows updates when a file is added, removed or
+			renamed). File sizes can change without the folder changing, so listings are also
+			read again once they are LISTING_MAXAGE seconds old.
+
+			Listings are reference counted, so a request can carry on sending a listing
+			while another request replaces it in the cache.
+
+			Names go into the links %-escaped with SENDBUFFER::WriteURL(), and
+			CONNECTION::ParseRequest() undoes that with DecodeURL() when they are followed.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include "httpdate.hpp"
+#include "metrics.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define LISTING_MAXAGE						10						// Seconds before a listing is read again anyway
+#define LISTING_MAXFOLDERS					256						// Number of folders kept in the cache
+
+#define LISTING_SORT_NAME					0
+#define LISTING_SORT_SIZE					1
+#define LISTING_SORT_DATE					2
+
+//----------------------------------------------------------------------------------------------------
+//			One file or folder in a listing
+//----------------------------------------------------------------------------------------------------
+struct LISTINGENTRY
+{
+	string Name;												// File name
+	unsigned __int64 Size;										// Size in bytes (0 for folders)
+	time_t Modified;											// Last write time
+	bool IsFolder;												// Is it a folder
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Sorting. Folders always come before files.
+//----------------------------------------------------------------------------------------------------
+struct LISTINGBYNAME
+{
+	bool operator()(const LISTINGENTRY &A, const LISTINGENTRY &B) const
+	{
+		if (A.IsFolder != B.IsFolder)
+			return A.IsFolder;
+		return strcmpi(A.Name.c_str(), B.Name.c_str()) < 0;
+	}
+};
+
+struct LISTINGORDER												// Sorts entry numbers by size or date
+{
+	const vector <LISTINGENTRY> *Entries;
+	int Sort;
+
+	bool operator()(int A, int B) const
+	{
+		const LISTINGENTRY &EA = (*Entries)[A];
+		const LISTINGENTRY &EB = (*Entries)[B];
+		if (EA.IsFolder != EB.IsFolder)
+			return EA.IsFolder;
+		if (Sort == LISTING_SORT_SIZE && EA.Size != EB.Size)
+			return EA.Size < EB.Size;
+		if (Sort == LISTING_SORT_DATE && EA.Modified != EB.Modified)
+			return EA.Modified < EB.Modified;
+		return A < B;											// Entries are already in name order
+	}
+};
+
+//----------------------------------------------------------------------------------------------------
+//			A folder listing
+//----------------------------------------------------------------------------------------------------
+class LISTING
+{
+  public:
+	LISTING();													// Constructor
+	~LISTING();													// Destructor
+	bool Read(const string &Folder);							// Reads the folder
+	const vector <int> &Order(int Sort);						// Entry numbers in the given order
+	int Position(int X, bool Descending) const;					// Where the Xth entry is in an Order(), folders still first
+
+	vector <LISTINGENTRY> Entries;								// Entries, sorted by name
+	int Folders;												// How many of them are folders (they're all at the start)
+	FILETIME FolderModified;									// Last write time of the folder when it was read
+	time_t ReadAt;												// When it was read
+	time_t LastUsed;											// When it was last sent, for throwing out old listings
+	volatile LONG References;									// Number of requests using it, plus one for the cache
+
+  private:
+	vector <int> Orders[3];										// Entry numbers sorted by size and date, made as needed
+	bool HaveOrder[3];
+	CRITICAL_SECTION Lock;										// Protects Orders
+};
+
+//----------------------------------------------------------------------------------------------------
+//			LISTING::LISTING
+//----------------------------------------------------------------------------------------------------
+LISTING::LISTING()
+{
+	ReadAt = 0;
+	LastUsed = 0;
+	Folders = 0;
+	References = 1;
+	HaveOrder[0] = HaveOrder[1] = HaveOrder[2] = false;
+	InitializeCriticalSection(&Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTING::~LISTING
+//----------------------------------------------------------------------------------------------------
+LISTING::~LISTING()
+{
+	DeleteCriticalSection(&Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTING::Read()
+//----------------------------------------------------------------------------------------------------
+bool LISTING::Read(const string &Folder)
+{
+	WIN32_FILE_ATTRIBUTE_DATA FolderData;
+	if (!GetFileAttributesEx(Folder.c_str(), GetFileExInfoStandard, &FolderData))
+		return false;
+	FolderModified = FolderData.ftLastWriteTime;
+	ReadAt = Clock.Seconds();
+
+	WIN32_FIND_DATA FindData;
+	string FileIndex = Folder + "\\*.*";						// List all files
+	HANDLE hFind = FindFirstFile(FileIndex.c_str(), &FindData);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return false;
+
+	do
+	{
+		if (!strcmp(FindData.cFileName, "."))
+			continue;
+
+		LISTINGENTRY Entry;
+		Entry.Name = FindData.cFileName;
+		Entry.IsFolder = (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+		Entry.Size = Entry.IsFolder ? 0 :
+					 ((unsigned __int64)FindData.nFileSizeHigh << 32) | FindData.nFileSizeLow;
+		Entry.Modified = FileTimeToUnix(&FindData.ftLastWriteTime);
+		Entries.push_back(Entry);
+		if (Entry.IsFolder) Folders++;
+	} while (FindNextFile(hFind, &FindData));
+	FindClose(hFind);
+
+	sort(Entries.begin(), Entries.end(), LISTINGBYNAME());
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTING::Order()
+//----------------------------------------------------------------------------------------------------
+const vector <int> &LISTING::Order(int Sort)
+{
+	EnterCriticalSection(&Lock);
+	if (!HaveOrder[Sort])
+	{
+		Orders[Sort].resize(Entries.size());
+		for (int X = 0; X < (int)Entries.size(); X++)
+			Orders[Sort][X] = X;
+
+		if (Sort != LISTING_SORT_NAME)
+		{
+			LISTINGORDER ByField;
+			ByField.Entries = &Entries;
+			ByField.Sort = Sort;
+			sort(Orders[Sort].begin(), Orders[Sort].end(), ByField);
+		}
+		HaveOrder[Sort] = true;
+	}
+	LeaveCriticalSection(&Lock);
+	return Orders[Sort];
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTING::Position() - descending turns the folders round and the files round, but
+//			leaves the folders before the files
+//----------------------------------------------------------------------------------------------------
+int LISTING::Position(int X, bool Descending) const
+{
+	if (!Descending)
+		return X;
+	if (X < Folders)
+		return Folders - 1 - X;
+	return (int)Entries.size() - 1 - X + Folders;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Listing cache class
+//----------------------------------------------------------------------------------------------------
+class LISTINGCACHE
+{
+  public:
+	LISTINGCACHE();												// Constructor
+	LISTING *Get(const string &Folder);							// Gets a listing. Release() it when done
+	void Release(LISTING *Listing);								// Finished with a listing
+
+  private:
+	bool IsCurrent(const string &Folder, LISTING *Listing);		// Is a cached listing still good
+	void Trim();												// Throws out the least recently used listing
+
+	map <string, LISTING *> Folders;							// Folder path to its listing
+	CRITICAL_SECTION Lock;										// Protects Folders
+}Listings;
+
+//----------------------------------------------------------------------------------------------------
+//			LISTINGCACHE::LISTINGCACHE
+//----------------------------------------------------------------------------------------------------
+LISTINGCACHE::LISTINGCACHE()
+{
+	InitializeCriticalSection(&Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTINGCACHE::IsCurrent()
+//----------------------------------------------------------------------------------------------------
+bool LISTINGCACHE::IsCurrent(const string &Folder, LISTING *Listing)
+{
+	if (Clock.Seconds() - Listing->ReadAt > LISTING_MAXAGE)
+		return false;
+
+	WIN32_FILE_ATTRIBUTE_DATA FolderData;
+	if (!GetFileAttributesEx(Folder.c_str(), GetFileExInfoStandard, &FolderData))
+		return false;
+
+	return FolderData.ftLastWriteTime.dwLowDateTime == Listing->FolderModified.dwLowDateTime
+		&& FolderData.ftLastWriteTime.dwHighDateTime == Listing->FolderModified.dwHighDateTime;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTINGCACHE::Get()
+//----------------------------------------------------------------------------------------------------
+LISTING *LISTINGCACHE::Get(const string &Folder)
+{
+	LISTING *Listing = NULL;
+
+	EnterCriticalSection(&Lock);
+	map <string, LISTING *>::iterator Found = Folders.find(Folder);
+	if (Found != Folders.end())
+	{
+		Listing = Found->second;
+		InterlockedIncrement(&Listing->References);
+	}
+	LeaveCriticalSection(&Lock);
+
+	if (Listing)
+	{
+		if (IsCurrent(Folder, Listing))
+		{
+			Metrics.Cache(METRIC_CACHE_LISTING, true);
+			Listing->LastUsed = Clock.Seconds();
+			return Listing;
+		}
+		Release(Listing);										// Out of date
+	}
+
+	// Read the folder outside the lock, it can take a while
+	Metrics.Cache(METRIC_CACHE_LISTING, false);
+	Listing = new LISTING;
+	if (!Listing->Read(Folder))
+	{
+		delete Listing;
+		return NULL;
+	}
+	Listing->LastUsed = Clock.Seconds();
+	Listing->References = 2;									// One for the cache, one for the caller
+
+	EnterCriticalSection(&Lock);
+	Found = Folders.find(Folder);
+	if (Found != Folders.end())
+	{
+		Release(Found->second);									// Drop the cache's reference to the old one
+		Found->second = Listing;
+	}
+	else
+	{
+		if (Folders.size() >= LISTING_MAXFOLDERS)
+			Trim();
+		Folders[Folder] = Listing;
+	}
+	LeaveCriticalSection(&Lock);
+
+	return Listing;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTINGCACHE::Release()
+//----------------------------------------------------------------------------------------------------
+void LISTINGCACHE::Release(LISTING *Listing)
+{
+	if (InterlockedDecrement(&Listing->References) == 0)
+		delete Listing;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LISTINGCACHE::Trim() - called with the lock held
+//----------------------------------------------------------------------------------------------------
+void LISTINGCACHE::Trim()
+{
+	map <string, LISTING *>::iterator Oldest = Folders.end();
+	map <string, LISTING *>::iterator It;
+	for (It = Folders.begin(); It != Folders.end(); It++)
+	{
+		if (Oldest == Folders.end() || It->second->LastUsed < Oldest->second->LastUsed)
+			Oldest = It;
+	}
+	if (Oldest != Folders.end())
+	{
+		Release(Oldest->second);
+		Folders.erase(Oldest);
+	}
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -7,6 +7,9 @@
 #include <iostream>
 #include "options.hpp"
 #include "connection.hpp"
+#include "admission.hpp"
+#include "iocp.hpp"
+#include "prewarm.hpp"
 
 using namespace std;
 #pragma comment(lib, "wsock32.lib")
@@ -18,8 +21,12 @@ using namespace std;
 void ServiceMain();
 void  ControlHandler(DWORD request); 
 void TestLog(string);
-void PrintAccepts(const map<string, bool>::value_type& p);
 DWORD WINAPI ProcessRequest(LPVOID lpParam );
+DWORD WINAPI ProcessStream(LPVOID lpParam);
+void StartRequest(WAITING *Waiting);
+int OpenListener(int Port);
+void AcceptLoop(int SFD_Listen, bool Secure);
+DWORD WINAPI SecureAccepts(LPVOID lpParam);
 
 //---------------------------------------------------------------------------------------------
 //			Globals
@@ -30,8 +37,10 @@ SERVICE_STATUS          ServiceStatus;
 SERVICE_STATUS_HANDLE   hStatus; 
 struct ARGUMENT
 {
+	WAITING Waiting;											// For Admission, until it gets a slot
 	int SFD;
 	struct sockaddr_in CLA;
+	bool Secure;												// Came in on the HTTPS port
 };
 
 //---------------------------------------------------------------------------------------------
@@ -86,12 +95,42 @@ void ServiceMain()
 	// These are default settings, incase the configuration file is corrupt
 	Options.CGI["php"] = "C:\\PHP\\php.exe";
 	Options.Logfile = "C:\\SWS\\LOGS\\Logfile.log";
+	Options.LogFormat = "common";
+	Options.LogRotateSize = 0;
+	Options.LogRotateMinutes = 0;
+	Options.LogCompress = false;
 	Options.MaxConnections = 20;
+	Options.QueueTarget = 5;
+	Options.QueueInterval = 100;
+	Options.ClientConnections = 0;
+	Options.RateLimit = 0;
+	Options.RateBurst = 0;
+	Options.RatePrefix = 32;
+	Options.SendRate = 0;
+	Options.SendBurst = 256;
+	Options.ReadAhead = 1024;
+	Options.CacheSize = 16384;
+	Options.PrewarmTop = 0;
+	Options.PrewarmRate = 4096;
+	Options.SecurePort = 443;
+	Options.SessionLifetime = 36000;
+	Options.Http2 = 2;
+	Options.Http2Streams = 32;
 	Options.Port = 80;
 	Options.Servername = "SWS Web Server";
 	Options.Timeout = 20;
+	Options.HeaderTimeout = 0;
+	Options.BodyTimeout = 0;
+	Options.SendTimeout = 0;
+	Options.KeepAlive = 100;
+	Options.KeepAliveTimeout = 5;
 	Options.WebRoot = "C:\\SWS\\Webroot";
 	Options.AllowIndex = true;
+	Options.IndexPageSize = 1000;
+	Options.StatusURL = "/server-status";
+	Options.SlowRequestMs = 0;
+	Options.Engine = "threads";
+	Options.IOThreads = 0;
 	Options.IndexFiles[0] = "index.htm";
 	Options.IndexFiles[0] = "index.html";
 	
@@ -102,219 +141,40 @@ void ServiceMain()
 	{
 		// The configuration file had errors.
 		TestLog("Warning: Could not load configuration file properly");
+		AccessLog.Start();										// Start and stop the log so the warning gets written
+		AccessLog.Stop();
 		ServiceStatus.dwCurrentState = SERVICE_STOPPED; 
         SetServiceStatus (hStatus, &ServiceStatus);
 		return;
 	}
 
+	// Start the access log writer
+	StartAccessLogs();
+
+	// Map in any asset packs. Hosts whose pack fails to load are served from disk.
+	LoadAssetPacks();
+
+	// Work out where the reverse proxy routes go
+	Proxies.Start();
+
+	// Start the clock that keeps the Date: header up to date
+	Clock.Start();
+
+	// And the timer thread that closes connections that miss their deadlines
+	Timers.Start();
+	Admission.Start();
+	RateLimits.Start();
+
 	// Report that the service is running
 	ServiceStatus.dwCurrentState = SERVICE_RUNNING; 
 	SetServiceStatus (hStatus, &ServiceStatus);
 
-	//----------------------------------------------------------------------------------------------------
-	//			MIME Types
-	//----------------------------------------------------------------------------------------------------
-	Options.MIMETypes["hqx"] = "application/mac-binhex40";
-	Options.MIMETypes["doc"] = "application/msword";
-	Options.MIMETypes["bin"] = "application/octet-stream";
-	Options.MIMETypes["dms"] = "application/octet-stream";
-	Options.MIMETypes["lha"] = "application/octet-stream";
-	Options.MIMETypes["lzh"] = "application/octet-stream";
-	Options.MIMETypes["exe"] = "application/octet-stream";
-	Options.MIMETypes["class"] = "application/octet-stream";
-	Options.MIMETypes["pdf"] = "application/pdf";
-	Options.MIMETypes["ai"] = "application/postscript";
-	Options.MIMETypes["eps"] = "application/postscript";
-	Options.MIMETypes["ps"] = "application/postscript";
-	Options.MIMETypes["smi"] = "application/smil";
-	Options.MIMETypes["smil"] = "application/smil";
-	Options.MIMETypes["mif"] = "application/vnd.mif";
-	Options.MIMETypes["asf"] = "application/vnd.ms-asf";
-	Options.MIMETypes["xls"] = "application/vnd.ms-excel";
-	Options.MIMETypes["ppt"] = "application/vnd.ms-powerpoint";
-	Options.MIMETypes["vcd"] = "application/x-cdlink";
-	Options.MIMETypes["Z"] = "application/x-compress";
-	Options.MIMETypes["cpio"] = "application/x-cpio";
-	Options.MIMETypes["csh"] = "application/x-csh";
-	Options.MIMETypes["dcr"] = "application/x-director";
-	Options.MIMETypes["dir"] = "application/x-director";
-	Options.MIMETypes["dxr"] = "application/x-director";
-	Options.MIMETypes["dvi"] = "application/x-dvi";
-	Options.MIMETypes["gtar"] = "application/x-gtar";
-	Options.MIMETypes["gz"] = "application/x-gzip";
-	Options.MIMETypes["js"] = "application/x-javascript";
-	Options.MIMETypes["latex"] = "application/x-latex";
-	Options.MIMETypes["sh"] = "application/x-sh";
-	Options.MIMETypes["shar"] = "application/x-shar";
-	Options.MIMETypes["swf"] = "application/x-shockwave-flash";
-	Options.MIMETypes["sit"] = "application/x-stuffit";
-	Options.MIMETypes["tar"] = "application/x-tar";
-	Options.MIMETypes["tcl"] = "application/x-tcl";
-	Options.MIMETypes["tex"] = "application/x-tex";
-	Options.MIMETypes["texinfo"] = "application/x-texinfo";
-	Options.MIMETypes["texi"] = "application/x-texinfo";
-	Options.MIMETypes["t"] = "application/x-troff";
-	Options.MIMETypes["tr"] = "application/x-troff";
-	Options.MIMETypes["roff"] = "application/x-troff";
-	Options.MIMETypes["man"] = "application/x-troff-man";
-	Options.MIMETypes["me"] = "application/x-troff-me";
-	Options.MIMETypes["ms"] = "application/x-troff-ms";
-	Options.MIMETypes["zip"] = "application/zip";
-	Options.MIMETypes["au"] = "audio/basic";
-	Options.MIMETypes["snd"] = "audio/basic";
-	Options.MIMETypes["mid"] = "audio/midi";
-	Options.MIMETypes["midi"] = "audio/midi";
-	Options.MIMETypes["kar"] = "audio/midi";
-	Options.MIMETypes["mpga"] = "audio/mpeg";
-	Options.MIMETypes["mp2"] = "audio/mpeg";
-	Options.MIMETypes["mp3"] = "audio/mpeg";
-	Options.MIMETypes["aif"] = "audio/x-aiff";
-	Options.MIMETypes["aiff"] = "audio/x-aiff";
-	Options.MIMETypes["aifc"] = "audio/x-aiff";
-	Options.MIMETypes["ram"] = "audio/x-pn-realaudio";
-	Options.MIMETypes["rm"] = "audio/x-pn-realaudio";
-	Options.MIMETypes["ra"] = "audio/x-realaudio";
-	Options.MIMETypes["wav"] = "audio/x-wav";
-	Options.MIMETypes["bmp"] = "image/bmp";
-	Options.MIMETypes["gif"] = "image/gif";
-	Options.MIMETypes["ief"] = "image/ief";
-	Options.MIMETypes["jpeg"] = "image/jpeg";
-	Options.MIMETypes["jpg"] = "image/jpeg";
-	Options.MIMETypes["jpe"] = "image/jpeg";
-	Options.MIMETypes["png"] = "image/png";
-	Options.MIMETypes["tiff"] = "image/tiff";
-	Options.MIMETypes["tif"] = "image/tiff";
-	Options.MIMETypes["ras"] = "image/x-cmu-raster";
-	Options.MIMETypes["pnm"] = "image/x-portable-anymap";
-	Options.MIMETypes["pbm"] = "image/x-portable-bitmap";
-	Options.MIMETypes["pgm"] = "image/x-portable-graymap";
-	Options.MIMETypes["ppm"] = "image/x-portable-pixmap";
-	Options.MIMETypes["rgb"] = "image/x-rgb";
-	Options.MIMETypes["xbm"] = "image/x-xbitmap";
-	Options.MIMETypes["xpm"] = "image/x-xpixmap";
-	Options.MIMETypes["xwd"] = "image/x-xwindowdump";
-	Options.MIMETypes["igs"] = "model/iges";
-	Options.MIMETypes["iges"] = "model/iges";
-	Options.MIMETypes["msh"] = "model/mesh";
-	Options.MIMETypes["mesh"] = "model/mesh";
-	Options.MIMETypes["silo"] = "model/mesh";
-	Options.MIMETypes["wrl"] = "model/vrml";
-	Options.MIMETypes["vrml"] = "model/vrml";
-	Options.MIMETypes["css"] = "text/css";
-	Options.MIMETypes["html"] = "text/html";
-	Options.MIMETypes["htm"] = "text/html";
-	Options.MIMETypes["asc"] = "text/plain";
-	Options.MIMETypes["txt"] = "text/plain";
-	Options.MIMETypes["rtx"] = "text/richtext";
-	Options.MIMETypes["rtf"] = "text/rtf";
-	Options.MIMETypes["sgml"] = "text/sgml";
-	Options.MIMETypes["sgm"] = "text/sgml";
-	Options.MIMETypes["tsv"] = "text/tab-separated-values";
-	Options.MIMETypes["xml"] = "text/xml";
-	Options.MIMETypes["mpeg"] = "video/mpeg";
-	Options.MIMETypes["mpg"] = "video/mpeg";
-	Options.MIMETypes["mpe"] = "video/mpeg";
-	Options.MIMETypes["qt"] = "video/quicktime";
-	Options.MIMETypes["mov"] = "video/quicktime";
-	Options.MIMETypes["avi"] = "video/x-msvideo";
-
-	//----------------------------------------------------------------------------------------------------
-	//			Binary Files
-	//			The following extensions should be opened as binary. Anything else should be as text
-	//----------------------------------------------------------------------------------------------------
-	Options.Binary["hqx"] = true;
-	Options.Binary["doc"] = true;
-	Options.Binary["bin"] = true;
-	Options.Binary["dms"] = true;
-	Options.Binary["lha"] = true;
-	Options.Binary["lzh"] = true;
-	Options.Binary["exe"] = true;
-	Options.Binary["class"] = true;
-	Options.Binary["pdf"] = true;
-	Options.Binary["ai"] = true;
-	Options.Binary["eps"] = true;
-	Options.Binary["ps"] = true;
-	Options.Binary["smi"] = true;
-	Options.Binary["smil"] = true;
-	Options.Binary["mif"] = true;
-	Options.Binary["asf"] = true;
-	Options.Binary["xls"] = true;
-	Options.Binary["ppt"] = true;
-	Options.Binary["vcd"] = true;
-	Options.Binary["Z"] = true;
-	Options.Binary["cpio"] = true;
-	Options.Binary["csh"] = true;
-	Options.Binary["dcr"] = true;
-	Options.Binary["dir"] = true;
-	Options.Binary["dxr"] = true;
-	Options.Binary["dvi"] = true;
-	Options.Binary["gtar"] = true;
-	Options.Binary["gz"] = true;
-	Options.Binary["js"] = true;
-	Options.Binary["latex"] = true;
-	Options.Binary["sh"] = true;
-	Options.Binary["shar"] = true;
-	Options.Binary["swf"] = true;
-	Options.Binary["sit"] = true;
-	Options.Binary["tar"] = true;
-	Options.Binary["tcl"] = true;
-	Options.Binary["tex"] = true;
-	Options.Binary["texinfo"] = true;
-	Options.Binary["texi"] = true;
-	Options.Binary["t"] = true;
-	Options.Binary["tr"] = true;
-	Options.Binary["roff"] = true;
-	Options.Binary["man"] = true;
-	Options.Binary["me"] = true;
-	Options.Binary["ms"] = true;
-	Options.Binary["zip"] = true;
-	Options.Binary["au"] = true;
-	Options.Binary["snd"] = true;
-	Options.Binary["mid"] = true;
-	Options.Binary["midi"] = true;
-	Options.Binary["kar"] = true;
-	Options.Binary["mpga"] = true;
-	Options.Binary["mp2"] = true;
-	Options.Binary["mp3"] = true;
-	Options.Binary["aif"] = true;
-	Options.Binary["aiff"] = true;
-	Options.Binary["aifc"] = true;
-	Options.Binary["ram"] = true;
-	Options.Binary["rm"] = true;
-	Options.Binary["ra"] = true;
-	Options.Binary["wav"] = true;
-	Options.Binary["bmp"] = true;
-	Options.Binary["gif"] = true;
-	Options.Binary["ief"] = true;
-	Options.Binary["jpeg"] = true;
-	Options.Binary["jpg"] = true;
-	Options.Binary["jpe"] = true;
-	Options.Binary["png"] = true;
-	Options.Binary["tiff"] = true;
-	Options.Binary["tif"] = true;
-	Options.Binary["ras"] = true;
-	Options.Binary["pnm"] = true;
-	Options.Binary["pbm"] = true;
-	Options.Binary["pgm"] = true;
-	Options.Binary["ppm"] = true;
-	Options.Binary["rgb"] = true;
-	Options.Binary["xbm"] = true;
-	Options.Binary["xpm"] = true;
-	Options.Binary["xwd"] = true;
-	Options.Binary["igs"] = true;
-	Options.Binary["iges"] = true;
-	Options.Binary["msh"] = true;
-	Options.Binary["mesh"] = true;
-	Options.Binary["silo"] = true;
-	Options.Binary["wrl"] = true;
-	Options.Binary["vrml"] = true;
-	Options.Binary["mpeg"] = true;
-	Options.Binary["mpg"] = true;
-	Options.Binary["mpe"] = true;
-	Options.Binary["qt"] = true;
-	Options.Binary["mov"] = true;
-	Options.Binary["avi"] = true;
-	
+	// Read the files that will be asked for first, on a low priority thread
+	Prewarm.Start();
+
+	// MIME types and binary extensions
+	Options.LoadMIMETypes();
+
 	//-----------------------------------------------------------------------------------------
 	// Map status code numbers to text codes
 	//-----------------------------------------------------------------------------------------
@@ -322,84 +182,192 @@ void ServiceMain()
 	Options.ErrorCode[404] = "File Not Found";
 	Options.ErrorCode[301] = "Moved Permanently";
 	Options.ErrorCode[302] = "Moved Temporarily";
+	Options.ErrorCode[304] = "Not Modified";
+	Options.ErrorCode[400] = "Bad Request";
+	Options.ErrorCode[403] = "Forbidden";
+	Options.ErrorCode[429] = "Too Many Requests";
 	Options.ErrorCode[500] = "Internal Server Error";
+	Options.ErrorCode[501] = "Not Implemented";
+	Options.ErrorCode[502] = "Bad Gateway";
+	Options.ErrorCode[503] = "Service Unavailable";
+	Options.ErrorCode[504] = "Gateway Timeout";
+
+	// HTTP/2 streams each get a thread once Admission lets them, which answers them with
+	//  ProcessStream()
+	Http2.Start(ProcessStream);
 
 	//-----------------------------------------------------------------------------------------
 	// Step 3: Start web server
 	//-----------------------------------------------------------------------------------------
-	int SFD_Listen;									// Socket Descriptor we listen on
-	int SFD_New;									// Socket Descriptor for new connections
-	struct sockaddr_in ServerAddress;				// Servers address structure
-	struct sockaddr_in ClientAddress;				// Clients address structure
-	int Result;										// Result flag that will be used through the program for errors
-	
-	// Set socket
-	SFD_Listen = socket(AF_INET, SOCK_STREAM, 0);	// Find a good socket
-	if (SFD_Listen == -1)							// Socket could not be made
+	int SFD_Listen = OpenListener(Options.Port);	// Socket Descriptor we listen on
+	if (SFD_Listen == -1)							// Socket could not be made, or bound
 	{
 		ServiceStatus.dwCurrentState = SERVICE_STOPPED; 
 		SetServiceStatus (hStatus, &ServiceStatus);
 		return;
 	}
+
+	// HTTPS, if there's a certificate to serve it with. It has its own thread accepting
+	//  connections, and each of them gets a thread, whichever engine the rest use.
+	int SFD_Secure = -1;
+	if (Options.SecurePort > 0 && Tls.Start())
+	{
+		SFD_Secure = OpenListener(Options.SecurePort);
+		DWORD dwThreadId;
+		HANDLE hThread = SFD_Secure == -1 ? NULL : CreateThread(NULL, 0, SecureAccepts, (LPVOID)SFD_Secure, 0, &dwThreadId);
+		if (hThread)
+			CloseHandle(hThread);
+		else
+			TestLog("Warning: Could not listen for HTTPS");
+	}
+	else if (Options.SecurePort > 0 && Options.Certificate.length())
+		TestLog("Warning: No certificate found for HTTPS");
+
+	//-----------------------------------------------------------------------------------------
+	// Step 5: Handle Requests
+	//-----------------------------------------------------------------------------------------
+	SERVER_STOP = false;
+
+	// The iocp engine does everything on its own threads. If it can't start, use a thread
+	//  for each connection, for as many as Admission lets in at once.
+	if (!strcmpi(Options.Engine.c_str(), "iocp") && Engine.Start(SFD_Listen))
+	{
+		while (!SERVER_STOP)
+			Sleep(250);
+		closesocket(SFD_Listen);								// Cancels the waiting AcceptEx()s
+		if (SFD_Secure != -1)
+			closesocket(SFD_Secure);
+		Engine.Stop();
+		Prewarm.Stop();
+		AccessLog.Stop();
+		Timers.Stop();
+		Clock.Stop();
+		return;
+	}
+
+	AcceptLoop(SFD_Listen, false);
+	closesocket(SFD_Listen);
+	if (SFD_Secure != -1)
+		closesocket(SFD_Secure);
+	Prewarm.Stop();
+	AccessLog.Stop();
+	Timers.Stop();
+	Clock.Stop();
+	return;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Open Listener - a socket listening on Port, or -1
+//---------------------------------------------------------------------------------------------
+int OpenListener(int Port)
+{
+	struct sockaddr_in ServerAddress;				// Servers address structure
+	int SFD_Listen = socket(AF_INET, SOCK_STREAM, 0);	// Find a good socket
+	if (SFD_Listen == -1)							// Socket could not be made
+		return -1;
+
 	// Assign server information
 	ServerAddress.sin_family = AF_INET;				// Using TCP/IP
-	ServerAddress.sin_port = htons(Options.Port);	// Port
+	ServerAddress.sin_port = htons(Port);			// Port
 	ServerAddress.sin_addr.s_addr = INADDR_ANY;		// Use any and all addresses
 	memset(&(ServerAddress.sin_zero), '\0', 8);		// Zero out rest
 
-	// Bind to port
-	Result = bind(SFD_Listen, (struct sockaddr *) &ServerAddress, sizeof(struct sockaddr));
-	if (Result == -1)
+	// Bind to port, and listen. The backlog is as big as it goes, Admission decides who
+	//  waits rather than the stack
+	if (bind(SFD_Listen, (struct sockaddr *) &ServerAddress, sizeof(struct sockaddr)) == -1 ||
+		listen(SFD_Listen, SOMAXCONN) == -1)
 	{
-		ServiceStatus.dwCurrentState = SERVICE_STOPPED; 
-		SetServiceStatus (hStatus, &ServiceStatus);
-		return;
+		closesocket(SFD_Listen);
+		return -1;
 	}
+	return SFD_Listen;
+}
 
-	// Listen
-	Result = listen(SFD_Listen, Options.MaxConnections);
-	if (Result == -1)
-	{
-		ServiceStatus.dwCurrentState = SERVICE_STOPPED; 
-		SetServiceStatus (hStatus, &ServiceStatus);
-		return;
-	}
-	
+//---------------------------------------------------------------------------------------------
+//			Accept Loop - gives each connection to a thread, once Admission lets it in.
+//			Secure connections can't be told anything before their handshake, so the ones
+//			turned away are just closed.
+//---------------------------------------------------------------------------------------------
+void AcceptLoop(int SFD_Listen, bool Secure)
+{
+	int SFD_New;									// Socket Descriptor for new connections
+	struct sockaddr_in ClientAddress;				// Clients address structure
 	int Size = sizeof(struct sockaddr_in);
 
-	//-----------------------------------------------------------------------------------------
-	// Step 5: Handle Requests
-	//-----------------------------------------------------------------------------------------
-	SERVER_STOP = false;
 	while (!SERVER_STOP)
 	{
 		SFD_New = accept(SFD_Listen, (struct sockaddr *) &ClientAddress, &Size);
-		
-		DWORD dwThreadId;										// Info for the thead 
-		HANDLE hThread; 
-
-		// Create a structure of type ARGUMENT to be passed to the new thread
-		ARGUMENT Argument;
-		Argument.CLA = ClientAddress;
-		Argument.SFD = SFD_New;
-
-		// CreateThread and process the request
-		hThread = CreateThread( 
-        NULL,													// default security attributes 
-        0,                           							// use default stack size  
-        ProcessRequest,                 						// thread function 
-        &Argument,                								// argument to thread function 
-        0,                           							// use default creation flags 
-        &dwThreadId);                							// returns the thread identifier 
-		
-		if (hThread != NULL)									// If the thread was created, destroy it
+		if (SFD_New == -1)
+			continue;
+		if (!RateLimits.Connect(ClientAddress.sin_addr))
 		{
-			CloseHandle( hThread );
+			if (!Secure)
+				RateLimits.SendLimited(SFD_New);				// It has enough open already
+			closesocket(SFD_New);
+			continue;
 		}
 
+		// Create a structure of type ARGUMENT to be passed to the new thread. It's the
+		//  thread's to delete, as it may not start until after we've accepted another.
+		ARGUMENT *Argument = new ARGUMENT;
+		Argument->CLA = ClientAddress;
+		Argument->SFD = SFD_New;
+		Argument->Secure = Secure;
+		Argument->Waiting.Wake = StartRequest;
+		Argument->Waiting.Owner = Argument;
+
+		if (Admission.Arrive(&Argument->Waiting) != ADMISSION_QUEUED)
+			StartRequest(&Argument->Waiting);					// Otherwise it's queued, and gets started later.
+																//  Then Argument may be gone already
+	}
+}
+
+DWORD WINAPI SecureAccepts(LPVOID lpParam)
+{
+	AcceptLoop((int)lpParam, true);
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Start Request - called once a connection has a slot, or has been shed. Used by
+//			Admission, from whichever thread gave up the slot.
+//---------------------------------------------------------------------------------------------
+void StartRequest(WAITING *Waiting)
+{
+	ARGUMENT *Arg = (ARGUMENT *)Waiting->Owner;
+	if (Waiting->Shed)
+	{
+		if (!Arg->Secure)
+			Admission.SendShed(Arg->SFD);						// Too busy, try again later
+		closesocket(Arg->SFD);
+		RateLimits.Disconnect(Arg->CLA.sin_addr);
+		delete Arg;
+		return;
+	}
+
+	DWORD dwThreadId;											// Info for the thead 
+	HANDLE hThread; 
+
+	// CreateThread and process the request
+	hThread = CreateThread( 
+    NULL,														// default security attributes 
+    0,                           								// use default stack size  
+    ProcessRequest,                 							// thread function 
+    Arg,                										// argument to thread function 
+    0,                           								// use default creation flags 
+    &dwThreadId);                								// returns the thread identifier 
+	
+	if (hThread != NULL)										// If the thread was created, destroy it
+	{
+		CloseHandle( hThread );
+	}
+	else
+	{
+		closesocket(Arg->SFD);									// No thread, give the slot to someone else
+		RateLimits.Disconnect(Arg->CLA.sin_addr);
+		delete Arg;
+		Admission.Leave();
 	}
-	closesocket(SFD_Listen);
-	return;
 }
 
 //---------------------------------------------------------------------------------------------
@@ -408,16 +376,60 @@ void ServiceMain()
 DWORD WINAPI ProcessRequest(LPVOID lpParam )
 {
 	ARGUMENT * Arg = (ARGUMENT *)lpParam;							// Split the paramater into the arguments
+	bool Admitted = true;										// Holding a slot from Admission
 	
-	CONNECTION * New = new CONNECTION(Arg->SFD, Arg->CLA);
+	Metrics.ConnectionOpened();
+	CONNECTION * New = ConnectionPool.Get(Arg->SFD, Arg->CLA);	// A used connection if there is one
 	if (New)
 	{
-		New->ReadRequest();										// Read in the request
-		New->HandleRequest();									// Handle the request
+		if (!Arg->Secure || New->StartTLS())					// HTTPS starts with the handshake
+		{
+			do
+			{
+				New->ReadRequest(&Admitted);					// Read in the request, without a slot while it's idle
+				if (New->ServeHTTP2())							// Unless it was HTTP/2's preface, which gives
+				{												//  up the slot for its streams to take
+					Admitted = false;
+					break;
+				}
+				if (New->Gone())								// Or the client is done with a kept connection
+					break;
+				New->HandleRequest();							// Handle the request
+				New->CountRequest();							// Count it, before logging adds to the time
+				New->LogConnection();							// Log it
+			} while (!SERVER_STOP && New->Next());				// The same again if it was kept open
+		}
+		ConnectionPool.Put(New);								// Keep it for another request. Put() cancels its
+	}															//  deadline, so this comes before closesocket()
+	closesocket(Arg->SFD);
+	RateLimits.Disconnect(Arg->CLA.sin_addr);
+	Metrics.ConnectionClosed();
+	delete Arg;
+	if (Admitted)
+		Admission.Leave();										// Let the next one in
+	ThreadSlots.Release();										// Its statistics slot is free for the next thread
+	return 0;
+}
 
-		delete New;												// Destroy the connection
+//---------------------------------------------------------------------------------------------
+//			Stream Processor - an HTTP/2 stream's request, started by Http2
+//---------------------------------------------------------------------------------------------
+DWORD WINAPI ProcessStream(LPVOID lpParam)
+{
+	H2STREAM *Stream = (H2STREAM *)lpParam;
+	CONNECTION *New = ConnectionPool.Get((int)Stream->Link->Socket, Stream->Link->Client);
+	if (New)
+	{
+		New->StartStream(Stream);								// Everything it sends goes to the stream
+		New->RequestReceived(Stream->Request.c_str());
+		New->HandleRequest();
+		New->CountRequest();
+		New->LogConnection();
+		ConnectionPool.Put(New);
 	}
-	closesocket(Arg->SFD);
+	Http2.Finish(Stream);										// Ends the stream, and forgets it
+	Admission.Leave();											// It was given a slot before it started
+	ThreadSlots.Release();
 	return 0;
 }
 
@@ -444,6 +456,14 @@ void ControlHandler(DWORD request)
         SetServiceStatus (hStatus, &ServiceStatus);
         return; 
         
+	case SERVICE_CONTROL_REOPENLOGS:							// sc control "SWS Web Server" 128
+		AccessLog.Reopen();
+		break;
+
+	case SERVICE_CONTROL_ROTATELOGS:							// sc control "SWS Web Server" 129
+		AccessLog.RotateNow();
+		break;
+
 	default:
         break;
 	} 
@@ -458,23 +478,7 @@ void ControlHandler(DWORD request)
 //---------------------------------------------------------------------------------------------
 void TestLog(string Data)
 {
-	FILE* log;
-	log = fopen("C:\\SWS\\testlog.txt", "a+");
-	if (log == NULL)
-      return ;
-	fprintf(log, "%s", Data.c_str());
-	fclose(log);
-}
-
-//---------------------------------------------------------------------------------------------
-//			PrintAccepts
-//---------------------------------------------------------------------------------------------
-void PrintAccepts(const map<string, bool>::value_type& p)
-{
-	TestLog(p.first);
-	TestLog(" = ");
-	TestLog((p.second ? "true" : "false"));
-	TestLog("\n");
+	AccessLog.WriteText(Data.c_str());							// Written by the access log thread
 }
 
 
@@ -0,0 +1,730 @@
+#ifndef METRICSHPP
+#define METRICSHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			METRICS.HPP
+			-----------
+			Server statistics, sent to anyone who asks for Options.StatusURL
+			("/server-status" by default). The counters come out in the Prometheus text
+			format, or as JSON with ?format=json.
+
+			Request threads don't share counters. The counters are split into
+			METRIC_SHARDS shards, each on its own cache lines, and each thread takes one of
+			its own from ThreadSlots (see shard.hpp) the first time it counts something.
+			Each shard has a tiny spin lock that is only ever contended while the status
+			page is being made, or by threads sharing a shard once more than METRIC_SHARDS
+			threads are counting at once. Threads that count give their shard back with
+			ThreadSlots.Release() when they end; the counts stay in it for the next thread.
+			Nothing is added up until the status page asks for it.
+
+			LATENCY keeps a histogram of how long each stage of a request took (reading it,
+			parsing it, finding the file, working out its type, sending it, running CGI),
+			sharded the same way. CONNECTION::Mark() takes a QueryPerformanceCounter()
+			timestamp at each stage boundary and the whole lot is recorded at once when the
+			request is finished. The histograms are log-linear, like HdrHistogram: each
+			power of two is split into LATENCY_SUBBUCKETS equal buckets, so any value is
+			within about 6% with a fixed 2KB per histogram. Requests that take longer than
+			Options.SlowRequestMs are written to the text log with their stages.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include "options.hpp"
+#include "httpdate.hpp"
+#include "buffer.hpp"
+#include "accesslog.hpp"
+#include "admission.hpp"
+#include "ratelimit.hpp"
+#include "pacing.hpp"
+#include "proxy.hpp"
+#include "respcache.hpp"
+#include "tls.hpp"
+#include "shard.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define METRIC_SHARDS						SHARD_SLOTS				// Number of shards, one a thread
+#define METRIC_STATUSES						600						// Status codes counted (0 to 599)
+
+#define METRIC_GET							0						// Methods
+#define METRIC_HEAD							1
+#define METRIC_POST							2
+#define METRIC_OTHER						3
+#define METRIC_METHODS						4
+
+#define METRIC_CACHE_PACK					0						// Caches
+#define METRIC_CACHE_LISTING				1
+#define METRIC_CACHE_RESPONSE				2
+#define METRIC_CACHES						3
+
+#define TIMEOUT_IDLE						0						// Deadlines a connection can miss
+#define TIMEOUT_HEADER						1
+#define TIMEOUT_BODY						2
+#define TIMEOUT_SEND						3
+#define TIMEOUT_KEEPALIVE					4
+#define METRIC_TIMEOUTS						5
+
+#define METRIC_HTTP2_CONNECTION				0						// HTTP/2 happenings
+#define METRIC_HTTP2_STREAM					1
+#define METRIC_HTTP2_RESET					2
+#define METRIC_HTTP2						3
+
+#define STAGE_READ							0						// Request stages
+#define STAGE_PARSE							1
+#define STAGE_LOOKUP						2
+#define STAGE_FILETYPE						3
+#define STAGE_SEND							4
+#define STAGE_CGI							5
+#define STAGE_TOTAL							6
+#define LATENCY_STAGES						7
+
+#define LATENCY_SUBBITS						4						// Each power of two is split into 16
+#define LATENCY_SUBBUCKETS					(1 << LATENCY_SUBBITS)
+#define LATENCY_BUCKETS						((32 - LATENCY_SUBBITS + 1) * LATENCY_SUBBUCKETS)	// Enough for any DWORD
+
+static const char *MetricMethodNames[METRIC_METHODS] = { "GET", "HEAD", "POST", "other" };
+static const char *MetricCacheNames[METRIC_CACHES] = { "pack", "listing", "response" };
+static const char *MetricTimeoutNames[METRIC_TIMEOUTS] = { "idle", "header", "body", "send", "keepalive" };
+static const char *MetricHttp2Names[METRIC_HTTP2] = { "connections", "streams", "resets" };
+static const char *StageNames[LATENCY_STAGES] = { "read", "parse", "lookup", "filetype", "send", "cgi", "total" };
+
+//----------------------------------------------------------------------------------------------------
+//			One shard of counters
+//----------------------------------------------------------------------------------------------------
+struct METRICSHARD
+{
+	volatile LONG Lock;											// Spin lock, 1 while someone is using the shard
+	LONG Active;												// Connections open now
+	unsigned __int64 Connections;								// Connections accepted
+	unsigned __int64 KeptAlive;									// Requests on a connection kept open after an earlier one
+	unsigned __int64 Requests[METRIC_METHODS];					// Requests by method
+	unsigned __int64 Statuses[METRIC_STATUSES];					// Responses by status code
+	unsigned __int64 BytesSent;									// Bytes sent to clients
+	unsigned __int64 CGISpawns;									// CGI interpreters started
+	unsigned __int64 CacheHits[METRIC_CACHES];					// Cache hits by cache
+	unsigned __int64 CacheMisses[METRIC_CACHES];				// Cache misses by cache
+	unsigned __int64 TimeOuts[METRIC_TIMEOUTS];					// Connections closed for missing a deadline
+	unsigned __int64 Http2[METRIC_HTTP2];						// HTTP/2 connections, streams and streams reset
+	char Padding[64];											// Keeps the next shard off our last cache line
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Log-linear histogram of times in microseconds
+//----------------------------------------------------------------------------------------------------
+struct HISTOGRAM
+{
+	DWORD Counts[LATENCY_BUCKETS];								// Number of values in each bucket
+	unsigned __int64 Count;										// Number of values
+	unsigned __int64 Sum;										// Total of the values
+	DWORD Max;													// Biggest value
+
+	void Add(DWORD Value);										// Adds a value
+	void Merge(const HISTOGRAM &Other);							// Adds in another histogram
+	DWORD Quantile(double Fraction) const;						// Value below which Fraction of the values are
+};
+
+//----------------------------------------------------------------------------------------------------
+//			HistogramBucket() and BucketTop() - which bucket a value goes in, and the biggest value
+//			that goes in a bucket
+//----------------------------------------------------------------------------------------------------
+int HistogramBucket(DWORD Value)
+{
+	if (Value < LATENCY_SUBBUCKETS)
+		return Value;											// Small values get a bucket each
+
+	int Power = 31;												// Find the top bit
+	while (!(Value & (1UL << Power)))
+		Power--;
+	int Sub = (Value >> (Power - LATENCY_SUBBITS)) & (LATENCY_SUBBUCKETS - 1);
+	return (Power - LATENCY_SUBBITS + 1) * LATENCY_SUBBUCKETS + Sub;
+}
+
+DWORD BucketTop(int Bucket)
+{
+	if (Bucket < LATENCY_SUBBUCKETS)
+		return Bucket;
+
+	int Power = Bucket / LATENCY_SUBBUCKETS + LATENCY_SUBBITS - 1;
+	int Sub = Bucket % LATENCY_SUBBUCKETS;
+	unsigned __int64 Top = ((unsigned __int64)(LATENCY_SUBBUCKETS + Sub + 1) << (Power - LATENCY_SUBBITS)) - 1;
+	return Top > 0xFFFFFFFF ? 0xFFFFFFFF : (DWORD)Top;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			HISTOGRAM::Add(), Merge() and Quantile()
+//----------------------------------------------------------------------------------------------------
+void HISTOGRAM::Add(DWORD Value)
+{
+	Counts[HistogramBucket(Value)]++;
+	Count++;
+	Sum += Value;
+	if (Value > Max)
+		Max = Value;
+}
+
+void HISTOGRAM::Merge(const HISTOGRAM &Other)
+{
+	for (int B = 0; B < LATENCY_BUCKETS; B++)
+		Counts[B] += Other.Counts[B];
+	Count += Other.Count;
+	Sum += Other.Sum;
+	if (Other.Max > Max)
+		Max = Other.Max;
+}
+
+DWORD HISTOGRAM::Quantile(double Fraction) const
+{
+	if (Count == 0)
+		return 0;
+
+	unsigned __int64 Wanted = (unsigned __int64)(Fraction * (__int64)Count + 0.5);
+	if (Wanted < 1) Wanted = 1;
+	unsigned __int64 Seen = 0;
+	for (int B = 0; B < LATENCY_BUCKETS; B++)
+	{
+		Seen += Counts[B];
+		if (Seen >= Wanted)
+		{
+			DWORD Top = BucketTop(B);
+			return Top < Max ? Top : Max;						// Never say more than the biggest we saw
+		}
+	}
+	return Max;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Stage latency histograms
+//----------------------------------------------------------------------------------------------------
+struct LATENCYSHARD
+{
+	volatile LONG Lock;											// Spin lock, as for METRICSHARD
+	HISTOGRAM Stages[LATENCY_STAGES];							// One histogram per stage
+	char Padding[64];											// Keeps the next shard off our last cache line
+};
+
+class LATENCY
+{
+  public:
+	LATENCY();													// Constructor
+	__int64 Now();												// A timestamp, in QueryPerformanceCounter() ticks
+	DWORD Microseconds(__int64 Ticks);							// Converts ticks to microseconds
+	void Record(const __int64 *Ticks, DWORD Used);				// Records a request's stages. Used has a bit per stage
+	void Total(int Stage, HISTOGRAM *Sum);						// Adds up one stage from all the shards
+	void WritePrometheus(SENDBUFFER &Out);						// Writes the histograms for the status page
+	void WriteJSON(SENDBUFFER &Out);							// Same, as JSON
+
+  private:
+	LATENCYSHARD Shards[METRIC_SHARDS];
+	__int64 Frequency;											// QueryPerformanceCounter() ticks per second
+}Latency;
+
+//----------------------------------------------------------------------------------------------------
+//			LATENCY::LATENCY
+//----------------------------------------------------------------------------------------------------
+LATENCY::LATENCY()
+{
+	memset(Shards, 0, sizeof(Shards));
+	LARGE_INTEGER Freq;
+	QueryPerformanceFrequency(&Freq);
+	Frequency = Freq.QuadPart > 0 ? Freq.QuadPart : 1;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LATENCY::Now() and LATENCY::Microseconds()
+//----------------------------------------------------------------------------------------------------
+__int64 LATENCY::Now()
+{
+	LARGE_INTEGER Count;
+	QueryPerformanceCounter(&Count);
+	return Count.QuadPart;
+}
+
+DWORD LATENCY::Microseconds(__int64 Ticks)
+{
+	if (Ticks <= 0)
+		return 0;
+	__int64 Micro = Ticks / Frequency * 1000000 + Ticks % Frequency * 1000000 / Frequency;
+	return Micro > 0xFFFFFFFF ? 0xFFFFFFFF : (DWORD)Micro;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LATENCY::Record()
+//----------------------------------------------------------------------------------------------------
+void LATENCY::Record(const __int64 *Ticks, DWORD Used)
+{
+	DWORD Micro[LATENCY_STAGES];								// Convert before taking the lock
+	int S;
+	for (S = 0; S < LATENCY_STAGES; S++)
+		Micro[S] = Microseconds(Ticks[S]);
+
+	LATENCYSHARD *Shard = &Shards[ThreadSlots.Slot()];
+	LockShard(&Shard->Lock);
+	for (S = 0; S < LATENCY_STAGES; S++)
+	{
+		if (Used & (1 << S))
+			Shard->Stages[S].Add(Micro[S]);
+	}
+	UnlockShard(&Shard->Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LATENCY::Total()
+//----------------------------------------------------------------------------------------------------
+void LATENCY::Total(int Stage, HISTOGRAM *Sum)
+{
+	memset(Sum, 0, sizeof(HISTOGRAM));
+	for (int S = 0; S < METRIC_SHARDS; S++)
+	{
+		LockShard(&Shards[S].Lock);
+		Sum->Merge(Shards[S].Stages[Stage]);
+		UnlockShard(&Shards[S].Lock);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			WriteSeconds() - writes a number of microseconds as seconds ("0.001234")
+//----------------------------------------------------------------------------------------------------
+void WriteSeconds(SENDBUFFER &Out, unsigned __int64 Micro)
+{
+	char Text[32];
+	sprintf(Text, "%lu.%06lu", (unsigned long)(Micro / 1000000), (unsigned long)(Micro % 1000000));
+	Out.Write(Text);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LATENCY::WritePrometheus()
+//----------------------------------------------------------------------------------------------------
+void LATENCY::WritePrometheus(SENDBUFFER &Out)
+{
+	static const double Quantiles[5] = { 0.5, 0.9, 0.99, 0.999, 1.0 };
+	static const char *QuantileNames[5] = { "0.5", "0.9", "0.99", "0.999", "1" };
+
+	Out.Write("# HELP sws_stage_seconds Time spent in each stage of a request.\n# TYPE sws_stage_seconds summary\n");
+	for (int S = 0; S < LATENCY_STAGES; S++)
+	{
+		HISTOGRAM Sum;
+		Total(S, &Sum);
+		for (int Q = 0; Q < 5; Q++)
+		{
+			Out.Write("sws_stage_seconds{stage=\"");
+			Out.Write(StageNames[S]);
+			Out.Write("\",quantile=\"");
+			Out.Write(QuantileNames[Q]);
+			Out.Write("\"} ");
+			WriteSeconds(Out, Sum.Quantile(Quantiles[Q]));
+			Out.Write("\n");
+		}
+		Out.Write("sws_stage_seconds_sum{stage=\"");
+		Out.Write(StageNames[S]);
+		Out.Write("\"} ");
+		WriteSeconds(Out, Sum.Sum);
+		Out.Write("\nsws_stage_seconds_count{stage=\"");
+		Out.Write(StageNames[S]);
+		Out.Write("\"} ");
+		Out.WriteNumber(Sum.Count);
+		Out.Write("\n");
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			LATENCY::WriteJSON() - times are in microseconds
+//----------------------------------------------------------------------------------------------------
+void LATENCY::WriteJSON(SENDBUFFER &Out)
+{
+	Out.Write("{");
+	for (int S = 0; S < LATENCY_STAGES; S++)
+	{
+		HISTOGRAM Sum;
+		Total(S, &Sum);
+		if (S) Out.Write(",");
+		Out.Write("\n\"");
+		Out.Write(StageNames[S]);
+		Out.Write("\":{\"count\":");		Out.WriteNumber(Sum.Count);
+		Out.Write(",\"mean\":");			Out.WriteNumber(Sum.Count ? Sum.Sum / Sum.Count : 0);
+		Out.Write(",\"p50\":");			Out.WriteNumber(Sum.Quantile(0.5));
+		Out.Write(",\"p90\":");			Out.WriteNumber(Sum.Quantile(0.9));
+		Out.Write(",\"p99\":");			Out.WriteNumber(Sum.Quantile(0.99));
+		Out.Write(",\"p999\":");			Out.WriteNumber(Sum.Quantile(0.999));
+		Out.Write(",\"max\":");			Out.WriteNumber(Sum.Max);
+		Out.Write("}");
+	}
+	Out.Write("}");
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Metrics class
+//----------------------------------------------------------------------------------------------------
+class METRICS
+{
+  public:
+	METRICS();													// Constructor
+	void ConnectionOpened();									// A connection was accepted
+	void ConnectionClosed();									// A connection was closed
+	void KeptAlive();											// A request came on a connection kept open for it
+	void Request(const string &Method, int Status, unsigned __int64 Bytes);	// A request was answered
+	void CGISpawn();											// A CGI interpreter was started
+	void Cache(int Cache, bool Hit);							// A cache was looked in
+	void TimedOut(int Kind);									// A connection missed a deadline
+	void Http2(int Kind);										// An HTTP/2 connection or stream started, or a stream was reset
+
+	void Total(METRICSHARD *Sum);								// Adds up all the shards
+	void WritePrometheus(SENDBUFFER &Out);						// Writes the status page
+	void WriteJSON(SENDBUFFER &Out);							// Writes the status page as JSON
+
+  private:
+	METRICSHARD *Enter();										// Locks this thread's shard
+	void Leave(METRICSHARD *Shard);								// Unlocks it
+
+	METRICSHARD Shards[METRIC_SHARDS];
+	time_t Started;												// When the server started
+}Metrics;
+
+//----------------------------------------------------------------------------------------------------
+//			METRICS::METRICS
+//----------------------------------------------------------------------------------------------------
+METRICS::METRICS()
+{
+	memset(Shards, 0, sizeof(Shards));
+	Started = time(NULL);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			METRICS::Enter() and METRICS::Leave()
+//----------------------------------------------------------------------------------------------------
+METRICSHARD *METRICS::Enter()
+{
+	METRICSHARD *Shard = &Shards[ThreadSlots.Slot()];
+	LockShard(&Shard->Lock);
+	return Shard;
+}
+
+void METRICS::Leave(METRICSHARD *Shard)
+{
+	UnlockShard(&Shard->Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Recording
+//----------------------------------------------------------------------------------------------------
+void METRICS::ConnectionOpened()
+{
+	METRICSHARD *Shard = Enter();
+	Shard->Active++;
+	Shard->Connections++;
+	Leave(Shard);
+}
+
+void METRICS::ConnectionClosed()
+{
+	METRICSHARD *Shard = Enter();								// Its shard may not be ConnectionOpened()'s, only the total matters
+	Shard->Active--;
+	Leave(Shard);
+}
+
+void METRICS::KeptAlive()
+{
+	METRICSHARD *Shard = Enter();
+	Shard->KeptAlive++;
+	Leave(Shard);
+}
+
+void METRICS::Request(const string &Method, int Status, unsigned __int64 Bytes)
+{
+	int M = METRIC_OTHER;
+	if (!strcmpi(Method.c_str(), "GET"))		M = METRIC_GET;
+	else if (!strcmpi(Method.c_str(), "HEAD"))	M = METRIC_HEAD;
+	else if (!strcmpi(Method.c_str(), "POST"))	M = METRIC_POST;
+	if (Status < 0 || Status >= METRIC_STATUSES)
+		Status = 0;
+
+	METRICSHARD *Shard = Enter();
+	Shard->Requests[M]++;
+	Shard->Statuses[Status]++;
+	Shard->BytesSent += Bytes;
+	Leave(Shard);
+}
+
+void METRICS::CGISpawn()
+{
+	METRICSHARD *Shard = Enter();
+	Shard->CGISpawns++;
+	Leave(Shard);
+}
+
+void METRICS::Cache(int Cache, bool Hit)
+{
+	METRICSHARD *Shard = Enter();
+	if (Hit)	Shard->CacheHits[Cache]++;
+	else		Shard->CacheMisses[Cache]++;
+	Leave(Shard);
+}
+
+void METRICS::TimedOut(int Kind)
+{
+	METRICSHARD *Shard = Enter();
+	Shard->TimeOuts[Kind]++;
+	Leave(Shard);
+}
+
+void METRICS::Http2(int Kind)
+{
+	METRICSHARD *Shard = Enter();
+	Shard->Http2[Kind]++;
+	Leave(Shard);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			METRICS::Total()
+//----------------------------------------------------------------------------------------------------
+void METRICS::Total(METRICSHARD *Sum)
+{
+	memset(Sum, 0, sizeof(METRICSHARD));
+	for (int S = 0; S < METRIC_SHARDS; S++)
+	{
+		METRICSHARD *Shard = &Shards[S];
+		LockShard(&Shard->Lock);
+
+		int X;
+		Sum->Active += Shard->Active;
+		Sum->Connections += Shard->Connections;
+		Sum->KeptAlive += Shard->KeptAlive;
+		for (X = 0; X < METRIC_METHODS; X++)	Sum->Requests[X] += Shard->Requests[X];
+		for (X = 0; X < METRIC_STATUSES; X++)	Sum->Statuses[X] += Shard->Statuses[X];
+		Sum->BytesSent += Shard->BytesSent;
+		Sum->CGISpawns += Shard->CGISpawns;
+		for (X = 0; X < METRIC_CACHES; X++)
+		{
+			Sum->CacheHits[X] += Shard->CacheHits[X];
+			Sum->CacheMisses[X] += Shard->CacheMisses[X];
+		}
+		for (X = 0; X < METRIC_TIMEOUTS; X++)	Sum->TimeOuts[X] += Shard->TimeOuts[X];
+		for (X = 0; X < METRIC_HTTP2; X++)		Sum->Http2[X] += Shard->Http2[X];
+		Leave(Shard);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			METRICS::WritePrometheus()
+//----------------------------------------------------------------------------------------------------
+void METRICS::WritePrometheus(SENDBUFFER &Out)
+{
+	METRICSHARD Sum;
+	Total(&Sum);
+	int X;
+
+	Out.Write("# HELP sws_uptime_seconds Seconds since the server started.\n# TYPE sws_uptime_seconds gauge\nsws_uptime_seconds ");
+	Out.WriteNumber(Clock.Seconds() - Started);
+	Out.Write("\n# HELP sws_connections_active Connections being handled now.\n# TYPE sws_connections_active gauge\nsws_connections_active ");
+	Out.WriteNumber(Sum.Active > 0 ? Sum.Active : 0);
+	Out.Write("\n# HELP sws_connections_total Connections accepted.\n# TYPE sws_connections_total counter\nsws_connections_total ");
+	Out.WriteNumber(Sum.Connections);
+	Out.Write("\n# HELP sws_keepalive_requests_total Requests on a connection kept open after an earlier one.\n# TYPE sws_keepalive_requests_total counter\nsws_keepalive_requests_total ");
+	Out.WriteNumber(Sum.KeptAlive);
+
+	Out.Write("\n# HELP sws_requests_total Requests by method.\n# TYPE sws_requests_total counter\n");
+	for (X = 0; X < METRIC_METHODS; X++)
+	{
+		Out.Write("sws_requests_total{method=\"");
+		Out.Write(MetricMethodNames[X]);
+		Out.Write("\"} ");
+		Out.WriteNumber(Sum.Requests[X]);
+		Out.Write("\n");
+	}
+
+	Out.Write("# HELP sws_responses_total Responses by status code.\n# TYPE sws_responses_total counter\n");
+	for (X = 0; X < METRIC_STATUSES; X++)
+	{
+		if (Sum.Statuses[X] == 0)
+			continue;
+		Out.Write("sws_responses_total{code=\"");
+		Out.WriteNumber(X);
+		Out.Write("\"} ");
+		Out.WriteNumber(Sum.Statuses[X]);
+		Out.Write("\n");
+	}
+
+	Out.Write("# HELP sws_sent_bytes_total Bytes sent to clients.\n# TYPE sws_sent_bytes_total counter\nsws_sent_bytes_total ");
+	Out.WriteNumber(Sum.BytesSent);
+	Out.Write("\n# HELP sws_cgi_spawns_total CGI interpreters started.\n# TYPE sws_cgi_spawns_total counter\nsws_cgi_spawns_total ");
+	Out.WriteNumber(Sum.CGISpawns);
+
+	Out.Write("\n# HELP sws_cache_hits_total Cache hits.\n# TYPE sws_cache_hits_total counter\n");
+	for (X = 0; X < METRIC_CACHES; X++)
+	{
+		Out.Write("sws_cache_hits_total{cache=\"");
+		Out.Write(MetricCacheNames[X]);
+		Out.Write("\"} ");
+		Out.WriteNumber(Sum.CacheHits[X]);
+		Out.Write("\n");
+	}
+	Out.Write("# HELP sws_cache_misses_total Cache misses.\n# TYPE sws_cache_misses_total counter\n");
+	for (X = 0; X < METRIC_CACHES; X++)
+	{
+		Out.Write("sws_cache_misses_total{cache=\"");
+		Out.Write(MetricCacheNames[X]);
+		Out.Write("\"} ");
+		Out.WriteNumber(Sum.CacheMisses[X]);
+		Out.Write("\n");
+	}
+
+	Out.Write("# HELP sws_timeouts_total Connections closed for missing a deadline.\n# TYPE sws_timeouts_total counter\n");
+	for (X = 0; X < METRIC_TIMEOUTS; X++)
+	{
+		Out.Write("sws_timeouts_total{phase=\"");
+		Out.Write(MetricTimeoutNames[X]);
+		Out.Write("\"} ");
+		Out.WriteNumber(Sum.TimeOuts[X]);
+		Out.Write("\n");
+	}
+
+	Out.Write("# HELP sws_http2_connections_total Connections that spoke HTTP/2.\n# TYPE sws_http2_connections_total counter\nsws_http2_connections_total ");
+	Out.WriteNumber(Sum.Http2[METRIC_HTTP2_CONNECTION]);
+	Out.Write("\n# HELP sws_http2_streams_total HTTP/2 streams opened.\n# TYPE sws_http2_streams_total counter\nsws_http2_streams_total ");
+	Out.WriteNumber(Sum.Http2[METRIC_HTTP2_STREAM]);
+	Out.Write("\n# HELP sws_http2_resets_total HTTP/2 streams reset by either end.\n# TYPE sws_http2_resets_total counter\nsws_http2_resets_total ");
+	Out.WriteNumber(Sum.Http2[METRIC_HTTP2_RESET]);
+	Out.Write("\n");
+
+	Out.Write("# HELP sws_admission_busy Connections being worked on.\n# TYPE sws_admission_busy gauge\nsws_admission_busy ");
+	Out.WriteNumber(Admission.Busy > 0 ? Admission.Busy : 0);
+	Out.Write("\n# HELP sws_admission_waiting Connections waiting for a slot.\n# TYPE sws_admission_waiting gauge\nsws_admission_waiting ");
+	Out.WriteNumber(Admission.Waiting > 0 ? Admission.Waiting : 0);
+	Out.Write("\n# HELP sws_shed_total Connections turned away with a 503.\n# TYPE sws_shed_total counter\nsws_shed_total ");
+	Out.WriteNumber(Admission.Shed);
+	Out.Write("\n# HELP sws_rate_limited_total Connections and requests turned away with a 429.\n# TYPE sws_rate_limited_total counter\nsws_rate_limited_total ");
+	Out.WriteNumber(RateLimits.Limited);
+	Out.Write("\n# HELP sws_paced_total Pieces of files held back by a bandwidth cap.\n# TYPE sws_paced_total counter\nsws_paced_total ");
+	Out.WriteNumber(Pacing.Paused);
+	Out.Write("\n");
+
+	Out.Write("# HELP sws_proxy_requests_total Requests passed on to an upstream.\n# TYPE sws_proxy_requests_total counter\nsws_proxy_requests_total ");
+	Out.WriteNumber(Proxies.Forwarded);
+	Out.Write("\n# HELP sws_proxy_errors_total Proxied requests answered with a 502 or 504.\n# TYPE sws_proxy_errors_total counter\nsws_proxy_errors_total ");
+	Out.WriteNumber(Proxies.Errors);
+	Out.Write("\n# HELP sws_proxy_reused_total Proxied requests sent on a kept upstream connection.\n# TYPE sws_proxy_reused_total counter\nsws_proxy_reused_total ");
+	Out.WriteNumber(Proxies.Pooled);
+	Out.Write("\n# HELP sws_response_cache_entries Requests the response cache keeps track of.\n# TYPE sws_response_cache_entries gauge\nsws_response_cache_entries ");
+	Out.WriteNumber(ResponseCache.Entries);
+	Out.Write("\n# HELP sws_response_cache_bytes Size of the replies kept by the response cache.\n# TYPE sws_response_cache_bytes gauge\nsws_response_cache_bytes ");
+	Out.WriteNumber(ResponseCache.Bytes);
+	Out.Write("\n");
+
+	Out.Write("# HELP sws_tls_handshakes_total TLS handshakes finished.\n# TYPE sws_tls_handshakes_total counter\nsws_tls_handshakes_total ");
+	Out.WriteNumber(Tls.Handshakes);
+	Out.Write("\n# HELP sws_tls_resumed_total TLS handshakes that resumed a session.\n# TYPE sws_tls_resumed_total counter\nsws_tls_resumed_total ");
+	Out.WriteNumber(Tls.Resumptions);
+	Out.Write("\n# HELP sws_tls_failed_total TLS handshakes that failed.\n# TYPE sws_tls_failed_total counter\nsws_tls_failed_total ");
+	Out.WriteNumber(Tls.Failed);
+	Out.Write("\n");
+
+	Out.Write("# HELP sws_log_dropped_total Access log records dropped.\n# TYPE sws_log_dropped_total counter\nsws_log_dropped_total ");
+	Out.WriteNumber(AccessLog.Dropped);
+	Out.Write("\n# HELP sws_log_rotations_total Access log files rotated.\n# TYPE sws_log_rotations_total counter\nsws_log_rotations_total ");
+	Out.WriteNumber(AccessLog.Rotations);
+	Out.Write("\n");
+	Latency.WritePrometheus(Out);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			METRICS::WriteJSON()
+//----------------------------------------------------------------------------------------------------
+void METRICS::WriteJSON(SENDBUFFER &Out)
+{
+	METRICSHARD Sum;
+	Total(&Sum);
+	int X;
+	bool First;
+
+	Out.Write("{\"uptime\":");				Out.WriteNumber(Clock.Seconds() - Started);
+	Out.Write(",\n\"connections\":{\"active\":");	Out.WriteNumber(Sum.Active > 0 ? Sum.Active : 0);
+	Out.Write(",\"total\":");				Out.WriteNumber(Sum.Connections);
+	Out.Write(",\"kept_alive\":");			Out.WriteNumber(Sum.KeptAlive);
+
+	Out.Write("},\n\"requests\":{");
+	for (X = 0; X < METRIC_METHODS; X++)
+	{
+		if (X) Out.Write(",");
+		Out.Write("\"");
+		Out.Write(MetricMethodNames[X]);
+		Out.Write("\":");
+		Out.WriteNumber(Sum.Requests[X]);
+	}
+
+	Out.Write("},\n\"responses\":{");
+	First = true;
+	for (X = 0; X < METRIC_STATUSES; X++)
+	{
+		if (Sum.Statuses[X] == 0)
+			continue;
+		if (!First) Out.Write(",");
+		First = false;
+		Out.Write("\"");
+		Out.WriteNumber(X);
+		Out.Write("\":");
+		Out.WriteNumber(Sum.Statuses[X]);
+	}
+
+	Out.Write("},\n\"bytes_sent\":");		Out.WriteNumber(Sum.BytesSent);
+	Out.Write(",\n\"cgi_spawns\":");		Out.WriteNumber(Sum.CGISpawns);
+
+	Out.Write(",\n\"cache\":{");
+	for (X = 0; X < METRIC_CACHES; X++)
+	{
+		if (X) Out.Write(",");
+		Out.Write("\"");
+		Out.Write(MetricCacheNames[X]);
+		Out.Write("\":{\"hits\":");
+		Out.WriteNumber(Sum.CacheHits[X]);
+		Out.Write(",\"misses\":");
+		Out.WriteNumber(Sum.CacheMisses[X]);
+		Out.Write("}");
+	}
+
+	Out.Write("},\n\"timeouts\":{");
+	for (X = 0; X < METRIC_TIMEOUTS; X++)
+	{
+		if (X) Out.Write(",");
+		Out.Write("\"");
+		Out.Write(MetricTimeoutNames[X]);
+		Out.Write("\":");
+		Out.WriteNumber(Sum.TimeOuts[X]);
+	}
+
+	Out.Write("},\n\"http2\":{");
+	for (X = 0; X < METRIC_HTTP2; X++)
+	{
+		if (X) Out.Write(",");
+		Out.Write("\"");
+		Out.Write(MetricHttp2Names[X]);
+		Out.Write("\":");
+		Out.WriteNumber(Sum.Http2[X]);
+	}
+
+	Out.Write("},\n\"admission\":{\"busy\":");	Out.WriteNumber(Admission.Busy > 0 ? Admission.Busy : 0);
+	Out.Write(",\"waiting\":");				Out.WriteNumber(Admission.Waiting > 0 ? Admission.Waiting : 0);
+	Out.Write(",\"shed\":");				Out.WriteNumber(Admission.Shed);
+	Out.Write(",\"limited\":");			Out.WriteNumber(RateLimits.Limited);
+	Out.Write(",\"paced\":");				Out.WriteNumber(Pacing.Paused);
+
+	Out.Write("},\n\"proxy\":{\"requests\":");	Out.WriteNumber(Proxies.Forwarded);
+	Out.Write(",\"errors\":");				Out.WriteNumber(Proxies.Errors);
+	Out.Write(",\"reused\":");				Out.WriteNumber(Proxies.Pooled);
+
+	Out.Write("},\n\"response_cache\":{\"entries\":");	Out.WriteNumber(ResponseCache.Entries);
+	Out.Write(",\"bytes\":");				Out.WriteNumber(ResponseCache.Bytes);
+
+	Out.Write("},\n\"tls\":{\"handshakes\":");	Out.WriteNumber(Tls.Handshakes);
+	Out.Write(",\"resumed\":");			Out.WriteNumber(Tls.Resumptions);
+	Out.Write(",\"failed\":");				Out.WriteNumber(Tls.Failed);
+
+	Out.Write("},\n\"log\":{\"dropped\":");	Out.WriteNumber(AccessLog.Dropped);
+	Out.Write(",\"rotations\":");			Out.WriteNumber(AccessLog.Rotations);
+	Out.Write("},\n\"latency\":");
+	Latency.WriteJSON(Out);
+	Out.Write("}\n");
+}
+//----------------------------------------------------------------------------------------------------
+#endif
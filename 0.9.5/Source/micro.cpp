@@ -0,0 +1,417 @@
+//---------------------------------------------------------------------------------------------
+/*
+			MICRO.CPP
+			---------
+			SWSMicro - times the small pieces of work that every request does, one at a time,
+			so a change to one of them can be justified with numbers:
+
+				parse		CONNECTION::Reset() and ParseRequest() on real browser requests
+				filetype	CONNECTION::SetFileType() on common extensions
+				calcmonth	CalcMonth()
+				httpdate	ParseHTTPDate() on all three date formats
+				inttostring	IntToString()
+				formatnum	FormatNumber(), which replaces IntToString() in new code
+				headers		CONNECTION::BuildHeaders()
+
+			Each one reports nanoseconds and heap allocations per operation. Usage:
+
+				SWSMicro [-s file] [-b file] [-t percent]
+
+				-s file		Save the results as a baseline
+				-b file		Compare against a baseline. Anything more than -t percent
+							slower (default 10), or doing more allocations, is a
+							regression and SWSMicro exits with 1.
+
+			Run it on an otherwise idle machine, and use a Release build.
+*/
+//---------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <new>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "options.hpp"
+#include "connection.hpp"
+
+using namespace std;
+#pragma comment(lib, "wsock32.lib")
+#pragma warning(disable:4786)
+
+#define MICRO_MINTIME						0.2						// Seconds each benchmark runs for at least
+
+//---------------------------------------------------------------------------------------------
+//			Allocation counting. Every new in the program comes through here.
+//---------------------------------------------------------------------------------------------
+unsigned long Allocations = 0;
+
+void *operator new(size_t Size)
+{
+	Allocations++;
+	void *Block = malloc(Size ? Size : 1);
+	if (!Block)
+		throw bad_alloc();
+	return Block;
+}
+
+void operator delete(void *Block)
+{
+	free(Block);
+}
+
+void *operator new[](size_t Size)
+{
+	return operator new(Size);
+}
+
+void operator delete[](void *Block)
+{
+	free(Block);
+}
+
+//---------------------------------------------------------------------------------------------
+//			Requests as real browsers send them
+//---------------------------------------------------------------------------------------------
+static const char *Corpus[] =
+{
+	"GET /index.html HTTP/1.1\r\n"
+	"Host: www.ratemypoo.com\r\n"
+	"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+	"Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/avif,image/webp,*/*;q=0.8\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: en-GB,en;q=0.9\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n",
+
+	"GET /images/logo.gif HTTP/1.1\r\n"
+	"Host: www.ratemypoo.com\r\n"
+	"User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64; rv:121.0) Gecko/20100101 Firefox/121.0\r\n"
+	"Accept: image/avif,image/webp,*/*\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Referer: http://www.ratemypoo.com/index.html\r\n"
+	"If-Modified-Since: Sat, 29 Oct 1994 19:43:31 GMT\r\n"
+	"If-None-Match: \"3e8-2ea2f9c3\"\r\n"
+	"Connection: keep-alive\r\n"
+	"\r\n",
+
+	"GET /docs/ HTTP/1.0\r\n"
+	"User-Agent: Mozilla/4.0 (compatible; MSIE 6.0; Windows NT 5.1)\r\n"
+	"Accept: image/gif, image/x-xbitmap, image/jpeg, image/pjpeg, */*\r\n"
+	"Accept-Language: en-au\r\n"
+	"If-Modified-Since: Sunday, 06-Nov-94 08:49:37 GMT\r\n"
+	"\r\n",
+
+	"GET /search.php?q=web+server&page=2 HTTP/1.1\r\n"
+	"Host: localhost\r\n"
+	"User-Agent: curl/8.4.0\r\n"
+	"Accept: */*\r\n"
+	"\r\n",
+
+	"POST /cgi/form.php HTTP/1.1\r\n"
+	"Host: www.ratemypoo.com\r\n"
+	"User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 14_2) AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.2 Safari/605.1.15\r\n"
+	"Accept: text/html\r\n"
+	"Content-Type: application/x-www-form-urlencoded\r\n"
+	"Content-Length: 27\r\n"
+	"\r\n"
+	"name=Paul&rating=5&submit=1",
+
+	NULL
+};
+
+static const char *FileNames[] =
+{
+	"C:\\Webroot\\index.html", "C:\\Webroot\\images\\logo.gif", "C:\\Webroot\\style.css",
+	"C:\\Webroot\\script.php", "C:\\Webroot\\download.zip", "C:\\Webroot\\README", NULL
+};
+
+static const char *Dates[] =
+{
+	"Sun, 06 Nov 1994 08:49:37 GMT", "Sunday, 06-Nov-94 08:49:37 GMT", "Sun Nov  6 08:49:37 1994", NULL
+};
+
+static const char *Months[] =
+{
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec", NULL
+};
+
+//---------------------------------------------------------------------------------------------
+//			Results
+//---------------------------------------------------------------------------------------------
+struct RESULT
+{
+	string Name;
+	double Nanoseconds;											// Per operation
+	double Allocations;											// Per operation
+};
+
+//---------------------------------------------------------------------------------------------
+//			Benchmark class. A friend of CONNECTION, so it can call the private parts.
+//---------------------------------------------------------------------------------------------
+class MICROBENCH
+{
+  public:
+	MICROBENCH();
+	void RunAll();												// Runs every benchmark
+	vector <RESULT> Results;
+
+  private:
+	typedef unsigned long (MICROBENCH::*BENCHFUNCTION)(unsigned long Count);
+	void Run(const char *Name, BENCHFUNCTION Function);			// Times one benchmark
+
+	// Each does Count operations and returns something, so the work isn't optimised away
+	unsigned long Parse(unsigned long Count);
+	unsigned long FileType(unsigned long Count);
+	unsigned long Month(unsigned long Count);
+	unsigned long HTTPDate(unsigned long Count);
+	unsigned long IntString(unsigned long Count);
+	unsigned long FormatNum(unsigned long Count);
+	unsigned long HeaderBuild(unsigned long Count);
+
+	__int64 Frequency;
+	struct sockaddr_in Address;
+};
+
+MICROBENCH::MICROBENCH()
+{
+	LARGE_INTEGER Freq;
+	QueryPerformanceFrequency(&Freq);
+	Frequency = Freq.QuadPart;
+	memset(&Address, 0, sizeof(Address));
+}
+
+//---------------------------------------------------------------------------------------------
+//			MICROBENCH::Run() - doubles the count until it takes MICRO_MINTIME, then reports
+//			the last run
+//---------------------------------------------------------------------------------------------
+void MICROBENCH::Run(const char *Name, BENCHFUNCTION Function)
+{
+	(this->*Function)(100);										// Warm up
+
+	unsigned long Count = 100;
+	for (;;)
+	{
+		LARGE_INTEGER Start, End;
+		unsigned long AllocStart = Allocations;
+		QueryPerformanceCounter(&Start);
+		(this->*Function)(Count);
+		QueryPerformanceCounter(&End);
+		unsigned long Allocated = Allocations - AllocStart;
+
+		double Seconds = (double)(End.QuadPart - Start.QuadPart) / Frequency;
+		if (Seconds >= MICRO_MINTIME || Count >= 0x40000000)
+		{
+			RESULT Result;
+			Result.Name = Name;
+			Result.Nanoseconds = Seconds * 1e9 / Count;
+			Result.Allocations = (double)Allocated / Count;
+			Results.push_back(Result);
+			printf("%-12s %10.1f ns/op %8.2f allocs/op\n", Name, Result.Nanoseconds, Result.Allocations);
+			return;
+		}
+		Count *= 2;
+	}
+}
+
+void MICROBENCH::RunAll()
+{
+	Run("parse", &MICROBENCH::Parse);
+	Run("filetype", &MICROBENCH::FileType);
+	Run("calcmonth", &MICROBENCH::Month);
+	Run("httpdate", &MICROBENCH::HTTPDate);
+	Run("inttostring", &MICROBENCH::IntString);
+	Run("formatnum", &MICROBENCH::FormatNum);
+	Run("headers", &MICROBENCH::HeaderBuild);
+}
+
+//---------------------------------------------------------------------------------------------
+//			The benchmarks
+//---------------------------------------------------------------------------------------------
+unsigned long MICROBENCH::Parse(unsigned long Count)
+{
+	unsigned long Total = 0;
+	int Request = 0;
+	CONNECTION Connection(-1, Address);
+	for (unsigned long X = 0; X < Count; X++)
+	{
+		Connection.Reset(-1, Address);							// Used again, as ConnectionPool does
+		Connection.ParseRequest(Corpus[Request]);
+		Total += Connection.FileRequested.length();
+		if (!Corpus[++Request]) Request = 0;
+	}
+	return Total;
+}
+
+unsigned long MICROBENCH::FileType(unsigned long Count)
+{
+	unsigned long Total = 0;
+	CONNECTION Connection(-1, Address);
+	int File = 0;
+	for (unsigned long X = 0; X < Count; X++)
+	{
+		Connection.RealFile = FileNames[File];
+		Connection.Extension.erase();
+		Connection.SetFileType();
+		Total += Connection.IsBinary + Connection.IsScript;
+		if (!FileNames[++File]) File = 0;
+	}
+	return Total;
+}
+
+unsigned long MICROBENCH::Month(unsigned long Count)
+{
+	unsigned long Total = 0;
+	int M = 0;
+	for (unsigned long X = 0; X < Count; X++)
+	{
+		Total += CalcMonth(Months[M]);
+		if (!Months[++M]) M = 0;
+	}
+	return Total;
+}
+
+unsigned long MICROBENCH::HTTPDate(unsigned long Count)
+{
+	unsigned long Total = 0;
+	int D = 0;
+	for (unsigned long X = 0; X < Count; X++)
+	{
+		time_t Time;
+		if (ParseHTTPDate(Dates[D], &Time))
+			Total += (unsigned long)Time;
+		if (!Dates[++D]) D = 0;
+	}
+	return Total;
+}
+
+unsigned long MICROBENCH::IntString(unsigned long Count)
+{
+	unsigned long Total = 0;
+	for (unsigned long X = 0; X < Count; X++)
+		Total += IntToString(X).length();
+	return Total;
+}
+
+unsigned long MICROBENCH::FormatNum(unsigned long Count)
+{
+	unsigned long Total = 0;
+	char Text[21];
+	for (unsigned long X = 0; X < Count; X++)
+		Total += FormatNumber(X, Text);
+	return Total;
+}
+
+unsigned long MICROBENCH::HeaderBuild(unsigned long Count)
+{
+	unsigned long Total = 0;
+	CONNECTION Connection(-1, Address);
+	Connection.HTTPVersion = "HTTP/1.1";
+	FormatHTTPDate(time(NULL), Connection.Date);
+	for (unsigned long X = 0; X < Count; X++)
+	{
+		Connection.BuildHeaders("text/html", "10240");
+		Total += Connection.Headers.length();
+	}
+	return Total;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Baselines
+//---------------------------------------------------------------------------------------------
+bool SaveBaseline(const char *FileName, const vector <RESULT> &Results)
+{
+	FILE *Out = fopen(FileName, "w");
+	if (!Out)
+		return false;
+	for (int X = 0; X < (int)Results.size(); X++)
+		fprintf(Out, "%s %.1f %.2f\n", Results[X].Name.c_str(), Results[X].Nanoseconds, Results[X].Allocations);
+	fclose(Out);
+	return true;
+}
+
+int CompareBaseline(const char *FileName, const vector <RESULT> &Results, double Threshold)
+{
+	FILE *In = fopen(FileName, "r");
+	if (!In)
+	{
+		printf("Could not read %s\n", FileName);
+		return 1;
+	}
+
+	map <string, RESULT> Baseline;
+	char Name[64];
+	double Nanoseconds, Allocs;
+	while (fscanf(In, "%63s %lf %lf", Name, &Nanoseconds, &Allocs) == 3)
+	{
+		RESULT Result;
+		Result.Name = Name;
+		Result.Nanoseconds = Nanoseconds;
+		Result.Allocations = Allocs;
+		Baseline[Name] = Result;
+	}
+	fclose(In);
+
+	int Regressions = 0;
+	printf("\n%-12s %10s %10s %8s\n", "", "baseline", "now", "change");
+	for (int X = 0; X < (int)Results.size(); X++)
+	{
+		map <string, RESULT>::iterator Found = Baseline.find(Results[X].Name);
+		if (Found == Baseline.end())
+			continue;
+		const RESULT &Old = Found->second;
+		double Change = (Old.Nanoseconds > 0) ? (Results[X].Nanoseconds / Old.Nanoseconds - 1) * 100 : 0;
+		bool Slower = Change > Threshold;
+		bool MoreAllocs = Results[X].Allocations > Old.Allocations + 0.01;
+		printf("%-12s %10.1f %10.1f %+7.1f%%%s%s\n", Results[X].Name.c_str(), Old.Nanoseconds,
+			   Results[X].Nanoseconds, Change, Slower ? "  SLOWER" : "", MoreAllocs ? "  MORE ALLOCATIONS" : "");
+		if (Slower || MoreAllocs)
+			Regressions++;
+	}
+
+	if (Regressions)
+	{
+		printf("\n%d regression(s)\n", Regressions);
+		return 1;
+	}
+	printf("\nNo regressions\n");
+	return 0;
+}
+
+//---------------------------------------------------------------------------------------------
+//			Main
+//---------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	const char *SaveFile = NULL;
+	const char *BaselineFile = NULL;
+	double Threshold = 10;
+	for (int A = 1; A + 1 < argc; A += 2)
+	{
+		if (!strcmp(argv[A], "-s"))			SaveFile = argv[A + 1];
+		else if (!strcmp(argv[A], "-b"))	BaselineFile = argv[A + 1];
+		else if (!strcmp(argv[A], "-t"))	Threshold = atof(argv[A + 1]);
+	}
+
+	// Same tables the server uses
+	Options.LoadMIMETypes();
+	Options.CGI["php"] = "C:\\PHP\\php.exe";
+	Options.Servername = "SWS Web Server";
+	Options.WebRoot = "C:\\SWS\\Webroot";
+
+	MICROBENCH Bench;
+	Bench.RunAll();
+
+	if (SaveFile && !SaveBaseline(SaveFile, Bench.Results))
+	{
+		printf("Could not write %s\n", SaveFile);
+		return 1;
+	}
+	if (BaselineFile)
+		return CompareBaseline(BaselineFile, Bench.Results, Threshold);
+	return 0;
+}
@@ -3,6 +3,7 @@
 //----------------------------------------------------------------------------------------------------
 #include <windows.h>
 #include <map>
+#include <vector>
 #include <sstream>
 
 // These files are to be used for parsing XML documents (the config file) and must be downloaded
@@ -24,6 +25,18 @@ using namespace std;
 #pragma warning(disable:4786)
 
 int StringToInt(string);
+class ASSETPACK;												// assetpack.hpp
+
+//----------------------------------------------------------------------------------------------------
+//			A reverse proxy route - requests for Prefix on HostName go to one of Upstreams
+//----------------------------------------------------------------------------------------------------
+struct PROXYROUTE
+{
+	string HostName;											// Host it's for, empty for any host
+	string Prefix;												// Paths that start with this (/)
+	vector <string> Upstreams;									// host:port of each server it can go to
+};
+
 //----------------------------------------------------------------------------------------------------
 //			Options class - derived from configuration file
 //----------------------------------------------------------------------------------------------------
@@ -33,18 +46,53 @@ class OPTIONS
 	string Servername;											// Name of this server - Ie, Central Online (SWS)
 	int Port;													// Port number to listen on (80)
 	string WebRoot;												// Path to root web folder (C:\WebRoot)
-	int MaxConnections;											// Number of connections at once (20)
+	int MaxConnections;											// Number of connections at once (20), the rest queue
+	int QueueTarget;											// Longest a queue should keep them waiting in ms, 0 to never shed
+	int QueueInterval;											// How long it has to be over target to shed, in ms
+	int ClientConnections;										// Connections each client can have open, 0 for any
+	int RateLimit;												// Requests a second for each client, 0 for no limit
+	int RateBurst;												// Requests at once before RateLimit applies, 0 for a second's worth
+	int RatePrefix;												// Bits of the client's address that count as one client (32)
+	int SendRate;												// KB a second each connection sends files at, 0 for no cap
+	int SendBurst;												// KB sent at full speed before SendRate applies
+	int ReadAhead;												// KB a file must be for the next piece to be read while one is sent, 0 never
 	string Logfile;												// Path/name of log file (c:\SWS\logfile.log)
+	string LogFormat;											// common, combined or binary
+	int LogRotateSize;											// Start a new log file after this many KB, 0 for never
+	int LogRotateMinutes;										// Start a new log file this often, 0 for never
+	bool LogCompress;											// NTFS compress old log files
 	map <string, string> CGI;									// Map of extension/interpreter for CGI scripts (ie, CGI["php"] = "C:\PHP.exe"
 	map <int, string> IndexFiles;								// Files that will be used as auto indexes of folders (index.htm)
 	int Timeout;												// Idle time for each connection before time out and closure
+	int HeaderTimeout;											// Seconds for the rest of the headers once they start, 0 for Timeout
+	int BodyTimeout;											// Seconds for a POST body once the headers are in, 0 for Timeout
+	int SendTimeout;											// Seconds a send can go without progress, 0 for Timeout
+	int KeepAlive;												// Requests a connection can carry, 0 or 1 to close after each
+	int KeepAliveTimeout;										// Seconds a connection is kept open for the next one, 0 for Timeout
 	map <string, string> MIMETypes;								// MIME types
 	map <string, bool> Binary;									// Files that should be opened as binary
 	bool AllowIndex;											// Are we allowed to index files
+	int IndexPageSize;											// Entries per page of a folder index, 0 for one page
 	map <int, string> ErrorCode;								// List of number to string mapped error codes, ie:
 																//  ErrorCode[404] = "File Not Found";
 	string ErrorDirectory;										// Folder where custom error pages are kept
+	string StatusURL;											// Where the server status page is (/server-status), empty for none
+	int SlowRequestMs;											// Log requests that take longer than this, 0 for none
+	string Engine;												// threads (a thread per connection) or iocp (completion ports)
+	int IOThreads;												// Threads for the iocp engine, 0 for two per processor
+	vector <PROXYROUTE> Proxies;								// Requests passed on to other servers (see proxy.hpp)
+	int SecurePort;												// Port to serve HTTPS on (443), if there's a certificate
+	string Certificate;											// Subject of its certificate (see tls.hpp)
+	int SessionLifetime;										// Seconds a TLS session can be resumed for
+	int Http2;													// 0 for no HTTP/2, 1 for h2c only, 2 over HTTPS too (see http2.hpp)
+	int Http2Streams;											// Streams an HTTP/2 connection can have open at once
+	int CacheSize;												// KB of CGI and proxied replies kept (see respcache.hpp), 0 for none
+	string PrewarmList;											// Paths read into memory at startup (see prewarm.hpp), if any
+	int PrewarmTop;												// And the most requested this many from each access log
+	int PrewarmRate;											// KB a second read doing it, 0 for no limit
 	bool ReadSettings();										// Read in the settings from the config file
+	void LoadMIMETypes();										// Fill in MIMETypes and Binary
+	const char *Reason(int Code);								// ErrorCode's text for Code, or one for its class
 }Options;
 
 
@@ -60,6 +108,18 @@ public:
 	map <int, string> IndexFiles;								// Files that will be used as auto indexes of folders (index.htm)
 	string Root;												// Root folder of files for this VH (ie, c:\RateMyPoo)
 	string Logfile;												// Path/name of log file (C:\RateMyPoo\logfile.log)
+	string LogFormat;											// Log format, if not the same as Options.LogFormat
+	int LogNumber;												// Access log file number (see accesslog.hpp)
+	string PackFile;											// Asset pack made from Root, if any (C:\RateMyPoo.pak)
+	ASSETPACK *Pack;											// The pack once it is loaded, or NULL
+	int RateLimit;												// Requests a second for each client, 0 for the server's
+	int RateBurst;												// Requests at once before RateLimit applies
+	int SendRate;												// KB a second for each connection, 0 for the server's
+	int HostSendRate;											// KB a second for all of them together, 0 for any
+	volatile LONG SendDue;										// Pacing's due time for HostSendRate
+	string Certificate;											// Subject of its own certificate for HTTPS, if any
+
+	VIRTUALHOST() { Pack = NULL; LogNumber = -1; RateLimit = 0; RateBurst = 0; SendRate = 0; HostSendRate = 0; SendDue = 0; }
 };
 
 //----------------------------------------------------------------------------------------------------
@@ -95,6 +155,27 @@ int StringToInt(string str)
 }
 
 
+//----------------------------------------------------------------------------------------------------
+//			QueryValue(); - gets a value out of a query string, ie, QueryValue("a=1&page=2", "page")
+//			returns "2". Returns "" if the name is not there.
+//----------------------------------------------------------------------------------------------------
+string QueryValue(const string &Query, const char *Name)
+{
+	int NameLength = strlen(Name);
+	const char *P = Query.c_str();
+	while (P && *P)
+	{
+		if (!strncmp(P, Name, NameLength) && P[NameLength] == '=')
+		{
+			P += NameLength + 1;
+			const char *End = strchr(P, '&');
+			return End ? string(P, End - P) : string(P);
+		}
+		P = strchr(P, '&');										// On to the next one
+		if (P) P++;
+	}
+	return "";
+}
 
 //----------------------------------------------------------------------------------------------------
 //			Options::ReadSettings()
@@ -167,6 +248,30 @@ bool OPTIONS::ReadSettings()
 		Logfile = node->get_Content();
 	}
 	
+	// Log format
+	node = xml.SearchForTag(0,"LogFormat");
+	if (node)
+	{
+		LogFormat = node->get_Content();
+	}
+
+	// Log rotation
+	node = xml.SearchForTag(0,"LogRotateSize");
+	if (node)
+	{
+		LogRotateSize = StringToInt(node->get_Content());
+	}
+	node = xml.SearchForTag(0,"LogRotateMinutes");
+	if (node)
+	{
+		LogRotateMinutes = StringToInt(node->get_Content());
+	}
+	node = xml.SearchForTag(0,"LogCompress");
+	if (node)
+	{
+		LogCompress = !strcmpi(node->get_Content(), "true");
+	}
+	
 	// ErrorPages
 	node = xml.SearchForTag(0,"ErrorPages");
 	if (node)
@@ -226,15 +331,215 @@ bool OPTIONS::ReadSettings()
 		else AllowIndex = false;
 	}
 
+	// Server status page
+	node = xml.SearchForTag(0,"StatusURL");
+	if (node)
+	{
+		StatusURL = node->get_Content();
+	}
+
+	// Slow request log
+	node = xml.SearchForTag(0,"SlowRequestMs");
+	if (node)
+	{
+		SlowRequestMs = StringToInt(node->get_Content());
+	}
+
+	// Admission control
+	node = xml.SearchForTag(0,"QueueTarget");
+	if (node)
+	{
+		QueueTarget = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"QueueInterval");
+	if (node)
+	{
+		QueueInterval = StringToInt(node->get_Content());
+	}
+
+	// Limits for each client
+	node = xml.SearchForTag(0,"ClientConnections");
+	if (node)
+	{
+		ClientConnections = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"RateLimit");
+	if (node)
+	{
+		RateLimit = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"RateBurst");
+	if (node)
+	{
+		RateBurst = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"RatePrefix");
+	if (node)
+	{
+		RatePrefix = StringToInt(node->get_Content());
+	}
+
+	// Bandwidth caps
+	node = xml.SearchForTag(0,"SendRate");
+	if (node)
+	{
+		SendRate = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"SendBurst");
+	if (node)
+	{
+		SendBurst = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"ReadAhead");
+	if (node)
+	{
+		ReadAhead = StringToInt(node->get_Content());
+	}
+
+	// HTTPS
+	node = xml.SearchForTag(0,"SecurePort");
+	if (node)
+	{
+		SecurePort = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"Certificate");
+	if (node)
+	{
+		Certificate = node->get_Content();
+	}
+
+	node = xml.SearchForTag(0,"SessionLifetime");
+	if (node)
+	{
+		SessionLifetime = StringToInt(node->get_Content());
+	}
+
+	// HTTP/2
+	node = xml.SearchForTag(0,"Http2");
+	if (node)
+	{
+		Http2 = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"Http2Streams");
+	if (node)
+	{
+		Http2Streams = StringToInt(node->get_Content());
+	}
+
+	// Response cache
+	node = xml.SearchForTag(0,"CacheSize");
+	if (node)
+	{
+		CacheSize = StringToInt(node->get_Content());
+	}
+
+	// Startup prewarming
+	node = xml.SearchForTag(0,"PrewarmList");
+	if (node)
+	{
+		PrewarmList = node->get_Content();
+	}
+
+	node = xml.SearchForTag(0,"PrewarmTop");
+	if (node)
+	{
+		PrewarmTop = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"PrewarmRate");
+	if (node)
+	{
+		PrewarmRate = StringToInt(node->get_Content());
+	}
+
+	// Connection deadlines
+	node = xml.SearchForTag(0,"Timeout");
+	if (node)
+	{
+		Timeout = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"HeaderTimeout");
+	if (node)
+	{
+		HeaderTimeout = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"BodyTimeout");
+	if (node)
+	{
+		BodyTimeout = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"SendTimeout");
+	if (node)
+	{
+		SendTimeout = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"KeepAlive");
+	if (node)
+	{
+		KeepAlive = StringToInt(node->get_Content());
+	}
+
+	node = xml.SearchForTag(0,"KeepAliveTimeout");
+	if (node)
+	{
+		KeepAliveTimeout = StringToInt(node->get_Content());
+	}
+
+	// Connection engine
+	node = xml.SearchForTag(0,"Engine");
+	if (node)
+	{
+		Engine = node->get_Content();
+	}
+
+	node = xml.SearchForTag(0,"IOThreads");
+	if (node)
+	{
+		IOThreads = StringToInt(node->get_Content());
+	}
+
+	// Folder index page size
+	node = xml.SearchForTag(0,"IndexPageSize");
+	if (node)
+	{
+		IndexPageSize = StringToInt(node->get_Content());
+	}
+
 	// Virtual Hosts
 	string sName;
 	string sHostName;
 	string sRoot;
 	string sLogFile;
+	string sPackFile;
+	string sLogFormat;
 	string Index;
+	string sCertificate;
+	int iRateLimit;
+	int iRateBurst;
+	int iSendRate;
+	int iHostSendRate;
 	node = xml.SearchForTag(0,"VirtualHost");
 	while (node)
 	{
+		sPackFile = "";
+		sLogFormat = "";
+		sCertificate = "";
+		iRateLimit = 0;
+		iRateBurst = 0;
+		iSendRate = 0;
+		iHostSendRate = 0;
 		node2 = xml.SearchForTag(node, "vhName");
 		if (node2)
 		{
@@ -259,12 +564,61 @@ bool OPTIONS::ReadSettings()
 			sLogFile = node2->get_Content();
 		}
 
+		node2 = xml.SearchForTag(node, "vhLogFormat");				// Optional log format
+		if (node2)
+		{
+			sLogFormat = node2->get_Content();
+		}
+
+		node2 = xml.SearchForTag(node, "vhPack");					// Optional asset pack
+		if (node2)
+		{
+			sPackFile = node2->get_Content();
+		}
+
+		node2 = xml.SearchForTag(node, "vhCertificate");			// Optional certificate for HTTPS
+		if (node2)
+		{
+			sCertificate = node2->get_Content();
+		}
+
+		node2 = xml.SearchForTag(node, "vhRateLimit");				// Optional request rate for each client
+		if (node2)
+		{
+			iRateLimit = StringToInt(node2->get_Content());
+		}
+
+		node2 = xml.SearchForTag(node, "vhRateBurst");
+		if (node2)
+		{
+			iRateBurst = StringToInt(node2->get_Content());
+		}
+
+		node2 = xml.SearchForTag(node, "vhSendRate");				// Optional bandwidth caps
+		if (node2)
+		{
+			iSendRate = StringToInt(node2->get_Content());
+		}
+
+		node2 = xml.SearchForTag(node, "vhHostSendRate");
+		if (node2)
+		{
+			iHostSendRate = StringToInt(node2->get_Content());
+		}
+
 		if ( !sName.empty() && !sHostName.empty() && !sRoot.empty() && !sLogFile.empty())
 		{
 			VHI.Host[sHostName].HostName = sHostName;
 			VHI.Host[sHostName].Logfile = sLogFile;
 			VHI.Host[sHostName].Name = sName;
 			VHI.Host[sHostName].Root = sRoot;
+			VHI.Host[sHostName].PackFile = sPackFile;
+			VHI.Host[sHostName].LogFormat = sLogFormat;
+			VHI.Host[sHostName].Certificate = sCertificate;
+			VHI.Host[sHostName].RateLimit = iRateLimit;
+			VHI.Host[sHostName].RateBurst = iRateBurst;
+			VHI.Host[sHostName].SendRate = iSendRate;
+			VHI.Host[sHostName].HostSendRate = iHostSendRate;
 		}
 
 		CkXml *curNode = node;
@@ -273,41 +627,280 @@ bool OPTIONS::ReadSettings()
 		delete curNode;
 	}
 
+	// Reverse proxy routes. Unlike the virtual hosts these search inside their own tag,
+	//  as a route can have any number of upstreams.
+	node = xml.SearchForTag(0,"Proxy");
+	while (node)
+	{
+		PROXYROUTE Route;
+		Route.Prefix = "/";
+
+		node2 = node->SearchForTag(0, "pxHostName");				// Optional, any host if there isn't one
+		if (node2)
+		{
+			Route.HostName = node2->get_Content();
+			delete node2;
+		}
+
+		node2 = node->SearchForTag(0, "pxPrefix");					// Optional, everything if there isn't one
+		if (node2)
+		{
+			Route.Prefix = node2->get_Content();
+			delete node2;
+		}
+
+		node2 = node->SearchForTag(0, "pxUpstream");
+		while (node2)
+		{
+			Route.Upstreams.push_back(node2->get_Content());
+			CkXml *curNode2 = node2;
+			node2 = node->SearchForTag(curNode2, "pxUpstream");
+			delete curNode2;
+		}
+
+		if (!Route.Upstreams.empty())
+			Proxies.push_back(Route);
+
+		CkXml *curNode = node;
+		node = xml.SearchForTag(curNode,"Proxy");
+		delete curNode;
+	}
+
 
 	return 1;
 }
 
 
 //----------------------------------------------------------------------------------------------------
-//			CalcMonth() - returns the integer description of a month from its string, ie, "Feb" returns 2
+//			Options::Reason()
+//			Request threads use this rather than ErrorCode[], which would add Code to the map
+//			they all share if it wasn't there.
 //----------------------------------------------------------------------------------------------------
-int CalcMonth(string Month)
+const char *OPTIONS::Reason(int Code)
 {
-	if ( !strcmpi(Month.c_str(), "Jan")   )
-		return 0;
-	else if ( !strcmpi(Month.c_str(), "Feb")   )
-		return 1;
-	else if ( !strcmpi(Month.c_str(), "Mar")   )
-		return 2;
-	else if ( !strcmpi(Month.c_str(), "Apr")   )
-		return 3;
-	else if ( !strcmpi(Month.c_str(), "May")   )
-		return 4;
-	else if ( !strcmpi(Month.c_str(), "Jun")   )
-		return 5;
-	else if ( !strcmpi(Month.c_str(), "Jul")   )
-		return 6;
-	else if ( !strcmpi(Month.c_str(), "Aug")   )
-		return 7;
-	else if ( !strcmpi(Month.c_str(), "Sep")   )
-		return 8;
-	else if ( !strcmpi(Month.c_str(), "Oct")   )
-		return 9;
-	else if ( !strcmpi(Month.c_str(), "Nov")   )
-		return 10;
-	else if ( !strcmpi(Month.c_str(), "Dec")   )
-		return 11;
-	else return 0;
+	map <int, string>::const_iterator It = ErrorCode.find(Code);
+	if (It != ErrorCode.end())
+		return It->second.c_str();
+	switch (Code / 100)
+	{
+	case 1:		return "Continue";
+	case 2:		return "OK";
+	case 3:		return "Redirect";
+	case 4:		return "Client Error";
+	default:	return "Server Error";
+	}
 }
+
+//----------------------------------------------------------------------------------------------------
+//			Options::LoadMIMETypes()
+//			Also used by the asset packer, so MIME types in a pack match what the server would send.
+//----------------------------------------------------------------------------------------------------
+void OPTIONS::LoadMIMETypes()
+{
+	//----------------------------------------------------------------------------------------------------
+	//			MIME Types
+	//----------------------------------------------------------------------------------------------------
+	MIMETypes["hqx"] = "application/mac-binhex40";
+	MIMETypes["doc"] = "application/msword";
+	MIMETypes["bin"] = "application/octet-stream";
+	MIMETypes["dms"] = "application/octet-stream";
+	MIMETypes["lha"] = "application/octet-stream";
+	MIMETypes["lzh"] = "application/octet-stream";
+	MIMETypes["exe"] = "application/octet-stream";
+	MIMETypes["class"] = "application/octet-stream";
+	MIMETypes["pdf"] = "application/pdf";
+	MIMETypes["ai"] = "application/postscript";
+	MIMETypes["eps"] = "application/postscript";
+	MIMETypes["ps"] = "application/postscript";
+	MIMETypes["smi"] = "application/smil";
+	MIMETypes["smil"] = "application/smil";
+	MIMETypes["mif"] = "application/vnd.mif";
+	MIMETypes["asf"] = "application/vnd.ms-asf";
+	MIMETypes["xls"] = "application/vnd.ms-excel";
+	MIMETypes["ppt"] = "application/vnd.ms-powerpoint";
+	MIMETypes["vcd"] = "application/x-cdlink";
+	MIMETypes["Z"] = "application/x-compress";
+	MIMETypes["cpio"] = "application/x-cpio";
+	MIMETypes["csh"] = "application/x-csh";
+	MIMETypes["dcr"] = "application/x-director";
+	MIMETypes["dir"] = "application/x-director";
+	MIMETypes["dxr"] = "application/x-director";
+	MIMETypes["dvi"] = "application/x-dvi";
+	MIMETypes["gtar"] = "application/x-gtar";
+	MIMETypes["gz"] = "application/x-gzip";
+	MIMETypes["js"] = "application/x-javascript";
+	MIMETypes["latex"] = "application/x-latex";
+	MIMETypes["sh"] = "application/x-sh";
+	MIMETypes["shar"] = "application/x-shar";
+	MIMETypes["swf"] = "application/x-shockwave-flash";
+	MIMETypes["sit"] = "application/x-stuffit";
+	MIMETypes["tar"] = "application/x-tar";
+	MIMETypes["tcl"] = "application/x-tcl";
+	MIMETypes["tex"] = "application/x-tex";
+	MIMETypes["texinfo"] = "application/x-texinfo";
+	MIMETypes["texi"] = "application/x-texinfo";
+	MIMETypes["t"] = "application/x-troff";
+	MIMETypes["tr"] = "application/x-troff";
+	MIMETypes["roff"] = "application/x-troff";
+	MIMETypes["man"] = "application/x-troff-man";
+	MIMETypes["me"] = "application/x-troff-me";
+	MIMETypes["ms"] = "application/x-troff-ms";
+	MIMETypes["zip"] = "application/zip";
+	MIMETypes["au"] = "audio/basic";
+	MIMETypes["snd"] = "audio/basic";
+	MIMETypes["mid"] = "audio/midi";
+	MIMETypes["midi"] = "audio/midi";
+	MIMETypes["kar"] = "audio/midi";
+	MIMETypes["mpga"] = "audio/mpeg";
+	MIMETypes["mp2"] = "audio/mpeg";
+	MIMETypes["mp3"] = "audio/mpeg";
+	MIMETypes["aif"] = "audio/x-aiff";
+	MIMETypes["aiff"] = "audio/x-aiff";
+	MIMETypes["aifc"] = "audio/x-aiff";
+	MIMETypes["ram"] = "audio/x-pn-realaudio";
+	MIMETypes["rm"] = "audio/x-pn-realaudio";
+	MIMETypes["ra"] = "audio/x-realaudio";
+	MIMETypes["wav"] = "audio/x-wav";
+	MIMETypes["bmp"] = "image/bmp";
+	MIMETypes["gif"] = "image/gif";
+	MIMETypes["ief"] = "image/ief";
+	MIMETypes["jpeg"] = "image/jpeg";
+	MIMETypes["jpg"] = "image/jpeg";
+	MIMETypes["jpe"] = "image/jpeg";
+	MIMETypes["png"] = "image/png";
+	MIMETypes["tiff"] = "image/tiff";
+	MIMETypes["tif"] = "image/tiff";
+	MIMETypes["ras"] = "image/x-cmu-raster";
+	MIMETypes["pnm"] = "image/x-portable-anymap";
+	MIMETypes["pbm"] = "image/x-portable-bitmap";
+	MIMETypes["pgm"] = "image/x-portable-graymap";
+	MIMETypes["ppm"] = "image/x-portable-pixmap";
+	MIMETypes["rgb"] = "image/x-rgb";
+	MIMETypes["xbm"] = "image/x-xbitmap";
+	MIMETypes["xpm"] = "image/x-xpixmap";
+	MIMETypes["xwd"] = "image/x-xwindowdump";
+	MIMETypes["igs"] = "model/iges";
+	MIMETypes["iges"] = "model/iges";
+	MIMETypes["msh"] = "model/mesh";
+	MIMETypes["mesh"] = "model/mesh";
+	MIMETypes["silo"] = "model/mesh";
+	MIMETypes["wrl"] = "model/vrml";
+	MIMETypes["vrml"] = "model/vrml";
+	MIMETypes["css"] = "text/css";
+	MIMETypes["html"] = "text/html";
+	MIMETypes["htm"] = "text/html";
+	MIMETypes["asc"] = "text/plain";
+	MIMETypes["txt"] = "text/plain";
+	MIMETypes["rtx"] = "text/richtext";
+	MIMETypes["rtf"] = "text/rtf";
+	MIMETypes["sgml"] = "text/sgml";
+	MIMETypes["sgm"] = "text/sgml";
+	MIMETypes["tsv"] = "text/tab-separated-values";
+	MIMETypes["xml"] = "text/xml";
+	MIMETypes["mpeg"] = "video/mpeg";
+	MIMETypes["mpg"] = "video/mpeg";
+	MIMETypes["mpe"] = "video/mpeg";
+	MIMETypes["qt"] = "video/quicktime";
+	MIMETypes["mov"] = "video/quicktime";
+	MIMETypes["avi"] = "video/x-msvideo";
+
+	//----------------------------------------------------------------------------------------------------
+	//			Binary Files
+	//			The following extensions should be opened as binary. Anything else should be as text
+	//----------------------------------------------------------------------------------------------------
+	Binary["hqx"] = true;
+	Binary["doc"] = true;
+	Binary["bin"] = true;
+	Binary["dms"] = true;
+	Binary["lha"] = true;
+	Binary["lzh"] = true;
+	Binary["exe"] = true;
+	Binary["class"] = true;
+	Binary["pdf"] = true;
+	Binary["ai"] = true;
+	Binary["eps"] = true;
+	Binary["ps"] = true;
+	Binary["smi"] = true;
+	Binary["smil"] = true;
+	Binary["mif"] = true;
+	Binary["asf"] = true;
+	Binary["xls"] = true;
+	Binary["ppt"] = true;
+	Binary["vcd"] = true;
+	Binary["Z"] = true;
+	Binary["cpio"] = true;
+	Binary["csh"] = true;
+	Binary["dcr"] = true;
+	Binary["dir"] = true;
+	Binary["dxr"] = true;
+	Binary["dvi"] = true;
+	Binary["gtar"] = true;
+	Binary["gz"] = true;
+	Binary["js"] = true;
+	Binary["latex"] = true;
+	Binary["sh"] = true;
+	Binary["shar"] = true;
+	Binary["swf"] = true;
+	Binary["sit"] = true;
+	Binary["tar"] = true;
+	Binary["tcl"] = true;
+	Binary["tex"] = true;
+	Binary["texinfo"] = true;
+	Binary["texi"] = true;
+	Binary["t"] = true;
+	Binary["tr"] = true;
+	Binary["roff"] = true;
+	Binary["man"] = true;
+	Binary["me"] = true;
+	Binary["ms"] = true;
+	Binary["zip"] = true;
+	Binary["au"] = true;
+	Binary["snd"] = true;
+	Binary["mid"] = true;
+	Binary["midi"] = true;
+	Binary["kar"] = true;
+	Binary["mpga"] = true;
+	Binary["mp2"] = true;
+	Binary["mp3"] = true;
+	Binary["aif"] = true;
+	Binary["aiff"] = true;
+	Binary["aifc"] = true;
+	Binary["ram"] = true;
+	Binary["rm"] = true;
+	Binary["ra"] = true;
+	Binary["wav"] = true;
+	Binary["bmp"] = true;
+	Binary["gif"] = true;
+	Binary["ief"] = true;
+	Binary["jpeg"] = true;
+	Binary["jpg"] = true;
+	Binary["jpe"] = true;
+	Binary["png"] = true;
+	Binary["tiff"] = true;
+	Binary["tif"] = true;
+	Binary["ras"] = true;
+	Binary["pnm"] = true;
+	Binary["pbm"] = true;
+	Binary["pgm"] = true;
+	Binary["ppm"] = true;
+	Binary["rgb"] = true;
+	Binary["xbm"] = true;
+	Binary["xpm"] = true;
+	Binary["xwd"] = true;
+	Binary["igs"] = true;
+	Binary["iges"] = true;
+	Binary["msh"] = true;
+	Binary["mesh"] = true;
+	Binary["silo"] = true;
+	Binary["wrl"] = true;
+	Binary["vrml"] = true;
+	Binary["mpeg"] = true;
+	Binary["mpg"] = true;
+	Binary["mpe"] = true;
+	Binary["qt"] = true;
+	Binary["mov"] = true;
+	Binary["avi"] = true;
+}
+
 //----------------------------------------------------------------------------------------------------
 #endif
\ No newline at end of file
@@ -0,0 +1,164 @@
+#ifndef PACINGHPP
+#define PACINGHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			PACING.HPP
+			----------
+			Bandwidth caps for big downloads, so a few clients pulling large files can't
+			fill the uplink and slow every page down for everyone else.
+
+				<SendRate>				KB a second each connection sends a file at
+				<SendBurst>				KB it sends at full speed before that applies
+										(256), so small files aren't held up at all
+				<vhSendRate>			A virtual host's own <SendRate>
+				<vhHostSendRate>		KB a second all of a virtual host's connections
+										send at between them
+
+			Only binary files are paced. They are sent a piece at a time, a quarter of a
+			second's worth each, and before each piece Delay() says how long to hold it
+			back. Each cap is a token bucket kept as a single due time (as ratelimit.hpp
+			does for requests), so a piece is reserved on every bucket that applies at
+			once, and the wait is for whichever is furthest behind.
+
+			The iocp engine waits on the timer wheel, so a paced connection holds no
+			thread while it waits. The thread engine's threads belong to their connection
+			anyway, so they Sleep().
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include "options.hpp"
+
+#define PACE_PIECES							4						// Pieces a second
+#define PACE_SMALLEST						4096					// Smallest piece worth sending
+#define PACE_STALE							60000000				// Microseconds behind that must be a wrap
+
+//----------------------------------------------------------------------------------------------------
+//			One response's pacing
+//----------------------------------------------------------------------------------------------------
+struct PACE
+{
+	int Rate;													// Bytes a second for the connection, 0 for any
+	int HostRate;												// Bytes a second for the host, 0 for any
+	volatile LONG Due;											// When the connection's next byte is due, in microseconds
+	volatile LONG *HostDue;										// The same for the host
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Pacing class
+//----------------------------------------------------------------------------------------------------
+class PACING
+{
+  public:
+	PACING();													// Constructor
+	void Start(PACE *Pace, VIRTUALHOST *Host);					// Picks the caps for a new response
+	DWORD Piece(PACE *Pace, DWORD Largest);						// How much to send at once
+	DWORD Delay(PACE *Pace, DWORD Bytes);						// Reserves Bytes, returns ms to wait before sending them
+
+	volatile LONG Paused;										// Times a piece was held back
+
+  private:
+	LONG Reserve(volatile LONG *Due, int Rate, DWORD Bytes, LONG Time);	// Microseconds too early, or 0
+	LONG Now();													// Microseconds, wrapping
+
+	__int64 Frequency;											// QueryPerformanceFrequency()
+}Pacing;
+
+//----------------------------------------------------------------------------------------------------
+//			PACING::PACING
+//----------------------------------------------------------------------------------------------------
+PACING::PACING()
+{
+	QueryPerformanceFrequency((LARGE_INTEGER *)&Frequency);
+	Paused = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PACING::Start()
+//----------------------------------------------------------------------------------------------------
+void PACING::Start(PACE *Pace, VIRTUALHOST *Host)
+{
+	Pace->Rate = Options.SendRate * 1024;
+	Pace->HostRate = 0;
+	Pace->HostDue = NULL;
+	if (Host && Host->SendRate > 0)
+		Pace->Rate = Host->SendRate * 1024;
+	if (Host && Host->HostSendRate > 0)
+	{
+		Pace->HostRate = Host->HostSendRate * 1024;
+		Pace->HostDue = &Host->SendDue;
+	}
+	Pace->Due = Now();											// Starts with a full bucket
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PACING::Piece() - a quarter of a second's worth at the slowest cap
+//----------------------------------------------------------------------------------------------------
+DWORD PACING::Piece(PACE *Pace, DWORD Largest)
+{
+	int Rate = Pace->Rate;
+	if (Pace->HostRate > 0 && (Rate <= 0 || Pace->HostRate < Rate))
+		Rate = Pace->HostRate;
+	if (Rate <= 0)
+		return Largest;
+
+	DWORD Size = Rate / PACE_PIECES;
+	if (Size < PACE_SMALLEST)
+		Size = PACE_SMALLEST;
+	return Size < Largest ? Size : Largest;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PACING::Delay()
+//----------------------------------------------------------------------------------------------------
+DWORD PACING::Delay(PACE *Pace, DWORD Bytes)
+{
+	if (Pace->Rate <= 0 && Pace->HostRate <= 0)
+		return 0;
+
+	LONG Time = Now();
+	LONG Early = Reserve(&Pace->Due, Pace->Rate, Bytes, Time);
+	if (Pace->HostDue)
+	{
+		LONG HostEarly = Reserve(Pace->HostDue, Pace->HostRate, Bytes, Time);
+		if (HostEarly > Early)
+			Early = HostEarly;
+	}
+	if (Early <= 0)
+		return 0;
+	InterlockedIncrement(&Paused);
+	return (DWORD)(Early + 999) / 1000;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PACING::Reserve() - moves Due on by Bytes' worth. It can be sent now if Due was no
+//			more than a burst ahead, otherwise returns how much too early it is.
+//----------------------------------------------------------------------------------------------------
+LONG PACING::Reserve(volatile LONG *Due, int Rate, DWORD Bytes, LONG Time)
+{
+	if (Rate <= 0)
+		return 0;
+	LONG Cost = (LONG)((__int64)Bytes * 1000000 / Rate);
+	LONG Burst = (LONG)((__int64)Options.SendBurst * 1024 * 1000000 / Rate);
+
+	for (;;)
+	{
+		LONG Old = *Due;
+		LONG From = Old;
+		if (Time - From > 0 || From - Time > PACE_STALE)
+			From = Time;										// Nothing sent lately (or it's from before we wrapped)
+		if (InterlockedCompareExchange(Due, From + Cost, Old) == Old)
+			return From - Time - Burst;
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PACING::Now()
+//----------------------------------------------------------------------------------------------------
+LONG PACING::Now()
+{
+	__int64 Count;
+	QueryPerformanceCounter((LARGE_INTEGER *)&Count);
+	return (LONG)(Count / Frequency * 1000000 + Count % Frequency * 1000000 / Frequency);
+}
+//----------------------------------------------------------------------------------------------------
+#endif
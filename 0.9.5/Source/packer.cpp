@@ -0,0 +1,356 @@
+//---------------------------------------------------------------------------------------------
+/*
+			PACKER.CPP
+			----------
+			SWSPack - builds an asset pack out of a virtual host's Root folder. See
+			assetpack.hpp for the file layout. Usage:
+
+				SWSPack <Root folder> <Pack file> [index file ...]
+
+			For example:
+
+				SWSPack C:\RateMyPoo C:\SWS\Packs\RateMyPoo.pak index.htm index.html
+
+			Then add <vhPack>C:\SWS\Packs\RateMyPoo.pak</vhPack> to the virtual host in the
+			configuration file. The pack is a snapshot, so run SWSPack again after changing
+			any files in the Root folder.
+*/
+//---------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <stdio.h>
+#include "options.hpp"
+#include "httpdate.hpp"
+#include "assetpack.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+//---------------------------------------------------------------------------------------------
+//			Files found in the Root folder
+//---------------------------------------------------------------------------------------------
+struct PACKFILE
+{
+	string WebPath;												// Path as the browser asks for it ("/images/logo.gif")
+	string DiskPath;											// Real path to the file
+	DWORD Size;													// File size
+	time_t Modified;											// Last modified time
+	DWORD Data;													// Where its data will go in the pack
+};
+
+vector <PACKFILE> Files;
+map <string, int> FileIndex;									// Lower case web path to index in Files
+vector <string> IndexNames;										// Index files to look for in each folder
+
+// Folders and the index file in them
+struct PACKFOLDER
+{
+	string WebPath;
+	int IndexFile;
+};
+vector <PACKFOLDER> Folders;
+
+//---------------------------------------------------------------------------------------------
+//			Lower() - lower case copy of a string
+//---------------------------------------------------------------------------------------------
+string Lower(string Text)
+{
+	for (int X = 0; X < (int)Text.length(); X++)
+	{
+		if (Text[X] >= 'A' && Text[X] <= 'Z')
+			Text[X] += 'a' - 'A';
+	}
+	return Text;
+}
+
+//---------------------------------------------------------------------------------------------
+//			ScanFolder() - adds every file under Root + WebPath to Files
+//---------------------------------------------------------------------------------------------
+bool ScanFolder(const string &Root, const string &WebPath)
+{
+	string DiskFolder = Root + WebPath;
+	for (int Z = 0; Z < (int)DiskFolder.length(); Z++)			// Replace / with \.
+	{
+		if (DiskFolder[Z] == '/') DiskFolder[Z] = '\\';
+	}
+
+	WIN32_FIND_DATA FindData;
+	HANDLE hFind = FindFirstFile((DiskFolder + "\\*.*").c_str(), &FindData);
+	if (hFind == INVALID_HANDLE_VALUE)
+		return false;
+
+	vector <string> SubFolders;
+	do
+	{
+		string Name = FindData.cFileName;
+		if (Name == "." || Name == "..")
+			continue;
+
+		if (FindData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+		{
+			SubFolders.push_back(WebPath + "/" + Name);
+			continue;
+		}
+
+		if (FindData.nFileSizeHigh != 0)
+		{
+			cout << "Skipping " << DiskFolder << "\\" << Name << ": too big for a pack" << endl;
+			continue;
+		}
+
+		PACKFILE File;
+		File.WebPath = WebPath + "/" + Name;
+		File.DiskPath = DiskFolder + "\\" + Name;
+		File.Size = FindData.nFileSizeLow;
+		File.Modified = FileTimeToUnix(&FindData.ftLastWriteTime);
+		File.Data = 0;
+
+		FileIndex[Lower(File.WebPath)] = Files.size();
+		Files.push_back(File);
+	} while (FindNextFile(hFind, &FindData));
+	FindClose(hFind);
+
+	// Remember which index file this folder would serve
+	PACKFOLDER Folder;
+	Folder.WebPath = WebPath;
+	Folder.IndexFile = -1;
+	for (int I = 0; I < (int)IndexNames.size() && Folder.IndexFile < 0; I++)
+	{
+		map <string, int>::iterator Found = FileIndex.find(Lower(WebPath + "/" + IndexNames[I]));
+		if (Found != FileIndex.end())
+			Folder.IndexFile = Found->second;
+	}
+	if (Folder.IndexFile >= 0)
+		Folders.push_back(Folder);
+
+	for (int S = 0; S < (int)SubFolders.size(); S++)
+	{
+		ScanFolder(Root, SubFolders[S]);
+	}
+	return true;
+}
+
+//---------------------------------------------------------------------------------------------
+//			String table
+//---------------------------------------------------------------------------------------------
+string Strings;
+map <string, DWORD> StringOffsets;
+
+DWORD AddString(const string &Text, bool Share)					// Returns an offset relative to the table
+{
+	if (Share)
+	{
+		map <string, DWORD>::iterator Found = StringOffsets.find(Text);
+		if (Found != StringOffsets.end())
+			return Found->second;
+	}
+	DWORD Offset = Strings.length();
+	Strings += Text;
+	Strings += '\0';
+	if (Share)
+		StringOffsets[Text] = Offset;
+	return Offset;
+}
+
+//---------------------------------------------------------------------------------------------
+//			MIMETypeOf() - same rules as CONNECTION::SetFileType() and HandleRequest()
+//---------------------------------------------------------------------------------------------
+string MIMETypeOf(const string &Path)
+{
+	int Dot = Path.find_last_of('.');
+	int Slash = Path.find_last_of('/');
+	if (Dot < 0 || Dot < Slash)
+		return "text/plain";
+
+	string Extension = Path.substr(Dot + 1);
+	map <string, string>::iterator Found = Options.MIMETypes.find(Extension);
+	if (Found != Options.MIMETypes.end())
+		return Found->second;
+	return "text/plain";
+}
+
+//---------------------------------------------------------------------------------------------
+//			Main
+//---------------------------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+	if (argc < 3)
+	{
+		cout << "Usage: SWSPack <Root folder> <Pack file> [index file ...]" << endl;
+		return 1;
+	}
+
+	string Root = argv[1];
+	string PackFile = argv[2];
+	while (Root.length() && (Root[Root.length() - 1] == '\\' || Root[Root.length() - 1] == '/'))
+		Root.erase(Root.length() - 1);
+
+	for (int A = 3; A < argc; A++)
+		IndexNames.push_back(argv[A]);
+	if (IndexNames.empty())
+	{
+		IndexNames.push_back("index.htm");
+		IndexNames.push_back("index.html");
+	}
+
+	Options.LoadMIMETypes();
+
+	if (!ScanFolder(Root, ""))
+	{
+		cout << "Could not read " << Root << endl;
+		return 1;
+	}
+
+	//-----------------------------------------------------------------------------------------
+	// Build the entries. Each file gets one, and each folder with an index file gets two
+	// ("/docs" and "/docs/") that point at the index file.
+	vector <PACKENTRY> Entries;
+	vector <int> EntryFile;										// Which file each entry's data comes from
+	int X;
+
+	for (X = 0; X < (int)Files.size(); X++)
+	{
+		PACKENTRY Entry;
+		memset(&Entry, 0, sizeof(Entry));
+		Entry.Path = AddString(Files[X].WebPath, false);
+		Entries.push_back(Entry);
+		EntryFile.push_back(X);
+	}
+	for (X = 0; X < (int)Folders.size(); X++)
+	{
+		string Paths[2];
+		Paths[0] = Folders[X].WebPath;
+		Paths[1] = Folders[X].WebPath + "/";
+		for (int P = 0; P < 2; P++)
+		{
+			if (Paths[P].empty() || FileIndex.find(Lower(Paths[P])) != FileIndex.end())
+				continue;
+			PACKENTRY Entry;
+			memset(&Entry, 0, sizeof(Entry));
+			Entry.Path = AddString(Paths[P], false);
+			Entries.push_back(Entry);
+			EntryFile.push_back(Folders[X].IndexFile);
+		}
+	}
+
+	// Everything else about the entry depends only on the file
+	for (X = 0; X < (int)Entries.size(); X++)
+	{
+		PACKFILE &File = Files[EntryFile[X]];
+		char Buffer[64];
+
+		Entries[X].MIMEType = AddString(MIMETypeOf(File.WebPath), true);
+		sprintf(Buffer, "\"%lx-%lx\"", (unsigned long)File.Size, (unsigned long)File.Modified);
+		Entries[X].ETag = AddString(Buffer, true);
+		FormatHTTPDate(File.Modified, Buffer);
+		Entries[X].LastModified = AddString(Buffer, true);
+		Entries[X].Modified = (DWORD)File.Modified;
+		Entries[X].Length = File.Size;
+	}
+
+	//-----------------------------------------------------------------------------------------
+	// Lay the file out
+	DWORD BucketCount = 16;
+	while (BucketCount < Entries.size() * 2)					// Keep the table at most half full
+		BucketCount *= 2;
+
+	PACKHEADER Header;
+	memset(&Header, 0, sizeof(Header));
+	Header.Magic = PACK_MAGIC;
+	Header.Version = PACK_VERSION;
+	Header.EntryCount = Entries.size();
+	Header.BucketCount = BucketCount;
+	Header.BucketOffset = sizeof(PACKHEADER);
+	Header.EntryOffset = Header.BucketOffset + BucketCount * sizeof(DWORD);
+	Header.Created = (DWORD)time(NULL);
+
+	DWORD StringOffset = Header.EntryOffset + Entries.size() * sizeof(PACKENTRY);
+	unsigned __int64 End = StringOffset + Strings.length();
+	for (X = 0; X < (int)Files.size(); X++)
+	{
+		End = (End + PACK_ALIGN - 1) & ~(unsigned __int64)(PACK_ALIGN - 1);
+		Files[X].Data = (DWORD)End;
+		End += Files[X].Size;
+	}
+	if (End > 0xFFFFFFFF)
+	{
+		cout << "The folder is too big for one pack (4GB)" << endl;
+		return 1;
+	}
+	Header.FileSize = (DWORD)End;
+
+	// Fill in the offsets and the hash table
+	vector <DWORD> Buckets(BucketCount, 0);
+	for (X = 0; X < (int)Entries.size(); X++)
+	{
+		PACKFILE &File = Files[EntryFile[X]];
+		PACKENTRY &Entry = Entries[X];
+		Entry.Path += StringOffset;
+		Entry.MIMEType += StringOffset;
+		Entry.ETag += StringOffset;
+		Entry.LastModified += StringOffset;
+		Entry.Data = File.Data;
+
+		// A file.gz next to the file is its gzip version
+		map <string, int>::iterator Gzip = FileIndex.find(Lower(File.WebPath + ".gz"));
+		if (Gzip != FileIndex.end())
+		{
+			Entry.GzipData = Files[Gzip->second].Data;
+			Entry.GzipLength = Files[Gzip->second].Size;
+		}
+
+		Entry.Hash = PackHash(Strings.c_str() + (Entry.Path - StringOffset));
+		DWORD Bucket = Entry.Hash & (BucketCount - 1);
+		while (Buckets[Bucket] != 0)
+			Bucket = (Bucket + 1) & (BucketCount - 1);
+		Buckets[Bucket] = X + 1;
+	}
+
+	//-----------------------------------------------------------------------------------------
+	// Write it
+	ofstream Out(PackFile.c_str(), ios::binary);
+	if (!Out)
+	{
+		cout << "Could not create " << PackFile << endl;
+		return 1;
+	}
+
+	Out.write((const char *)&Header, sizeof(Header));
+	Out.write((const char *)&Buckets[0], BucketCount * sizeof(DWORD));
+	if (Entries.size())
+		Out.write((const char *)&Entries[0], Entries.size() * sizeof(PACKENTRY));
+	Out.write(Strings.data(), Strings.length());
+
+	DWORD Position = StringOffset + Strings.length();
+	char Buffer[65536];
+	for (X = 0; X < (int)Files.size(); X++)
+	{
+		static const char Padding[PACK_ALIGN] = { 0 };
+		Out.write(Padding, Files[X].Data - Position);
+		Position = Files[X].Data;
+
+		ifstream In(Files[X].DiskPath.c_str(), ios::binary);
+		DWORD Left = Files[X].Size;
+		while (Left > 0 && In)
+		{
+			In.read(Buffer, Left < sizeof(Buffer) ? Left : sizeof(Buffer));
+			Out.write(Buffer, In.gcount());
+			Left -= In.gcount();
+			Position += In.gcount();
+		}
+		if (Left > 0)
+		{
+			cout << "Could not read " << Files[X].DiskPath << endl;
+			return 1;
+		}
+	}
+	Out.close();
+
+	cout << "Packed " << Files.size() << " files (" << Entries.size() << " entries, "
+		 << Header.FileSize << " bytes) into " << PackFile << endl;
+	return 0;
+}
@@ -0,0 +1,447 @@
+#ifndef PREWARMHPP
+#define PREWARMHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			PREWARM.HPP
+			-----------
+			After a restart nothing is in memory, and the first requests all wait on the
+			disk. Once the service is running, a low priority thread reads the files that
+			are asked for most, so they are waiting when the requests arrive:
+
+				files		Read through once, a piece at a time, so Windows keeps them in
+							its file cache (which TransmitFile() and SendBinary() send from)
+				folders		The index file if there is one, otherwise the folder's listing
+							goes into the listing cache (see listing.hpp)
+				packed		Files in a virtual host's asset pack have their pages touched,
+							the gzip version's too, so the mapping is in memory
+
+			Which files is given by
+
+				<PrewarmList>C:\SWS\hot.txt</PrewarmList>	A path a line, "/index.html" for the
+															main web root or "www.example.com
+															/logo.gif" for a virtual host. #
+															starts a comment
+				<PrewarmTop>100</PrewarmTop>				And the most requested paths in the
+															end of each access log, for the log's
+															host (0, none)
+				<PrewarmRate>4096</PrewarmRate>				KB a second it reads, 0 for as fast
+															as it can
+
+			The end of each log is the last PREWARM_SCAN bytes of it, except for binary logs,
+			which are read from the start since a record can't be found in the middle. Only
+			GETs and HEADs answered with a 200 or 304 count.
+
+			Files bigger than PREWARM_LARGEST are looked up but not read, so one big
+			download can't push everything else out of the cache. CGI and proxied replies
+			aren't made ahead of time (see respcache.hpp); that would run scripts and send
+			requests upstream that nobody asked for.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include "options.hpp"
+#include "buffer.hpp"
+#include "assetpack.hpp"
+#include "listing.hpp"
+#include "accesslog.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define PREWARM_SCAN						8388608					// Bytes read from the end of each access log
+#define PREWARM_PATHS						65536					// Different paths counted in one log, the rest are ignored
+#define PREWARM_LARGEST						67108864				// Files bigger than this aren't read
+#define PREWARM_PAGE						4096					// Touched a byte a page in asset packs
+
+//----------------------------------------------------------------------------------------------------
+//			A path to warm, and the host it's for
+//----------------------------------------------------------------------------------------------------
+struct PREWARMPATH
+{
+	VIRTUALHOST *Host;											// NULL for the main web root
+	string Path;												// As requested, "/images/logo.gif"
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Prewarmer class
+//----------------------------------------------------------------------------------------------------
+class PREWARMER
+{
+  public:
+	PREWARMER();												// Constructor
+	void Start();												// Starts the thread, if there is anything to warm
+	void Stop();												// Stops it where it is and waits for it
+
+	volatile LONG Files;										// Files, folders and packed files warmed
+	unsigned __int64 Bytes;										// Bytes read or touched
+
+  private:
+	static DWORD WINAPI Thread(LPVOID lpParam);					// Finds the paths, then warms them
+	void ReadList(const string &FileName);						// Adds the paths in a list file
+	void ReadLog(const string &FileName, int Format, VIRTUALHOST *Host);	// Adds a log's most requested paths
+	void Add(VIRTUALHOST *Host, const string &Path);			// Adds a path, once
+	void Warm(const PREWARMPATH &Item);							// Gets one path into memory
+	bool ReadThrough(const string &FileName);					// Reads a file through, false if it can't
+	void Touch(const char *Data, DWORD Length);					// Touches a page of mapped memory at a time
+	void Throttle(DWORD Length);								// Waits long enough for Length bytes at Options.PrewarmRate
+
+	vector <PREWARMPATH> Paths;									// In the order they're warmed
+	map <string, bool> Seen;									// "host path" of those in Paths
+	HANDLE hThread;
+	volatile LONG Stopping;										// 1 once Stop() has been called
+}Prewarm;
+
+PREWARMER::PREWARMER()
+{
+	Files = 0;
+	Bytes = 0;
+	hThread = NULL;
+	Stopping = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::Start() - starts the thread that reads the list and the logs and warms
+//			what they name. Call it once the service is running.
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::Start()
+{
+	if (Options.PrewarmList.empty() && Options.PrewarmTop <= 0)
+		return;
+	Stopping = 0;
+	DWORD dwThreadId;
+	hThread = CreateThread(NULL, 0, Thread, this, CREATE_SUSPENDED, &dwThreadId);
+	if (hThread == NULL)
+		return;
+	SetThreadPriority(hThread, THREAD_PRIORITY_LOWEST);		// Requests come first
+	ResumeThread(hThread);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::Stop()
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::Stop()
+{
+	InterlockedExchange(&Stopping, 1);
+	if (hThread == NULL)
+		return;
+	WaitForSingleObject(hThread, INFINITE);						// It looks at Stopping between pieces
+	CloseHandle(hThread);
+	hThread = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::Thread() - used by CreateThread()
+//----------------------------------------------------------------------------------------------------
+DWORD WINAPI PREWARMER::Thread(LPVOID lpParam)
+{
+	PREWARMER *P = (PREWARMER *)lpParam;
+	DWORD Started = GetTickCount();
+	if (Options.PrewarmList.length())
+		P->ReadList(Options.PrewarmList);
+	if (Options.PrewarmTop > 0)
+	{
+		P->ReadLog(Options.Logfile, LogFormat(Options.LogFormat), NULL);
+		map <string, VIRTUALHOST>::iterator It;
+		for (It = VHI.Host.begin(); It != VHI.Host.end(); It++)
+		{
+			VIRTUALHOST *Host = &It->second;
+			if (Host->Logfile.empty())
+				continue;										// It's in the main log, without its name
+			P->ReadLog(Host->Logfile, LogFormat(Host->LogFormat.empty() ? Options.LogFormat : Host->LogFormat), Host);
+		}
+	}
+	P->Seen.clear();
+
+	for (int X = 0; X < (int)P->Paths.size() && !P->Stopping; X++)
+		P->Warm(P->Paths[X]);
+
+	char Text[128];
+	sprintf(Text, "Prewarmed %ld of %d paths, %lu KB, in %lu seconds\n", P->Files, (int)P->Paths.size(),
+			(DWORD)(P->Bytes / 1024), (GetTickCount() - Started) / 1000);
+	AccessLog.WriteText(Text);
+	vector <PREWARMPATH>().swap(P->Paths);						// Done with them
+	ThreadSlots.Release();
+	return 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::ReadList()
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::ReadList(const string &FileName)
+{
+	ifstream hFile (FileName.c_str());
+	string Line;
+	while (getline(hFile, Line))
+	{
+		int Start = Line.find_first_not_of(" \t\r");
+		if (Start < 0 || Line[Start] == '#')
+			continue;
+		int End = Line.find_last_not_of(" \t\r");
+		Line = Line.substr(Start, End - Start + 1);
+
+		if (Line[0] == '/')
+		{
+			Add(NULL, Line);
+			continue;
+		}
+		int Space = Line.find_first_of(" \t");
+		if (Space < 0)
+			continue;
+		map <string, VIRTUALHOST>::iterator VH = VHI.Host.find(Line.substr(0, Space));
+		if (VH == VHI.Host.end())
+			continue;											// Not one of ours
+		int Path = Line.find_first_not_of(" \t", Space);
+		if (Path >= 0 && Line[Path] == '/')
+			Add(&VH->second, Line.substr(Path));
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::ReadLog() - counts the requests in the end of a log, and adds the
+//			Options.PrewarmTop most requested paths
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::ReadLog(const string &FileName, int Format, VIRTUALHOST *Host)
+{
+	HANDLE hFile = CreateFile(FileName.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL,
+							  OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+	DWORD High = 0;
+	DWORD Size = GetFileSize(hFile, &High);
+	if (Format != LOG_BINARY && (High || Size > PREWARM_SCAN))
+	{
+		LONG Back = -PREWARM_SCAN;
+		SetFilePointer(hFile, Back, NULL, FILE_END);			// Just the end of it
+		Size = PREWARM_SCAN;
+	}
+	else if (High || Size > PREWARM_SCAN)
+		Size = PREWARM_SCAN;
+	string Log;
+	Log.resize(Size);
+	DWORD Got = 0;
+	::ReadFile(hFile, &Log[0], Size, &Got, NULL);
+	CloseHandle(hFile);
+	Log.resize(Got);
+
+	//-----------------------------------------------------------------------------------------
+	// Count each path
+	map <string, int> Counts;
+	const char *Data = Log.data();
+	const char *End = Data + Log.length();
+	const char *Record = Data;
+	if (Format != LOG_BINARY && Got == PREWARM_SCAN)
+	{
+		Record = (const char *)memchr(Data, '\n', Got);		// Skip the line we started in the middle of
+		Record = Record ? Record + 1 : End;
+	}
+	while (Record < End)
+	{
+		int Status;
+		const char *Request;
+		int Length;
+		const char *Next;
+		if (Format == LOG_BINARY)
+		{
+			if (End - Record < 21)
+				break;
+			WORD RecordLength = *(WORD *)Record;
+			if (RecordLength < 21 || End - Record < RecordLength)
+				break;
+			Status = *(WORD *)(Record + 10);
+			Length = (BYTE)Record[20];
+			Request = Record + 21;
+			Next = Record + RecordLength;
+			if (Request + Length > Next)
+				break;
+		}
+		else
+		{
+			Next = (const char *)memchr(Record, '\n', End - Record);
+			Next = Next ? Next + 1 : End;
+			Request = (const char *)memchr(Record, '"', Next - Record);	// "GET /a.gif HTTP/1.0" 200 2326
+			const char *Quote = Request ? (const char *)memchr(Request + 1, '"', Next - Request - 1) : NULL;
+			if (!Quote)
+			{
+				Record = Next;
+				continue;
+			}
+			Request++;
+			Length = Quote - Request;
+			Status = atoi(Quote + 1);
+		}
+		Record = Next;
+
+		if (Status != 200 && Status != 304)
+			continue;
+		int Method = 0;
+		if (Length > 4 && !strncmp(Request, "GET ", 4))
+			Method = 4;
+		else if (Length > 5 && !strncmp(Request, "HEAD ", 5))
+			Method = 5;
+		else
+			continue;
+		Request += Method;
+		Length -= Method;
+		int Path = 0;
+		while (Path < Length && Request[Path] != ' ' && Request[Path] != '?')
+			Path++;
+		if (!Path || Request[0] != '/')
+			continue;
+
+		string Key(Request, Path);
+		if (!DecodeURL(Key))
+			continue;											// Logged as it was asked for, found as ParseRequest() finds it
+		map <string, int>::iterator It = Counts.find(Key);
+		if (It != Counts.end())
+			It->second++;
+		else if (Counts.size() < PREWARM_PATHS)
+			Counts[Key] = 1;
+	}
+
+	//-----------------------------------------------------------------------------------------
+	// The most requested first
+	vector < pair <int, string> > Order;
+	map <string, int>::iterator C;
+	for (C = Counts.begin(); C != Counts.end(); C++)
+		Order.push_back(pair <int, string> (-C->second, C->first));
+	sort(Order.begin(), Order.end());
+	for (int X = 0; X < (int)Order.size() && X < Options.PrewarmTop; X++)
+		Add(Host, Order[X].second);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::Add()
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::Add(VIRTUALHOST *Host, const string &Path)
+{
+	string Key = Host ? Host->HostName : string();
+	Key += ' ';
+	Key += Path;
+	if (Seen.find(Key) != Seen.end())
+		return;
+	Seen[Key] = true;
+
+	PREWARMPATH Item;
+	Item.Host = Host;
+	Item.Path = Path;
+	Paths.push_back(Item);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::Warm() - finds the path the way CONNECTION::LocateFile() and
+//			HandleRequest() would, and gets whatever they'd use into memory
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::Warm(const PREWARMPATH &Item)
+{
+	VIRTUALHOST *Host = (Item.Host && Item.Host->Root.length()) ? Item.Host : NULL;
+	if (strstr(Item.Path.c_str(), ".."))
+		return;
+
+	if (Host && Host->Pack)
+	{
+		const PACKENTRY *Entry = Host->Pack->Find(Item.Path.c_str());
+		if (Entry)
+		{
+			Touch(Host->Pack->Data(Entry->Data), Entry->Length);
+			if (Entry->GzipLength > 0)
+				Touch(Host->Pack->Data(Entry->GzipData), Entry->GzipLength);
+			InterlockedIncrement(&Files);
+			return;
+		}
+	}
+
+	string RealFile = Host ? Host->Root : Options.WebRoot;
+	string Path = Item.Path;
+	for (int Z = 0; Z < (int)Path.length(); Z++)				// Windows slashes
+	{
+		if (Path[Z] == '/') Path[Z] = '\\';
+	}
+	RealFile += Path;
+	DWORD Attributes = GetFileAttributes(RealFile.c_str());
+	if (Attributes == 0xFFFFFFFF)
+		return;													// Gone since it was asked for
+	if (!(Attributes & FILE_ATTRIBUTE_DIRECTORY))
+	{
+		if (ReadThrough(RealFile))
+			InterlockedIncrement(&Files);
+		return;
+	}
+
+	// A folder is answered with its index file if there is one, otherwise its listing
+	for (int X = 0; X < (int)Options.IndexFiles.size(); X++)
+	{
+		string Index = RealFile;
+		Index += "\\";
+		Index += Options.IndexFiles[X];
+		if (GetFileAttributes(Index.c_str()) == 0xFFFFFFFF)
+			continue;
+		if (ReadThrough(Index))
+			InterlockedIncrement(&Files);
+		return;
+	}
+	if (!Options.AllowIndex)
+		return;
+	LISTING *Listing = Listings.Get(RealFile);
+	if (Listing)
+	{
+		Listings.Release(Listing);
+		InterlockedIncrement(&Files);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::ReadThrough()
+//----------------------------------------------------------------------------------------------------
+bool PREWARMER::ReadThrough(const string &FileName)
+{
+	HANDLE hFile = CreateFile(FileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+							  FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+	DWORD High = 0;
+	DWORD Size = GetFileSize(hFile, &High);
+	IOBUFFER *Block = (High || Size > PREWARM_LARGEST) ? NULL : IOBuffers.Get(IOBUFFER_BULK);
+	DWORD Got = Block ? 1 : 0;									// Too big, it's only been looked up
+	while (Got && !Stopping)
+	{
+		if (!::ReadFile(hFile, Block->Data, Block->Size, &Got, NULL))
+			break;
+		Bytes += Got;
+		Throttle(Got);
+	}
+	IOBuffers.Put(Block);
+	CloseHandle(hFile);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::Touch() - reads a byte of each page, which faults it in from the pack
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::Touch(const char *Data, DWORD Length)
+{
+	volatile char Sum = 0;
+	for (DWORD Done = 0; Done < Length && !Stopping; Done += PREWARM_PAGE)
+	{
+		Sum += Data[Done];
+		if (Done % IOBUFFER_BULK == 0)
+			Throttle(Length - Done < IOBUFFER_BULK ? Length - Done : IOBUFFER_BULK);
+	}
+	Bytes += Length;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PREWARMER::Throttle()
+//----------------------------------------------------------------------------------------------------
+void PREWARMER::Throttle(DWORD Length)
+{
+	if (Options.PrewarmRate > 0)
+		Sleep((DWORD)((unsigned __int64)Length * 1000 / ((unsigned __int64)Options.PrewarmRate * 1024)));
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,589 @@
+#ifndef PROXYHPP
+#define PROXYHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			PROXY.HPP
+			---------
+			A reverse proxy, so the server can sit in front of application servers itself.
+			Each <Proxy> in the config file is a route:
+
+				<Proxy>
+					<pxHostName>apps.example.com</pxHostName>		Optional, any host if missing
+					<pxPrefix>/api/</pxPrefix>						Optional, / if missing
+					<pxUpstream>10.0.0.5:8080</pxUpstream>			As many as there are
+					<pxUpstream>10.0.0.6:8080</pxUpstream>
+				</Proxy>
+
+			A request goes to the route with the longest prefix of its path. The request is
+			passed on as HTTP/1.1 with X-Forwarded-For added, to whichever upstream has the
+			fewest requests outstanding, and the reply is streamed back a buffer at a time
+			as it arrives, never held whole.
+
+			Connections to the upstreams are kept open between requests. Each upstream
+			keeps its idle connections in a pool for each shard (see shard.hpp), so the
+			threads taking them only meet when they pick the same shard; a thread whose
+			own pool is empty looks in the others before connecting. An idle connection
+			the upstream has closed is noticed before it is used. If a kept connection
+			fails before any reply arrives, a GET or HEAD is tried again on another.
+
+			An upstream that refuses a connection is left alone for PROXY_RETRY ms, unless
+			all of a route's upstreams are.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include "options.hpp"
+#include "shard.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define PROXY_IDLE							8						// Idle connections kept to an upstream, for each shard
+#define PROXY_KEEPIDLE						30000					// Longest one is kept idle, in ms
+#define PROXY_RETRY							5000					// How long an upstream that refused is left alone, in ms
+#define PROXY_ATTEMPTS						3						// Upstreams tried for one request
+
+#define CHUNK_SIZE							0						// CHUNKED states
+#define CHUNK_EXTENSION						1
+#define CHUNK_DATA							2
+#define CHUNK_DATAEND						3
+#define CHUNK_TRAILER						4
+#define CHUNK_DONE							5
+#define CHUNK_ERROR							6
+
+//----------------------------------------------------------------------------------------------------
+//			An upstream server, and a route to some
+//----------------------------------------------------------------------------------------------------
+struct IDLEPOOL
+{
+	volatile LONG Lock;											// Spin lock, as shard.hpp
+	int Count;
+	SOCKET Sockets[PROXY_IDLE];									// Newest last
+	DWORD Since[PROXY_IDLE];									// GetTickCount() when each went idle
+	char Padding[64];											// Keeps the next pool off our last cache line
+};
+
+struct UPSTREAM
+{
+	struct sockaddr_in Address;
+	volatile LONG Outstanding;									// Requests it is working on
+	volatile LONG DownUntil;									// GetTickCount() it can be tried again, 0 if it's up
+	IDLEPOOL Idle[SHARD_COUNT];
+};
+
+struct PROXY
+{
+	string HostName;											// As PROXYROUTE
+	string Prefix;
+	vector <UPSTREAM *> Upstreams;
+	volatile LONG Next;											// Where Pick() starts looking, so ties take turns
+};
+
+//----------------------------------------------------------------------------------------------------
+//			What an upstream's reply headers said
+//----------------------------------------------------------------------------------------------------
+struct PROXYREPLY
+{
+	int Status;													// Status code, for the log
+	bool Chunked;												// Transfer-Encoding: chunked
+	bool Close;													// Can't be kept open after this reply
+	bool Framed;												// The client can tell where it ends without a close
+	__int64 Length;												// Content-Length, or -1 for until it closes
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Finds where a chunked body ends, and takes the chunk sizes out of it if asked
+//----------------------------------------------------------------------------------------------------
+struct CHUNKED
+{
+	int State;													// CHUNK_
+	DWORD Remaining;											// Size being read, then what's left of the chunk
+	int Line;													// Characters on this trailer line so far
+
+	void Start() { State = CHUNK_SIZE; Remaining = 0; Line = 0; }
+	int Feed(char *Data, int Length, bool Strip, int *Used);	// Returns how much of Data to send on
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Proxies class
+//----------------------------------------------------------------------------------------------------
+class PROXIES
+{
+  public:
+	PROXIES();													// Constructor
+	void Start();												// Builds the routes from Options.Proxies
+	PROXY *Find(const char *Host, const char *Path);			// The route for a request, or NULL
+	UPSTREAM *Pick(PROXY *Proxy, UPSTREAM *Not);				// Least outstanding, not Not if there's another
+	SOCKET Get(UPSTREAM *Upstream, bool *Reused);				// An idle connection, or a new one
+	void Done(UPSTREAM *Upstream, SOCKET Socket, bool KeepAlive);	// Finished with what Pick() and Get() gave
+	void BuildRequest(string &Out, const char *RequestLine, const char *Headers, const string &Body,
+					  struct in_addr Client);					// The request to send the upstream
+	int ReadReply(const char *Data, int Length, bool Head, bool Strip, bool KeepOpen,
+				  PROXYREPLY *Reply, string &Out);				// Length of the headers, 0 if not all here, -1 if bad
+
+	volatile LONG Forwarded;									// Requests passed on
+	volatile LONG Errors;										// Requests answered with a 502 or 504
+	volatile LONG Pooled;										// Requests sent on a kept connection
+
+  private:
+	SOCKET Take(IDLEPOOL *Pool, DWORD Now);						// A live idle connection from Pool
+	static bool IsHeader(const char *Line, int Length, const char *Name);
+
+	vector <PROXY *> Routes;
+}Proxies;
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::PROXIES
+//----------------------------------------------------------------------------------------------------
+PROXIES::PROXIES()
+{
+	Forwarded = Errors = Pooled = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::Start() - needs Winsock started, for gethostbyname()
+//----------------------------------------------------------------------------------------------------
+void PROXIES::Start()
+{
+	for (int R = 0; R < (int)Options.Proxies.size(); R++)
+	{
+		PROXYROUTE &Route = Options.Proxies[R];
+		PROXY *Proxy = new PROXY;
+		Proxy->HostName = Route.HostName;
+		Proxy->Prefix = Route.Prefix;
+		Proxy->Next = 0;
+
+		for (int U = 0; U < (int)Route.Upstreams.size(); U++)
+		{
+			string Host = Route.Upstreams[U];
+			int Port = 80;
+			int Colon = Host.find(':');
+			if (Colon >= 0)
+			{
+				Port = atoi(Host.c_str() + Colon + 1);
+				Host.erase(Colon);
+			}
+
+			struct sockaddr_in Address;
+			memset(&Address, 0, sizeof(Address));
+			Address.sin_family = AF_INET;
+			Address.sin_port = htons((u_short)Port);
+			Address.sin_addr.s_addr = inet_addr(Host.c_str());
+			if (Address.sin_addr.s_addr == INADDR_NONE)
+			{
+				struct hostent *Entry = gethostbyname(Host.c_str());
+				if (!Entry)
+					continue;									// Requests for it get a 502
+				memcpy(&Address.sin_addr, Entry->h_addr, sizeof(Address.sin_addr));
+			}
+
+			UPSTREAM *Upstream = (UPSTREAM *)VirtualAlloc(NULL, sizeof(UPSTREAM), MEM_COMMIT, PAGE_READWRITE);	// Zeroed
+			if (!Upstream)
+				continue;
+			Upstream->Address = Address;
+			Proxy->Upstreams.push_back(Upstream);
+		}
+		Routes.push_back(Proxy);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::Find() - the longest prefix wins, then a route for the host over one for any
+//----------------------------------------------------------------------------------------------------
+PROXY *PROXIES::Find(const char *Host, const char *Path)
+{
+	PROXY *Best = NULL;
+	int BestScore = -1;
+	for (int R = 0; R < (int)Routes.size(); R++)
+	{
+		PROXY *Proxy = Routes[R];
+		if (Proxy->HostName.length() && strcmpi(Proxy->HostName.c_str(), Host))
+			continue;
+		if (strncmp(Path, Proxy->Prefix.c_str(), Proxy->Prefix.length()))
+			continue;
+		int Score = 2 * Proxy->Prefix.length() + (Proxy->HostName.length() ? 1 : 0);
+		if (Score > BestScore)
+		{
+			Best = Proxy;
+			BestScore = Score;
+		}
+	}
+	return Best;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::Pick()
+//----------------------------------------------------------------------------------------------------
+UPSTREAM *PROXIES::Pick(PROXY *Proxy, UPSTREAM *Not)
+{
+	int Count = Proxy->Upstreams.size();
+	if (!Count)
+		return NULL;
+
+	DWORD Now = GetTickCount();
+	DWORD Start = (DWORD)InterlockedIncrement(&Proxy->Next);
+	UPSTREAM *Best = NULL;
+	UPSTREAM *Down = NULL;										// In case they all are
+	for (int U = 0; U < Count; U++)
+	{
+		UPSTREAM *Upstream = Proxy->Upstreams[(Start + U) % Count];
+		if (Upstream == Not && Count > 1)
+			continue;
+		LONG Until = Upstream->DownUntil;
+		if (Until && (LONG)(Now - (DWORD)Until) < 0)
+		{
+			if (!Down)
+				Down = Upstream;
+			continue;
+		}
+		if (!Best || Upstream->Outstanding < Best->Outstanding)
+			Best = Upstream;
+	}
+	if (!Best)
+		Best = Down;
+	if (Best)
+		InterlockedIncrement(&Best->Outstanding);
+	return Best;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::Get() - from this shard's pool, then any other's, then a new connection
+//----------------------------------------------------------------------------------------------------
+SOCKET PROXIES::Get(UPSTREAM *Upstream, bool *Reused)
+{
+	DWORD Now = GetTickCount();
+	int Shard = ShardNumber();
+	for (int S = 0; S < SHARD_COUNT; S++)
+	{
+		SOCKET Socket = Take(&Upstream->Idle[(Shard + S) % SHARD_COUNT], Now);
+		if (Socket != INVALID_SOCKET)
+		{
+			*Reused = true;
+			InterlockedIncrement(&Pooled);
+			return Socket;
+		}
+	}
+
+	*Reused = false;
+	SOCKET Socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (Socket == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	if (connect(Socket, (struct sockaddr *)&Upstream->Address, sizeof(Upstream->Address)) != 0)
+	{
+		closesocket(Socket);
+		InterlockedExchange(&Upstream->DownUntil, (LONG)((GetTickCount() + PROXY_RETRY) | 1));	// Never 0
+		return INVALID_SOCKET;
+	}
+	InterlockedExchange(&Upstream->DownUntil, 0);
+
+	int Milliseconds = Options.Timeout * 1000;					// So a stuck upstream can't keep us forever
+	if (Milliseconds > 0)
+	{
+		setsockopt(Socket, SOL_SOCKET, SO_RCVTIMEO, (char *)&Milliseconds, sizeof(Milliseconds));
+		setsockopt(Socket, SOL_SOCKET, SO_SNDTIMEO, (char *)&Milliseconds, sizeof(Milliseconds));
+	}
+	return Socket;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::Take() - newest first, so the ones left idle longest get closed
+//----------------------------------------------------------------------------------------------------
+SOCKET PROXIES::Take(IDLEPOOL *Pool, DWORD Now)
+{
+	if (!Pool->Count)
+		return INVALID_SOCKET;									// Not worth the lock
+
+	for (;;)
+	{
+		SOCKET Socket = INVALID_SOCKET;
+		DWORD Since = 0;
+		LockShard(&Pool->Lock);
+		if (Pool->Count > 0)
+		{
+			Pool->Count--;
+			Socket = Pool->Sockets[Pool->Count];
+			Since = Pool->Since[Pool->Count];
+		}
+		UnlockShard(&Pool->Lock);
+		if (Socket == INVALID_SOCKET)
+			return INVALID_SOCKET;
+
+		// Nothing should arrive on an idle connection. If something can be read, it's the
+		//  upstream closing it.
+		fd_set Readable;
+		FD_ZERO(&Readable);
+		FD_SET(Socket, &Readable);
+		struct timeval Zero = { 0, 0 };
+		if (Now - Since < PROXY_KEEPIDLE && select(0, &Readable, NULL, NULL, &Zero) == 0)
+			return Socket;
+		closesocket(Socket);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::Done()
+//----------------------------------------------------------------------------------------------------
+void PROXIES::Done(UPSTREAM *Upstream, SOCKET Socket, bool KeepAlive)
+{
+	InterlockedDecrement(&Upstream->Outstanding);
+	if (Socket == INVALID_SOCKET)
+		return;
+
+	if (KeepAlive)
+	{
+		IDLEPOOL *Pool = &Upstream->Idle[ShardNumber()];
+		LockShard(&Pool->Lock);
+		if (Pool->Count < PROXY_IDLE)
+		{
+			Pool->Sockets[Pool->Count] = Socket;
+			Pool->Since[Pool->Count] = GetTickCount();
+			Pool->Count++;
+			Socket = INVALID_SOCKET;
+		}
+		UnlockShard(&Pool->Lock);
+	}
+	if (Socket != INVALID_SOCKET)
+		closesocket(Socket);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::IsHeader() - does the header line start with Name:
+//----------------------------------------------------------------------------------------------------
+bool PROXIES::IsHeader(const char *Line, int Length, const char *Name)
+{
+	int NameLength = strlen(Name);
+	return Length > NameLength && Line[NameLength] == ':' && !strnicmp(Line, Name, NameLength);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::BuildRequest() - the client's request as HTTP/1.1, without the headers that
+//			were only about its own connection. Headers ends where ParseRequest() cut off the body.
+//----------------------------------------------------------------------------------------------------
+void PROXIES::BuildRequest(string &Out, const char *RequestLine, const char *Headers, const string &Body,
+						   struct in_addr Client)
+{
+	// Method and path from the request line
+	const char *Method = RequestLine;
+	const char *Path = strchr(Method, ' ');
+	if (!Path)
+		Path = "/";
+	while (*Path == ' ')
+		Path++;
+	if (!strnicmp(Path, "http://", 7))							// An absolute URL, we only want the path
+	{
+		Path = strchr(Path + 7, '/');
+		if (!Path)
+			Path = "/";
+	}
+	const char *PathEnd = Path;
+	while (*PathEnd && *PathEnd != ' ')
+		PathEnd++;
+
+	Out.erase();
+	Out.append(Method, strcspn(Method, " "));
+	Out += ' ';
+	Out.append(Path, PathEnd - Path);
+	Out += " HTTP/1.1\r\n";
+
+	// The headers after the request line
+	bool HasHost = false;
+	const char *Line = strchr(Headers, '\n');
+	while (Line && *Line)
+	{
+		Line++;
+		int Length = strcspn(Line, "\n");
+		int Text = Length;
+		if (Text && Line[Text - 1] == '\r')
+			Text--;
+		if (!Text)
+			break;												// The blank line
+
+		if (!IsHeader(Line, Text, "Connection") && !IsHeader(Line, Text, "Keep-Alive") &&
+			!IsHeader(Line, Text, "Proxy-Connection") && !IsHeader(Line, Text, "TE") &&
+			!IsHeader(Line, Text, "Upgrade") && !IsHeader(Line, Text, "Transfer-Encoding") &&
+			!IsHeader(Line, Text, "Content-Length") && !IsHeader(Line, Text, "Expect"))
+		{
+			Out.append(Line, Text);
+			Out += "\r\n";
+		}
+		if (IsHeader(Line, Text, "Host"))
+			HasHost = true;
+		Line += Length;
+	}
+	if (!HasHost)
+		Out += "Host: \r\n";									// HTTP/1.1 needs one, even if it's empty
+
+	Out += "X-Forwarded-For: ";
+	Out += inet_ntoa(Client);
+	if (Body.length() || !strnicmp(Method, "POST ", 5))
+	{
+		char Number[21];
+		sprintf(Number, "%d", Body.length());
+		Out += "\r\nContent-Length: ";
+		Out += Number;
+	}
+	Out += "\r\nConnection: keep-alive\r\n\r\n";
+	Out += Body;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			PROXIES::ReadReply() - reads the upstream's headers, and puts the ones for the client
+//			in Out. If Strip is set the client can't take chunks, and the caller takes them out.
+//			KeepOpen is whether the client's connection can be kept open after the reply, which
+//			it only is if the client can tell where the reply ends. It's told if it closes.
+//----------------------------------------------------------------------------------------------------
+int PROXIES::ReadReply(const char *Data, int Length, bool Head, bool Strip, bool KeepOpen, PROXYREPLY *Reply,
+					   string &Out)
+{
+	// Wait for the blank line
+	int End = -1;
+	for (int X = 0; X < Length; X++)
+	{
+		if (Data[X] != '\n')
+			continue;
+		if (X + 1 < Length && Data[X + 1] == '\n')
+			End = X + 2;
+		else if (X + 2 < Length && Data[X + 1] == '\r' && Data[X + 2] == '\n')
+			End = X + 3;
+		if (End >= 0)
+			break;
+	}
+	if (End < 0)
+		return 0;
+	if (Length < 12 || strncmp(Data, "HTTP/1.", 7))
+		return -1;
+
+	Reply->Status = atoi(Data + 9);
+	Reply->Chunked = false;
+	Reply->Close = Data[7] == '0';								// HTTP/1.0 closes unless it says otherwise
+	Reply->Length = -1;
+
+	Out.erase();
+	const char *Line = Data;
+	bool First = true;
+	while (Line < Data + End)
+	{
+		int Size = strcspn(Line, "\n");
+		int Text = Size;
+		if (Text && Line[Text - 1] == '\r')
+			Text--;
+		if (!Text)
+			break;
+
+		if (IsHeader(Line, Text, "Content-Length"))
+			Reply->Length = _atoi64(Line + 15);
+		else if (IsHeader(Line, Text, "Transfer-Encoding"))
+			Reply->Chunked = strstr(string(Line, Text).c_str(), "chunked") != NULL;
+		else if (IsHeader(Line, Text, "Connection") || IsHeader(Line, Text, "Proxy-Connection"))
+		{
+			string Value(Line, Text);
+			if (strstr(Value.c_str(), "close"))
+				Reply->Close = true;
+			else if (strstr(Value.c_str(), "keep-alive") || strstr(Value.c_str(), "Keep-Alive"))
+				Reply->Close = false;
+		}
+
+		if (First || (!IsHeader(Line, Text, "Connection") && !IsHeader(Line, Text, "Keep-Alive") &&
+			!IsHeader(Line, Text, "Proxy-Connection") && !(Strip && IsHeader(Line, Text, "Transfer-Encoding"))))
+		{
+			Out.append(Line, Text);
+			Out += "\r\n";
+		}
+		First = false;
+		Line += Size + 1;
+	}
+
+	// Replies that never have a body
+	if (Head || Reply->Status / 100 == 1 || Reply->Status == 204 || Reply->Status == 304)
+	{
+		Reply->Chunked = false;
+		Reply->Length = 0;
+	}
+	if (Reply->Chunked)
+		Reply->Length = -1;
+	else if (Reply->Length < 0)
+		Reply->Close = true;									// It ends when the upstream closes
+
+	Reply->Framed = Reply->Length >= 0 || (Reply->Chunked && !Strip);
+	if (!KeepOpen || !Reply->Framed)
+		Out += "Connection: close\r\n";
+	else if (Strip)
+		Out += "Connection: keep-alive\r\n";					// HTTP/1.0 closes unless it's told otherwise
+	Out += "\r\n";
+	return End;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			CHUNKED::Feed() - Used is set to how much of Data was the body, which is less than
+//			Length once it has ended. With Strip, the chunk data is moved to the start of Data.
+//----------------------------------------------------------------------------------------------------
+int CHUNKED::Feed(char *Data, int Length, bool Strip, int *Used)
+{
+	int Out = 0;
+	int X = 0;
+	while (X < Length && State != CHUNK_DONE && State != CHUNK_ERROR)
+	{
+		char C = Data[X];
+		switch (State)
+		{
+		case CHUNK_SIZE:
+			if (C >= '0' && C <= '9')		Remaining = Remaining * 16 + (C - '0');
+			else if (C >= 'a' && C <= 'f')	Remaining = Remaining * 16 + (C - 'a' + 10);
+			else if (C >= 'A' && C <= 'F')	Remaining = Remaining * 16 + (C - 'A' + 10);
+			else if (C == '\n')				State = Remaining ? CHUNK_DATA : CHUNK_TRAILER;
+			else							State = CHUNK_EXTENSION;	// \r, or ;name=value
+			if (Remaining > 0x0FFFFFFF)
+				State = CHUNK_ERROR;
+			X++;
+			break;
+
+		case CHUNK_EXTENSION:
+			if (C == '\n')
+				State = Remaining ? CHUNK_DATA : CHUNK_TRAILER;
+			X++;
+			break;
+
+		case CHUNK_DATA:
+		{
+			int Take = Length - X;
+			if ((DWORD)Take > Remaining)
+				Take = Remaining;
+			if (Strip)
+			{
+				memmove(Data + Out, Data + X, Take);
+				Out += Take;
+			}
+			X += Take;
+			Remaining -= Take;
+			if (!Remaining)
+				State = CHUNK_DATAEND;
+			break;
+		}
+
+		case CHUNK_DATAEND:										// The \r\n after the data
+			if (C == '\n')
+				State = CHUNK_SIZE;
+			X++;
+			break;
+
+		case CHUNK_TRAILER:										// Trailer lines, until a blank one
+			if (C == '\n')
+			{
+				if (!Line)
+					State = CHUNK_DONE;
+				Line = 0;
+			}
+			else if (C != '\r')
+				Line++;
+			X++;
+			break;
+		}
+	}
+	*Used = X;
+	return Strip ? Out : X;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,244 @@
+#ifndef RATELIMITHPP
+#define RATELIMITHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			RATELIMIT.HPP
+			-------------
+			Limits for each client, so one client can't take the whole server. A client is
+			its address, or the first <RatePrefix> bits of it to treat a network as one.
+
+				<ClientConnections>		Connections a client can have open at once. Checked
+										when it connects, before anything else.
+				<RateLimit>				Requests a second a client can make, and
+				<RateBurst>				how many it can make at once before that applies.
+										Checked once the headers are parsed, before
+										anything touches the disk. A virtual host can set
+										its own with <vhRateLimit> and <vhRateBurst>.
+
+			Either way, the client gets a ready-made 429 and the connection is closed.
+
+			The rate is a token bucket, kept as GCRA does it: a single number for each
+			client, the time its next request is due. A request that arrives more than a
+			burst's worth early is turned away, otherwise the due time moves on by one
+			request's worth. That one number can be updated with InterlockedCompareExchange(),
+			so checking a client takes no locks at all.
+
+			Clients are kept in a fixed table split into SHARD_COUNT shards by address, with
+			RATE_PROBES slots looked at for each. A client that isn't there takes a free slot,
+			or one whose client has nothing open and a full bucket, as forgetting it changes
+			nothing. If none of its slots are free the client is let through.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <string>
+#include <stdio.h>
+#include "options.hpp"
+#include "shard.hpp"
+#include "buffer.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define RATE_SLOTS							1024					// Clients each shard keeps track of
+#define RATE_PROBES							8						// Slots looked at for each client
+
+//----------------------------------------------------------------------------------------------------
+//			One client
+//----------------------------------------------------------------------------------------------------
+struct RATEENTRY
+{
+	volatile LONG Key;											// Address prefix, 0 for a free slot
+	volatile LONG Due;											// When the next request is due, in microseconds
+	volatile LONG Connections;									// Connections it has open
+};
+
+struct RATESHARD
+{
+	RATEENTRY Entries[RATE_SLOTS];
+	char Padding[64];											// Keeps the next shard off our last cache line
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Rate limit class
+//----------------------------------------------------------------------------------------------------
+class RATELIMITS
+{
+  public:
+	RATELIMITS();												// Constructor
+	void Start();												// Renders the 429. Call once the options are read
+	bool Connect(struct in_addr Address);						// A client connected, false if it has too many open
+	void Disconnect(struct in_addr Address);					// A connection Connect() allowed has closed
+	bool Request(struct in_addr Address, VIRTUALHOST *Host);	// A request arrived, false if it is too soon
+	int SendLimited(int SFD, SENDFUNCTION Through = NULL, void *Context = NULL);	// Sends the 429, returns bytes sent
+
+	volatile LONG Limited;										// Connections and requests turned away
+
+  private:
+	RATEENTRY *Find(struct in_addr Address, bool Add);			// The client's entry, or NULL
+	LONG Now();													// Microseconds, wrapping
+
+	RATESHARD *Shards;
+	__int64 Frequency;											// QueryPerformanceFrequency()
+	string Response;											// The 429
+}RateLimits;
+
+//----------------------------------------------------------------------------------------------------
+//			RATELIMITS::RATELIMITS
+//----------------------------------------------------------------------------------------------------
+RATELIMITS::RATELIMITS()
+{
+	Shards = (RATESHARD *)VirtualAlloc(NULL, SHARD_COUNT * sizeof(RATESHARD), MEM_COMMIT, PAGE_READWRITE);	// Zeroed
+	QueryPerformanceFrequency((LARGE_INTEGER *)&Frequency);
+	Limited = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RATELIMITS::Start()
+//----------------------------------------------------------------------------------------------------
+void RATELIMITS::Start()
+{
+	const char *Body = "<html><head><title>429 Too Many Requests</title></head>\n"
+					   "<body><h1>Too Many Requests</h1>Please slow down.</body></html>\n";
+	char Length[21];
+	sprintf(Length, "%d", strlen(Body));
+
+	Response = "HTTP/1.0 429 Too Many Requests\nServer: ";
+	Response += Options.Servername;
+	Response += "\nRetry-After: 1\nConnection: close\nContent-type: text/html\nContent-length: ";
+	Response += Length;
+	Response += "\n\n";
+	Response += Body;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RATELIMITS::Now()
+//----------------------------------------------------------------------------------------------------
+LONG RATELIMITS::Now()
+{
+	__int64 Count;
+	QueryPerformanceCounter((LARGE_INTEGER *)&Count);
+	return (LONG)(Count / Frequency * 1000000 + Count % Frequency * 1000000 / Frequency);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RATELIMITS::Find()
+//----------------------------------------------------------------------------------------------------
+RATEENTRY *RATELIMITS::Find(struct in_addr Address, bool Add)
+{
+	if (!Shards)
+		return NULL;
+	DWORD Mask = Options.RatePrefix <= 0 ? 0 : Options.RatePrefix >= 32 ? 0xFFFFFFFF : ~(0xFFFFFFFF >> Options.RatePrefix);
+	LONG Key = (LONG)(ntohl(Address.s_addr) & Mask);
+	if (!Key)
+		Key = 1;												// 0 means free
+	DWORD Hash = (DWORD)Key * 2654435761UL;						// Knuth's multiplicative hash, the top bits are best
+	RATESHARD *Shard = &Shards[(Hash >> 28) % SHARD_COUNT];
+
+	int Probe;
+	for (Probe = 0; Probe < RATE_PROBES; Probe++)
+	{
+		RATEENTRY *Entry = &Shard->Entries[((Hash >> 16) + Probe) % RATE_SLOTS];
+		if (Entry->Key == Key)
+			return Entry;
+	}
+	if (!Add)
+		return NULL;
+
+	LONG Time = Now();
+	for (Probe = 0; Probe < RATE_PROBES; Probe++)
+	{
+		RATEENTRY *Entry = &Shard->Entries[((Hash >> 16) + Probe) % RATE_SLOTS];
+		LONG Old = Entry->Key;
+		bool Free = !Old || (Entry->Connections <= 0 && Time - Entry->Due >= 0);
+		if (Free && InterlockedCompareExchange(&Entry->Key, Key, Old) == Old)
+		{
+			InterlockedExchange(&Entry->Due, Time);				// Starts with a full bucket
+			InterlockedExchange(&Entry->Connections, 0);
+			return Entry;
+		}
+	}
+	return NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RATELIMITS::Connect() and RATELIMITS::Disconnect()
+//----------------------------------------------------------------------------------------------------
+bool RATELIMITS::Connect(struct in_addr Address)
+{
+	if (Options.ClientConnections <= 0)
+		return true;
+	RATEENTRY *Entry = Find(Address, true);
+	if (!Entry)
+		return true;											// Nowhere to count it
+	if (InterlockedIncrement(&Entry->Connections) > Options.ClientConnections)
+	{
+		InterlockedDecrement(&Entry->Connections);
+		InterlockedIncrement(&Limited);
+		return false;
+	}
+	return true;
+}
+
+void RATELIMITS::Disconnect(struct in_addr Address)
+{
+	if (Options.ClientConnections <= 0)
+		return;
+	RATEENTRY *Entry = Find(Address, false);
+	if (Entry && Entry->Connections > 0)
+		InterlockedDecrement(&Entry->Connections);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RATELIMITS::Request()
+//----------------------------------------------------------------------------------------------------
+bool RATELIMITS::Request(struct in_addr Address, VIRTUALHOST *Host)
+{
+	int Rate = Options.RateLimit;
+	int Burst = Options.RateBurst;
+	if (Host && Host->RateLimit > 0)
+	{
+		Rate = Host->RateLimit;
+		Burst = Host->RateBurst;
+	}
+	if (Rate <= 0)
+		return true;
+	if (Burst < 1)
+		Burst = Rate;											// A second's worth
+
+	RATEENTRY *Entry = Find(Address, true);
+	if (!Entry)
+		return true;
+
+	LONG Interval = 1000000 / Rate;								// Between requests at the steady rate
+	LONG Tolerance = Interval * (Burst - 1);					// How early a request can be
+	LONG Time = Now();
+	for (;;)
+	{
+		LONG Old = Entry->Due;
+		LONG Due = Old;
+		if (Time - Due > 0 || Due - Time > Tolerance + Interval)
+			Due = Time;											// Bucket is full (or it's from before we wrapped)
+		if (Due - Time > Tolerance)
+		{
+			InterlockedIncrement(&Limited);
+			return false;
+		}
+		if (InterlockedCompareExchange(&Entry->Due, Due + Interval, Old) == Old)
+			return true;
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RATELIMITS::SendLimited()
+//----------------------------------------------------------------------------------------------------
+int RATELIMITS::SendLimited(int SFD, SENDFUNCTION Through, void *Context)
+{
+	int Sent = Through ? Through(Context, Response.data(), Response.length()) : send(SFD, Response.data(), Response.length(), 0);
+	if (!Through)
+		shutdown(SFD, 1);										// SD_SEND, we've nothing else to say. A TLS session
+																//  or an HTTP/2 stream is ended by its owner instead
+	return Sent > 0 ? Sent : 0;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,430 @@
+#ifndef RESPCACHEHPP
+#define RESPCACHEHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			RESPCACHE.HPP
+			-------------
+			A shared cache of whole replies from CGI scripts and proxied upstreams, so a
+			page that says it can be kept for a few seconds is only made once in that
+			time, however many ask for it.
+
+			Only GETs are cached, keyed by the host and the request line, and only 200s
+			whose headers allow it: Cache-Control: max-age= (or s-maxage=), or Expires:.
+			no-store, no-cache, private and Set-Cookie: all keep a reply out, and so does
+			any Vary:, since the key doesn't have the request headers it would vary on. A
+			reply to a request with Authorization: is only kept if it says public or
+			s-maxage=, as it may have been made for that user alone; otherwise the fill is
+			abandoned, so it doesn't stop anyone else's reply being kept. A reply can also
+			say stale-while-revalidate=: for that long after it goes stale it is still sent
+			at once, while the one request that found it stale makes it again.
+
+			Requests that miss at the same time are coalesced. The first one is given
+			the entry to fill, and runs the script or asks the upstream while capturing
+			what it sends. The others wait on the entry's event and then take what it
+			left. A reply that can't be cached marks its entry as a pass for CACHE_PASS
+			ms, so requests for it run side by side rather than queueing behind each
+			other. The wait holds the thread, so under the iocp engine a script that fills
+			an entry is run the way the thread engine runs it, not through the port the
+			waiters may be holding up.
+
+			Replies are kept as they were sent, headers and all, up to <CacheSize> KB
+			between them (0 turns the cache off), least recently used going first. Each
+			is reference counted, so one can be replaced while it is still being sent.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string>
+#include <map>
+#include <stdlib.h>
+#include <time.h>
+#include "options.hpp"
+#include "httpdate.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define CACHE_PASS							10000					// How long an uncacheable reply bypasses the cache, in ms
+#define CACHE_LARGEST						8						// Largest reply is this fraction of <CacheSize>
+
+#define CACHE_COMPLETE						0						// How a fill ended
+#define CACHE_ABANDON						1						// Didn't get all of it, the next request tries
+#define CACHE_UNCACHEABLE					2						// Got it, but it can't be kept
+
+//----------------------------------------------------------------------------------------------------
+//			A reply, and the entry that keeps it
+//----------------------------------------------------------------------------------------------------
+struct CACHEDREPLY
+{
+	volatile LONG Refs;											// The entry's, and each sender's
+	int Status;													// For the log
+	DWORD Length;
+	char Data[1];												// Length bytes, allocated with the rest
+};
+
+struct CACHEENTRY
+{
+	string Key;
+	CACHEDREPLY *Reply;											// NULL until the first fill
+	DWORD Fresh;												// GetTickCount() until which Reply is fresh
+	DWORD Stale;												// And until which it can be sent while it's made again
+	DWORD Pass;													// Until which the cache is bypassed, 0 for not
+	bool Filling;												// A request is making it
+	int Waiters;												// Requests waiting for it
+	HANDLE Filled;												// Set when a fill ends
+	CACHEENTRY *Newer;											// Least recently used list
+	CACHEENTRY *Older;
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Response cache class
+//----------------------------------------------------------------------------------------------------
+class RESPONSECACHE
+{
+  public:
+	RESPONSECACHE();											// Constructor
+	void Begin(const string &Key, CACHEDREPLY **Reply, CACHEENTRY **Fill);	// See below
+	void Finish(CACHEENTRY *Fill, const string &Captured, int How, bool Authorized);	// Ends a fill Begin() gave out
+	void Release(CACHEDREPLY *Reply);							// Done sending a reply Begin() gave out
+	DWORD Largest();											// Biggest reply worth capturing
+
+	volatile LONG Entries;										// Entries kept
+	volatile LONG Bytes;										// Size of their replies
+
+  private:
+	static bool Freshness(const string &Captured, int *Status, DWORD *Fresh, DWORD *Stale, bool *Shared);
+	static int HeaderNumber(const char *Headers, const char *Name);
+	void Unlink(CACHEENTRY *Entry);
+	void Link(CACHEENTRY *Entry);								// As the most recently used
+	void Evict();												// Until it fits in Options.CacheSize
+
+	CRITICAL_SECTION Lock;										// For everything
+	map <string, CACHEENTRY *> Index;
+	CACHEENTRY *Newest;
+	CACHEENTRY *Oldest;
+}ResponseCache;
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::RESPONSECACHE
+//----------------------------------------------------------------------------------------------------
+RESPONSECACHE::RESPONSECACHE()
+{
+	InitializeCriticalSection(&Lock);
+	Newest = Oldest = NULL;
+	Entries = Bytes = 0;
+}
+
+DWORD RESPONSECACHE::Largest()
+{
+	return (DWORD)Options.CacheSize * 1024 / CACHE_LARGEST;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::Begin() - what to do with a request for Key:
+//				Reply set, Fill NULL	Send Reply, that's all
+//				Reply set, Fill set		Send Reply, which is stale, then make it again quietly
+//										to fill Fill
+//				Reply NULL, Fill set	Make it as usual, capturing it to fill Fill
+//				Both NULL				Make it as usual, the cache can't help
+//			Waits if another request is making it already.
+//----------------------------------------------------------------------------------------------------
+void RESPONSECACHE::Begin(const string &Key, CACHEDREPLY **Reply, CACHEENTRY **Fill)
+{
+	*Reply = NULL;
+	*Fill = NULL;
+	if (Options.CacheSize <= 0)
+		return;
+
+	EnterCriticalSection(&Lock);
+	for (;;)
+	{
+		DWORD Now = GetTickCount();
+		map <string, CACHEENTRY *>::iterator Found = Index.find(Key);
+		CACHEENTRY *Entry = Found == Index.end() ? NULL : Found->second;
+		if (!Entry)
+		{
+			Entry = new CACHEENTRY;
+			Entry->Key = Key;
+			Entry->Reply = NULL;
+			Entry->Fresh = Entry->Stale = Entry->Pass = 0;
+			Entry->Waiters = 0;
+			Entry->Filling = false;
+			Entry->Filled = CreateEvent(NULL, TRUE, FALSE, NULL);
+			Entry->Newer = Entry->Older = NULL;
+			Index[Key] = Entry;
+			Entries++;
+			Link(Entry);
+		}
+		else
+		{
+			Unlink(Entry);
+			Link(Entry);
+		}
+
+		if (Entry->Pass && (LONG)(Now - Entry->Pass) < 0)
+			break;												// Can't be cached, make it as usual
+		if (Entry->Reply && (LONG)(Now - Entry->Fresh) < 0)
+		{
+			InterlockedIncrement(&Entry->Reply->Refs);
+			*Reply = Entry->Reply;
+			break;
+		}
+		if (Entry->Reply && (LONG)(Now - Entry->Stale) < 0)
+		{
+			InterlockedIncrement(&Entry->Reply->Refs);
+			*Reply = Entry->Reply;
+			if (!Entry->Filling)
+			{
+				Entry->Filling = true;							// This one makes it again
+				ResetEvent(Entry->Filled);
+				*Fill = Entry;
+			}
+			break;
+		}
+		if (!Entry->Filling)
+		{
+			Entry->Filling = true;
+			Entry->Pass = 0;
+			ResetEvent(Entry->Filled);
+			*Fill = Entry;
+			break;
+		}
+
+		// Someone is making it already. Wait for them, then look again.
+		Entry->Waiters++;
+		LeaveCriticalSection(&Lock);
+		DWORD Waited = WaitForSingleObject(Entry->Filled, Options.Timeout > 0 ? Options.Timeout * 1000 : INFINITE);
+		EnterCriticalSection(&Lock);
+		Entry->Waiters--;
+		if (Waited != WAIT_OBJECT_0)
+			break;												// Taking too long, make it ourselves
+	}
+	LeaveCriticalSection(&Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::Finish()
+//----------------------------------------------------------------------------------------------------
+void RESPONSECACHE::Finish(CACHEENTRY *Fill, const string &Captured, int How, bool Authorized)
+{
+	int Status = 0;
+	DWORD Fresh = 0, Stale = 0;
+	bool Shared = false;
+	if (How == CACHE_COMPLETE && (Captured.length() > Largest() || !Freshness(Captured, &Status, &Fresh, &Stale, &Shared)))
+		How = CACHE_UNCACHEABLE;
+	if (Authorized && !Shared)
+		How = CACHE_ABANDON;									// Maybe for that user only, the next request tries
+
+	CACHEDREPLY *New = NULL;
+	if (How == CACHE_COMPLETE)
+	{
+		New = (CACHEDREPLY *)malloc(sizeof(CACHEDREPLY) + Captured.length());
+		if (New)
+		{
+			New->Refs = 1;										// The entry's
+			New->Status = Status;
+			New->Length = Captured.length();
+			memcpy(New->Data, Captured.data(), Captured.length());
+		}
+		else
+			How = CACHE_ABANDON;
+	}
+
+	EnterCriticalSection(&Lock);
+	DWORD Now = GetTickCount();
+	CACHEDREPLY *Old = NULL;
+	if (How == CACHE_COMPLETE)
+	{
+		Old = Fill->Reply;
+		Fill->Reply = New;
+		Fill->Fresh = Now + Fresh;
+		Fill->Stale = Now + Fresh + Stale;
+		Bytes += New->Length;
+	}
+	else if (How == CACHE_UNCACHEABLE)
+	{
+		Old = Fill->Reply;
+		Fill->Reply = NULL;
+		Fill->Pass = (Now + CACHE_PASS) | 1;					// Never 0
+	}
+	if (Old)
+		Bytes -= Old->Length;
+	Fill->Filling = false;
+	SetEvent(Fill->Filled);										// Waiters look again
+	Evict();
+	LeaveCriticalSection(&Lock);
+
+	if (Old)
+		Release(Old);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::Release()
+//----------------------------------------------------------------------------------------------------
+void RESPONSECACHE::Release(CACHEDREPLY *Reply)
+{
+	if (Reply && !InterlockedDecrement(&Reply->Refs))
+		free(Reply);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::Evict() - must be locked. Entries being made or waited for stay. Passes
+//			and empty entries take no room, so there can only be one entry for each KB as well.
+//----------------------------------------------------------------------------------------------------
+void RESPONSECACHE::Evict()
+{
+	CACHEENTRY *Entry = Oldest;
+	DWORD Now = GetTickCount();
+	while (Entry && (Bytes > Options.CacheSize * 1024 || Entries > (LONG)Options.CacheSize))
+	{
+		CACHEENTRY *Newer = Entry->Newer;
+		if (!Entry->Filling && !Entry->Waiters)
+		{
+			Unlink(Entry);
+			Index.erase(Entry->Key);
+			Entries--;
+			if (Entry->Reply)
+			{
+				Bytes -= Entry->Reply->Length;
+				Release(Entry->Reply);
+			}
+			CloseHandle(Entry->Filled);
+			delete Entry;
+		}
+		Entry = Newer;
+	}
+
+	// Stale entries that can't be sent any more only take up room
+	for (Entry = Oldest; Entry; Entry = Entry->Newer)
+	{
+		if (Entry->Reply && !Entry->Filling && (LONG)(Now - Entry->Stale) >= 0)
+		{
+			Bytes -= Entry->Reply->Length;
+			Release(Entry->Reply);
+			Entry->Reply = NULL;
+		}
+		if (Entry->Reply)
+			break;												// Don't walk the whole list every time
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::Link() and RESPONSECACHE::Unlink() - must be locked
+//----------------------------------------------------------------------------------------------------
+void RESPONSECACHE::Link(CACHEENTRY *Entry)
+{
+	Entry->Older = Newest;
+	Entry->Newer = NULL;
+	if (Newest)
+		Newest->Newer = Entry;
+	else
+		Oldest = Entry;
+	Newest = Entry;
+}
+
+void RESPONSECACHE::Unlink(CACHEENTRY *Entry)
+{
+	if (Entry->Newer)
+		Entry->Newer->Older = Entry->Older;
+	else
+		Newest = Entry->Older;
+	if (Entry->Older)
+		Entry->Older->Newer = Entry->Newer;
+	else
+		Oldest = Entry->Newer;
+	Entry->Newer = Entry->Older = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::Freshness() - false unless the reply is a 200 its headers let us keep.
+//			Fresh and Stale are in ms. Shared is set if it says any cache can keep it, even one
+//			answering other users (public or s-maxage=). CGI scripts write their headers straight after ours, so
+//			a header isn't always at the start of a line, and they're looked for anywhere.
+//----------------------------------------------------------------------------------------------------
+bool RESPONSECACHE::Freshness(const string &Captured, int *Status, DWORD *Fresh, DWORD *Stale, bool *Shared)
+{
+	*Shared = false;
+	if (Captured.length() < 12 || strnicmp(Captured.c_str(), "HTTP/1.", 7))
+		return false;
+	*Status = atoi(Captured.c_str() + 9);
+	if (*Status != 200)
+		return false;
+
+	// The headers, in lower case
+	int End = Captured.find("\n\n");
+	int CREnd = Captured.find("\r\n\r\n");
+	if (End < 0 || (CREnd >= 0 && CREnd < End))
+		End = CREnd;
+	if (End < 0)
+		return false;
+	string Headers(Captured, 0, End);
+	for (int X = 0; X < (int)Headers.length(); X++)
+		Headers[X] = tolower(Headers[X]);
+	const char *H = Headers.c_str();
+
+	if (strstr(H, "set-cookie:"))
+		return false;											// Meant for one client
+	const char *Vary = strstr(H, "vary:");
+	if (Vary)
+	{
+		Vary += 5;
+		Vary += strspn(Vary, " \t");
+		if (*Vary && *Vary != '\r' && *Vary != '\n')
+			return false;										// Differs with headers the key doesn't have
+	}
+
+	long Seconds = -1;
+	*Stale = 0;
+	const char *Control = strstr(H, "cache-control:");
+	if (Control)
+	{
+		string Value(Control, strcspn(Control, "\r\n"));
+		const char *V = Value.c_str();
+		if (strstr(V, "no-store") || strstr(V, "no-cache") || strstr(V, "private"))
+			return false;
+		Seconds = HeaderNumber(V, "s-maxage=");
+		*Shared = Seconds >= 0 || strstr(V, "public") != NULL;
+		if (Seconds < 0)
+			Seconds = HeaderNumber(V, "max-age=");
+		int Revalidate = HeaderNumber(V, "stale-while-revalidate=");
+		if (Revalidate > 0)
+			*Stale = Revalidate * 1000;
+	}
+	if (Seconds < 0)
+	{
+		const char *Expires = strstr(H, "expires:");
+		if (Expires)
+		{
+			Expires += 8;
+			while (*Expires == ' ')
+				Expires++;
+			string Value(Expires, strcspn(Expires, "\r\n"));
+			time_t When;
+			if (ParseHTTPDate(Value.c_str(), &When))
+				Seconds = (long)(When - time(NULL));
+		}
+	}
+	if (Seconds <= 0)
+		return false;
+	if (Seconds > 86400)
+		Seconds = 86400;										// GetTickCount() arithmetic wants it short
+	*Fresh = Seconds * 1000;
+	if (*Stale > 86400000)
+		*Stale = 86400000;
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSECACHE::HeaderNumber() - the number after Name, or -1
+//----------------------------------------------------------------------------------------------------
+int RESPONSECACHE::HeaderNumber(const char *Headers, const char *Name)
+{
+	const char *Found = strstr(Headers, Name);
+	if (!Found)
+		return -1;
+	Found += strlen(Name);
+	if (*Found < '0' || *Found > '9')
+		return -1;
+	return atoi(Found);
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,369 @@
+#ifndef RESPONSEHPP
+#define RESPONSEHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			RESPONSE.HPP
+			------------
+			RESPONSEWRITER is a SENDBUFFER that sends an HTTP response, and works out how
+			the body is framed so the connection can be kept open for the client's next
+			request whenever it can be. For example:
+
+				RESPONSEWRITER Out(SFD);
+				Out.Start(HTTPVersion, 200, "OK", KeepAlive, Head);	// Head for a HEAD request
+				Out.Header("Content-type", "text/html");
+				Out.Write("<html>...");							// Anything SENDBUFFER can write
+				Out.End();										// The rest, and the end of the body
+				KeepAlive = Out.KeepAlive;						// Whether the next request can follow
+
+			Nothing is sent until the buffer fills up, or Flush() or End() is called. The
+			headers then go out with whichever framing fits:
+
+				Content-Length	If ContentLength() was told it, or if the whole body is
+								still in the buffer at End(), as most pages are
+				chunked			For HTTP/1.1 clients, once part of the body has to go
+								before the rest is made
+				neither			For HTTP/1.0 and HTTP/2 streams. The body ends when the
+								connection (or stream) does, so KeepAlive is cleared
+
+			Flush() sends what there is now, headers and all, so a page that takes a while
+			to make starts arriving before it's finished. Trailer() adds a header that is
+			sent after the last chunk. Adding one before the headers have gone asks for
+			chunks, and names it in a Trailer: header. Trailers are dropped if the body
+			isn't chunked, which includes HTTP/2 streams.
+
+			The headers and each chunk's size go in the room SENDBUFFER keeps in front of
+			its buffer, and the last chunk and trailers in the room after it, so a piece is
+			still one send() with its framing around it.
+
+			ResponseCloses() tells whether a response that was made earlier, such as one
+			the response cache kept, told the client the connection was closing.
+
+			Connections that can be kept open wait for another request with
+
+				<KeepAlive>				Requests a connection can carry (100), 0 or 1 to
+										close it after each one
+				<KeepAliveTimeout>		Seconds it waits for the next one (5), 0 for
+										<Timeout>
+
+			Requests that arrive while the last one is being answered (pipelined) are
+			kept, and answered next.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <winsock.h>
+#include <string.h>
+#include <stdio.h>
+#include <string>
+#include "buffer.hpp"
+
+using namespace std;
+#pragma warning(disable:4786)
+
+#define RESPONSE_ROOM						512						// Room for framing either side of the buffer
+
+//----------------------------------------------------------------------------------------------------
+//			Response writer class
+//----------------------------------------------------------------------------------------------------
+class RESPONSEWRITER : public SENDBUFFER
+{
+  public:
+	RESPONSEWRITER(int SFD_SET, int Size = SENDBUFFER_SIZE);	// Constructor
+
+	void Start(const string &Version, int Status, const char *Reason, bool Persistent, bool HeadOnly);
+																// The status line. Persistent if the client can send another
+	void Header(const char *Name, const char *Value);			// Adds a header, until the headers are sent
+	void Header(const char *Name, const string &Value);
+	void Headers(const char *Lines, int Length);				// Adds headers that are lines already, as a script writes them
+	void ContentLength(unsigned __int64 Bytes);					// The body will be this long
+	void Trailer(const char *Name, const char *Value);			// Adds a header for after a chunked body
+	bool Flush();												// Sends everything so far, headers and all
+	bool End();													// Sends the rest, and ends the body
+
+	bool KeepAlive;												// Can the connection be used again after this response
+	bool Chunked;												// Is the body going in chunks
+
+  protected:
+	int Send(const char *Data, int Length);						// Sends Data with its framing
+
+  private:
+	void Decide(int Length);									// Picks the framing, with Length ready to go
+	bool Frame(const char *Data, int Length);					// Sends Data, and whatever has to go before and after it
+	bool SendAll(const char *Data, int Length);					// Sends all of Data the way SENDBUFFER would
+
+	string Head;												// Status line and headers, until they are sent
+	string Trailers;											// Trailer lines
+	string TrailerNames;										// Names of the ones added before the headers went
+	string Before;												// Framing for the piece being sent
+	string After;
+	bool Http11;												// The client can take chunks
+	bool Http10;												// The client has to be told it's kept alive
+	bool HeadOnly;												// HEAD, or a status with no body
+	bool HeadSent;												// Have the headers gone
+	bool Ending;												// End() is sending the last piece
+	bool Ended;													// The body has been ended
+	__int64 Declared;											// ContentLength(), or -1
+	unsigned __int64 Written;									// Body bytes sent
+	DWORD Chunks;												// Chunks sent
+};
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::RESPONSEWRITER
+//----------------------------------------------------------------------------------------------------
+RESPONSEWRITER::RESPONSEWRITER(int SFD_SET, int Size) : SENDBUFFER(SFD_SET, Size, RESPONSE_ROOM)
+{
+	Start("HTTP/1.1", 200, "OK", false, false);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::Start()
+//----------------------------------------------------------------------------------------------------
+void RESPONSEWRITER::Start(const string &Version, int Status, const char *Reason, bool Persistent, bool HeadOnly_SET)
+{
+	char Number[21];
+	Head = Version;
+	Head += ' ';
+	Head.append(Number, FormatNumber(Status, Number));
+	Head += ' ';
+	Head += Reason;
+	Head += "\r\n";
+	Trailers.erase();
+	TrailerNames.erase();
+
+	Http11 = !strcmpi(Version.c_str(), "HTTP/1.1");
+	Http10 = !strcmpi(Version.c_str(), "HTTP/1.0");
+	HeadOnly = HeadOnly_SET || Status / 100 == 1 || Status == 204 || Status == 304;	// These never have a body
+	KeepAlive = Persistent;
+	Chunked = false;
+	HeadSent = false;
+	Ending = false;
+	Ended = false;
+	Declared = -1;
+	Written = 0;
+	Chunks = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::Header(), RESPONSEWRITER::Headers() and RESPONSEWRITER::ContentLength()
+//----------------------------------------------------------------------------------------------------
+void RESPONSEWRITER::Header(const char *Name, const char *Value)
+{
+	if (HeadSent)
+		return;
+	Head += Name;
+	Head += ": ";
+	Head += Value;
+	Head += "\r\n";
+}
+
+void RESPONSEWRITER::Header(const char *Name, const string &Value)
+{
+	Header(Name, Value.c_str());
+}
+
+void RESPONSEWRITER::Headers(const char *Lines, int Length)
+{
+	if (!HeadSent)
+		Head.append(Lines, Length);
+}
+
+void RESPONSEWRITER::ContentLength(unsigned __int64 Bytes)
+{
+	if (!HeadSent)
+		Declared = Bytes;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::Trailer()
+//----------------------------------------------------------------------------------------------------
+void RESPONSEWRITER::Trailer(const char *Name, const char *Value)
+{
+	if (Ended)
+		return;
+	if (!HeadSent)
+	{
+		if (TrailerNames.length())
+			TrailerNames += ", ";
+		TrailerNames += Name;
+	}
+	Trailers += Name;
+	Trailers += ": ";
+	Trailers += Value;
+	Trailers += "\r\n";
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::Flush() and RESPONSEWRITER::End()
+//----------------------------------------------------------------------------------------------------
+bool RESPONSEWRITER::Flush()
+{
+	if (Used || HeadSent)
+		return SENDBUFFER::Flush();
+	if (!Failed)
+		Frame(NULL, 0);											// Just the headers, the body is coming
+	return !Failed;
+}
+
+bool RESPONSEWRITER::End()
+{
+	Ending = true;
+	SENDBUFFER::Flush();										// Frames the last piece, and ends the body after it
+	if (!Ended && !Failed)
+		Frame(NULL, 0);											// Nothing was left, so the ending goes on its own
+	if (Failed || (Declared >= 0 && !HeadOnly && Written != (unsigned __int64)Declared))
+		KeepAlive = false;										// The client can't tell where this one ended
+	return !Failed;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::Decide() - adds the framing headers. Length is what is about to be
+//			sent, which is the whole body if End() is sending it.
+//----------------------------------------------------------------------------------------------------
+void RESPONSEWRITER::Decide(int Length)
+{
+	char Number[21];
+	if (Declared >= 0)
+	{
+		FormatNumber(Declared, Number);
+		Header("Content-Length", Number);
+	}
+	else if (HeadOnly)
+		;														// Nothing to frame
+	else if (Http11 && (!Ending || Trailers.length()))
+	{
+		Chunked = true;
+		Header("Transfer-Encoding", "chunked");
+		if (TrailerNames.length())
+			Header("Trailer", TrailerNames);
+	}
+	else if (Ending)
+	{
+		FormatNumber(Length, Number);
+		Header("Content-Length", Number);
+	}
+	else
+		KeepAlive = false;										// It ends when the connection does
+
+	if (!KeepAlive)
+		Header("Connection", "close");
+	else if (Http10)
+		Header("Connection", "keep-alive");						// HTTP/1.0 closes unless it's told otherwise
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::Send() and RESPONSEWRITER::Frame()
+//			Everything SENDBUFFER sends comes through Send(), a buffer at a time, or a piece too
+//			big for the buffer. The end of each chunk goes out with the next one's size.
+//----------------------------------------------------------------------------------------------------
+int RESPONSEWRITER::Send(const char *Data, int Length)
+{
+	return Frame(Data, Length) ? Length : SOCKET_ERROR;
+}
+
+bool RESPONSEWRITER::Frame(const char *Data, int Length)
+{
+	int Given = Length;
+	Before.erase();
+	After.erase();
+	if (!HeadSent)
+	{
+		Decide(Length);
+		Before = Head;
+		Before += "\r\n";
+		HeadSent = true;
+	}
+	if (HeadOnly)
+		Length = 0;												// A HEAD is only told about the body
+	if (Chunked && Length > 0)
+	{
+		char Size[16];
+		sprintf(Size, Chunks++ ? "\r\n%x\r\n" : "%x\r\n", Length);
+		Before += Size;
+	}
+	if (Ending)
+	{
+		if (Chunked)
+		{
+			After = Chunks ? "\r\n0\r\n" : "0\r\n";				// The last chunk
+			After += Trailers;
+			After += "\r\n";
+		}
+		Ended = true;
+	}
+
+	bool Sent;
+	int Wire = Before.length() + Length + After.length();
+	if (Length && Data == Buffer && (int)Before.length() <= Room && (int)After.length() <= Room)
+	{
+		char *From = Buffer - Before.length();					// One send(), framing and all
+		memcpy(From, Before.data(), Before.length());
+		memcpy(Buffer + Length, After.data(), After.length());
+		Sent = SendAll(From, Wire);
+	}
+	else
+	{
+		if (!Length)
+		{
+			Before += After;
+			After.erase();
+		}
+		Sent = (Before.empty() || SendAll(Before.data(), Before.length())) &&
+			   (!Length || SendAll(Data, Length)) &&
+			   (After.empty() || SendAll(After.data(), After.length()));
+	}
+	if (!Sent)
+	{
+		Failed = true;
+		KeepAlive = false;
+		return false;
+	}
+	Written += Length;
+	BytesSent += Wire;
+	BytesSent -= Given;											// SENDBUFFER counts what it handed us
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			RESPONSEWRITER::SendAll()
+//----------------------------------------------------------------------------------------------------
+bool RESPONSEWRITER::SendAll(const char *Data, int Length)
+{
+	int Sent = 0;
+	while (Sent < Length)
+	{
+		int Y = SENDBUFFER::Send(Data + Sent, Length - Sent);
+		if (Y <= 0)
+			return false;
+		Sent += Y;
+	}
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ResponseCloses() - did a response, headers first, say Connection: close
+//----------------------------------------------------------------------------------------------------
+bool ResponseCloses(const char *Data, int Length)
+{
+	const char *End = Data + Length;
+	const char *Line = Data;
+	while (Line < End)
+	{
+		const char *Next = (const char *)memchr(Line, '\n', End - Line);
+		if (!Next)
+			break;
+		int Text = Next - Line;
+		if (Text && Line[Text - 1] == '\r')
+			Text--;
+		if (!Text)
+			break;												// The blank line, no more headers
+		if (Text > 11 && !strnicmp(Line, "Connection:", 11))
+		{
+			string Value(Line + 11, Text - 11);
+			if (strstr(Value.c_str(), "close") || strstr(Value.c_str(), "Close"))
+				return true;
+		}
+		Line = Next + 1;
+	}
+	return false;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
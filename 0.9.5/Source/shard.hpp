@@ -0,0 +1,125 @@
+#ifndef SHARDHPP
+#define SHARDHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			SHARD.HPP
+			---------
+			Things every request thread touches (the statistics, the connection pool, the
+			buffer pool) are split into SHARD_COUNT shards. A thread only uses the shard its
+			thread ID picks, so two threads only meet when they happen to pick the same one.
+			Each shard has a spin lock for those times:
+
+				SHARD *Shard = &Shards[ShardNumber()];
+				LockShard(&Shard->Lock);
+				...
+				UnlockShard(&Shard->Lock);
+
+			With a thread per connection there are far more threads than shards, so each
+			shard is shared by many threads. Where that matters (the statistics), a thread
+			takes a slot of its own with ThreadSlots.Slot() instead, and gives it back with
+			ThreadSlots.Release() when it ends. The slot number is kept in thread local
+			storage. Only SHARD_SLOTS threads can have one at once; past that, threads share
+			slots by thread ID as they would shards. A slot's lock is then only contended by
+			whoever is adding up all the slots.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include <string.h>
+
+#define SHARD_COUNT							16						// Number of shards
+#define SHARD_SLOTS							256						// Threads that can have a slot of their own at once
+#define SHARD_SPINS							16						// Tries at a busy shard lock before sleeping
+
+//----------------------------------------------------------------------------------------------------
+//			LockShard() and UnlockShard() - the spin lock each shard has. Sleep(0) only gives way
+//			to threads of the same priority, so a low priority holder (the prewarm thread) could
+//			be kept off the processor by the very threads waiting for it. After a few tries it
+//			gives way to any thread, and then sleeps.
+//----------------------------------------------------------------------------------------------------
+void LockShard(volatile LONG *Lock)
+{
+	for (int Tries = 0; InterlockedExchange(Lock, 1) != 0; Tries++)
+	{
+		if (Tries < SHARD_SPINS)
+			SwitchToThread();									// Anything ready on this processor
+		else
+			Sleep(1);											// Anything at all
+	}
+}
+
+void UnlockShard(volatile LONG *Lock)
+{
+	InterlockedExchange(Lock, 0);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			ShardNumber() - which shard the calling thread uses
+//----------------------------------------------------------------------------------------------------
+int ShardNumber()
+{
+	return (GetCurrentThreadId() >> 2) % SHARD_COUNT;			// Thread IDs are multiples of 4
+}
+
+//----------------------------------------------------------------------------------------------------
+//			Thread slots class
+//----------------------------------------------------------------------------------------------------
+class THREADSLOTS
+{
+  public:
+	THREADSLOTS();												// Constructor
+	int Slot();													// The calling thread's slot, 0 to SHARD_SLOTS - 1
+	void Release();												// The calling thread is ending, give its slot back
+
+  private:
+	DWORD Index;												// Thread local storage index, holding the slot plus one
+	volatile LONG Taken[SHARD_SLOTS];							// 1 for slots a thread has
+	volatile LONG Next;											// Where the next search starts
+}ThreadSlots;
+
+THREADSLOTS::THREADSLOTS()
+{
+	Index = TlsAlloc();
+	memset((void *)Taken, 0, sizeof(Taken));
+	Next = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			THREADSLOTS::Slot()
+//----------------------------------------------------------------------------------------------------
+int THREADSLOTS::Slot()
+{
+	DWORD Have = (DWORD)TlsGetValue(Index);
+	if (Have)
+		return (Have - 1) % SHARD_SLOTS;
+
+	int Start = (DWORD)InterlockedIncrement(&Next) % SHARD_SLOTS;
+	for (int X = 0; X < SHARD_SLOTS; X++)
+	{
+		int Try = (Start + X) % SHARD_SLOTS;
+		if (!Taken[Try] && InterlockedExchange(&Taken[Try], 1) == 0)
+		{
+			TlsSetValue(Index, (LPVOID)(Try + 1));
+			return Try;
+		}
+	}
+
+	// All taken. Share one by thread ID, and remember not to look again (or to give it back)
+	int Shared = (GetCurrentThreadId() >> 2) % SHARD_SLOTS;
+	TlsSetValue(Index, (LPVOID)(Shared + 1 + SHARD_SLOTS));
+	return Shared;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			THREADSLOTS::Release()
+//----------------------------------------------------------------------------------------------------
+void THREADSLOTS::Release()
+{
+	DWORD Have = (DWORD)TlsGetValue(Index);
+	if (!Have)
+		return;
+	TlsSetValue(Index, NULL);
+	if (Have <= SHARD_SLOTS)
+		InterlockedExchange(&Taken[Have - 1], 0);
+}
+//----------------------------------------------------------------------------------------------------
+#endif
@@ -0,0 +1,279 @@
+#ifndef TIMERSHPP
+#define TIMERSHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			TIMERS.HPP
+			----------
+			Deadlines for every connection, without a system timer for each of them. A
+			TIMER lives inside whatever it times, and arming, re-arming or cancelling one
+			is a few pointer changes:
+
+				Timer.Expired = TookTooLong;						// Called if it goes off
+				Timer.Owner = this;
+				Timers.Arm(&Timer, 20000);							// 20 seconds from now
+				...
+				Timers.Cancel(&Timer);								// Finished in time
+
+			The timers are kept in hierarchical timing wheels. The first level has a slot
+			for each of the next WHEEL_SLOTS ticks (WHEEL_TICK_MS each), the second a slot
+			for each WHEEL_SLOTS ticks after that, and so on. A timer goes in the slot for
+			when it is due, so arming one never looks at any of the others. When the first
+			level comes round again, the next second-level slot is spread out over it, and
+			a timer is only moved a couple of times before it goes off or is cancelled.
+
+			There are SHARD_COUNT wheels (see shard.hpp), and a timer always goes in the
+			one its address picks, so threads arming timers only meet when their timers
+			pick the same wheel. One thread moves all of them on every tick and calls
+			Expired() for the timers that are due, with that wheel locked. Arm() and
+			Cancel() always take the lock of the timer's wheel, even when it isn't armed, so
+			once Cancel() returns, Expired() is not running and won't be called. Expired()
+			must not arm or cancel timers itself.
+*/
+//----------------------------------------------------------------------------------------------------
+#include <windows.h>
+#include "shard.hpp"
+
+#define WHEEL_TICK_MS						100						// Resolution of a timer
+#define WHEEL_BITS							8
+#define WHEEL_SLOTS							(1 << WHEEL_BITS)		// Slots in each level
+#define WHEEL_LEVELS						3						// 25.6 seconds, 1.8 hours, 19 days
+#define WHEEL_LONGEST						((1UL << (WHEEL_BITS * WHEEL_LEVELS)) - 1)	// Ticks
+
+//----------------------------------------------------------------------------------------------------
+//			One timer, and one wheel
+//----------------------------------------------------------------------------------------------------
+struct TIMERWHEEL;
+
+struct TIMER
+{
+	TIMER *Next;												// Next timer in the slot
+	TIMER **PrevNext;											// Whatever points at this one
+	DWORD Expires;												// Tick it goes off on
+	TIMERWHEEL *Wheel;											// Wheel it is in, NULL when it isn't armed
+	void (*Expired)(TIMER *Timer);								// Called on the timer thread when it goes off
+	void *Owner;												// For Expired()
+	int Kind;													// For Expired()
+};
+
+struct TIMERWHEEL
+{
+	volatile LONG Lock;											// Spin lock, as shard.hpp
+	DWORD Now;													// Ticks so far
+	TIMER *Slots[WHEEL_LEVELS][WHEEL_SLOTS];					// Timers due in each slot
+	char Padding[64];											// Keeps the next wheel off our last cache line
+};
+
+//----------------------------------------------------------------------------------------------------
+//			Timers class
+//----------------------------------------------------------------------------------------------------
+class TIMERS
+{
+  public:
+	TIMERS();													// Constructor
+	bool Start();												// Starts the timer thread
+	void Stop();												// Stops it
+
+	void Arm(TIMER *Timer, DWORD Milliseconds);					// Arms Timer, or moves it if it already is
+	void Cancel(TIMER *Timer);									// Disarms Timer, if it is armed
+
+  private:
+	TIMERWHEEL *WheelFor(TIMER *Timer);							// The wheel Timer always goes in
+	void Insert(TIMERWHEEL *Wheel, TIMER *Timer);				// Puts Timer in the slot for when it is due
+	void Remove(TIMER *Timer);									// Takes it out again
+	void Cascade(TIMERWHEEL *Wheel, int Level);					// Spreads the next slot of Level over the ones below
+	void Advance(TIMERWHEEL *Wheel, DWORD To);					// Moves on to tick To, firing what is due
+
+	static DWORD WINAPI TimerThread(LPVOID lpParam);			// Calls Advance() every tick
+
+	TIMERWHEEL Wheels[SHARD_COUNT];
+	volatile bool Running;										// Is the timer thread running
+	HANDLE hThread;												// The timer thread
+}Timers;
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::TIMERS
+//----------------------------------------------------------------------------------------------------
+TIMERS::TIMERS()
+{
+	memset(Wheels, 0, sizeof(Wheels));
+	Running = false;
+	hThread = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::Start() and TIMERS::Stop()
+//----------------------------------------------------------------------------------------------------
+bool TIMERS::Start()
+{
+	if (Running)
+		return true;
+
+	Running = true;
+	DWORD dwThreadId;
+	hThread = CreateThread(NULL, 0, TimerThread, this, 0, &dwThreadId);
+	if (hThread == NULL)
+	{
+		Running = false;
+		return false;
+	}
+	return true;
+}
+
+void TIMERS::Stop()
+{
+	if (!Running)
+		return;
+
+	Running = false;
+	WaitForSingleObject(hThread, 2000);
+	CloseHandle(hThread);
+	hThread = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::WheelFor() - by address, so it's the same whichever thread asks
+//----------------------------------------------------------------------------------------------------
+TIMERWHEEL *TIMERS::WheelFor(TIMER *Timer)
+{
+	return &Wheels[((DWORD)Timer >> 6) % SHARD_COUNT];			// Timers live in bigger things, so skip the low bits
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::Arm()
+//----------------------------------------------------------------------------------------------------
+void TIMERS::Arm(TIMER *Timer, DWORD Milliseconds)
+{
+	DWORD Ticks = (Milliseconds + WHEEL_TICK_MS - 1) / WHEEL_TICK_MS;
+	if (Ticks < 1)
+		Ticks = 1;
+	if (Ticks > WHEEL_LONGEST)
+		Ticks = WHEEL_LONGEST;
+
+	TIMERWHEEL *Wheel = WheelFor(Timer);
+	LockShard(&Wheel->Lock);
+	if (Timer->Wheel == Wheel)
+		Remove(Timer);
+	Timer->Expires = Wheel->Now + Ticks;
+	Timer->Wheel = Wheel;
+	Insert(Wheel, Timer);
+	UnlockShard(&Wheel->Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::Cancel()
+//----------------------------------------------------------------------------------------------------
+void TIMERS::Cancel(TIMER *Timer)
+{
+	TIMERWHEEL *Wheel = WheelFor(Timer);
+	LockShard(&Wheel->Lock);									// Waits for Expired() if it's going off now
+	if (Timer->Wheel == Wheel)									// It didn't go off while we waited
+	{
+		Remove(Timer);
+		Timer->Wheel = NULL;
+	}
+	UnlockShard(&Wheel->Lock);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::Insert() and TIMERS::Remove() - the wheel must be locked
+//----------------------------------------------------------------------------------------------------
+void TIMERS::Insert(TIMERWHEEL *Wheel, TIMER *Timer)
+{
+	DWORD Due = Timer->Expires - Wheel->Now;
+	int Level = 0;
+	while (Level < WHEEL_LEVELS - 1 && Due >= (1UL << (WHEEL_BITS * (Level + 1))))
+		Level++;
+
+	TIMER **Slot = &Wheel->Slots[Level][(Timer->Expires >> (WHEEL_BITS * Level)) & (WHEEL_SLOTS - 1)];
+	Timer->Next = *Slot;
+	if (Timer->Next)
+		Timer->Next->PrevNext = &Timer->Next;
+	Timer->PrevNext = Slot;
+	*Slot = Timer;
+}
+
+void TIMERS::Remove(TIMER *Timer)
+{
+	*Timer->PrevNext = Timer->Next;
+	if (Timer->Next)
+		Timer->Next->PrevNext = Timer->PrevNext;
+	Timer->Next = NULL;
+	Timer->PrevNext = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::Cascade() - re-inserts the timers in Level's slot for now. They are all due
+//			within that level's span below, so they go down at least one level.
+//----------------------------------------------------------------------------------------------------
+void TIMERS::Cascade(TIMERWHEEL *Wheel, int Level)
+{
+	TIMER **Slot = &Wheel->Slots[Level][(Wheel->Now >> (WHEEL_BITS * Level)) & (WHEEL_SLOTS - 1)];
+	TIMER *List = *Slot;
+	*Slot = NULL;
+	while (List)
+	{
+		TIMER *Timer = List;
+		List = Timer->Next;
+		Insert(Wheel, Timer);
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::Advance() - the wheel must be locked
+//----------------------------------------------------------------------------------------------------
+void TIMERS::Advance(TIMERWHEEL *Wheel, DWORD To)
+{
+	while (Wheel->Now != To)
+	{
+		Wheel->Now++;
+
+		// Every time a level comes round, bring the next slot of the level above down
+		for (int Level = 1; Level < WHEEL_LEVELS; Level++)
+		{
+			if (Wheel->Now & ((1UL << (WHEEL_BITS * Level)) - 1))
+				break;
+			Cascade(Wheel, Level);
+		}
+
+		// Everything in the first level's slot is due now
+		TIMER **Slot = &Wheel->Slots[0][Wheel->Now & (WHEEL_SLOTS - 1)];
+		while (*Slot)
+		{
+			TIMER *Timer = *Slot;
+			Remove(Timer);
+			Timer->Wheel = NULL;
+			Timer->Expired(Timer);
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TIMERS::TimerThread() - used by CreateThread()
+//----------------------------------------------------------------------------------------------------
+DWORD WINAPI TIMERS::TimerThread(LPVOID lpParam)
+{
+	TIMERS *Self = (TIMERS *)lpParam;
+	DWORD Last = GetTickCount();
+	unsigned __int64 Elapsed = (unsigned __int64)Self->Wheels[0].Now * WHEEL_TICK_MS;	// Milliseconds, so GetTickCount()
+																// can wrap. From where the last Start() got to.
+
+	while (Self->Running)
+	{
+		Sleep(WHEEL_TICK_MS);
+		DWORD Now = GetTickCount();
+		Elapsed += Now - Last;
+		Last = Now;
+
+		DWORD To = (DWORD)(Elapsed / WHEEL_TICK_MS);
+		for (int S = 0; S < SHARD_COUNT; S++)
+		{
+			TIMERWHEEL *Wheel = &Self->Wheels[S];
+			LockShard(&Wheel->Lock);
+			Self->Advance(Wheel, To);
+			UnlockShard(&Wheel->Lock);
+		}
+	}
+	return 0;
+}
+//----------------------------------------------------------------------------------------------------
+#endif
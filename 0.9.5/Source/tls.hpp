@@ -0,0 +1,670 @@
+#ifndef TLSHPP
+#define TLSHPP 1
+//----------------------------------------------------------------------------------------------------
+/*
+			TLS.HPP
+			-------
+			HTTPS, done by SChannel in this process rather than by a separate one in front
+			of it, so there's no extra copy and hop for every request.
+
+				<SecurePort>			Port HTTPS is served on (443)
+				<Certificate>			Subject of the certificate to use, from the local
+										machine's personal (MY) store. Any part of the
+										subject will do, as CertFindCertificateInStore()
+										looks for it.
+				<vhCertificate>			A virtual host's own certificate
+				<SessionLifetime>		Seconds a client can resume its TLS session for,
+										rather than doing the whole handshake again (36000)
+
+			With <Http2> at 2 (see http2.hpp) the handshake offers h2 and http/1.1 with
+			ALPN, which needs Windows 8.1 or later. Older SChannel may refuse the extra
+			buffer, so set <Http2> to 1 or 0 there.
+
+			HTTPS only starts if one of the certificates can be found. The certificate for
+			a connection is picked by the name the client asks for in its ClientHello (SNI),
+			matched against the virtual hosts' <vhHostName>s. A client that doesn't say, or
+			asks for a host without a certificate of its own, gets <Certificate>, or the
+			connection is closed if there isn't one.
+
+			Resumption uses SChannel's session cache, which keeps the sessions for each
+			credentials handle, so hosts that share a certificate share one handle. Each
+			session's records are sealed and opened in a pair of pooled buffers. Files are
+			read straight into the outgoing record (see Payload()), so they are copied no
+			more often than they were before.
+
+			Secure connections get a thread each, whichever engine the rest use, as each
+			record has to be made before it is sent. SWSBench uses the client half to
+			measure handshakes and bulk transfer over loopback.
+*/
+//----------------------------------------------------------------------------------------------------
+#define SECURITY_WIN32
+#include <windows.h>
+#include <winsock.h>
+#include <wincrypt.h>
+#include <security.h>
+#include <schannel.h>
+#include <string>
+#include <map>
+#include <vector>
+#include "options.hpp"
+#include "buffer.hpp"
+
+using namespace std;
+#pragma comment(lib, "secur32.lib")
+#pragma comment(lib, "crypt32.lib")
+#pragma warning(disable:4786)
+
+#ifndef SECPKG_ATTR_SESSION_INFO								// Newer than VC6's Platform SDK
+#define SECPKG_ATTR_SESSION_INFO			0x5d
+#define SSL_SESSION_RECONNECT				1
+typedef struct _SecPkgContext_SessionInfo
+{
+	DWORD dwFlags;
+	DWORD cbSessionId;
+	BYTE rgbSessionId[32];
+} SecPkgContext_SessionInfo;
+#endif
+
+#ifndef SECBUFFER_APPLICATION_PROTOCOLS						// Windows 8.1's SChannel and later
+#define SECBUFFER_APPLICATION_PROTOCOLS		18
+#endif
+
+// The protocols offered with ALPN when <Http2> is 2, as SEC_APPLICATION_PROTOCOLS: the size of
+//  the list, the list's kind (ALPN) and size, then each protocol's length and name
+static const BYTE TlsProtocols[] = { 18, 0, 0, 0, 2, 0, 0, 0, 12, 0, 2, 'h', '2', 8, 'h', 't', 't', 'p', '/', '1', '.', '1' };
+
+#define TLS_BUFFER							IOBUFFER_BULK			// Each way, room for a record and then some
+#define TLS_ASC_FLAGS						(ASC_REQ_SEQUENCE_DETECT | ASC_REQ_REPLAY_DETECT | ASC_REQ_CONFIDENTIALITY | \
+											 ASC_REQ_EXTENDED_ERROR | ASC_REQ_ALLOCATE_MEMORY | ASC_REQ_STREAM)
+#define TLS_ISC_FLAGS						(ISC_REQ_SEQUENCE_DETECT | ISC_REQ_REPLAY_DETECT | ISC_REQ_CONFIDENTIALITY | \
+											 ISC_REQ_EXTENDED_ERROR | ISC_REQ_ALLOCATE_MEMORY | ISC_REQ_STREAM)
+
+//----------------------------------------------------------------------------------------------------
+//			A certificate and the credentials handle made from it
+//----------------------------------------------------------------------------------------------------
+struct TLSCREDENTIAL
+{
+	string Subject;												// As it was configured
+	PCCERT_CONTEXT Certificate;
+	CredHandle Handle;
+};
+
+//----------------------------------------------------------------------------------------------------
+//			One connection's TLS
+//----------------------------------------------------------------------------------------------------
+struct TLSSESSION
+{
+	SOCKET Socket;
+	bool Server;												// Which end we are
+	CredHandle *Credentials;									// What the handshake used
+	CtxtHandle Context;
+	bool Started;												// Context is one to delete
+	SecPkgContext_StreamSizes Sizes;							// Record header, trailer and largest message
+	IOBUFFER *In;												// Records as they arrive
+	DWORD InUsed;												// Bytes in it still to be opened
+	char *Ready;												// Opened data in In not read yet
+	DWORD ReadyLength;
+	char *Extra;												// Records after it, still sealed
+	DWORD ExtraLength;
+	IOBUFFER *Out;												// The record being sent
+	bool Resumed;												// The handshake resumed a session
+};
+
+//----------------------------------------------------------------------------------------------------
+//			TLS class
+//----------------------------------------------------------------------------------------------------
+class TLSCHANNEL
+{
+  public:
+	TLSCHANNEL();												// Constructor
+	bool Start();												// Loads the certificates, false if there are none
+	bool Accept(TLSSESSION *Session, SOCKET Socket);			// The server's handshake, false if it failed
+	bool Connect(TLSSESSION *Session, SOCKET Socket, const char *Name, CredHandle *Credentials);	// The client's
+	static bool ClientCredentials(CredHandle *Credentials);		// For Connect(). Doesn't check the server's certificate
+	int Send(TLSSESSION *Session, const char *Data, int Length);	// Returns how much was sent
+	int Recv(TLSSESSION *Session, char *Data, int Length);		// As recv(), 0 when the other end closes
+	char *Payload(TLSSESSION *Session, DWORD *Room);			// Where the next record's data goes, see below
+	void End(TLSSESSION *Session);								// Says goodbye, and frees it
+	static int Write(void *Session, const char *Data, int Length);	// Send() as a SENDFUNCTION
+
+	volatile LONG Handshakes;									// Handshakes finished
+	volatile LONG Resumptions;									// How many of them resumed a session
+	volatile LONG Failed;										// Handshakes that didn't finish
+
+  private:
+	bool Begin(TLSSESSION *Session, SOCKET Socket, bool Server);	// Gets the buffers
+	bool Finish(TLSSESSION *Session);							// Once the handshake is done
+	bool More(TLSSESSION *Session);								// Receives more into In
+	void Rest(TLSSESSION *Session);								// Moves Extra to the start of In
+	void Token(TLSSESSION *Session, SecBuffer *Out);			// Sends a handshake token and frees it
+	TLSCREDENTIAL *Load(const string &Subject);					// Finds a certificate, NULL if it can't
+	TLSCREDENTIAL *Choose(const BYTE *Hello, int Length);		// The credentials for a ClientHello
+	static bool ServerName(const BYTE *Hello, int Length, string &Name);	// SNI from a ClientHello
+
+	HCERTSTORE Store;											// The machine's MY store
+	TLSCREDENTIAL *Default;										// <Certificate>, or NULL
+	vector <TLSCREDENTIAL *> Loaded;							// Everything Load() found
+	map <string, TLSCREDENTIAL *> Hosts;						// Virtual hosts' own, by lower case host name
+}Tls;
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::TLSCHANNEL
+//----------------------------------------------------------------------------------------------------
+TLSCHANNEL::TLSCHANNEL()
+{
+	Store = NULL;
+	Default = NULL;
+	Handshakes = Resumptions = Failed = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Start()
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::Start()
+{
+	Store = CertOpenStore(CERT_STORE_PROV_SYSTEM_A, 0, 0, CERT_SYSTEM_STORE_LOCAL_MACHINE | CERT_STORE_READONLY_FLAG, "MY");
+	if (!Store)
+		return false;
+
+	if (Options.Certificate.length())
+		Default = Load(Options.Certificate);
+	map <string, VIRTUALHOST>::iterator VH;
+	for (VH = VHI.Host.begin(); VH != VHI.Host.end(); VH++)
+	{
+		if (VH->second.Certificate.empty())
+			continue;
+		TLSCREDENTIAL *Credential = Load(VH->second.Certificate);
+		if (!Credential)
+			continue;											// It gets Default, if anything
+		string Name = VH->second.HostName;
+		for (int X = 0; X < (int)Name.length(); X++)
+			Name[X] = tolower(Name[X]);
+		Hosts[Name] = Credential;
+	}
+	return Default || !Hosts.empty();
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Load() - a subject asked for twice gets the same handle, so its sessions
+//			can be resumed whichever host they started on
+//----------------------------------------------------------------------------------------------------
+TLSCREDENTIAL *TLSCHANNEL::Load(const string &Subject)
+{
+	for (int X = 0; X < (int)Loaded.size(); X++)
+	{
+		if (Loaded[X]->Subject == Subject)
+			return Loaded[X];
+	}
+
+	PCCERT_CONTEXT Certificate = CertFindCertificateInStore(Store, X509_ASN_ENCODING | PKCS_7_ASN_ENCODING, 0,
+															CERT_FIND_SUBJECT_STR_A, Subject.c_str(), NULL);
+	if (!Certificate)
+		return NULL;
+
+	SCHANNEL_CRED Settings;
+	memset(&Settings, 0, sizeof(Settings));
+	Settings.dwVersion = SCHANNEL_CRED_VERSION;
+	Settings.cCreds = 1;
+	Settings.paCred = &Certificate;
+	Settings.dwSessionLifespan = Options.SessionLifetime * 1000;	// 0 is SChannel's own (10 hours)
+
+	TLSCREDENTIAL *Credential = new TLSCREDENTIAL;
+	TimeStamp Expiry;
+	if (AcquireCredentialsHandleA(NULL, UNISP_NAME_A, SECPKG_CRED_INBOUND, NULL, &Settings, NULL, NULL,
+								  &Credential->Handle, &Expiry) != SEC_E_OK)
+	{
+		CertFreeCertificateContext(Certificate);
+		delete Credential;
+		return NULL;
+	}
+	Credential->Subject = Subject;
+	Credential->Certificate = Certificate;
+	Loaded.push_back(Credential);
+	return Credential;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::ClientCredentials()
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::ClientCredentials(CredHandle *Credentials)
+{
+	SCHANNEL_CRED Settings;
+	memset(&Settings, 0, sizeof(Settings));
+	Settings.dwVersion = SCHANNEL_CRED_VERSION;
+	Settings.dwFlags = SCH_CRED_MANUAL_CRED_VALIDATION | SCH_CRED_NO_DEFAULT_CREDS;	// Loopback, with any certificate
+
+	TimeStamp Expiry;
+	return AcquireCredentialsHandleA(NULL, UNISP_NAME_A, SECPKG_CRED_OUTBOUND, NULL, &Settings, NULL, NULL,
+									 Credentials, &Expiry) == SEC_E_OK;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Begin() and TLSCHANNEL::End()
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::Begin(TLSSESSION *Session, SOCKET Socket, bool Server)
+{
+	memset(Session, 0, sizeof(TLSSESSION));
+	Session->Socket = Socket;
+	Session->Server = Server;
+	Session->In = IOBuffers.Get(TLS_BUFFER);
+	Session->Out = IOBuffers.Get(TLS_BUFFER);
+	if (!Session->In || !Session->Out)
+	{
+		End(Session);
+		return false;
+	}
+	return true;
+}
+
+void TLSCHANNEL::End(TLSSESSION *Session)
+{
+	if (Session->Started)
+	{
+		// close_notify, so the client knows it has everything
+		DWORD Type = SCHANNEL_SHUTDOWN;
+		SecBuffer Shutdown = { sizeof(Type), SECBUFFER_TOKEN, &Type };
+		SecBufferDesc ShutdownDesc = { SECBUFFER_VERSION, 1, &Shutdown };
+		if (ApplyControlToken(&Session->Context, &ShutdownDesc) == SEC_E_OK)
+		{
+			SecBuffer Out = { 0, SECBUFFER_TOKEN, NULL };
+			SecBufferDesc OutDesc = { SECBUFFER_VERSION, 1, &Out };
+			DWORD Attributes;
+			if (Session->Server)
+				AcceptSecurityContext(Session->Credentials, &Session->Context, NULL, TLS_ASC_FLAGS, 0, NULL,
+									  &OutDesc, &Attributes, NULL);
+			else
+				InitializeSecurityContextA(Session->Credentials, &Session->Context, NULL, TLS_ISC_FLAGS, 0, 0, NULL, 0,
+										   NULL, &OutDesc, &Attributes, NULL);
+			Token(Session, &Out);
+		}
+		DeleteSecurityContext(&Session->Context);
+		Session->Started = false;
+	}
+	IOBuffers.Put(Session->In);
+	IOBuffers.Put(Session->Out);
+	Session->In = Session->Out = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Token() - sends what a handshake call left in Out, if anything
+//----------------------------------------------------------------------------------------------------
+void TLSCHANNEL::Token(TLSSESSION *Session, SecBuffer *Out)
+{
+	if (!Out->pvBuffer)
+		return;
+	const char *Data = (const char *)Out->pvBuffer;
+	DWORD Sent = 0;
+	while (Sent < Out->cbBuffer)
+	{
+		int Y = send(Session->Socket, Data + Sent, Out->cbBuffer - Sent, 0);
+		if (Y <= 0)
+			break;
+		Sent += Y;
+	}
+	FreeContextBuffer(Out->pvBuffer);
+	Out->pvBuffer = NULL;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::More() and TLSCHANNEL::Rest()
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::More(TLSSESSION *Session)
+{
+	if (Session->InUsed >= Session->In->Size)
+		return false;											// Bigger than any record should be
+	int Got = recv(Session->Socket, Session->In->Data + Session->InUsed, Session->In->Size - Session->InUsed, 0);
+	if (Got <= 0)
+		return false;
+	Session->InUsed += Got;
+	return true;
+}
+
+void TLSCHANNEL::Rest(TLSSESSION *Session)
+{
+	if (Session->ExtraLength)
+		memmove(Session->In->Data, Session->Extra, Session->ExtraLength);
+	Session->InUsed = Session->ExtraLength;
+	Session->Extra = NULL;
+	Session->ExtraLength = 0;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Accept()
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::Accept(TLSSESSION *Session, SOCKET Socket)
+{
+	if (!Begin(Session, Socket, true))
+		return false;
+
+	// The ClientHello says which host it wants, so read all of its record first
+	const BYTE *Hello = (const BYTE *)Session->In->Data;
+	while (Session->InUsed < 5 || (Hello[0] == 0x16 && Session->InUsed < 5 + (DWORD)(Hello[3] << 8 | Hello[4])))
+	{
+		if (!More(Session))
+			break;
+	}
+	TLSCREDENTIAL *Credential = Choose(Hello, Session->InUsed);
+	if (!Credential || !Session->InUsed)
+	{
+		InterlockedIncrement(&Failed);
+		End(Session);
+		return false;
+	}
+	Session->Credentials = &Credential->Handle;
+
+	for (;;)
+	{
+		SecBuffer In[3] = { { Session->InUsed, SECBUFFER_TOKEN, Session->In->Data }, { 0, SECBUFFER_EMPTY, NULL },
+							{ sizeof(TlsProtocols), SECBUFFER_APPLICATION_PROTOCOLS, (void *)TlsProtocols } };
+		SecBufferDesc InDesc = { SECBUFFER_VERSION, Options.Http2 >= 2 ? 3 : 2, In };
+		SecBuffer Out = { 0, SECBUFFER_TOKEN, NULL };
+		SecBufferDesc OutDesc = { SECBUFFER_VERSION, 1, &Out };
+		DWORD Attributes;
+		SECURITY_STATUS Status = AcceptSecurityContext(Session->Credentials, Session->Started ? &Session->Context : NULL,
+													   &InDesc, TLS_ASC_FLAGS, 0, &Session->Context, &OutDesc,
+													   &Attributes, NULL);
+		if (Status == SEC_E_OK || Status == SEC_I_CONTINUE_NEEDED)
+			Session->Started = true;
+		Token(Session, &Out);									// Our half, or an alert saying why not
+
+		if (Status == SEC_E_INCOMPLETE_MESSAGE)
+		{
+			if (More(Session))
+				continue;
+		}
+		if (Status != SEC_E_OK && Status != SEC_I_CONTINUE_NEEDED)
+		{
+			InterlockedIncrement(&Failed);
+			End(Session);
+			return false;
+		}
+
+		// Anything after the message is the start of the next one
+		Session->Extra = In[1].BufferType == SECBUFFER_EXTRA ? Session->In->Data + Session->InUsed - In[1].cbBuffer : NULL;
+		Session->ExtraLength = In[1].BufferType == SECBUFFER_EXTRA ? In[1].cbBuffer : 0;
+		Rest(Session);
+		if (Status == SEC_E_OK)
+			return Finish(Session);
+		if (!Session->InUsed && !More(Session))
+		{
+			InterlockedIncrement(&Failed);
+			End(Session);
+			return false;
+		}
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Connect()
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::Connect(TLSSESSION *Session, SOCKET Socket, const char *Name, CredHandle *Credentials)
+{
+	if (!Begin(Session, Socket, false))
+		return false;
+	Session->Credentials = Credentials;
+
+	SecBuffer Out = { 0, SECBUFFER_TOKEN, NULL };
+	SecBufferDesc OutDesc = { SECBUFFER_VERSION, 1, &Out };
+	DWORD Attributes;
+	SECURITY_STATUS Status = InitializeSecurityContextA(Credentials, NULL, (SEC_CHAR *)Name, TLS_ISC_FLAGS, 0, 0, NULL, 0,
+														&Session->Context, &OutDesc, &Attributes, NULL);
+	if (Status != SEC_I_CONTINUE_NEEDED)
+	{
+		InterlockedIncrement(&Failed);
+		End(Session);
+		return false;
+	}
+	Session->Started = true;
+	Token(Session, &Out);										// The ClientHello
+
+	for (;;)
+	{
+		if (!Session->InUsed && !More(Session))
+			break;
+		SecBuffer In[2] = { { Session->InUsed, SECBUFFER_TOKEN, Session->In->Data }, { 0, SECBUFFER_EMPTY, NULL } };
+		SecBufferDesc InDesc = { SECBUFFER_VERSION, 2, In };
+		Out.cbBuffer = 0;
+		Out.BufferType = SECBUFFER_TOKEN;
+		Out.pvBuffer = NULL;
+		Status = InitializeSecurityContextA(Credentials, &Session->Context, NULL, TLS_ISC_FLAGS, 0, 0, &InDesc, 0,
+											NULL, &OutDesc, &Attributes, NULL);
+		Token(Session, &Out);
+
+		if (Status == SEC_E_INCOMPLETE_MESSAGE)
+		{
+			if (More(Session))
+				continue;
+			break;
+		}
+		if (Status != SEC_E_OK && Status != SEC_I_CONTINUE_NEEDED)
+			break;
+
+		Session->Extra = In[1].BufferType == SECBUFFER_EXTRA ? Session->In->Data + Session->InUsed - In[1].cbBuffer : NULL;
+		Session->ExtraLength = In[1].BufferType == SECBUFFER_EXTRA ? In[1].cbBuffer : 0;
+		Rest(Session);
+		if (Status == SEC_E_OK)
+			return Finish(Session);
+	}
+	InterlockedIncrement(&Failed);
+	End(Session);
+	return false;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Finish()
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::Finish(TLSSESSION *Session)
+{
+	if (QueryContextAttributesA(&Session->Context, SECPKG_ATTR_STREAM_SIZES, &Session->Sizes) != SEC_E_OK ||
+		Session->Sizes.cbHeader + Session->Sizes.cbTrailer >= Session->Out->Size)
+	{
+		InterlockedIncrement(&Failed);
+		End(Session);
+		return false;
+	}
+	if (Session->Sizes.cbMaximumMessage > Session->Out->Size - Session->Sizes.cbHeader - Session->Sizes.cbTrailer)
+		Session->Sizes.cbMaximumMessage = Session->Out->Size - Session->Sizes.cbHeader - Session->Sizes.cbTrailer;
+
+	SecPkgContext_SessionInfo Info;
+	if (QueryContextAttributesA(&Session->Context, SECPKG_ATTR_SESSION_INFO, &Info) == SEC_E_OK &&
+		(Info.dwFlags & SSL_SESSION_RECONNECT))
+	{
+		Session->Resumed = true;
+		InterlockedIncrement(&Resumptions);
+	}
+	InterlockedIncrement(&Handshakes);
+	return true;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Payload() - data put here by the caller and then passed to Send() is
+//			sealed where it is, rather than copied in. Room is the most one record takes.
+//----------------------------------------------------------------------------------------------------
+char *TLSCHANNEL::Payload(TLSSESSION *Session, DWORD *Room)
+{
+	*Room = Session->Sizes.cbMaximumMessage;
+	return Session->Out->Data + Session->Sizes.cbHeader;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Send()
+//----------------------------------------------------------------------------------------------------
+int TLSCHANNEL::Send(TLSSESSION *Session, const char *Data, int Length)
+{
+	char *Record = Session->Out->Data;
+	char *Payload = Record + Session->Sizes.cbHeader;
+	int Sent = 0;
+	while (Sent < Length)
+	{
+		DWORD Part = Length - Sent;
+		if (Part > Session->Sizes.cbMaximumMessage)
+			Part = Session->Sizes.cbMaximumMessage;
+		if (Data + Sent != Payload)
+			memcpy(Payload, Data + Sent, Part);					// Unless Payload() put it there already
+
+		SecBuffer Buffers[4] =
+		{
+			{ Session->Sizes.cbHeader, SECBUFFER_STREAM_HEADER, Record },
+			{ Part, SECBUFFER_DATA, Payload },
+			{ Session->Sizes.cbTrailer, SECBUFFER_STREAM_TRAILER, Payload + Part },
+			{ 0, SECBUFFER_EMPTY, NULL }
+		};
+		SecBufferDesc Desc = { SECBUFFER_VERSION, 4, Buffers };
+		if (EncryptMessage(&Session->Context, 0, &Desc, 0) != SEC_E_OK)
+			break;
+
+		int Size = Buffers[0].cbBuffer + Buffers[1].cbBuffer + Buffers[2].cbBuffer;
+		int Done = 0;
+		while (Done < Size)
+		{
+			int Y = send(Session->Socket, Record + Done, Size - Done, 0);
+			if (Y <= 0)
+				return Sent;									// Gone, or the deadline closed it
+			Done += Y;
+		}
+		Sent += Part;
+	}
+	return Sent;
+}
+
+int TLSCHANNEL::Write(void *Session, const char *Data, int Length)
+{
+	return Tls.Send((TLSSESSION *)Session, Data, Length);
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Recv() - hands out what's been opened already, or opens the next
+//			record, receiving more until there's all of one
+//----------------------------------------------------------------------------------------------------
+int TLSCHANNEL::Recv(TLSSESSION *Session, char *Data, int Length)
+{
+	for (;;)
+	{
+		if (Session->ReadyLength)
+		{
+			int Part = Session->ReadyLength < (DWORD)Length ? Session->ReadyLength : Length;
+			memcpy(Data, Session->Ready, Part);
+			Session->Ready += Part;
+			Session->ReadyLength -= Part;
+			if (!Session->ReadyLength)
+				Rest(Session);
+			return Part;
+		}
+
+		if (Session->InUsed)
+		{
+			SecBuffer Buffers[4] =
+			{
+				{ Session->InUsed, SECBUFFER_DATA, Session->In->Data },
+				{ 0, SECBUFFER_EMPTY, NULL },
+				{ 0, SECBUFFER_EMPTY, NULL },
+				{ 0, SECBUFFER_EMPTY, NULL }
+			};
+			SecBufferDesc Desc = { SECBUFFER_VERSION, 4, Buffers };
+			SECURITY_STATUS Status = DecryptMessage(&Session->Context, &Desc, 0, NULL);
+			if (Status == SEC_E_OK)
+			{
+				// Opened where it was. In is now the data, then any records after it.
+				for (int X = 0; X < 4; X++)
+				{
+					if (Buffers[X].BufferType == SECBUFFER_DATA)
+					{
+						Session->Ready = (char *)Buffers[X].pvBuffer;
+						Session->ReadyLength = Buffers[X].cbBuffer;
+					}
+					if (Buffers[X].BufferType == SECBUFFER_EXTRA)
+					{
+						Session->Extra = (char *)Buffers[X].pvBuffer;
+						Session->ExtraLength = Buffers[X].cbBuffer;
+					}
+				}
+				Session->InUsed = 0;
+				if (!Session->ReadyLength)
+					Rest(Session);								// An empty record
+				continue;
+			}
+			if (Status == SEC_I_CONTEXT_EXPIRED)
+				return 0;										// close_notify
+			if (Status != SEC_E_INCOMPLETE_MESSAGE)
+				return -1;										// Renegotiation, which we don't do, or rubbish
+		}
+
+		if (Session->InUsed >= Session->In->Size)
+			return -1;
+		int Got = recv(Session->Socket, Session->In->Data + Session->InUsed, Session->In->Size - Session->InUsed, 0);
+		if (Got <= 0)
+			return Got;
+		Session->InUsed += Got;
+	}
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::Choose()
+//----------------------------------------------------------------------------------------------------
+TLSCREDENTIAL *TLSCHANNEL::Choose(const BYTE *Hello, int Length)
+{
+	string Name;
+	if (ServerName(Hello, Length, Name))
+	{
+		map <string, TLSCREDENTIAL *>::iterator Found = Hosts.find(Name);
+		if (Found != Hosts.end())
+			return Found->second;
+	}
+	return Default;
+}
+
+//----------------------------------------------------------------------------------------------------
+//			TLSCHANNEL::ServerName() - the host_name in a ClientHello's server_name extension,
+//			in lower case. Hello is the first record, which the whole ClientHello fits in.
+//----------------------------------------------------------------------------------------------------
+bool TLSCHANNEL::ServerName(const BYTE *Hello, int Length, string &Name)
+{
+	// Record header (5 bytes), then the handshake's (4), which must be a ClientHello (1)
+	if (Length < 9 || Hello[0] != 0x16 || Hello[5] != 1)
+		return false;
+	int End = 5 + (Hello[3] << 8 | Hello[4]);
+	if (End > Length)
+		End = Length;
+
+	int At = 9 + 2 + 32;										// Version and random
+	if (At + 1 > End)
+		return false;
+	At += 1 + Hello[At];										// Session ID
+	if (At + 2 > End)
+		return false;
+	At += 2 + (Hello[At] << 8 | Hello[At + 1]);					// Cipher suites
+	if (At + 1 > End)
+		return false;
+	At += 1 + Hello[At];										// Compression methods
+	if (At + 2 > End)
+		return false;
+	int Extensions = At + 2 + (Hello[At] << 8 | Hello[At + 1]);
+	if (Extensions < End)
+		End = Extensions;
+	At += 2;
+
+	while (At + 4 <= End)
+	{
+		int Type = Hello[At] << 8 | Hello[At + 1];
+		int Size = Hello[At + 2] << 8 | Hello[At + 3];
+		At += 4;
+		if (At + Size > End)
+			return false;
+		if (Type == 0)											// server_name: list length, name type, name length
+		{
+			if (Size < 5 || Hello[At + 2] != 0)
+				return false;									// Not a host_name
+			int NameLength = Hello[At + 3] << 8 | Hello[At + 4];
+			if (5 + NameLength > Size)
+				return false;
+			Name.assign((const char *)Hello + At + 5, NameLength);
+			for (int X = 0; X < NameLength; X++)
+				Name[X] = tolower(Name[X]);
+			return true;
+		}
+		At += Size;
+	}
+	return false;
+}
+//----------------------------------------------------------------------------------------------------
+#endif